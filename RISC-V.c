@@ -1,157 +1,290 @@
+#include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-#define NUM_REGISTERS 32
-#define MEMORY_SIZE (1024 * 1024) // 1 MB memory
-// Defining Opcodes
-#define OPCODE_LUI       0x37
-#define OPCODE_AUIPC     0x17
-#define OPCODE_JAL       0x6F
-#define OPCODE_JALR      0x67
-#define OPCODE_BRANCH    0x63
-#define OPCODE_LOAD      0x03
-#define OPCODE_STORE     0x23
-#define OPCODE_OP_IMM    0x13
-#define OPCODE_OP        0x33
-#define OPCODE_SYSTEM    0x73
-// BRANCH
-#define FUNCT3_BEQ       0x0
-#define FUNCT3_BNE       0x1
-#define FUNCT3_BLT       0x4
-#define FUNCT3_BGE       0x5
-#define FUNCT3_BLTU      0x6
-#define FUNCT3_BGEU      0x7
-// LOAD
-#define FUNCT3_LB        0x0
-#define FUNCT3_LH        0x1
-#define FUNCT3_LW        0x2
-#define FUNCT3_LBU       0x4
-#define FUNCT3_LHU       0x5
-// STORE
-#define FUNCT3_SB        0x0
-#define FUNCT3_SH        0x1
-#define FUNCT3_SW        0x2
-// IMMEDIATE_OPS
-#define FUNCT3_ADDI      0x0
-#define FUNCT3_SLLI      0x1
-#define FUNCT3_SLTI      0x2
-#define FUNCT3_SLTIU     0x3
-#define FUNCT3_XORI      0x4
-#define FUNCT3_SRLI_SRAI 0x5
-#define FUNCT3_ORI       0x6
-#define FUNCT3_ANDI      0x7
-// REGULAR_OPS
-#define FUNCT3_ADD_SUB   0x0
-#define FUNCT3_SLL       0x1
-#define FUNCT3_SLT       0x2
-#define FUNCT3_SLTU      0x3
-#define FUNCT3_XOR       0x4
-#define FUNCT3_SRL_SRA   0x5
-#define FUNCT3_OR        0x6
-#define FUNCT3_AND       0x7
-// R TYPE_OPS
-#define FUNCT7_ADD       0x00
-#define FUNCT7_SUB       0x20
-#define FUNCT7_SLLI      0x00
-#define FUNCT7_SRLI      0x00
-#define FUNCT7_SRAI      0x20
-// SYSTEM
-#define SYSTEM_ECALL     0x000
-#define SYSTEM_EBREAK    0x001
-// Setting up registers and the memory array 
-int32_t registers_array[NUM_REGISTERS];
-uint32_t pc = 0;
-uint8_t memory[MEMORY_SIZE];
-// Toggle to allow misaligned memory access
-int allow_misaligned = 1; // Set to 1 to allow, 0 to enforce alignment
-
-// Defining the functions for getting the opcode, rd, funct3, rs1, rs2, funct7 to decode the instruction
-#define GET_OPCODE(instr)          (instr & 0x7F)
-#define GET_RD(instr)              ((instr >> 7) & 0x1F)
-#define GET_FUNCT3(instr)          ((instr >> 12) & 0x7)
-#define GET_RS1(instr)             ((instr >> 15) & 0x1F)
-#define GET_RS2(instr)             ((instr >> 20) & 0x1F)
-#define GET_FUNCT7(instr)          ((instr >> 25) & 0x7F)
+#include "RISC-V.h"
+#include "trace.h"
 
+// Function to record a halt, trap or error in sim->trap and return its status
+// Halts and traps also stop the program until rv_set_pc or rv_reset
+rv_status_t rv_raise(rv_sim_t *sim, rv_status_t status, uint32_t address, const char *format, ...) {
+    va_list args;
+
+    sim->trap.status = status;
+    sim->trap.pc = sim->pc;
+    sim->trap.address = address;
+    va_start(args, format);
+    vsnprintf(sim->trap.message, sizeof(sim->trap.message), format, args);
+    va_end(args);
+    if (status < RV_ERROR_IO) {
+        sim->halted = status;
+    }
+    return status;
+}
 // Function to sign extend the value
 
 int32_t sign_extend(int32_t value, int bits) {
     int32_t mask= 1 << (bits - 1);
     return (value ^ mask) - mask;
 }
+// Function to create a simulator with zeroed registers and memory
+// Memory is allocated a page at a time as the program writes it, so creating a simulator is cheap
+rv_sim_t *rv_create(void) {
+    rv_sim_t *sim = calloc(1, sizeof(rv_sim_t));
+    if (!sim) {
+        return NULL;
+    }
+    sim->page_tables = calloc(PAGE_TABLE_ENTRIES, sizeof(page_t *));
+    if (!sim->page_tables) {
+        free(sim);
+        return NULL;
+    }
+    mem_flush_tlb(sim);
+    sim->reservation = NO_RESERVATION;
+    sim->allow_misaligned = 1; // testing requires misaligned accesses to be allowed
+    sim->misaligned_mask = 0;
+    sim->core = RV_CORE_SWITCH;
+    sim->fusion = 1;
+    return sim;
+}
+
+void rv_destroy(rv_sim_t *sim) {
+    if (!sim || sim->hart_id != 0) {
+        return; // the other harts go with hart 0
+    }
+    rv_set_harts(sim, 1);
+    rv_trace_close(sim);
+    rv_set_stats(sim, 0);
+    rv_set_profile(sim, 0);
+    rv_set_timing(sim, 0, RV_PREDICTOR_NOT_TAKEN, 0);
+    rv_set_caches(sim, NULL, NULL);
+    rv_set_syscalls(sim, 0, NULL);
+    jit_destroy(sim);
+    mem_free(sim);
+    elf_free(sim);
+    free(sim->page_tables);
+    free(sim);
+}
 // Function to initialize the registers and memory
+// Only the pages the last program touched have to be freed. The memory belongs to hart 0, so resetting
+// another hart only clears its registers, and resetting hart 0 resets all of them.
+void rv_reset(rv_sim_t *sim) {
+    if (sim->hart_id == 0) {
+        jit_destroy(sim);
+        mem_free(sim);
+        elf_free(sim);
+        if (sim->smp) {
+            smp_reset(sim);
+        }
+    }
+    memset(sim->registers_array, 0, sizeof(sim->registers_array));
+    sim->pc = 0;
+    sim->registers_array[2] = 0; // sp starts at 0 and the stack grows down from the top of the address space
+    sim->halted = RV_OK;
+    sim->instret = 0;
+    sim->watchdog_start = 0;
+    sim->watchdog_deadline = 0;
+    sim->reservation = NO_RESERVATION;
+    memset(sim->fusions, 0, sizeof(sim->fusions));
+    memset(&sim->trap, 0, sizeof(sim->trap));
+    if (sim->syscalls) {
+        syscall_reset(sim); // closes the files the last program opened
+    }
+}
 
-void initialize() {
-    memset(registers_array, 0, sizeof(registers_array));
-    memset(memory, 0, sizeof(memory));
-    pc = 0;
-    registers_array[2] = 0; // sp starts at 0 instead of the end of memory as before
+rv_status_t rv_set_core(rv_sim_t *sim, rv_core_t core) {
+    if (core != RV_CORE_SWITCH && core != RV_CORE_THREADED && core != RV_CORE_JIT) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Unknown core %d", (int)core);
+    }
+    sim->core = core;
+    return RV_OK;
 }
-// Function to load the memory from the binary file
-void load_memory(const char *filename) {
+
+rv_status_t rv_set_watchdog(rv_sim_t *sim, uint64_t max_insns, double seconds) {
+    if (!(seconds >= 0)) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Invalid watchdog time limit %g", seconds);
+    }
+    sim->watchdog_insns = max_insns;
+    sim->watchdog_seconds = seconds;
+    sim->watchdog_start = sim->smp ? smp_instret(sim) : sim->instret;
+    sim->watchdog_deadline = 0;
+    return RV_OK;
+}
+
+void rv_set_allow_misaligned(rv_sim_t *sim, int allow) {
+    sim->allow_misaligned = allow != 0;
+    sim->misaligned_mask = allow ? 0 : ~0u;
+    jit_destroy(sim); // translated code has the alignment checks built in
+}
+
+rv_status_t rv_load_buffer(rv_sim_t *sim, const void *data, size_t size, uint32_t address) {
+    return rv_write_mem(sim, address, data, size);
+}
+// Function to load the memory from the binary file, starting at address 0
+rv_status_t rv_load_file(rv_sim_t *sim, const char *filename, size_t *loaded_bytes) {
+    uint8_t buffer[16 * PAGE_SIZE];
+
+    if (sim->hart_id != 0) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Programs are loaded through hart 0");
+    }
     FILE *file = fopen(filename, "rb");
     if (!file) {
-        perror("Failed to open binary file");
-        exit(EXIT_FAILURE);
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to open binary file: %s", strerror(errno));
     }
 
-    size_t bytes_read = fread(memory, 1, MEMORY_SIZE, file);
-    fclose(file);
-// Checking if the binary file is either too large or not a multiple of 4 bytes
-    if (bytes_read > MEMORY_SIZE) {
-        printf("Binary file is too large to fit in memory.\n");
-        exit(EXIT_FAILURE);
+    size_t total = 0, bytes_read = fread(buffer, 1, sizeof(buffer), file);
+    if (elf_is_elf(buffer, bytes_read)) {
+        fclose(file);
+        if (loaded_bytes) {
+            *loaded_bytes = 0;
+        }
+        return elf_load(sim, filename);
     }
-
-    if (bytes_read % 4 != 0) {
-        printf("Warning: File size is not a multiple of 4 bytes.\n");
+    rv_status_t status = RV_OK;
+    for (; status == RV_OK && bytes_read > 0; bytes_read = fread(buffer, 1, sizeof(buffer), file)) {
+        if (total + bytes_read > (uint64_t)UINT32_MAX + 1) {
+            status = rv_raise(sim, RV_ERROR_IO, 0, "Binary file is too large to fit in memory.");
+            break;
+        }
+        status = rv_write_mem(sim, (uint32_t)total, buffer, bytes_read);
+        total += bytes_read;
+    }
+    fclose(file);
+    if (loaded_bytes) {
+        *loaded_bytes = total;
     }
+    return status;
 }
-// Function to print the registers
+// Function to print the registers, every hart's in turn when there are several
+void rv_print_registers(const rv_sim_t *sim) {
+    unsigned num_harts = rv_get_num_harts(sim);
 
-void print_registers() {
-    printf("\n--- Register Contents ---\n");
-    for (int i = 0; i < NUM_REGISTERS; i++) {
-        printf("x%02d = %d (0x%08X)\n", i, registers_array[i], (uint32_t)registers_array[i]);
+    for (unsigned h = 0; h < num_harts; h++) {
+        const rv_sim_t *hart = rv_get_hart(sim, h);
+        if (num_harts == 1) {
+            printf("\n--- Register Contents ---\n");
+        } else {
+            printf("\n--- Register Contents (hart %u) ---\n", h);
+        }
+        for (int i = 0; i < NUM_REGISTERS; i++) {
+            printf("x%02d = %d (0x%08X)\n", i, hart->registers_array[i], (uint32_t)hart->registers_array[i]);
+        }
+        printf("--------------------------\n");
     }
-    printf("--------------------------\n");
 }
 // Function to dump the current registers into a res binary file
-void dump_registers_res() {
-    FILE *file = fopen("register_dump.res","wb");
+// With several harts the file holds the 32 registers of each hart in turn, hart 0 first
+rv_status_t rv_dump_registers(const rv_sim_t *sim, const char *filename) {
+    unsigned num_harts = rv_get_num_harts(sim);
+    FILE *file = fopen(filename,"wb");
     if (!file) {
-        perror("Failed to open register dump file");
-        exit(EXIT_FAILURE);
+        return RV_ERROR_IO;
+    }
+    for (unsigned h = 0; h < num_harts; h++) {
+        fwrite(rv_get_hart(sim, h)->registers_array, sizeof(int32_t), NUM_REGISTERS, file);
     }
-    fwrite(registers_array, sizeof(int32_t), NUM_REGISTERS, file);
     fclose(file);
+    return RV_OK;
+}
+
+int32_t rv_get_reg(const rv_sim_t *sim, unsigned reg) {
+    return reg < NUM_REGISTERS ? sim->registers_array[reg] : 0;
+}
+
+void rv_set_reg(rv_sim_t *sim, unsigned reg, int32_t value) {
+    if (reg != 0 && reg < NUM_REGISTERS) {
+        sim->registers_array[reg] = value;
+    }
+}
+
+uint32_t rv_get_pc(const rv_sim_t *sim) {
+    return sim->pc;
+}
+// Setting pc also resumes a halted program, e.g. past an ECALL the host has handled
+void rv_set_pc(rv_sim_t *sim, uint32_t new_pc) {
+    sim->pc = new_pc;
+    sim->halted = RV_OK;
+}
+
+const rv_trap_t *rv_get_trap(const rv_sim_t *sim) {
+    return &sim->trap;
+}
+
+uint64_t rv_get_instret(const rv_sim_t *sim) {
+    return sim->instret;
+}
+// Function to execute RV32M instructions (R type with funct7 0x01), one host operation each
+rv_status_t execute_m_type(rv_sim_t *sim, uint32_t funct3, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    int32_t operand1 = sim->registers_array[rs1];
+    int32_t operand2 = sim->registers_array[rs2];
+    int32_t result = 0;
+
+    switch (funct3) {
+        case FUNCT3_MUL:
+            result = (int32_t)((uint32_t)operand1 * (uint32_t)operand2);
+            break;
+        case FUNCT3_MULH:
+            result = rv_mulh(operand1, operand2);
+            break;
+        case FUNCT3_MULHSU:
+            result = rv_mulhsu(operand1, operand2);
+            break;
+        case FUNCT3_MULHU:
+            result = rv_mulhu(operand1, operand2);
+            break;
+        case FUNCT3_DIV:
+            result = rv_div(operand1, operand2);
+            break;
+        case FUNCT3_DIVU:
+            result = rv_divu(operand1, operand2);
+            break;
+        case FUNCT3_REM:
+            result = rv_rem(operand1, operand2);
+            break;
+        case FUNCT3_REMU:
+            result = rv_remu(operand1, operand2);
+            break;
+    }
+
+    if (rd != 0) {
+        sim->registers_array[rd] = result;
+    }
+    return RV_OK;
 }
 // Function to execute  R type instructions
-void execute_r_type(uint32_t funct7, uint32_t funct3, uint32_t rd, uint32_t rs1, uint32_t rs2) {
-    int32_t operand1= registers_array[rs1];
-    int32_t operand2 = registers_array[rs2];
+rv_status_t execute_r_type(rv_sim_t *sim, uint32_t funct7, uint32_t funct3, uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    int32_t operand1= sim->registers_array[rs1];
+    int32_t operand2 = sim->registers_array[rs2];
     int32_t result = 0;
+
+    if (funct7 == FUNCT7_MULDIV) {
+        return execute_m_type(sim, funct3, rd, rs1, rs2);
+    }
+    // Only ADD/SUB and SRL/SRA have a second funct7; SLL checks its own below
+    if (funct7 != FUNCT7_ADD && funct3 != FUNCT3_ADD_SUB && funct3 != FUNCT3_SRL_SRA) {
+        return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported R-type funct7: 0x%X", funct7);
+    }
 // Switch case to check the funct3 and funct7 values and perform the operation accordingly
-// The result is stored in the rd register and the value of (WE ALWAYS KEEP THE VALUE OF REGISTER x0 AS 0)
+// The result is stored in the rd register unless rd is x0, which stays 0
     switch (funct3) {
         case FUNCT3_ADD_SUB:
             if (funct7 ==FUNCT7_ADD) {
-                result = operand1 + operand2;
+                result = (int32_t)((uint32_t)operand1 + (uint32_t)operand2);
             } else if (funct7 == FUNCT7_SUB) {
-                result = operand1-operand2;
+                result = (int32_t)((uint32_t)operand1 - (uint32_t)operand2);
             } else {
-                printf("Unsupported R-type funct7: 0x%X\n", funct7);
-                exit(EXIT_FAILURE);
+                return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported R-type funct7: 0x%X", funct7);
             }
             break;
         case FUNCT3_SLL:
             if (funct7 != FUNCT7_SLLI) {
-                printf("Unsupported R-type funct7 for SLL: 0x%X\n", funct7);
-                exit(EXIT_FAILURE);
+                return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported R-type funct7 for SLL: 0x%X", funct7);
             }
-            result = operand1 << (operand2 & 0x1F);
+            result = (int32_t)((uint32_t)operand1 << (operand2 & 0x1F));
             break;
         case FUNCT3_SLT:
             result = (operand1 < operand2) ? 1 : 0;
@@ -168,8 +301,7 @@ void execute_r_type(uint32_t funct7, uint32_t funct3, uint32_t rd, uint32_t rs1,
             } else if (funct7 == FUNCT7_SRAI) {
                 result = operand1 >> (operand2 & 0x1F);
             } else {
-                printf("Unsupported R-type funct7 for SRL/SRA: 0x%X\n", funct7);
-                exit(EXIT_FAILURE);
+                return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported R-type funct7 for SRL/SRA: 0x%X", funct7);
             }
             break;
         case FUNCT3_OR:
@@ -179,29 +311,29 @@ void execute_r_type(uint32_t funct7, uint32_t funct3, uint32_t rd, uint32_t rs1,
             result = operand1 & operand2;
             break;
         default:
-            printf("Unsupported R-type funct3: 0x%X\n", funct3);
-            exit(EXIT_FAILURE);
+            return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported R-type funct3: 0x%X", funct3);
     }
 
-    registers_array[rd] = result; // Store the result in the rd register
-    registers_array[0] = 0; // x0 is hardwired to 0
+    if (rd != 0) { // x0 is hardwired to 0
+        sim->registers_array[rd] = result;
+    }
+    return RV_OK;
 }
 
 // Function to execute I type instructions. Same approach as R type instructions
-void execute_i_type(uint32_t funct7, uint32_t funct3, uint32_t rd, uint32_t rs1, int32_t imm) {
-    int32_t operand1 = registers_array[rs1];
+rv_status_t execute_i_type(rv_sim_t *sim, uint32_t funct7, uint32_t funct3, uint32_t rd, uint32_t rs1, int32_t imm) {
+    int32_t operand1 = sim->registers_array[rs1];
     int32_t result = 0;
 
     switch (funct3) {
         case FUNCT3_ADDI:
-            result = operand1 + imm;
+            result = (int32_t)((uint32_t)operand1 + (uint32_t)imm);
             break;
         case FUNCT3_SLLI:
             if (funct7 != FUNCT7_SLLI) {
-                printf("Unsupported I-type funct7 for SLLI: 0x%X\n", funct7);
-                exit(EXIT_FAILURE);
+                return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported I-type funct7 for SLLI: 0x%X", funct7);
             }
-            result = operand1 << (imm & 0x1F);
+            result = (int32_t)((uint32_t)operand1 << (imm & 0x1F));
             break;
         case FUNCT3_SLTI:
             result= (operand1 < imm) ? 1 : 0;
@@ -218,8 +350,7 @@ void execute_i_type(uint32_t funct7, uint32_t funct3, uint32_t rd, uint32_t rs1,
             } else if (funct7 == FUNCT7_SRAI) {
                 result = operand1 >> (imm & 0x1F);
             } else {
-                printf("Unsupported I-type funct7 for SRLI/SRAI: 0x%X\n", funct7);
-                exit(EXIT_FAILURE);
+                return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported I-type funct7 for SRLI/SRAI: 0x%X", funct7);
             }
             break;
         case FUNCT3_ORI:
@@ -229,19 +360,66 @@ void execute_i_type(uint32_t funct7, uint32_t funct3, uint32_t rd, uint32_t rs1,
             result = operand1 & imm;
             break;
         default:
-            printf("Unsupported I-type funct3: 0x%X\n", funct3);
-            exit(EXIT_FAILURE);
+            return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported I-type funct3: 0x%X", funct3);
     }
 
     if (rd != 0) { // if rd is x0 we don't write to it
-        registers_array[rd] = result;
+        sim->registers_array[rd] = result;
+    }
+    return RV_OK;
+}
+// Function to raise the trap for a load or store that mem_load/mem_store turned down
+static rv_status_t memory_fault(rv_sim_t *sim, rv_status_t status, uint32_t address) {
+    if (status == RV_TRAP_MISALIGNED) {
+        return rv_raise(sim, RV_TRAP_MISALIGNED, address, "Misaligned memory access at address 0x%X", address);
+    }
+    return rv_raise(sim, RV_TRAP_ACCESS_FAULT, address, "Memory access fault at address 0x%X", address);
+}
+// Function to execute LOAD instructions
+// Inlined into the threaded core's handlers, where funct3 and so the access size are constants, and so is
+// misaligned_mask (see mem_load)
+static ALWAYS_INLINE rv_status_t execute_load(rv_sim_t *sim, uint32_t funct3, uint32_t rd, uint32_t rs1, int32_t imm,
+                                              uint32_t misaligned_mask) {
+    uint32_t address = (uint32_t)sim->registers_array[rs1] + imm;
+    uint32_t loaded_value = 0;
+    int access_size;
+
+    switch (funct3) {
+        case FUNCT3_LB:
+        case FUNCT3_LBU:
+            access_size = 1;
+            break;
+        case FUNCT3_LH:
+        case FUNCT3_LHU:
+            access_size = 2;
+            break;
+        case FUNCT3_LW:
+            access_size = 4;
+            break;
+        default:
+            return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported LOAD funct3: 0x%X", funct3);
+    }
+
+    rv_status_t status = mem_load(sim, address, access_size, &loaded_value, misaligned_mask);
+    if (status != RV_OK) {
+        return memory_fault(sim, status, address);
+    }
+    if (funct3 == FUNCT3_LB) {
+        loaded_value = (int8_t)loaded_value;
+    } else if (funct3 == FUNCT3_LH) {
+        loaded_value = (int16_t)loaded_value;
+    }
+
+    if (rd != 0) {
+        sim->registers_array[rd] = loaded_value;
     }
-    registers_array[0] = 0; // we keep this line as an extra precaution (but it is not necessary)
+    return RV_OK;
 }
 //S type instructions
-void execute_s_type(uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm) {
-    int32_t address = registers_array[rs1] + imm;
-    int32_t value= registers_array[rs2];
+static ALWAYS_INLINE rv_status_t execute_s_type(rv_sim_t *sim, uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm,
+                                                uint32_t misaligned_mask) {
+    uint32_t address = (uint32_t)sim->registers_array[rs1] + imm;
+    int32_t value= sim->registers_array[rs2];
     int access_size = 4;
 
     switch (funct3) {
@@ -255,34 +433,78 @@ void execute_s_type(uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm) {
             access_size = 4;
             break;
         default:
-            printf("Unsupported S-type funct3: 0x%X\n", funct3);
-            exit(EXIT_FAILURE);
+            return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported S-type funct3: 0x%X", funct3);
     }
 
-    if (address < 0 || address + access_size - 1 >= MEMORY_SIZE) {
-        printf("Memory access out of bounds at address 0x%X\n", address);
-        exit(EXIT_FAILURE);
+    // Misaligned accesses (when sim->allow_misaligned is 0) and stores to pages holding decoded code miss
+    // the TLB; the slow path reports the former and drops the stale decodes of the latter
+    rv_status_t status = mem_store(sim, address, access_size, (uint32_t)value, misaligned_mask);
+    if (status != RV_OK) {
+        return memory_fault(sim, status, address);
     }
-
-    // Depending on allow_misaligned, we may need to check for misaligned memory access (testing requires allow_misaligned=1)
-    if (!allow_misaligned) {
-        if (address % access_size != 0) {
-            printf("Misaligned memory access at address 0x%X\n", address);
-            exit(EXIT_FAILURE);
-        }
+    return RV_OK;
+}
+// Function to compute the word an AMO writes back from the word it read and rs2
+static uint32_t amo_result(uint8_t insn, uint32_t old, uint32_t operand) {
+    switch (insn) {
+        case INSN_AMOSWAP: return operand;
+        case INSN_AMOADD:  return old + operand;
+        case INSN_AMOXOR:  return old ^ operand;
+        case INSN_AMOAND:  return old & operand;
+        case INSN_AMOOR:   return old | operand;
+        case INSN_AMOMIN:  return (int32_t)old < (int32_t)operand ? old : operand;
+        case INSN_AMOMAX:  return (int32_t)old > (int32_t)operand ? old : operand;
+        case INSN_AMOMINU: return old < operand ? old : operand;
+        default:           return old > operand ? old : operand; // AMOMAXU
     }
+}
+// Function to execute the RV32A instructions with host atomics on the word every hart shares, so harts on
+// other host threads see each read-modify-write as one step. All of them are sequentially consistent, which
+// covers any aq/rl bits. SC.W succeeds if the word still holds what LR.W read, a compare-and-swap as in
+// QEMU: it can't tell that another hart changed the word and changed it back.
+static ALWAYS_INLINE rv_status_t execute_amo(rv_sim_t *sim, const decoded_instr_t *d) {
+    uint32_t address = (uint32_t)sim->registers_array[d->rs1];
+    uint32_t operand = (uint32_t)sim->registers_array[d->rs2];
+    uint32_t *word, old, result;
 
-    //byte by byte data writing
-    for (int i = 0; i < access_size; i++) {
-        memory[address + i] = (value >> (8 * i)) & 0xFF;
+    if (d->insn < INSN_LR || d->insn > INSN_AMOMAXU) {
+        return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported AMO instruction: 0x%08X at PC: 0x%08X", d->raw, sim->pc);
     }
+    rv_status_t status = mem_atomic_word(sim, address, d->insn != INSN_LR, &word);
+    if (status != RV_OK) {
+        return memory_fault(sim, status, address);
+    }
+    switch (d->insn) {
+        case INSN_LR:
+            result = LE32(__atomic_load_n(word, __ATOMIC_SEQ_CST));
+            sim->reservation = address;
+            sim->reservation_value = result;
+            break;
+        case INSN_SC:
+            old = LE32(sim->reservation_value);
+            result = sim->reservation == address &&
+                     __atomic_compare_exchange_n(word, &old, LE32(operand), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? 0 : 1;
+            sim->reservation = NO_RESERVATION;
+            break;
+        default:
+            old = __atomic_load_n(word, __ATOMIC_RELAXED);
+            do {
+                result = LE32(old);
+            } while (!__atomic_compare_exchange_n(word, &old, LE32(amo_result(d->insn, result, operand)), 1,
+                                                  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+            break;
+    }
+    if (d->rd != 0) {
+        sim->registers_array[d->rd] = (int32_t)result;
+    }
+    return RV_OK;
 }
 // Function to execute B type instructions
 // The funct3 value is checked and the branch is taken according to the instruction
 
-void execute_b_type(uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm) {
-    int32_t operand1 = registers_array[rs1];
-    int32_t operand2= registers_array[rs2];
+rv_status_t execute_b_type(rv_sim_t *sim, uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm, uint32_t length) {
+    int32_t operand1 = sim->registers_array[rs1];
+    int32_t operand2= sim->registers_array[rs2];
     int branch = 0;
 
     switch (funct3) {
@@ -305,237 +527,809 @@ void execute_b_type(uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm) {
             if ((uint32_t)operand1 >= (uint32_t)operand2) branch = 1;
             break;
         default:
-            printf("Unsupported B-type funct3: 0x%X\n", funct3);
-            exit(EXIT_FAILURE);
+            return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported B-type funct3: 0x%X", funct3);
     }
 // If the branch is taken, the program counter has to be updated in accordance to whether or not the branch is taken
     if (branch) {
-        pc += imm;
+        sim->pc += imm;
     } else {
-        pc += 4;
+        sim->pc += length;
     }
+    return RV_OK;
 }
 // Function to execute U type instructions
-void execute_u_type(uint32_t opcode, uint32_t rd, int32_t imm) {
+rv_status_t execute_u_type(rv_sim_t *sim, uint32_t opcode, uint32_t rd, int32_t imm) {
     switch (opcode) {
         case OPCODE_LUI:
             if (rd != 0) {
-                registers_array[rd] = imm;
+                sim->registers_array[rd] = imm;
             }
             break;
         case OPCODE_AUIPC:
             if (rd != 0) {
-                registers_array[rd] = pc + imm;
+                sim->registers_array[rd] = sim->pc + imm;
             } // ensuring again that x0 is not written to 
             break;
         default:
-            printf("Unsupported U-type opcode: 0x%X\n", opcode);
-            exit(EXIT_FAILURE);
+            return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported U-type opcode: 0x%X", opcode);
     }
-    registers_array[0] = 0; // Still unnecessary but we keep it for consistency
+    return RV_OK;
 }
 // Function to execute J type instructions
-void execute_j_type(uint32_t rd, int32_t imm) {
+// The return address skips the jump itself, which is 2 bytes for C.JAL
+void execute_j_type(rv_sim_t *sim, uint32_t rd, int32_t imm, uint32_t length) {
     if (rd != 0) {
-        registers_array[rd] = pc + 4;
+        sim->registers_array[rd] = sim->pc + length;
     }
-    pc += imm;
+    sim->pc += imm;
 } // jalr is used to jump to a register value
-void execute_jalr(uint32_t rd, uint32_t rs1, int32_t imm) {
-    int32_t target = registers_array[rs1] + imm;
+void execute_jalr(rv_sim_t *sim, uint32_t rd, uint32_t rs1, int32_t imm, uint32_t length) {
+    int32_t target = (int32_t)((uint32_t)sim->registers_array[rs1] + (uint32_t)imm);
     target &= ~1;
     if (rd != 0) {
-        registers_array[rd] = pc + 4;
+        sim->registers_array[rd] = sim->pc + length;
     }
-    pc = target;
+    sim->pc = target;
 }
 // Function to handle system calls
-// This function is used to handle the system calls like ECALL and EBREAK which are used to exit the program
-void handle_system_call(uint32_t instruction) {
+// This function is used to handle the system calls like ECALL and EBREAK which are used to halt the program
+// With system call emulation on (syscall.c), ECALL runs the Linux system call in a7 instead
+rv_status_t handle_system_call(rv_sim_t *sim, uint32_t instruction) {
     uint32_t funct= (instruction >>20) & 0xFFF;
 
     switch (funct) {
-        case SYSTEM_ECALL:
-            printf("ECALL encountered at PC: 0x%08X\n", pc);
-            print_registers();
-            dump_registers_res(); //  dump at Ecall instead of at the end of the program
-            exit(EXIT_SUCCESS);
-            break;
+        case SYSTEM_ECALL: // the caller dumps the registers and stops
+            if (sim->syscalls) {
+                return syscall_handle(sim);
+            }
+            return rv_raise(sim, RV_HALT_ECALL, 0, "ECALL encountered at PC: 0x%08X", sim->pc);
         case SYSTEM_EBREAK:
-            printf("EBREAK encountered at PC: 0x%08X\n", pc);
-            print_registers();
-            dump_registers_res();
-            exit(EXIT_SUCCESS);
+            return rv_raise(sim, RV_HALT_EBREAK, 0, "EBREAK encountered at PC: 0x%08X", sim->pc);
+        case SYSTEM_WFI: // there are no interrupts to wait for
+            return rv_raise(sim, RV_HALT_IDLE, 0, "WFI encountered at PC: 0x%08X", sim->pc);
+        default:
+            return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported SYSTEM instruction funct: 0x%X at PC: 0x%08X", funct, sim->pc);
+    }
+}
+// Function to execute the CSR instructions
+// Only the Zicntr counters and mhartid exist, and they are read-only. cycle and time deliberately count
+// completed instructions just like instret, even with the timing model on, so that turning on --timing
+// leaves every register dump the same.
+rv_status_t execute_csr(rv_sim_t *sim, uint32_t funct3, uint32_t rd, uint32_t rs1, uint32_t csr) {
+    uint64_t counter;
+
+    switch (csr) {
+        case CSR_CYCLE:
+        case CSR_TIME:
+        case CSR_INSTRET:
+            counter = sim->instret;
+            break;
+        case CSR_CYCLEH:
+        case CSR_TIMEH:
+        case CSR_INSTRETH:
+            counter = sim->instret >> 32;
+            break;
+        case CSR_MHARTID:
+            counter = sim->hart_id;
+            break;
+        default:
+            return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported CSR: 0x%03X at PC: 0x%08X", csr, sim->pc);
+    }
+    // CSRRW(I) always writes, CSRRS(I)/CSRRC(I) only with a nonzero rs1/immediate
+    if ((funct3 & 0x3) == 0 || (funct3 & 0x3) == (FUNCT3_CSRRW & 0x3) || rs1 != 0) {
+        return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported CSR write: 0x%03X at PC: 0x%08X", csr, sim->pc);
+    }
+    if (rd != 0) {
+        sim->registers_array[rd] = (int32_t)counter;
+    }
+    return RV_OK;
+}
+// Function to find the concrete instruction (INSN_*) behind an opcode/funct3/funct7 combination
+// Mirrors the checks in the execute_* functions: anything they would reject becomes INSN_ILLEGAL
+uint8_t classify_instruction(uint32_t opcode, uint32_t funct3, uint32_t funct7) {
+    static const uint8_t branch_insns[8] = {
+        INSN_BEQ, INSN_BNE, INSN_ILLEGAL, INSN_ILLEGAL, INSN_BLT, INSN_BGE, INSN_BLTU, INSN_BGEU
+    };
+    static const uint8_t load_insns[8] = {
+        INSN_LB, INSN_LH, INSN_LW, INSN_ILLEGAL, INSN_LBU, INSN_LHU, INSN_ILLEGAL, INSN_ILLEGAL
+    };
+    static const uint8_t store_insns[8] = {
+        INSN_SB, INSN_SH, INSN_SW, INSN_ILLEGAL, INSN_ILLEGAL, INSN_ILLEGAL, INSN_ILLEGAL, INSN_ILLEGAL
+    };
+
+    switch (opcode) {
+        case OPCODE_LUI:    return INSN_LUI;
+        case OPCODE_AUIPC:  return INSN_AUIPC;
+        case OPCODE_JAL:    return INSN_JAL;
+        case OPCODE_JALR:   return funct3 == 0 ? INSN_JALR : INSN_ILLEGAL;
+        case OPCODE_BRANCH: return branch_insns[funct3];
+        case OPCODE_LOAD:   return load_insns[funct3];
+        case OPCODE_STORE:  return store_insns[funct3];
+        case OPCODE_SYSTEM:
+            if (funct3 == 0) return INSN_SYSTEM;
+            return (funct3 & 0x3) ? INSN_CSR : INSN_ILLEGAL;
+        case OPCODE_MISC_MEM:
+            if (funct3 == FUNCT3_FENCE) return INSN_FENCE;
+            return funct3 == FUNCT3_FENCE_I ? INSN_FENCE_I : INSN_ILLEGAL;
+        case OPCODE_AMO:
+            if (funct3 != FUNCT3_AMO_W) {
+                return INSN_ILLEGAL;
+            }
+            switch (funct7 >> 2) {
+                case FUNCT5_LR:      return INSN_LR;
+                case FUNCT5_SC:      return INSN_SC;
+                case FUNCT5_AMOSWAP: return INSN_AMOSWAP;
+                case FUNCT5_AMOADD:  return INSN_AMOADD;
+                case FUNCT5_AMOXOR:  return INSN_AMOXOR;
+                case FUNCT5_AMOAND:  return INSN_AMOAND;
+                case FUNCT5_AMOOR:   return INSN_AMOOR;
+                case FUNCT5_AMOMIN:  return INSN_AMOMIN;
+                case FUNCT5_AMOMAX:  return INSN_AMOMAX;
+                case FUNCT5_AMOMINU: return INSN_AMOMINU;
+                case FUNCT5_AMOMAXU: return INSN_AMOMAXU;
+            }
             break;
+        case OPCODE_OP_IMM:
+            switch (funct3) {
+                case FUNCT3_ADDI:  return INSN_ADDI;
+                case FUNCT3_SLTI:  return INSN_SLTI;
+                case FUNCT3_SLTIU: return INSN_SLTIU;
+                case FUNCT3_XORI:  return INSN_XORI;
+                case FUNCT3_ORI:   return INSN_ORI;
+                case FUNCT3_ANDI:  return INSN_ANDI;
+                case FUNCT3_SLLI:  return funct7 == FUNCT7_SLLI ? INSN_SLLI : INSN_ILLEGAL;
+                case FUNCT3_SRLI_SRAI:
+                    if (funct7 == FUNCT7_SRLI) return INSN_SRLI;
+                    if (funct7 == FUNCT7_SRAI) return INSN_SRAI;
+                    return INSN_ILLEGAL;
+            }
+            break;
+        case OPCODE_OP:
+            if (funct7 == FUNCT7_MULDIV) {
+                static const uint8_t m_insns[8] = {
+                    INSN_MUL, INSN_MULH, INSN_MULHSU, INSN_MULHU, INSN_DIV, INSN_DIVU, INSN_REM, INSN_REMU
+                };
+                return m_insns[funct3];
+            }
+            switch (funct3) {
+                case FUNCT3_ADD_SUB:
+                    if (funct7 == FUNCT7_ADD) return INSN_ADD;
+                    if (funct7 == FUNCT7_SUB) return INSN_SUB;
+                    return INSN_ILLEGAL;
+                case FUNCT3_SLL:  return funct7 == FUNCT7_SLLI ? INSN_SLL : INSN_ILLEGAL;
+                case FUNCT3_SLT:  return funct7 == FUNCT7_ADD ? INSN_SLT : INSN_ILLEGAL;
+                case FUNCT3_SLTU: return funct7 == FUNCT7_ADD ? INSN_SLTU : INSN_ILLEGAL;
+                case FUNCT3_XOR:  return funct7 == FUNCT7_ADD ? INSN_XOR : INSN_ILLEGAL;
+                case FUNCT3_SRL_SRA:
+                    if (funct7 == FUNCT7_SRLI) return INSN_SRL;
+                    if (funct7 == FUNCT7_SRAI) return INSN_SRA;
+                    return INSN_ILLEGAL;
+                case FUNCT3_OR:   return funct7 == FUNCT7_ADD ? INSN_OR : INSN_ILLEGAL;
+                case FUNCT3_AND:  return funct7 == FUNCT7_ADD ? INSN_AND : INSN_ILLEGAL;
+            }
+            break;
+    }
+    return INSN_ILLEGAL;
+}
+// Instruction word encoders, used to expand RV32C instructions
+#define ENCODE_R(opcode, rd, funct3, rs1, rs2, funct7) \
+    ((uint32_t)(funct7) << 25 | (uint32_t)(rs2) << 20 | (uint32_t)(rs1) << 15 | (uint32_t)(funct3) << 12 | \
+     (uint32_t)(rd) << 7 | (opcode))
+#define ENCODE_I(opcode, rd, funct3, rs1, imm) \
+    (((uint32_t)(imm) & 0xFFF) << 20 | (uint32_t)(rs1) << 15 | (uint32_t)(funct3) << 12 | (uint32_t)(rd) << 7 | (opcode))
+#define ENCODE_S(funct3, rs1, rs2, imm) \
+    ((((uint32_t)(imm) >> 5) & 0x7F) << 25 | (uint32_t)(rs2) << 20 | (uint32_t)(rs1) << 15 | \
+     (uint32_t)(funct3) << 12 | ((uint32_t)(imm) & 0x1F) << 7 | OPCODE_STORE)
+#define ENCODE_B(funct3, rs1, imm) \
+    ((((uint32_t)(imm) >> 12) & 0x1) << 31 | (((uint32_t)(imm) >> 5) & 0x3F) << 25 | (uint32_t)(rs1) << 15 | \
+     (uint32_t)(funct3) << 12 | (((uint32_t)(imm) >> 1) & 0xF) << 8 | (((uint32_t)(imm) >> 11) & 0x1) << 7 | OPCODE_BRANCH)
+#define ENCODE_J(rd, imm) \
+    ((((uint32_t)(imm) >> 20) & 0x1) << 31 | (((uint32_t)(imm) >> 1) & 0x3FF) << 21 | \
+     (((uint32_t)(imm) >> 11) & 0x1) << 20 | (((uint32_t)(imm) >> 12) & 0xFF) << 12 | (uint32_t)(rd) << 7 | OPCODE_JAL)
+#define CBIT(instr, from, to)  ((((instr) >> (from)) & 0x1) << (to)) // bit from of a compressed instruction, moved to bit to
+#define CREG(instr, lsb)       (8 + (((instr) >> (lsb)) & 0x7))         // 3-bit register field, x8-x15
+
+// Function to expand a 16-bit RV32C instruction into the 32-bit instruction it stands for
+// Reserved encodings, the all-zero halfword and the floating-point loads and stores expand to 0, which the
+// execute path rejects as an illegal instruction. HINTs expand to their no-op 32-bit forms.
+uint32_t expand_compressed(uint32_t c) {
+    uint32_t funct3 = (c >> 13) & 0x7;
+    uint32_t rd = (c >> 7) & 0x1F;
+    uint32_t rs2 = (c >> 2) & 0x1F;
+    int32_t imm6 = sign_extend((int32_t)(CBIT(c, 12, 5) | ((c >> 2) & 0x1F)), 6); // C.ADDI, C.LI, C.ANDI
+    int32_t imm;
+
+    switch ((c & 0x3) << 3 | funct3) {
+        // Quadrant 0
+        case 0x00: // C.ADDI4SPN
+            imm = (int32_t)(((c >> 7) & 0xF) << 6 | ((c >> 11) & 0x3) << 4 | CBIT(c, 5, 3) | CBIT(c, 6, 2));
+            return imm ? ENCODE_I(OPCODE_OP_IMM, CREG(c, 2), FUNCT3_ADDI, 2, imm) : 0;
+        case 0x02: // C.LW
+            imm = (int32_t)(((c >> 10) & 0x7) << 3 | CBIT(c, 6, 2) | CBIT(c, 5, 6));
+            return ENCODE_I(OPCODE_LOAD, CREG(c, 2), FUNCT3_LW, CREG(c, 7), imm);
+        case 0x06: // C.SW
+            imm = (int32_t)(((c >> 10) & 0x7) << 3 | CBIT(c, 6, 2) | CBIT(c, 5, 6));
+            return ENCODE_S(FUNCT3_SW, CREG(c, 7), CREG(c, 2), imm);
+
+        // Quadrant 1
+        case 0x08: // C.ADDI (C.NOP for rd == 0)
+            return ENCODE_I(OPCODE_OP_IMM, rd, FUNCT3_ADDI, rd, imm6);
+        case 0x09: // C.JAL
+        case 0x0D: // C.J
+            imm = (int32_t)(CBIT(c, 12, 11) | CBIT(c, 11, 4) | ((c >> 9) & 0x3) << 8 | CBIT(c, 8, 10) | CBIT(c, 7, 6) |
+                            CBIT(c, 6, 7) | ((c >> 3) & 0x7) << 1 | CBIT(c, 2, 5));
+            return ENCODE_J(funct3 == 0x1 ? 1 : 0, sign_extend(imm, 12));
+        case 0x0A: // C.LI
+            return ENCODE_I(OPCODE_OP_IMM, rd, FUNCT3_ADDI, 0, imm6);
+        case 0x0B:
+            if (rd == 2) { // C.ADDI16SP
+                imm = sign_extend((int32_t)(CBIT(c, 12, 9) | CBIT(c, 6, 4) | CBIT(c, 5, 6) | ((c >> 3) & 0x3) << 7 |
+                                            CBIT(c, 2, 5)), 10);
+                return imm ? ENCODE_I(OPCODE_OP_IMM, 2, FUNCT3_ADDI, 2, imm) : 0;
+            }
+            // C.LUI
+            return imm6 ? ((uint32_t)imm6 << 12) | rd << 7 | OPCODE_LUI : 0;
+        case 0x0C: {
+            uint32_t rd_prime = CREG(c, 7);
+            switch ((c >> 10) & 0x3) {
+                case 0x0: // C.SRLI
+                    return (c & (1u << 12)) ? 0 : ENCODE_I(OPCODE_OP_IMM, rd_prime, FUNCT3_SRLI_SRAI, rd_prime, rs2);
+                case 0x1: // C.SRAI
+                    return (c & (1u << 12)) ? 0 :
+                           ENCODE_I(OPCODE_OP_IMM, rd_prime, FUNCT3_SRLI_SRAI, rd_prime, FUNCT7_SRAI << 5 | rs2);
+                case 0x2: // C.ANDI
+                    return ENCODE_I(OPCODE_OP_IMM, rd_prime, FUNCT3_ANDI, rd_prime, imm6);
+                default: { // C.SUB, C.XOR, C.OR, C.AND (the RV64 C.SUBW/C.ADDW have bit 12 set)
+                    static const uint8_t funct3s[4] = { FUNCT3_ADD_SUB, FUNCT3_XOR, FUNCT3_OR, FUNCT3_AND };
+                    uint32_t op = (c >> 5) & 0x3;
+                    if (c & (1u << 12)) {
+                        return 0;
+                    }
+                    return ENCODE_R(OPCODE_OP, rd_prime, funct3s[op], rd_prime, CREG(c, 2), op == 0 ? FUNCT7_SUB : 0);
+                }
+            }
+        }
+        case 0x0E: // C.BEQZ
+        case 0x0F: // C.BNEZ
+            imm = (int32_t)(CBIT(c, 12, 8) | ((c >> 10) & 0x3) << 3 | ((c >> 5) & 0x3) << 6 | ((c >> 3) & 0x3) << 1 |
+                            CBIT(c, 2, 5));
+            return ENCODE_B(funct3 == 0x6 ? FUNCT3_BEQ : FUNCT3_BNE, CREG(c, 7), sign_extend(imm, 9));
+
+        // Quadrant 2
+        case 0x10: // C.SLLI
+            return (c & (1u << 12)) ? 0 : ENCODE_I(OPCODE_OP_IMM, rd, FUNCT3_SLLI, rd, rs2);
+        case 0x12: // C.LWSP
+            imm = (int32_t)(CBIT(c, 12, 5) | ((c >> 4) & 0x7) << 2 | ((c >> 2) & 0x3) << 6);
+            return rd ? ENCODE_I(OPCODE_LOAD, rd, FUNCT3_LW, 2, imm) : 0;
+        case 0x14:
+            if (!(c & (1u << 12))) {
+                if (rs2 == 0) { // C.JR
+                    return rd ? ENCODE_I(OPCODE_JALR, 0, 0, rd, 0) : 0;
+                }
+                return ENCODE_R(OPCODE_OP, rd, FUNCT3_ADD_SUB, 0, rs2, FUNCT7_ADD); // C.MV
+            }
+            if (rs2 == 0) {
+                // C.EBREAK, C.JALR
+                return rd ? ENCODE_I(OPCODE_JALR, 1, 0, rd, 0) : ENCODE_I(OPCODE_SYSTEM, 0, 0, 0, SYSTEM_EBREAK);
+            }
+            return ENCODE_R(OPCODE_OP, rd, FUNCT3_ADD_SUB, rd, rs2, FUNCT7_ADD); // C.ADD
+        case 0x16: // C.SWSP
+            imm = (int32_t)(((c >> 9) & 0xF) << 2 | ((c >> 7) & 0x3) << 6);
+            return ENCODE_S(FUNCT3_SW, 2, rs2, imm);
+        default:
+            return 0;
+    }
+}
+
+// Function to find the threaded core's handler for a compressed instruction that expanded to insn
+static uint8_t compressed_handler(uint8_t insn) {
+#define INSN_C_CASE(name) case INSN_##name: return INSN_C_##name;
+    switch (insn) {
+        INSN_RVC_LIST(INSN_C_CASE)
         default:
-            printf("Unsupported SYSTEM instruction funct: 0x%X at PC: 0x%08X\n", funct, pc);
-            exit(EXIT_FAILURE);
+            return insn; // SYSTEM and ILLEGAL go through execute_decoded(), which steps pc by d->length
     }
+#undef INSN_C_CASE
 }
-// Function to execute a single instruction
-void execute_instruction(uint32_t instruction) {
+
+// Function to decode an instruction once into a decoded_instr_t record
+// Compressed instructions are expanded first, so every core executes them as the 32-bit instruction they
+// stand for and only steps pc by 2. Only the fields are pulled out here; unsupported encodings are still
+// reported by the execute path.
+void decode_instruction(uint32_t instruction, decoded_instr_t *d) {
+    uint8_t length = 4;
+    if (IS_COMPRESSED(instruction)) {
+        instruction = expand_compressed(instruction & 0xFFFF);
+        length = 2;
+    }
     uint32_t opcode = GET_OPCODE(instruction);
-    uint32_t rd = GET_RD(instruction);
     uint32_t funct3 = GET_FUNCT3(instruction);
-    uint32_t rs1 = GET_RS1(instruction);
-    uint32_t rs2 = GET_RS2(instruction);
-    uint32_t funct7 = GET_FUNCT7(instruction);
     int32_t imm = 0;
-// Bunch of switch cases to check the opcode and perform the operation accordingly
+
     switch (opcode) {
         case OPCODE_LUI:
-        case OPCODE_AUIPC: {
+        case OPCODE_AUIPC:
             imm = instruction & 0xFFFFF000;
-            execute_u_type(opcode, rd, imm);
-            pc += 4;
             break;
-        }
-        case OPCODE_JAL: {
+        case OPCODE_JAL:
             imm = ((instruction >> 21) & 0x3FF) << 1;
             imm |= ((instruction >> 20) & 0x1) << 11;
             imm |= ((instruction >> 12) & 0xFF) << 12;
             imm |= ((instruction >> 31) & 0x1) << 20;
             imm = sign_extend(imm, 21);
-            execute_j_type(rd, imm);
             break;
-        }
-        case OPCODE_JALR: {
+        case OPCODE_JALR:
+        case OPCODE_LOAD:
             imm = sign_extend((instruction >> 20) & 0xFFF, 12);
-            execute_jalr(rd, rs1, imm);
             break;
-        }
-        case OPCODE_BRANCH: {
+        case OPCODE_BRANCH:
             imm= ((instruction >> 7) & 0x1) << 11;
             imm |= ((instruction >> 8) & 0xF) << 1;
             imm |= ((instruction >> 25) & 0x3F) << 5;
             imm |= ((instruction >> 31) & 0x1) << 12;
             imm= sign_extend(imm, 13);
-            execute_b_type(funct3, rs1, rs2, imm);
             break;
-        }
-        case OPCODE_LOAD: {
-            imm = sign_extend((instruction >> 20) & 0xFFF, 12);
-            int32_t address = registers_array[rs1] + imm;
-            int32_t loaded_value = 0;
+        case OPCODE_STORE:
+            imm = ((instruction >> 7) & 0x1F) | (((instruction >> 25) & 0x7F) << 5);
+            imm= sign_extend(imm, 12);
+            break;
+        case OPCODE_OP_IMM:
+            if (funct3 == FUNCT3_SLLI || funct3 == FUNCT3_SRLI_SRAI) {
+                imm = (instruction >> 20) & 0x1F;
+            } else {
+                imm = sign_extend((instruction >> 20) & 0xFFF, 12);
+            }
+            break;
+        case OPCODE_SYSTEM:
+            imm = (instruction >> 20) & 0xFFF; // ECALL/EBREAK or the CSR number
+            break;
+        default:
+            break;
+    }
 
-            if (address < 0 || address >= MEMORY_SIZE) {
-                printf("Memory access out of bounds at address 0x%X\n", address);
-                exit(EXIT_FAILURE);
+    d->raw = instruction;
+    d->imm = imm;
+    d->opcode = opcode;
+    d->insn = classify_instruction(opcode, funct3, GET_FUNCT7(instruction));
+    d->handler = length == 2 ? compressed_handler(d->insn) : d->insn;
+    d->funct3 = funct3;
+    d->funct7 = GET_FUNCT7(instruction);
+    d->rd = GET_RD(instruction);
+    d->rs1 = GET_RS1(instruction);
+    d->rs2 = GET_RS2(instruction);
+    if (d->insn == INSN_LR && d->rs2 != 0) {
+        d->insn = d->handler = INSN_ILLEGAL; // LR.W has no rs2, its field is reserved
+    }
+    // hints such as "addi x0, x0, 0" leave no trace, so the threaded core's handlers needn't guard x0
+    if (d->rd == 0 && (d->insn <= INSN_AUIPC || (d->insn >= INSN_ADDI && d->insn <= INSN_AND) ||
+                       (d->insn >= INSN_MUL && d->insn <= INSN_REMU))) { // LUI and AUIPC come first
+        d->handler = length == 2 ? INSN_C_NOP : INSN_NOP;
+    }
+    // a jump or branch to itself never gets anywhere else, and execute_decoded halts on it (see idle_loop)
+    if (imm == 0 && (d->insn == INSN_JAL || (d->insn >= INSN_BEQ && d->insn <= INSN_BGEU))) {
+        d->handler = INSN_SYSTEM;
+    }
+    d->valid = 1;
+    d->length = length;
+    d->imm2 = 0;
+    d->rd2 = 0;
+    d->length2 = 0;
+}
+// Function to fetch outside the page of the last fetch (see fetch_decoded in RISC-V.h), decoding the
+// instruction on the first visit. Returns NULL if the page isn't executable. Odd pcs and 32-bit
+// instructions that cross into the next page are decoded into a scratch record and never cached, so a
+// store only ever has to drop decoded records on its own page. Decode caches are shared by all harts, so a
+// record is only marked valid once it is complete.
+const decoded_instr_t *fetch_decoded_slow(rv_sim_t *sim, uint32_t fetch_pc) {
+    decoded_instr_t *entry, record;
+    uint32_t instruction = 0;
+    int length = 2;
+
+    page_t *page = mem_page(sim, fetch_pc, 1);
+    if (page && !(page->perms & RV_PERM_EXEC)) {
+        return NULL;
+    }
+    entry = &sim->scratch;
+    if ((fetch_pc & 1) == 0 && page) {
+        decoded_instr_t *decoded = __atomic_load_n(&page->decoded, __ATOMIC_ACQUIRE);
+        if (!decoded) {
+            decoded_instr_t *fresh = calloc(DECODE_PAGE_ENTRIES, sizeof(decoded_instr_t));
+            if (fresh && __atomic_compare_exchange_n(&page->decoded, &decoded, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                decoded = fresh;
+            } else {
+                free(fresh);
             }
-            switch (funct3) {
-                case FUNCT3_LB:
-                    loaded_value = (int8_t)memory[address];
-                    break;
-                case FUNCT3_LH:
-                    if (!allow_misaligned) {
-                        if (address % 2 != 0) {
-                            printf("Misaligned memory access at address 0x%X\n", address);
-                            exit(EXIT_FAILURE);
-                        }
-                    }
-                    loaded_value = (int16_t)(memory[address] | (memory[address + 1] << 8));
-                    break;
-                case FUNCT3_LW:
-                    if (!allow_misaligned) {
-                        if (address % 4 != 0) {
-                            printf("Misaligned memory access at address 0x%X\n", address);
-                            exit(EXIT_FAILURE);
-                        }
-                    }
-                    loaded_value = memory[address] |
-                                   (memory[address + 1] << 8) |
-                                   (memory[address + 2] << 16) |
-                                   (memory[address + 3] << 24);
-                    break;
-                case FUNCT3_LBU:
-                    loaded_value = (uint8_t)memory[address];
-                    break;
-                case FUNCT3_LHU:
-                    if (!allow_misaligned) {
-                        if (address % 2 != 0) {
-                            printf("Misaligned memory access at address 0x%X\n", address);
-                            exit(EXIT_FAILURE);
-                        }
-                    }
-                    loaded_value = memory[address] | (memory[address + 1] << 8);
-                    break;
-                default:
-                    printf("Unsupported LOAD funct3: 0x%X\n", funct3);
-                    exit(EXIT_FAILURE);
+            // stores to the page have to go through the slow path from now on
+            sim->tlb[(fetch_pc >> PAGE_SHIFT) & (TLB_ENTRIES - 1)].write_tag = TLB_INVALID;
+        }
+        if (decoded) { // out of memory just means this page is decoded on every visit
+            sim->itlb_tag = fetch_pc & PAGE_MASK;
+            sim->itlb_decoded = decoded;
+            entry = &decoded[(fetch_pc >> 1) & (DECODE_PAGE_ENTRIES - 1)];
+            if (__atomic_load_n(&entry->valid, __ATOMIC_ACQUIRE)) {
+                return entry;
             }
+        }
+    }
 
-            if (rd != 0) {
-                registers_array[rd] = loaded_value;
+    // Fetches need execute permission only, so the bytes are read straight from the pages. The first
+    // halfword tells whether the instruction is compressed or two more bytes follow.
+    for (int i = 0; i < length; i++) {
+        const page_t *byte_page = i == 0 ? page : mem_page(sim, fetch_pc + i, 0);
+        if (byte_page && !(byte_page->perms & RV_PERM_EXEC)) {
+            return NULL; // an instruction running into a page that isn't executable
+        }
+        if (byte_page && byte_page->data) {
+            instruction |= (uint32_t)byte_page->data[(fetch_pc + i) & (PAGE_SIZE - 1)] << (8 * i);
+        }
+        if (i == 1 && !IS_COMPRESSED(instruction)) {
+            length = 4;
+        }
+    }
+    if (((fetch_pc + length - 1) ^ fetch_pc) & PAGE_MASK) {
+        entry = &sim->scratch;
+    }
+    if (entry == &sim->scratch) {
+        decode_instruction(instruction, entry);
+        return entry;
+    }
+    decode_instruction(instruction, &record);
+    if (sim->fusion) {
+        fuse_decoded(page, fetch_pc, &record);
+    }
+    record.valid = 0;
+    *entry = record;
+    __atomic_store_n(&entry->valid, 1, __ATOMIC_RELEASE);
+    return entry;
+}
+// Function to raise the fault for a pc that fetch_decoded() returned NULL for
+rv_status_t fetch_fault(rv_sim_t *sim) {
+    return rv_raise(sim, RV_TRAP_ACCESS_FAULT, sim->pc, "Instruction access fault at PC: 0x%08X", sim->pc);
+}
+// Function to throw out decoded records overlapping a store of size bytes at address
+// Records start at every halfword, so a 32-bit instruction starting up to 3 bytes before the store overlaps it too,
+// and a fused pair (two 32-bit instructions) up to 7 bytes before it
+void invalidate_decoded(rv_sim_t *sim, uint32_t address, int size) {
+    uint32_t first = (address - 6) >> 1;
+    uint32_t last = (address + size - 1) >> 1;
+
+    for (uint32_t half = first; ; half = (half + 1) & 0x7FFFFFFF) {
+        uint32_t start = half << 1;
+        page_t *page = mem_page(sim, start, 0);
+        decoded_instr_t *entry = page && page->decoded ? &page->decoded[half & (DECODE_PAGE_ENTRIES - 1)] : NULL;
+        if (entry && entry->valid && ((uint32_t)(start - address) < (uint32_t)size || address - start < (uint32_t)entry->length + entry->length2)) {
+            entry->valid = 0;
+            sim->code_writes++;
+            if (sim->jit) {
+                jit_invalidate(sim, start, entry->length); // translated copies of the instruction are stale as well
             }
-            pc += 4;
+        }
+        if (half == last) {
+            break;
+        }
+    }
+}
+// Function to halt on a jump or taken branch to itself. Its registers can't change while it runs, so it
+// would run forever; every core hands it to execute_decoded.
+static rv_status_t idle_loop(rv_sim_t *sim) {
+    return rv_raise(sim, RV_HALT_IDLE, 0, "Idle loop (jump to itself) at PC: 0x%08X", sim->pc);
+}
+
+// Function to execute a single decoded instruction
+// Returns RV_OK, or the halt/trap status with pc left on the instruction
+rv_status_t execute_decoded(rv_sim_t *sim, const decoded_instr_t *d) {
+    uint32_t rd = d->rd;
+    uint32_t rs1 = d->rs1;
+    int32_t imm = d->imm;
+    rv_status_t status = RV_OK;
+// Bunch of switch cases to check the opcode and perform the operation accordingly
+    switch (d->opcode) {
+        case OPCODE_LUI:
+        case OPCODE_AUIPC: {
+            status = execute_u_type(sim, d->opcode, rd, imm);
+            break;
+        }
+        case OPCODE_JAL: {
+            if (imm == 0) {
+                return idle_loop(sim);
+            }
+            execute_j_type(sim, rd, imm, d->length);
+            return RV_OK;
+        }
+        case OPCODE_JALR: {
+            if (d->funct3 != 0) {
+                return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported JALR funct3: 0x%X", d->funct3);
+            }
+            execute_jalr(sim, rd, rs1, imm, d->length);
+            return RV_OK;
+        }
+        case OPCODE_BRANCH: {
+            uint32_t pc = sim->pc;
+            status = execute_b_type(sim, d->funct3, rs1, d->rs2, imm, d->length);
+            return status == RV_OK && sim->pc == pc ? idle_loop(sim) : status;
+        }
+        case OPCODE_LOAD: {
+            status = execute_load(sim, d->funct3, rd, rs1, imm, sim->misaligned_mask);
             break;
         }
         case OPCODE_STORE: {
-            int32_t imm_store = ((instruction >> 7) & 0x1F) | (((instruction >> 25) & 0x7F) << 5);
-            imm_store= sign_extend(imm_store, 12);
-            execute_s_type(funct3, rs1, rs2, imm_store);
-            pc += 4;
+            status = execute_s_type(sim, d->funct3, rs1, d->rs2, imm, sim->misaligned_mask);
             break;
         }
         case OPCODE_OP_IMM: {
-            if (funct3 == FUNCT3_SLLI || funct3 == FUNCT3_SRLI_SRAI) {
-                imm = (instruction >> 20) & 0x1F;
-            } else {
-                imm = sign_extend((instruction >> 20) & 0xFFF, 12);
-            }
-            execute_i_type(funct7, funct3, rd, rs1, imm);
-            pc += 4;
+            status = execute_i_type(sim, d->funct7, d->funct3, rd, rs1, imm);
             break;
         }
         case OPCODE_OP: {
-            execute_r_type(funct7,funct3, rd, rs1, rs2);
-            pc += 4;
+            status = execute_r_type(sim, d->funct7, d->funct3, rd, rs1, d->rs2);
+            break;
+        }
+        case OPCODE_MISC_MEM: {
+            // FENCE orders the accesses of this hart for the others. FENCE.I has nothing to do: a hart's own
+            // stores already drop the decoded and translated copies of the code they overwrite.
+            if (d->insn == INSN_FENCE) {
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            } else if (d->insn != INSN_FENCE_I) {
+                return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported MISC-MEM funct3: 0x%X", d->funct3);
+            }
+            break;
+        }
+        case OPCODE_AMO: {
+            status = execute_amo(sim, d);
             break;
         }
         case OPCODE_SYSTEM: {
-            handle_system_call(instruction );
-            pc += 4;
+            if (d->funct3 == 0) {
+                status = handle_system_call(sim, d->raw);
+            } else {
+                status = execute_csr(sim, d->funct3, rd, rs1, (uint32_t)imm);
+            }
             break;
         }
         default:
-            printf("Unsupported opcode: 0x%X at PC: 0x%08X\n", opcode, pc);
-            exit(EXIT_FAILURE);
+            return rv_raise(sim, RV_TRAP_ILLEGAL_INSTRUCTION, 0, "Unsupported opcode: 0x%X at PC: 0x%08X", d->opcode, sim->pc);
+    }
+
+    if (status != RV_OK) {
+        return status;
+    }
+    sim->pc += d->length;
+    return RV_OK;
+}
+// Instrumentation hooks of the instrumented core variants, see sim_instrumented
+static ALWAYS_INLINE void instrument_begin(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d) {
+    if (sim->trace) trace_begin(sim, insn_pc, d);
+    if (sim->cache) cache_begin(sim, d);
+}
+// Called after an instruction completed, with the pc of the next one
+static ALWAYS_INLINE void instrument_end(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d, uint32_t next_pc) {
+    if (sim->trace) trace_end(sim);
+    if (sim->stats) stats_retire(sim, insn_pc, d, next_pc);
+    if (sim->profile) profile_retire(sim, insn_pc, d, next_pc);
+    if (sim->cache) cache_retire(sim, insn_pc, d);
+    if (sim->timing) timing_retire(sim, insn_pc, d, next_pc);
+}
+// Called when an instruction halted or trapped instead; it is traced but not counted
+static ALWAYS_INLINE void instrument_stopped(rv_sim_t *sim) {
+    if (sim->trace) trace_end(sim);
+}
+
+// run through the instructions in the memory until the program halts, budget instructions have
+// completed or pc reaches stop_pc. The instrumentation checks are constants after inlining, so the
+// plain loop carries no trace or statistics code.
+static ALWAYS_INLINE rv_status_t run_switch(rv_sim_t *sim, uint64_t budget, uint32_t stop_pc, const int instrumented) {
+    uint64_t executed = 0;
+    rv_status_t status = RV_OK;
+
+    while (executed < budget) {
+        const decoded_instr_t *d = fetch_decoded(sim, sim->pc);
+        if (!d) {
+            status = fetch_fault(sim);
+            break;
+        }
+        if (d->insn == INSN_CSR || d->insn == INSN_SYSTEM) {
+            // the counters include the instructions of this run so far
+            sim->instret += executed;
+            budget -= executed;
+            executed = 0;
+        }
+
+        uint32_t insn_pc = sim->pc;
+        if (instrumented) instrument_begin(sim, insn_pc, d);
+        status = execute_decoded(sim, d);
+        if (status != RV_OK) {
+            if (instrumented) instrument_stopped(sim);
+            break;
+        }
+        if (instrumented) instrument_end(sim, insn_pc, d, sim->pc);
+        executed++;
+        if (sim->pc == stop_pc) {
+            break;
+        }
+    }
+
+    sim->instret += executed;
+    return status;
+}
+
+// Threaded-code core (threaded_core.inc), generated once per combination of the checks a run can do without:
+// instrumentation, the alignment policy (when accesses are allowed to be misaligned, the TLB hit test is all
+// there is) and the budget and stop pc of bounded runs. The instrumented variant is rare enough to keep the
+// run-time alignment policy and limits.
+#if defined(__GNUC__)
+#define USE_COMPUTED_GOTO 1
+#endif
+#define THREADED_CORE_NAME run_threaded_instrumented
+#define THREADED_CORE_INSTRUMENTED 1
+#define THREADED_CORE_MISALIGNED_MASK sim->misaligned_mask
+#define THREADED_CORE_LIMITS 1
+#include "threaded_core.inc"
+#define THREADED_CORE_NAME run_threaded_unaligned
+#define THREADED_CORE_INSTRUMENTED 0
+#define THREADED_CORE_MISALIGNED_MASK 0u
+#define THREADED_CORE_LIMITS 1
+#include "threaded_core.inc"
+#define THREADED_CORE_NAME run_threaded_unaligned_unlimited
+#define THREADED_CORE_INSTRUMENTED 0
+#define THREADED_CORE_MISALIGNED_MASK 0u
+#define THREADED_CORE_LIMITS 0
+#include "threaded_core.inc"
+#define THREADED_CORE_NAME run_threaded_aligned
+#define THREADED_CORE_INSTRUMENTED 0
+#define THREADED_CORE_MISALIGNED_MASK ~0u
+#define THREADED_CORE_LIMITS 1
+#include "threaded_core.inc"
+#define THREADED_CORE_NAME run_threaded_aligned_unlimited
+#define THREADED_CORE_INSTRUMENTED 0
+#define THREADED_CORE_MISALIGNED_MASK ~0u
+#define THREADED_CORE_LIMITS 0
+#include "threaded_core.inc"
+
+rv_status_t run_threaded(rv_sim_t *sim, uint64_t budget, uint32_t stop_pc) {
+    if (sim_instrumented(sim)) {
+        return run_threaded_instrumented(sim, budget, stop_pc);
+    }
+    int limited = budget != RV_UNLIMITED || stop_pc != NO_STOP_PC;
+    if (sim->allow_misaligned) {
+        return limited ? run_threaded_unaligned(sim, budget, stop_pc)
+                       : run_threaded_unaligned_unlimited(sim, budget, stop_pc);
+    }
+    return limited ? run_threaded_aligned(sim, budget, stop_pc) : run_threaded_aligned_unlimited(sim, budget, stop_pc);
+}
+
+// Function to run the selected core
+static rv_status_t run_selected_core(rv_sim_t *sim, uint64_t budget, uint32_t stop_pc) {
+    switch (sim->core) {
+        case RV_CORE_JIT:
+            if (stop_pc == NO_STOP_PC) {
+                return run_jit(sim, budget);
+            }
+            // translated blocks jump straight into each other past any stop pc, so interpret instead
+            return run_threaded(sim, budget, stop_pc);
+        case RV_CORE_THREADED:
+            return run_threaded(sim, budget, stop_pc);
+        default:
+            if (sim_instrumented(sim)) {
+                return run_switch(sim, budget, stop_pc, 1);
+            }
+            return run_switch(sim, budget, stop_pc, 0);
     }
+}
+
+// Function to run one hart for at most budget instructions; smp.c runs every quantum of every hart here
+rv_status_t run_hart(rv_sim_t *sim, uint64_t budget, uint32_t stop_pc) {
+    rv_status_t status;
 
-    registers_array[0] = 0 ; // let x0 be hardwired to 0
+    if (!sim->stats) {
+        return run_selected_core(sim, budget, stop_pc);
+    }
+    stats_run_begin(sim);
+    status = run_selected_core(sim, budget, stop_pc);
+    stats_run_end(sim);
+    return status;
 }
-// run through all  of the instructions in the memory
-void run() {
-    while (pc + 3 < MEMORY_SIZE) {
-        uint32_t instruction = 0;
-        instruction |= memory[pc];
-        instruction |= memory[pc + 1] << 8;
-        instruction |= memory[pc + 2] << 16;
-        instruction |= memory[pc + 3] << 24;
 
-        printf("PC = 0x%08X | Instruction = 0x%08X\n", pc, instruction);
-        execute_instruction(instruction);
+static rv_status_t run_program(rv_sim_t *sim, uint64_t budget, uint32_t stop_pc) {
+    if (sim->smp) {
+        return smp_run(sim, budget, stop_pc);
+    }
+    if (sim->halted != RV_OK) {
+        return sim->halted;
     }
+    return run_hart(sim, budget, stop_pc);
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
 
-    printf("Program execution completed.\n");
+// Function to count the instructions the program retired since the watchdog was armed
+static uint64_t watchdog_count(const rv_sim_t *sim) {
+    uint64_t instret = sim->smp ? smp_instret(sim) : sim->instret;
+    return instret > sim->watchdog_start ? instret - sim->watchdog_start : 0;
 }
 
-//          Main function
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("Usage: %s <binary_file>\n",argv[0]);
-        return EXIT_FAILURE;
+rv_status_t watchdog_check(rv_sim_t *sim) {
+    if (sim->watchdog_seconds > 0) {
+        double now = now_seconds();
+        if (sim->watchdog_deadline == 0) {
+            sim->watchdog_deadline = now + sim->watchdog_seconds;
+        } else if (now >= sim->watchdog_deadline) {
+            return rv_raise(sim, RV_HALT_WATCHDOG, 0, "Watchdog: still running after %g s, at PC: 0x%08X",
+                            sim->watchdog_seconds, sim->pc);
+        }
     }
-//ensuring that dump_registers_res function is called in event of a weird termination
-    if (atexit(dump_registers_res) != 0) {
-        fprintf(stderr, "Failed to set exit function.\n");
-        return EXIT_FAILURE;
+    if (sim->watchdog_insns && watchdog_count(sim) >= sim->watchdog_insns) {
+        return rv_raise(sim, RV_HALT_WATCHDOG, 0, "Watchdog: still running after %llu instructions, at PC: 0x%08X",
+                        (unsigned long long)sim->watchdog_insns, sim->pc);
     }
+    return RV_OK;
+}
 
-    initialize();
-    load_memory(argv[1]);
-    run();
-    print_registers();
+// Function to return how many instructions the program may run before the watchdog checks the clock again
+// or its instruction limit is used up
+uint64_t watchdog_left(const rv_sim_t *sim) {
+    uint64_t left = RV_UNLIMITED;
+
+    if (sim->watchdog_insns) {
+        uint64_t count = watchdog_count(sim);
+        left = count < sim->watchdog_insns ? sim->watchdog_insns - count : 0;
+    }
+    if (sim->watchdog_seconds > 0 && left > RV_WATCHDOG_SLICE) {
+        left = RV_WATCHDOG_SLICE;
+    }
+    return left;
+}
+
+// Function to run the program under the watchdog, in slices of at most watchdog_left instructions with a
+// watchdog_check before each. A run that returns RV_OK used up its slice (every hart still running did) or
+// stopped at stop_pc.
+static rv_status_t run_watched(rv_sim_t *sim, uint64_t budget, uint32_t stop_pc) {
+    while (budget > 0) {
+        if (sim->smp ? smp_program_over(sim) : sim->halted != RV_OK) {
+            return sim->halted;
+        }
+        rv_status_t status = watchdog_check(sim);
+        if (status != RV_OK) {
+            return status;
+        }
+        uint64_t slice = watchdog_left(sim);
+        if (slice > budget) {
+            slice = budget;
+        }
+        status = run_program(sim, slice, stop_pc);
+        if (status != RV_OK || (stop_pc != NO_STOP_PC && sim->pc == stop_pc)) {
+            return status;
+        }
+        budget -= slice;
+    }
+    return RV_OK;
+}
+
+static rv_status_t run_core(rv_sim_t *sim, uint64_t budget, uint32_t stop_pc) {
+    rv_status_t status;
+
+    if (watchdog_armed(sim)) {
+        status = run_watched(sim, budget, stop_pc);
+    } else {
+        status = run_program(sim, budget, stop_pc);
+    }
+    if (sim->syscalls) {
+        syscall_flush(sim); // the host sees all the output of a run once it returns
+    }
+    return status;
+}
+
+rv_status_t rv_step(rv_sim_t *sim, uint64_t count) {
+    return run_core(sim, count, NO_STOP_PC);
+}
+
+rv_status_t rv_run_until(rv_sim_t *sim, uint32_t stop_pc, uint64_t max_count) {
+    return run_core(sim, max_count, stop_pc);
+}
 
-    return EXIT_SUCCESS;
+rv_status_t rv_run(rv_sim_t *sim) {
+    return run_core(sim, RV_UNLIMITED, NO_STOP_PC);
 }
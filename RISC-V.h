@@ -0,0 +1,457 @@
+#ifndef RISC_V_H
+#define RISC_V_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "riscv_sim.h"
+
+#define NUM_REGISTERS 32
+// Defining Opcodes
+#define OPCODE_LUI       0x37
+#define OPCODE_AUIPC     0x17
+#define OPCODE_JAL       0x6F
+#define OPCODE_JALR      0x67
+#define OPCODE_BRANCH    0x63
+#define OPCODE_LOAD      0x03
+#define OPCODE_STORE     0x23
+#define OPCODE_OP_IMM    0x13
+#define OPCODE_OP        0x33
+#define OPCODE_SYSTEM    0x73
+#define OPCODE_MISC_MEM  0x0F
+#define OPCODE_AMO       0x2F
+// BRANCH
+#define FUNCT3_BEQ       0x0
+#define FUNCT3_BNE       0x1
+#define FUNCT3_BLT       0x4
+#define FUNCT3_BGE       0x5
+#define FUNCT3_BLTU      0x6
+#define FUNCT3_BGEU      0x7
+// LOAD
+#define FUNCT3_LB        0x0
+#define FUNCT3_LH        0x1
+#define FUNCT3_LW        0x2
+#define FUNCT3_LBU       0x4
+#define FUNCT3_LHU       0x5
+// STORE
+#define FUNCT3_SB        0x0
+#define FUNCT3_SH        0x1
+#define FUNCT3_SW        0x2
+// IMMEDIATE_OPS
+#define FUNCT3_ADDI      0x0
+#define FUNCT3_SLLI      0x1
+#define FUNCT3_SLTI      0x2
+#define FUNCT3_SLTIU     0x3
+#define FUNCT3_XORI      0x4
+#define FUNCT3_SRLI_SRAI 0x5
+#define FUNCT3_ORI       0x6
+#define FUNCT3_ANDI      0x7
+// REGULAR_OPS
+#define FUNCT3_ADD_SUB   0x0
+#define FUNCT3_SLL       0x1
+#define FUNCT3_SLT       0x2
+#define FUNCT3_SLTU      0x3
+#define FUNCT3_XOR       0x4
+#define FUNCT3_SRL_SRA   0x5
+#define FUNCT3_OR        0x6
+#define FUNCT3_AND       0x7
+// R TYPE_OPS
+#define FUNCT7_ADD       0x00
+#define FUNCT7_SUB       0x20
+#define FUNCT7_MULDIV    0x01
+// RV32M (OP opcode, funct7 0x01)
+#define FUNCT3_MUL       0x0
+#define FUNCT3_MULH      0x1
+#define FUNCT3_MULHSU    0x2
+#define FUNCT3_MULHU     0x3
+#define FUNCT3_DIV       0x4
+#define FUNCT3_DIVU      0x5
+#define FUNCT3_REM       0x6
+#define FUNCT3_REMU      0x7
+#define FUNCT7_SLLI      0x00
+#define FUNCT7_SRLI      0x00
+#define FUNCT7_SRAI      0x20
+// SYSTEM
+#define SYSTEM_ECALL     0x000
+#define SYSTEM_EBREAK    0x001
+#define SYSTEM_WFI       0x105
+// MISC-MEM
+#define FUNCT3_FENCE     0x0
+#define FUNCT3_FENCE_I   0x1
+// RV32A (AMO opcode, funct3 0x2 for words). funct5 is the top five bits of funct7, below them aq and rl.
+#define FUNCT3_AMO_W     0x2
+#define FUNCT5_AMOADD    0x00
+#define FUNCT5_AMOSWAP   0x01
+#define FUNCT5_LR        0x02
+#define FUNCT5_SC        0x03
+#define FUNCT5_AMOXOR    0x04
+#define FUNCT5_AMOOR     0x08
+#define FUNCT5_AMOAND    0x0C
+#define FUNCT5_AMOMIN    0x10
+#define FUNCT5_AMOMAX    0x14
+#define FUNCT5_AMOMINU   0x18
+#define FUNCT5_AMOMAXU   0x1C
+// Zicsr (SYSTEM opcode, funct3 != 0). The I forms take a 5-bit immediate in the rs1 field.
+#define FUNCT3_CSRRW     0x1
+#define FUNCT3_CSRRS     0x2
+#define FUNCT3_CSRRC     0x3
+#define FUNCT3_CSRRWI    0x5
+#define FUNCT3_CSRRSI    0x6
+#define FUNCT3_CSRRCI    0x7
+// Zicntr counters (read-only), the high halves are the upper 32 bits of the 64-bit counters
+#define CSR_CYCLE        0xC00
+#define CSR_TIME         0xC01
+#define CSR_INSTRET      0xC02
+#define CSR_CYCLEH       0xC80
+#define CSR_TIMEH        0xC81
+#define CSR_INSTRETH     0xC82
+// Machine information register (read-only)
+#define CSR_MHARTID      0xF14
+// Guest memory is the whole 32-bit address space in 4 KiB pages. A two-level page table (10 bits of the
+// page number per level) is filled in on first touch, and page data only on the first write.
+#define PAGE_SHIFT          12
+#define PAGE_SIZE           (1u << PAGE_SHIFT)
+#define PAGE_MASK           (~(PAGE_SIZE - 1))
+#define PAGE_TABLE_SHIFT    10
+#define PAGE_TABLE_ENTRIES  (1 << PAGE_TABLE_SHIFT)
+// Software TLB in front of the page table for loads and stores (direct mapped on the page number)
+#define TLB_ENTRIES         256
+#define TLB_INVALID         1u  // never equal to a page address
+#define NO_RESERVATION      1u  // never a word address (see execute_amo)
+// Decode cache: every instruction is decoded once into a decoded_instr_t and reused on later visits.
+// Records are kept per page, one per halfword since RV32C instructions can start at any even address,
+// and only allocated once code is fetched from the page.
+#define DECODE_PAGE_ENTRIES (PAGE_SIZE / 2)
+// Every concrete instruction the threaded core has a handler for. ILLEGAL covers encodings we reject
+// and SYSTEM covers ECALL/EBREAK, both of which go back through the switch core for their messages. CSR
+// covers all six CSR instructions. LR through AMOMAXU are the RV32A word instructions, in this order.
+#define INSN_LIST(X) \
+    X(LUI) X(AUIPC) X(JAL) X(JALR) \
+    X(BEQ) X(BNE) X(BLT) X(BGE) X(BLTU) X(BGEU) \
+    X(LB) X(LH) X(LW) X(LBU) X(LHU) \
+    X(SB) X(SH) X(SW) \
+    X(ADDI) X(SLTI) X(SLTIU) X(XORI) X(ORI) X(ANDI) X(SLLI) X(SRLI) X(SRAI) \
+    X(ADD) X(SUB) X(SLL) X(SLT) X(SLTU) X(XOR) X(SRL) X(SRA) X(OR) X(AND) \
+    X(MUL) X(MULH) X(MULHSU) X(MULHU) X(DIV) X(DIVU) X(REM) X(REMU) \
+    X(FENCE) X(FENCE_I) \
+    X(LR) X(SC) X(AMOSWAP) X(AMOADD) X(AMOXOR) X(AMOAND) X(AMOOR) X(AMOMIN) X(AMOMAX) X(AMOMINU) X(AMOMAXU) \
+    X(SYSTEM) X(CSR) X(ILLEGAL)
+// The instructions RV32C instructions expand to (besides SYSTEM and ILLEGAL). The threaded core has a second
+// handler for each of them, INSN_C_*, that steps pc by 2, so finding the next instruction never has to wait
+// for the length of the current one to be loaded.
+#define INSN_RVC_LIST(X) \
+    X(LUI) X(JAL) X(JALR) X(BEQ) X(BNE) X(LW) X(SW) \
+    X(ADDI) X(ANDI) X(SLLI) X(SRLI) X(SRAI) X(ADD) X(SUB) X(XOR) X(OR) X(AND)
+// Instruction pairs the threaded core runs as one operation (macro-op fusion, see fusion.c). The record of
+// the first instruction gets the INSN_FUSED_* handler, or INSN_FUSED_C_* when either instruction is
+// compressed, and the operands of the second one.
+#define FUSED_LIST(X) \
+    X(LUI_ADDI) X(AUIPC_JALR) X(AUIPC_LW) X(SLLI_SRLI) X(SLLI_SRAI) \
+    X(SLT_BEQZ) X(SLT_BNEZ) X(SLTU_BEQZ) X(SLTU_BNEZ) X(SLTI_BEQZ) X(SLTI_BNEZ) X(SLTIU_BEQZ) X(SLTIU_BNEZ)
+#define INSN_ENUM(name) INSN_##name,
+#define INSN_C_ENUM(name) INSN_C_##name,
+#define INSN_FUSED_ENUM(name) INSN_FUSED_##name, INSN_FUSED_C_##name,
+// NOP and C_NOP are the handlers of instructions whose only effect is writing x0 (see decode_instruction),
+// so the threaded core's other handlers can write rd without keeping x0 at zero.
+enum {
+    INSN_LIST(INSN_ENUM) INSN_COUNT, INSN_C_BEFORE_FIRST = INSN_COUNT - 1, INSN_RVC_LIST(INSN_C_ENUM)
+    FUSED_LIST(INSN_FUSED_ENUM) INSN_NOP, INSN_C_NOP, HANDLER_COUNT
+};
+typedef struct {
+    uint32_t raw;      // instruction word, compressed ones expanded (used by the trace and SYSTEM instructions)
+    int32_t imm;       // immediate, already sign-extended for its format
+    int32_t imm2;      // fused pair: the second instruction's immediate, or what the pair adds up (see fusion.c)
+    uint8_t opcode;    // selects the execute path of the switch core
+    uint8_t insn;      // concrete instruction (INSN_*)
+    uint8_t handler;   // handler id of the threaded core: insn, its INSN_C_* twin for compressed instructions,
+                       // INSN_(C_)NOP when it only writes x0, or INSN_FUSED_(C_)* for the first instruction of
+                       // a fused pair
+    uint8_t funct3;
+    uint8_t funct7;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t valid;     // cleared when a store overwrites the instruction
+    uint8_t length;    // 2 for a compressed instruction, 4 otherwise
+    uint8_t rd2;       // fused pair: rd of the second instruction
+    uint8_t length2;   // fused pair: length of the second instruction; 0 if the record isn't fused
+} decoded_instr_t;
+
+// Defining the functions for getting the opcode, rd, funct3, rs1, rs2, funct7 to decode the instruction
+#define GET_OPCODE(instr)          (instr & 0x7F)
+#define GET_RD(instr)              ((instr >> 7) & 0x1F)
+#define GET_FUNCT3(instr)          ((instr >> 12) & 0x7)
+#define GET_RS1(instr)             ((instr >> 15) & 0x1F)
+#define GET_RS2(instr)             ((instr >> 20) & 0x1F)
+#define GET_FUNCT7(instr)          ((instr >> 25) & 0x7F)
+// The two low bits of a 32-bit instruction are 11, anything else is a 16-bit RV32C instruction
+#define IS_COMPRESSED(instr)       (((instr) & 0x3) != 0x3)
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+// stop_pc value that never matches, since pc stays even
+#define NO_STOP_PC 0xFFFFFFFFu
+
+typedef struct {
+    uint8_t *data;                         // NULL until the page is first written, reads see zeros until then
+    decoded_instr_t *decoded;              // decode cache of the page, NULL until code is fetched from it
+    uint8_t perms;                         // RV_PERM_* bits
+    uint8_t borrowed;                      // data points into the mapped ELF file and isn't freed
+} page_t;
+
+// A TLB hit on read_tag/write_tag means the page may be read/written directly at addend + address.
+// Pages with decoded code never get a write_tag, so their stores take the slow path and drop stale code.
+typedef struct {
+    uint32_t read_tag;                     // page address, or TLB_INVALID
+    uint32_t write_tag;
+    uintptr_t addend;                      // host address of the page data minus the page address
+} tlb_entry_t;
+
+typedef struct jit_state jit_state_t;
+typedef struct trace_state trace_state_t;
+typedef struct stats_state stats_state_t;
+typedef struct profile_state profile_state_t;
+typedef struct timing_state timing_state_t;
+typedef struct cache_state cache_state_t;
+typedef struct syscall_state syscall_state_t;
+typedef struct smp_state smp_state_t;
+
+// Hart state. Everything the simulator used to keep in globals lives here.
+struct rv_sim {
+    int32_t registers_array[NUM_REGISTERS];
+    uint32_t pc;
+    int allow_misaligned;                  // 1 to allow misaligned memory access, 0 to enforce alignment
+    uint32_t misaligned_mask;              // 0 when misaligned accesses are allowed, ~0 when they trap
+    rv_core_t core;
+    rv_status_t halted;                    // RV_OK while the program can continue
+    rv_trap_t trap;
+    uint64_t instret;                      // instructions completed, also the cycle/time/instret CSRs
+    uint64_t jit_budget;                   // instructions translated code may still run in this call
+    tlb_entry_t tlb[TLB_ENTRIES];
+    uint32_t itlb_tag;                     // page of the last instruction fetch, or TLB_INVALID
+    decoded_instr_t *itlb_decoded;         // decode cache of that page
+    page_t **page_tables;                  // PAGE_TABLE_ENTRIES second-level tables, NULL while no page in them was
+                                           // touched; all harts share hart 0's
+    decoded_instr_t scratch;               // decode of an odd pc or an instruction crossing pages, never cached
+    jit_state_t *jit;                      // NULL until the JIT is first used
+    trace_state_t *trace;                  // NULL while tracing is off
+    stats_state_t *stats;                  // NULL while statistics are off
+    profile_state_t *profile;              // NULL while profiling is off
+    timing_state_t *timing;                // NULL while the timing model is off
+    cache_state_t *cache;                  // NULL while the caches are off
+    syscall_state_t *syscalls;             // NULL while ECALL halts the program
+    uint32_t hart_id;                      // mhartid, 0 for the simulator the host created
+    smp_state_t *smp;                      // shared by all harts (smp.c), NULL while there is only one
+    uint32_t reservation;                  // address of the LR.W reservation, or NO_RESERVATION
+    uint32_t reservation_value;            // the word LR.W read there
+    uint64_t code_writes;                  // bumped whenever decoded instructions are overwritten or dropped (batch.c)
+    int fusion;                            // 1 while fetches fuse instruction pairs (fusion.c)
+    uint64_t watchdog_insns;               // rv_set_watchdog limits, 0 when off
+    double watchdog_seconds;
+    uint64_t watchdog_start;               // instructions retired when the watchdog was armed or the sim reset
+    double watchdog_deadline;              // clock time the time limit runs out, 0 until the first run
+    uint64_t fusions[RV_FUSION_COUNT];     // fused pairs the threaded core ran, per rv_fusion_t
+    rv_symbol_t *symbols;                  // symbol table of the loaded ELF file, sorted by address
+    size_t num_symbols;
+    char *symbol_names;
+    uint8_t *elf_image;                    // the ELF file borrowed pages point into, NULL when none
+    size_t elf_image_size;
+    int elf_image_mapped;
+};
+
+// Guest memory is little-endian. Big-endian hosts swap bytes after a single host-width access.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LE16(x) __builtin_bswap16(x)
+#define LE32(x) __builtin_bswap32(x)
+#else
+#define LE16(x) (x)
+#define LE32(x) (x)
+#endif
+
+// Function to read size (1, 2 or 4) little-endian bytes from host memory, which need not be aligned
+static ALWAYS_INLINE uint32_t load_le(const uint8_t *host, int size) {
+    if (size == 4) {
+        uint32_t value;
+        memcpy(&value, host, 4);
+        return LE32(value);
+    }
+    if (size == 2) {
+        uint16_t value;
+        memcpy(&value, host, 2);
+        return LE16(value);
+    }
+    return host[0];
+}
+
+static ALWAYS_INLINE void store_le(uint8_t *host, int size, uint32_t value) {
+    if (size == 4) {
+        uint32_t le = LE32(value);
+        memcpy(host, &le, 4);
+    } else if (size == 2) {
+        uint16_t le = LE16((uint16_t)value);
+        memcpy(host, &le, 2);
+    } else {
+        host[0] = (uint8_t)value;
+    }
+}
+
+// Paged memory (memory.c). The slow paths return RV_TRAP_MISALIGNED or RV_TRAP_ACCESS_FAULT on a fault
+// and leave raising it to the caller.
+page_t *mem_page(rv_sim_t *sim, uint32_t address, int create);
+rv_status_t mem_load_slow(rv_sim_t *sim, uint32_t address, int size, uint32_t *value);
+rv_status_t mem_store_slow(rv_sim_t *sim, uint32_t address, int size, uint32_t value);
+void mem_flush_tlb(rv_sim_t *sim);
+void mem_free(rv_sim_t *sim);
+void mem_drop_decoded(rv_sim_t *sim);
+// Function to get the host address of the aligned guest word at address for an RV32A access (see memory.c)
+rv_status_t mem_atomic_word(rv_sim_t *sim, uint32_t address, int write, uint32_t **host);
+
+// Function to load size bytes (little-endian) at address
+// One test covers the TLB lookup, accesses that cross into the next page (the tag is the last byte's page)
+// and misaligned accesses when they have to trap; all of those go to mem_load_slow. misaligned_mask is
+// sim->misaligned_mask, or the constant a threaded core variant was generated for.
+static ALWAYS_INLINE rv_status_t mem_load(rv_sim_t *sim, uint32_t address, int size, uint32_t *value,
+                                          uint32_t misaligned_mask) {
+    const tlb_entry_t *entry = &sim->tlb[(address >> PAGE_SHIFT) & (TLB_ENTRIES - 1)];
+
+    if ((((address + size - 1) & PAGE_MASK) ^ entry->read_tag) | (address & (size - 1) & misaligned_mask)) {
+        return mem_load_slow(sim, address, size, value);
+    }
+    *value = load_le((const uint8_t *)(entry->addend + address), size);
+    return RV_OK;
+}
+// Function to store the low size bytes of value at address
+static ALWAYS_INLINE rv_status_t mem_store(rv_sim_t *sim, uint32_t address, int size, uint32_t value,
+                                           uint32_t misaligned_mask) {
+    const tlb_entry_t *entry = &sim->tlb[(address >> PAGE_SHIFT) & (TLB_ENTRIES - 1)];
+
+    if ((((address + size - 1) & PAGE_MASK) ^ entry->write_tag) | (address & (size - 1) & misaligned_mask)) {
+        return mem_store_slow(sim, address, size, value);
+    }
+    store_le((uint8_t *)(entry->addend + address), size, value);
+    return RV_OK;
+}
+
+// ELF loading (elf.c)
+int elf_is_elf(const uint8_t *header, size_t size);
+rv_status_t elf_load(rv_sim_t *sim, const char *filename);
+void elf_release_image(rv_sim_t *sim);
+void elf_free(rv_sim_t *sim);
+void elf_sort_symbols(rv_sim_t *sim);
+
+// Decoding and the interpreter (RISC-V.c)
+void decode_instruction(uint32_t instruction, decoded_instr_t *d);
+rv_status_t rv_raise(rv_sim_t *sim, rv_status_t status, uint32_t address, const char *format, ...);
+const decoded_instr_t *fetch_decoded_slow(rv_sim_t *sim, uint32_t fetch_pc);
+// Function to get the decoded record for the instruction at fetch_pc, or NULL if its page isn't executable
+// The page of the last fetch is remembered in sim->itlb_tag, so straight-line code skips the page table walk.
+static ALWAYS_INLINE const decoded_instr_t *fetch_decoded(rv_sim_t *sim, uint32_t fetch_pc) {
+    if ((fetch_pc & (PAGE_MASK | 1)) == sim->itlb_tag) {
+        const decoded_instr_t *entry = &sim->itlb_decoded[(fetch_pc >> 1) & (DECODE_PAGE_ENTRIES - 1)];
+        if (entry->valid) {
+            return entry;
+        }
+    }
+    return fetch_decoded_slow(sim, fetch_pc);
+}
+rv_status_t fetch_fault(rv_sim_t *sim);
+void invalidate_decoded(rv_sim_t *sim, uint32_t address, int size);
+// Macro-op fusion (fusion.c): fetch_decoded_slow hands every record it caches to fuse_decoded, which turns
+// it into a fused pair when the instruction after it on the same page completes a known idiom
+void fuse_decoded(const page_t *page, uint32_t fetch_pc, decoded_instr_t *first);
+rv_status_t execute_decoded(rv_sim_t *sim, const decoded_instr_t *d);
+// CSR instructions and system calls read sim->instret, so every core adds the instructions it has run so
+// far before one
+rv_status_t execute_csr(rv_sim_t *sim, uint32_t funct3, uint32_t rd, uint32_t rs1, uint32_t csr);
+
+// RV32M arithmetic, shared by all cores. Division never traps: dividing by zero and INT32_MIN / -1 give
+// the results the spec defines, which plain host / and % would not.
+static inline int32_t rv_mulh(int32_t a, int32_t b) { return (int32_t)(((int64_t)a * b) >> 32); }
+static inline int32_t rv_mulhsu(int32_t a, int32_t b) { return (int32_t)(((int64_t)a * (int64_t)(uint32_t)b) >> 32); }
+static inline int32_t rv_mulhu(int32_t a, int32_t b) { return (int32_t)(((uint64_t)(uint32_t)a * (uint32_t)b) >> 32); }
+static inline int32_t rv_div(int32_t a, int32_t b) {
+    if (b == 0) return -1;
+    if (a == INT32_MIN && b == -1) return INT32_MIN;
+    return a / b;
+}
+static inline int32_t rv_divu(int32_t a, int32_t b) { return b == 0 ? -1 : (int32_t)((uint32_t)a / (uint32_t)b); }
+static inline int32_t rv_rem(int32_t a, int32_t b) {
+    if (b == 0) return a;
+    if (a == INT32_MIN && b == -1) return 0;
+    return a % b;
+}
+static inline int32_t rv_remu(int32_t a, int32_t b) { return b == 0 ? a : (int32_t)((uint32_t)a % (uint32_t)b); }
+
+// Function to tell whether an instruction ends a basic block (it may change control flow or stop the hart)
+static inline int insn_ends_block(const decoded_instr_t *d) {
+    switch (d->insn) {
+        case INSN_JAL: case INSN_JALR:
+        case INSN_BEQ: case INSN_BNE: case INSN_BLT: case INSN_BGE: case INSN_BLTU: case INSN_BGEU:
+        case INSN_SYSTEM: case INSN_ILLEGAL:
+            return 1;
+        default:
+            return 0;
+    }
+}
+rv_status_t run_threaded(rv_sim_t *sim, uint64_t budget, uint32_t stop_pc);
+
+// Statistics (stats.c). The instrumented variants of the interpreter cores call stats_retire after every
+// instruction that completes; next_pc tells taken branches from not taken ones.
+void stats_retire(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d, uint32_t next_pc);
+// Profiler (profile.c), called like stats_retire
+void profile_retire(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d, uint32_t next_pc);
+// Pipeline timing model (timing.c), called like stats_retire
+void timing_retire(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d, uint32_t next_pc);
+// Cache simulator (cache.c). cache_begin runs before every instruction to take the address of a load or
+// store, cache_retire after it completed, before timing_retire, which then asks cache_miss_cycles what the
+// instruction's fetch and data misses cost.
+void cache_begin(rv_sim_t *sim, const decoded_instr_t *d);
+void cache_retire(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d);
+void cache_miss_cycles(const rv_sim_t *sim, uint64_t *fetch, uint64_t *data);
+// System call emulation (syscall.c), only called while sim->syscalls is set. syscall_handle runs the ECALL
+// at sim->pc; run_core calls syscall_flush after every run to pass buffered guest writes to the host.
+rv_status_t syscall_handle(rv_sim_t *sim);
+void syscall_flush(rv_sim_t *sim);
+void syscall_reset(rv_sim_t *sim);
+// Multiple harts (smp.c). run_core hands the runs of a simulator with several harts to smp_run, which runs
+// every quantum of every hart through run_hart. memory.c calls smp_memory_changed when the host changes
+// memory behind the translated code of the other harts.
+rv_status_t run_hart(rv_sim_t *sim, uint64_t budget, uint32_t stop_pc);
+rv_status_t smp_run(rv_sim_t *sim, uint64_t budget, uint32_t stop_pc);
+void smp_reset(rv_sim_t *sim);
+void smp_memory_changed(rv_sim_t *sim);
+// smp_program_over tells whether every hart halted or one stopped the others, smp_instret returns the most
+// instructions any hart retired
+int smp_program_over(const rv_sim_t *sim);
+uint64_t smp_instret(const rv_sim_t *sim);
+// Watchdog (RISC-V.c). The cores that run outside run_core (rv_collect_bbv, rv_batch_run) call
+// watchdog_check before every slice of at most watchdog_left instructions; it starts the clock on the first
+// call after the watchdog was armed and halts the program with RV_HALT_WATCHDOG once a limit is used up.
+rv_status_t watchdog_check(rv_sim_t *sim);
+uint64_t watchdog_left(const rv_sim_t *sim);
+
+static inline int watchdog_armed(const rv_sim_t *sim) {
+    return sim->watchdog_insns || sim->watchdog_seconds > 0;
+}
+
+// Function to tell whether the cores have to run their instrumented variants (tracing, statistics,
+// profiling, timing or caches are on); translated code has no instrumentation, so the JIT hands those runs
+// to the threaded core
+static inline int sim_instrumented(const rv_sim_t *sim) {
+    return sim->trace || sim->stats || sim->profile || sim->timing || sim->cache;
+}
+
+// run_core brackets every run with stats_run_begin/stats_run_end to measure the host time for the MIPS figure
+void stats_run_begin(rv_sim_t *sim);
+void stats_run_end(rv_sim_t *sim);
+
+// Basic-block JIT (jit.c)
+rv_status_t run_jit(rv_sim_t *sim, uint64_t budget);
+void jit_invalidate(rv_sim_t *sim, uint32_t address, int size);
+void jit_destroy(rv_sim_t *sim);
+
+#endif
@@ -0,0 +1,500 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+
+// Batch mode: one program, many inputs, up to RV_BATCH_MAX_LANES instances (lanes) at a time.
+// Each lane is an rv_sim_t of its own for memory, traps and the host's state access, but while a batch runs
+// the registers of all lanes live here, as one row of lanes per register, and pcs and instruction counts
+// are kept per lane. A run picks the lowest pc any lane stands at and runs every lane at that pc as one
+// group through the SIMD core (batch_core.inc), so a lane that fell behind, e.g. on the short side of an
+// if/else or by leaving a loop early, is the next to run and catches up with the others at the pc where
+// their paths meet again. The group runs until its lanes take different sides of a branch or JALR.
+//
+// The instructions come from one more rv_sim_t, program, that holds the program as loaded and is never
+// run. That only works while every lane's code is the program's: whenever program decodes an instruction
+// for the first time, every lane decodes it too, and a lane that gets something else (or nothing) runs
+// alone on its own memory from then on (solo). Decoding it also gives the lane a decode cache on the page,
+// so a later store of the lane into the instruction drops the record and bumps lane->code_writes, as
+// does the host writing code or dropping decode caches, and the lane goes solo as well.
+//
+// Three builds of the core per lane count: AVX2 (8 lanes per instruction), SSE2 (4) and scalar (the
+// vector operations lowered to one lane at a time, by forbidding SSE in that function). rv_batch_create
+// takes the best the host has; on other hosts the core is built once for whatever the compiler targets.
+
+typedef int32_t lanes4_t __attribute__((vector_size(4 * sizeof(int32_t)), may_alias));
+typedef uint32_t ulanes4_t __attribute__((vector_size(4 * sizeof(uint32_t)), may_alias));
+typedef int32_t lanes8_t __attribute__((vector_size(8 * sizeof(int32_t)), may_alias));
+typedef uint32_t ulanes8_t __attribute__((vector_size(8 * sizeof(uint32_t)), may_alias));
+static const lanes4_t lane_index4 = { 0, 1, 2, 3 };
+static const lanes8_t lane_index8 = { 0, 1, 2, 3, 4, 5, 6, 7 };
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BATCH_X86 1
+#endif
+
+typedef uint64_t (*batch_core_t)(rv_batch_t *batch, uint32_t group, uint32_t pc, uint64_t limit, uint32_t stop_pc);
+
+struct rv_batch {
+    int32_t regs[NUM_REGISTERS][RV_BATCH_MAX_LANES] __attribute__((aligned(64))); // regs[r][lane]
+    uint32_t pc[RV_BATCH_MAX_LANES];
+    uint64_t code_writes[RV_BATCH_MAX_LANES]; // lanes[l]->code_writes while lane l's code is the program's
+    uint32_t solo;                         // lanes with code of their own, each runs alone
+    unsigned count;
+    rv_batch_isa_t isa;
+    batch_core_t core;
+    rv_sim_t *program;                     // the program as loaded, the lanes' instructions come from here
+    rv_sim_t *lanes[RV_BATCH_MAX_LANES];
+    uint64_t groups;                       // times the core ran
+    uint64_t steps;                        // instructions the core ran, each for a whole group
+    uint64_t lane_steps;                   // instructions the lanes completed
+};
+
+// Function to give the lanes in group the pc they go on at (taken_pc where taken, next_pc elsewhere) and
+// count instructions for them
+static void batch_split(rv_batch_t *batch, uint32_t group, const int32_t *taken, uint32_t taken_pc,
+                        uint32_t next_pc, uint64_t count) {
+    for (; group; group &= group - 1) {
+        unsigned l = __builtin_ctz(group);
+        batch->pc[l] = taken[l] ? taken_pc : next_pc;
+        batch->lanes[l]->instret += count;
+    }
+}
+
+static void batch_jump(rv_batch_t *batch, uint32_t group, const int32_t *target, uint64_t count) {
+    for (; group; group &= group - 1) {
+        unsigned l = __builtin_ctz(group);
+        batch->pc[l] = (uint32_t)target[l];
+        batch->lanes[l]->instret += count;
+    }
+}
+
+static void batch_settle(rv_batch_t *batch, uint32_t group, uint32_t pc, uint64_t count) {
+    for (; group; group &= group - 1) {
+        unsigned l = __builtin_ctz(group);
+        batch->pc[l] = pc;
+        batch->lanes[l]->instret += count;
+    }
+}
+
+// Function to take lane l out of the group it runs in: it stands at pc after count instructions of the
+// group, and runs alone on its own code from now on if solo is set
+static void batch_leave(rv_batch_t *batch, uint32_t *group, unsigned l, uint32_t pc, uint64_t count, int solo) {
+    *group &= ~(1u << l);
+    batch->pc[l] = pc;
+    batch->lanes[l]->instret += count;
+    if (solo) {
+        batch->solo |= 1u << l;
+    }
+}
+
+// Function to tell whether lane l has overwritten code it shares with the program
+static int batch_code_written(const rv_batch_t *batch, unsigned l) {
+    return !(batch->solo & (1u << l)) && batch->lanes[l]->code_writes != batch->code_writes[l];
+}
+
+// Function to run the instruction at pc for lane l through the switch core, on the lane's rv_sim_t, after
+// count instructions of its group. The lane stays in the group if the instruction completes and left its
+// code alone.
+static rv_status_t batch_fallback_lane(rv_batch_t *batch, uint32_t *group, unsigned l, const decoded_instr_t *d,
+                                       uint32_t pc, uint64_t count) {
+    rv_sim_t *lane = batch->lanes[l];
+
+    for (int r = 0; r < NUM_REGISTERS; r++) {
+        lane->registers_array[r] = batch->regs[r][l];
+    }
+    lane->pc = pc;
+    lane->instret += count; // what CSR instructions and system calls see
+    rv_status_t status = execute_decoded(lane, d);
+    lane->instret -= count;
+    for (int r = 1; r < NUM_REGISTERS; r++) {
+        batch->regs[r][l] = lane->registers_array[r];
+    }
+    if (status != RV_OK) {
+        batch_leave(batch, group, l, pc, count, 0);
+    } else if (batch_code_written(batch, l)) {
+        batch_leave(batch, group, l, lane->pc, count + 1, 1);
+    }
+    return status;
+}
+
+static void batch_fallback(rv_batch_t *batch, uint32_t *group, const decoded_instr_t *d, uint32_t pc, uint64_t count) {
+    for (uint32_t lanes = *group; lanes; lanes &= lanes - 1) {
+        batch_fallback_lane(batch, group, __builtin_ctz(lanes), d, pc, count);
+    }
+}
+
+// Function to load for every lane in the group from its address; the core sign-extends. A lane whose
+// access doesn't simply hit memory runs the load through the switch core, which raises its trap.
+static void batch_load(rv_batch_t *batch, uint32_t *group, const decoded_instr_t *d, uint32_t pc, uint64_t count,
+                       const int32_t *address, int32_t *value) {
+    int size = d->insn == INSN_LW ? 4 : d->insn == INSN_LH || d->insn == INSN_LHU ? 2 : 1;
+
+    for (uint32_t lanes = *group; lanes; lanes &= lanes - 1) {
+        unsigned l = __builtin_ctz(lanes);
+        rv_sim_t *lane = batch->lanes[l];
+        uint32_t loaded;
+        if (mem_load(lane, (uint32_t)address[l], size, &loaded, lane->misaligned_mask) == RV_OK) {
+            value[l] = (int32_t)loaded;
+        } else if (batch_fallback_lane(batch, group, l, d, pc, count) == RV_OK) {
+            value[l] = batch->regs[d->rd][l];
+        }
+    }
+}
+
+static void batch_store(rv_batch_t *batch, uint32_t *group, const decoded_instr_t *d, uint32_t pc, uint64_t count,
+                        const int32_t *address, const int32_t *value) {
+    int size = d->insn == INSN_SW ? 4 : d->insn == INSN_SH ? 2 : 1;
+
+    for (uint32_t lanes = *group; lanes; lanes &= lanes - 1) {
+        unsigned l = __builtin_ctz(lanes);
+        rv_sim_t *lane = batch->lanes[l];
+        if (mem_store(lane, (uint32_t)address[l], size, (uint32_t)value[l], lane->misaligned_mask) != RV_OK) {
+            batch_fallback_lane(batch, group, l, d, pc, count);
+        } else if (batch_code_written(batch, l)) {
+            batch_leave(batch, group, l, pc + d->length, count + 1, 1);
+        }
+    }
+}
+
+// Function to fetch the instruction at pc for the group after count instructions, when source's last
+// fetch was on another page or the instruction wasn't decoded yet. Returns NULL when the group is done.
+static const decoded_instr_t *batch_fetch(rv_batch_t *batch, rv_sim_t *source, uint32_t *group, uint32_t pc,
+                                          uint64_t count) {
+    rv_sim_t *program = batch->program;
+
+    if (source != program) { // a solo lane
+        const decoded_instr_t *d = fetch_decoded(source, pc);
+        if (!d) {
+            source->pc = pc;
+            fetch_fault(source);
+            batch_leave(batch, group, __builtin_ctz(*group), pc, count, 0);
+        }
+        return d;
+    }
+    page_t *page = mem_page(program, pc, 0);
+    int decoded = !(pc & 1) && page && page->decoded && page->decoded[(pc >> 1) & (DECODE_PAGE_ENTRIES - 1)].valid;
+    const decoded_instr_t *d = fetch_decoded_slow(program, pc);
+    if (decoded && d) {
+        return d;
+    }
+    // First time here: every lane decodes the instruction as well, see the top of the file
+    for (unsigned l = 0; l < batch->count; l++) {
+        if (batch->solo & (1u << l)) {
+            continue;
+        }
+        rv_sim_t *lane = batch->lanes[l];
+        const decoded_instr_t *own = fetch_decoded(lane, pc);
+        if (d && own && own->raw == d->raw && own->length == d->length) {
+            continue;
+        }
+        batch->solo |= 1u << l;
+        if (*group & (1u << l)) {
+            batch_leave(batch, group, l, pc, count, 1);
+            if (!own) {
+                lane->pc = pc;
+                fetch_fault(lane);
+            }
+        }
+    }
+    return *group ? d : NULL;
+}
+
+#if defined(BATCH_X86)
+#define BATCH_LANES 8
+#define BATCH_WIDTH 8
+#define BATCH_VEC lanes8_t
+#define BATCH_UVEC ulanes8_t
+#define BATCH_INDEX lane_index8
+#define BATCH_CORE_NAME run_batch8_avx2
+#define BATCH_TARGET __attribute__((target("avx2")))
+#include "batch_core.inc"
+#define BATCH_LANES 16
+#define BATCH_WIDTH 8
+#define BATCH_VEC lanes8_t
+#define BATCH_UVEC ulanes8_t
+#define BATCH_INDEX lane_index8
+#define BATCH_CORE_NAME run_batch16_avx2
+#define BATCH_TARGET __attribute__((target("avx2")))
+#include "batch_core.inc"
+#define BATCH_LANES 8
+#define BATCH_WIDTH 4
+#define BATCH_VEC lanes4_t
+#define BATCH_UVEC ulanes4_t
+#define BATCH_INDEX lane_index4
+#define BATCH_CORE_NAME run_batch8_sse2
+#define BATCH_TARGET
+#include "batch_core.inc"
+#define BATCH_LANES 16
+#define BATCH_WIDTH 4
+#define BATCH_VEC lanes4_t
+#define BATCH_UVEC ulanes4_t
+#define BATCH_INDEX lane_index4
+#define BATCH_CORE_NAME run_batch16_sse2
+#define BATCH_TARGET
+#include "batch_core.inc"
+#define BATCH_SCALAR_TARGET __attribute__((target("no-sse,no-sse2,no-mmx")))
+#else
+#define BATCH_SCALAR_TARGET
+#endif
+#define BATCH_LANES 8
+#define BATCH_WIDTH 4
+#define BATCH_VEC lanes4_t
+#define BATCH_UVEC ulanes4_t
+#define BATCH_INDEX lane_index4
+#define BATCH_CORE_NAME run_batch8_scalar
+#define BATCH_TARGET BATCH_SCALAR_TARGET
+#include "batch_core.inc"
+#define BATCH_LANES 16
+#define BATCH_WIDTH 4
+#define BATCH_VEC lanes4_t
+#define BATCH_UVEC ulanes4_t
+#define BATCH_INDEX lane_index4
+#define BATCH_CORE_NAME run_batch16_scalar
+#define BATCH_TARGET BATCH_SCALAR_TARGET
+#include "batch_core.inc"
+
+// Function to tell whether the host can run isa (never RV_BATCH_AUTO)
+static int batch_isa_supported(rv_batch_isa_t isa) {
+#if defined(BATCH_X86)
+    switch (isa) {
+        case RV_BATCH_SCALAR: return 1;
+        case RV_BATCH_SSE2:   return __builtin_cpu_supports("sse2");
+        case RV_BATCH_AVX2:   return __builtin_cpu_supports("avx2");
+        default:              return 0;
+    }
+#else
+    return isa == RV_BATCH_SCALAR;
+#endif
+}
+
+static const char *batch_isa_name(rv_batch_isa_t isa) {
+    switch (isa) {
+        case RV_BATCH_SCALAR: return "scalar";
+        case RV_BATCH_SSE2:   return "SSE2";
+        case RV_BATCH_AVX2:   return "AVX2";
+        default:              return "auto";
+    }
+}
+
+rv_batch_t *rv_batch_create(unsigned lanes) {
+    if (lanes == 0 || lanes > RV_BATCH_MAX_LANES) {
+        return NULL;
+    }
+    rv_batch_t *batch = aligned_alloc(64, sizeof(rv_batch_t));
+    if (!batch) {
+        return NULL;
+    }
+    memset(batch, 0, sizeof(*batch));
+    batch->count = lanes;
+    batch->program = rv_create();
+    for (unsigned l = 0; l < lanes; l++) {
+        batch->lanes[l] = rv_create();
+    }
+    for (unsigned l = 0; l < lanes; l++) {
+        if (!batch->program || !batch->lanes[l]) {
+            rv_batch_destroy(batch);
+            return NULL;
+        }
+        rv_set_fusion(batch->lanes[l], 0);
+    }
+    rv_set_fusion(batch->program, 0);
+    rv_batch_set_isa(batch, RV_BATCH_AUTO);
+    return batch;
+}
+
+void rv_batch_destroy(rv_batch_t *batch) {
+    if (!batch) {
+        return;
+    }
+    rv_destroy(batch->program);
+    for (unsigned l = 0; l < batch->count; l++) {
+        rv_destroy(batch->lanes[l]);
+    }
+    free(batch);
+}
+
+rv_status_t rv_batch_set_isa(rv_batch_t *batch, rv_batch_isa_t isa) {
+    static const batch_core_t cores[][2] = {
+#if defined(BATCH_X86)
+        [RV_BATCH_SSE2] = { run_batch8_sse2, run_batch16_sse2 },
+        [RV_BATCH_AVX2] = { run_batch8_avx2, run_batch16_avx2 },
+#endif
+        [RV_BATCH_SCALAR] = { run_batch8_scalar, run_batch16_scalar },
+    };
+
+    if (isa == RV_BATCH_AUTO) {
+        isa = batch_isa_supported(RV_BATCH_AVX2) ? RV_BATCH_AVX2 :
+              batch_isa_supported(RV_BATCH_SSE2) ? RV_BATCH_SSE2 : RV_BATCH_SCALAR;
+    }
+    if (!batch_isa_supported(isa)) {
+        return rv_raise(batch->lanes[0], RV_ERROR_ARGUMENT, 0, "This host can't run batch mode with %s", batch_isa_name(isa));
+    }
+    batch->isa = isa;
+    batch->core = cores[isa][batch->count > 8];
+    return RV_OK;
+}
+
+rv_batch_isa_t rv_batch_get_isa(const rv_batch_t *batch) {
+    return batch->isa;
+}
+
+unsigned rv_batch_get_lanes(const rv_batch_t *batch) {
+    return batch->count;
+}
+
+rv_sim_t *rv_batch_lane(const rv_batch_t *batch, unsigned lane) {
+    return lane < batch->count ? batch->lanes[lane] : NULL;
+}
+
+// Function to start the lanes on the program just loaded, all of them sharing its decoded code
+static void batch_loaded(rv_batch_t *batch) {
+    for (unsigned l = 0; l < batch->count; l++) {
+        batch->code_writes[l] = batch->lanes[l]->code_writes;
+    }
+    batch->solo = 0;
+}
+
+rv_status_t rv_batch_load(rv_batch_t *batch, const char *filename, size_t *loaded_bytes) {
+    rv_status_t status;
+
+    for (unsigned l = 0; l < batch->count; l++) {
+        rv_reset(batch->lanes[l]);
+        if ((status = rv_load_file(batch->lanes[l], filename, loaded_bytes)) != RV_OK) {
+            return status;
+        }
+    }
+    rv_reset(batch->program);
+    if ((status = rv_load_file(batch->program, filename, NULL)) != RV_OK) {
+        return rv_raise(batch->lanes[0], status, 0, "%s", batch->program->trap.message);
+    }
+    batch_loaded(batch);
+    return RV_OK;
+}
+
+rv_status_t rv_batch_load_buffer(rv_batch_t *batch, const void *data, size_t size, uint32_t address) {
+    rv_status_t status;
+
+    for (unsigned l = 0; l < batch->count; l++) {
+        rv_reset(batch->lanes[l]);
+        if ((status = rv_load_buffer(batch->lanes[l], data, size, address)) != RV_OK) {
+            return status;
+        }
+    }
+    rv_reset(batch->program);
+    if ((status = rv_load_buffer(batch->program, data, size, address)) != RV_OK) {
+        return rv_raise(batch->lanes[0], status, 0, "%s", batch->program->trap.message);
+    }
+    batch_loaded(batch);
+    return RV_OK;
+}
+
+unsigned rv_batch_run(rv_batch_t *batch, uint64_t max_count) {
+    uint64_t end[RV_BATCH_MAX_LANES];      // instret at which each lane's budget is used up
+    uint64_t stop[RV_BATCH_MAX_LANES];     // ... or its watchdog slice is
+    uint64_t start_instret = 0;
+    uint32_t active = 0;                   // lanes that can run
+    unsigned running = 0;
+
+    for (unsigned l = 0; l < batch->count; l++) {
+        rv_sim_t *lane = batch->lanes[l];
+        for (int r = 0; r < NUM_REGISTERS; r++) {
+            batch->regs[r][l] = r ? lane->registers_array[r] : 0;
+        }
+        batch->pc[l] = lane->pc;
+        end[l] = lane->instret + max_count < lane->instret ? UINT64_MAX : lane->instret + max_count;
+        start_instret += lane->instret;
+        if (batch_code_written(batch, l)) {
+            batch->solo |= 1u << l; // the host changed its code
+        }
+        if (lane->halted == RV_OK && max_count > 0) {
+            active |= 1u << l;
+        }
+    }
+
+    while (active) {
+        // lanes under the watchdog run a slice at a time and are checked in between, like run_watched
+        for (uint32_t lanes = active; lanes; lanes &= lanes - 1) {
+            unsigned l = __builtin_ctz(lanes);
+            rv_sim_t *lane = batch->lanes[l];
+            stop[l] = end[l];
+            if (watchdog_armed(lane)) {
+                lane->pc = batch->pc[l]; // for the watchdog message
+                if (watchdog_check(lane) != RV_OK) {
+                    active &= ~(1u << l);
+                    continue;
+                }
+                uint64_t left = watchdog_left(lane);
+                if (left < end[l] - lane->instret) {
+                    stop[l] = lane->instret + left;
+                }
+            }
+        }
+        uint32_t run = active;
+        while (run) {
+            // the lanes at the lowest pc, or the solo lane there alone, run until they get past the next lane
+            unsigned first = __builtin_ctz(run);
+            for (uint32_t lanes = run; lanes; lanes &= lanes - 1) {
+                unsigned l = __builtin_ctz(lanes);
+                if (batch->pc[l] < batch->pc[first]) {
+                    first = l;
+                }
+            }
+            uint32_t pc = batch->pc[first], group = 1u << first, stop_pc = UINT32_MAX;
+            uint64_t limit = stop[first] - batch->lanes[first]->instret;
+            for (uint32_t lanes = run & ~group; lanes; lanes &= lanes - 1) {
+                unsigned l = __builtin_ctz(lanes);
+                if (batch->pc[l] == pc && !(batch->solo & (group | 1u << l))) {
+                    group |= 1u << l;
+                    if (stop[l] - batch->lanes[l]->instret < limit) {
+                        limit = stop[l] - batch->lanes[l]->instret;
+                    }
+                } else if (batch->pc[l] > pc && batch->pc[l] < stop_pc) {
+                    stop_pc = batch->pc[l];
+                }
+            }
+            batch->steps += batch->core(batch, group, pc, limit, stop_pc);
+            batch->groups++;
+            for (uint32_t lanes = group; lanes; lanes &= lanes - 1) {
+                unsigned l = __builtin_ctz(lanes);
+                if (batch->lanes[l]->halted != RV_OK || batch->lanes[l]->instret >= stop[l]) {
+                    run &= ~(1u << l);
+                }
+            }
+        }
+        active = 0;
+        for (unsigned l = 0; l < batch->count; l++) {
+            if (batch->lanes[l]->halted == RV_OK && batch->lanes[l]->instret < end[l]) {
+                active |= 1u << l;
+            }
+        }
+    }
+
+    for (unsigned l = 0; l < batch->count; l++) {
+        rv_sim_t *lane = batch->lanes[l];
+        for (int r = 1; r < NUM_REGISTERS; r++) {
+            lane->registers_array[r] = batch->regs[r][l];
+        }
+        lane->pc = batch->pc[l];
+        batch->lane_steps += lane->instret;
+        if (lane->syscalls) {
+            syscall_flush(lane);
+        }
+        running += lane->halted == RV_OK;
+    }
+    batch->lane_steps -= start_instret;
+    return running;
+}
+
+void rv_print_batch(const rv_batch_t *batch) {
+    printf("\n--- Batch ---\n");
+    printf("%-16s %12s\n", "SIMD", batch_isa_name(batch->isa));
+    printf("%-16s %12u\n", "lanes", batch->count);
+    printf("%-16s %12llu\n", "instructions", (unsigned long long)batch->lane_steps);
+    printf("%-16s %12llu\n", "SIMD steps", (unsigned long long)batch->steps);
+    printf("%-16s %12llu\n", "groups", (unsigned long long)batch->groups);
+    printf("%-16s %12.2f\n", "lanes per step", batch->steps ? (double)batch->lane_steps / (double)batch->steps : 0.0);
+    printf("--------------------------\n");
+}
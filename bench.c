@@ -0,0 +1,529 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "riscv_sim.h"
+
+// Benchmark runner.
+// Runs every .bin under the given directories (default benchmarks) to its ECALL on each core, several
+// times, and reports guest instructions per second with a 95% confidence interval, host cycles per guest
+// instruction and peak RSS. Each benchmark/core pair runs in a child process of its own, so its peak RSS
+// isn't hidden by an earlier, bigger one and nothing (the JIT's code, memory pages) carries over. A run
+// only counts if the final registers match the .res file next to the binary.
+//
+// Runs are timed in process CPU time, which time slices given to other processes don't inflate. Host
+// cycles come from the CPU's cycle counter (perf_event_open) when the kernel allows it, otherwise they are
+// the CPU time at the rate of the time-stamp counter, which ticks at the nominal clock rate.
+//
+// --json writes the results, and --baseline compares with a file written that way: a pair is a regression
+// when it is more than --threshold percent slower and its confidence interval lies wholly below the
+// baseline's, so noise alone doesn't trip it. The exit status is nonzero on regressions and failures.
+
+#define NUM_REGISTERS 32
+#define MAX_RUNS 100
+#define MAX_BENCHMARKS 256
+
+typedef struct {
+    const char *name;
+    rv_core_t core;
+} core_option_t;
+
+static const core_option_t cores[] = {
+    { "switch", RV_CORE_SWITCH },
+    { "threaded", RV_CORE_THREADED },
+    { "jit", RV_CORE_JIT },
+};
+#define NUM_CORES (int)(sizeof(cores) / sizeof(cores[0]))
+
+// What a child reports back through its pipe
+typedef struct {
+    int ok;
+    char message[128];
+    int perf_cycles;                  // cycles are from the cycle counter, not the time-stamp counter
+    uint64_t instructions;
+    double seconds[MAX_RUNS];         // CPU time
+    double cycles[MAX_RUNS];
+} child_report_t;
+
+typedef struct {
+    char *path;
+    int core;
+    child_report_t report;
+    long peak_rss_kb;
+    double mips, mips_ci, cycles_per_insn;
+    int has_baseline;
+    double baseline_mips, baseline_ci;
+    int regression;
+    int changed;                      // different instruction count from the baseline
+} result_t;
+
+static char *paths[MAX_BENCHMARKS];
+static size_t num_paths;
+static int runs = 5, warmups = 1;
+static int pin_cpu = -1;
+static int fusion = 1;                 // 0 runs with macro-op fusion off (--no-fusion), for A/B comparisons
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Time-stamp counter, 0 where there is none
+static uint64_t timestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// Function to open a counter of the user-mode cycles of this process. Returns -1 if there is none.
+static int open_cycle_counter() {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_cycle_counter(int fd) {
+    uint64_t count = 0;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+    return count;
+}
+
+static int has_suffix(const char *name, const char *suffix) {
+    size_t length = strlen(name), suffix_length = strlen(suffix);
+    return length >= suffix_length && strcmp(name + length - suffix_length, suffix) == 0;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Function to collect the .bin files of a directory (not recursively), or a single .bin
+static void find_benchmarks(const char *path) {
+    DIR *dir = opendir(path);
+
+    if (!dir) {
+        if (has_suffix(path, ".bin") && num_paths < MAX_BENCHMARKS) {
+            paths[num_paths++] = strdup(path);
+        } else {
+            printf("Error: Cannot open '%s': %s\n", path, strerror(errno));
+        }
+        return;
+    }
+    for (struct dirent *entry; (entry = readdir(dir)) != NULL;) {
+        if (!has_suffix(entry->d_name, ".bin") || num_paths >= MAX_BENCHMARKS) {
+            continue;
+        }
+        size_t length = strlen(path) + strlen(entry->d_name) + 2;
+        paths[num_paths] = malloc(length);
+        snprintf(paths[num_paths++], length, "%s/%s", path, entry->d_name);
+    }
+    closedir(dir);
+}
+
+// Function to read the expected registers. Returns 0 if there is no .res file.
+static int read_expected(const char *path, int32_t expected[NUM_REGISTERS]) {
+    size_t length = strlen(path) + 1;
+    char *res_path = malloc(length);
+    int found = 0;
+
+    memcpy(res_path, path, length);
+    strcpy(res_path + length - 5, ".res");
+    FILE *file = fopen(res_path, "rb");
+    if (file) {
+        found = fread(expected, sizeof(int32_t), NUM_REGISTERS, file) == NUM_REGISTERS;
+        fclose(file);
+    }
+    free(res_path);
+    return found;
+}
+
+// Function to run one benchmark on one core in the child, warmups first
+static void run_child(const char *path, rv_core_t core, child_report_t *report) {
+    int32_t expected[NUM_REGISTERS];
+    int has_expected = read_expected(path, expected);
+    rv_sim_t *sim = rv_create();
+
+    memset(report, 0, sizeof(*report));
+    if (!sim) {
+        snprintf(report->message, sizeof(report->message), "Failed to allocate simulator memory");
+        return;
+    }
+    rv_set_core(sim, core);
+    rv_set_fusion(sim, fusion);
+    int counter = open_cycle_counter();
+    report->perf_cycles = counter >= 0;
+    for (int run = -warmups; run < runs; run++) {
+        rv_reset(sim);
+        if (rv_load_file(sim, path, NULL) != RV_OK) {
+            snprintf(report->message, sizeof(report->message), "%s", rv_get_trap(sim)->message);
+            return;
+        }
+        double start_wall = now_seconds(), start = cpu_seconds();
+        uint64_t start_stamp = timestamp(), start_cycles = counter >= 0 ? read_cycle_counter(counter) : 0;
+        rv_status_t status = rv_run(sim);
+        uint64_t cycles = counter >= 0 ? read_cycle_counter(counter) - start_cycles : 0;
+        uint64_t stamps = timestamp() - start_stamp;
+        double seconds = cpu_seconds() - start, wall_seconds = now_seconds() - start_wall;
+
+        if (status != RV_HALT_ECALL) {
+            snprintf(report->message, sizeof(report->message), "No ECALL: %.100s", rv_get_trap(sim)->message);
+            return;
+        }
+        for (int r = 0; has_expected && r < NUM_REGISTERS; r++) {
+            if (rv_get_reg(sim, r) != expected[r]) {
+                snprintf(report->message, sizeof(report->message), "x%d = %d, expected %d", r, rv_get_reg(sim, r), expected[r]);
+                return;
+            }
+        }
+        if (run >= 0) {
+            report->seconds[run] = seconds;
+            report->cycles[run] = counter >= 0 ? (double)cycles : wall_seconds > 0 ? stamps / wall_seconds * seconds : 0;
+        }
+        report->instructions = rv_get_instret(sim);
+    }
+    report->ok = 1;
+    if (counter >= 0) {
+        close(counter);
+    }
+    rv_destroy(sim);
+}
+
+// Function to run one benchmark/core pair in a child process and collect its report and peak RSS
+static void run_benchmark(result_t *result) {
+    int fds[2];
+    struct rusage usage;
+    int status;
+
+    memset(&result->report, 0, sizeof(result->report));
+    if (pipe(fds) != 0) {
+        snprintf(result->report.message, sizeof(result->report.message), "pipe: %s", strerror(errno));
+        return;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        snprintf(result->report.message, sizeof(result->report.message), "fork: %s", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return;
+    }
+    if (pid == 0) {
+        child_report_t *report = calloc(1, sizeof(child_report_t));
+        close(fds[0]);
+        if (pin_cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(pin_cpu, &set);
+            sched_setaffinity(0, sizeof(set), &set);
+        }
+        run_child(result->path, cores[result->core].core, report);
+        size_t written = 0;
+        while (written < sizeof(*report)) {
+            ssize_t n = write(fds[1], (char *)report + written, sizeof(*report) - written);
+            if (n <= 0) {
+                _exit(EXIT_FAILURE);
+            }
+            written += (size_t)n;
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    close(fds[1]);
+    size_t got = 0;
+    while (got < sizeof(result->report)) {
+        ssize_t n = read(fds[0], (char *)&result->report + got, sizeof(result->report) - got);
+        if (n <= 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    close(fds[0]);
+    if (wait4(pid, &status, 0, &usage) == pid) {
+        result->peak_rss_kb = usage.ru_maxrss;
+    }
+    if (got < sizeof(result->report)) {
+        memset(&result->report, 0, sizeof(result->report));
+        snprintf(result->report.message, sizeof(result->report.message), "Benchmark process died (status 0x%X)", status);
+    }
+}
+
+// Two-sided 95% quantile of Student's t distribution with df degrees of freedom
+static double t_quantile(int df) {
+    static const double table[] = {
+        0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    if (df < (int)(sizeof(table) / sizeof(table[0]))) {
+        return table[df];
+    }
+    return df < 60 ? 2.000 : df < 120 ? 1.980 : 1.960;
+}
+
+static void summarize(result_t *result) {
+    const child_report_t *report = &result->report;
+    double sum = 0, squares = 0, cycles = 0;
+
+    for (int i = 0; i < runs; i++) {
+        double mips = report->instructions / report->seconds[i] / 1e6;
+        sum += mips;
+        squares += mips * mips;
+        cycles += report->cycles[i];
+    }
+    result->mips = sum / runs;
+    double variance = runs > 1 ? (squares - sum * sum / runs) / (runs - 1) : 0;
+    result->mips_ci = runs > 1 ? t_quantile(runs - 1) * sqrt(variance > 0 ? variance : 0) / sqrt(runs) : 0;
+    result->cycles_per_insn = report->instructions ? cycles / runs / report->instructions : 0;
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+static int json_number(const char *line, const char *key, double *value) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+    const char *at = strstr(line, pattern);
+    return at && sscanf(at + strlen(pattern), "%lf", value) == 1;
+}
+
+static int json_string(const char *line, const char *key, char *value, size_t size) {
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": \"", key);
+    const char *at = strstr(line, pattern);
+    if (!at) {
+        return 0;
+    }
+    at += strlen(pattern);
+    const char *end = strchr(at, '"');
+    if (!end || (size_t)(end - at) >= size) {
+        return 0;
+    }
+    memcpy(value, at, (size_t)(end - at));
+    value[end - at] = '\0';
+    return 1;
+}
+
+// Function to look the results up in a file written by --json (one result per line), by benchmark file
+// name and core. Returns 0 if the file can't be read.
+static int read_baseline(const char *filename, result_t *results, size_t num_results, double threshold) {
+    FILE *file = fopen(filename, "r");
+    char line[1024], name[256], core[32];
+
+    if (!file) {
+        printf("Error: Cannot open baseline '%s': %s\n", filename, strerror(errno));
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        double mips, ci, instructions;
+        if (!json_string(line, "benchmark", name, sizeof(name)) || !json_string(line, "core", core, sizeof(core)) ||
+            !json_number(line, "mips", &mips) || !json_number(line, "mips_ci95", &ci) ||
+            !json_number(line, "instructions", &instructions)) {
+            continue;
+        }
+        for (size_t i = 0; i < num_results; i++) {
+            result_t *result = &results[i];
+            if (!result->report.ok || strcmp(base_name(result->path), name) != 0 || strcmp(cores[result->core].name, core) != 0) {
+                continue;
+            }
+            result->has_baseline = 1;
+            result->baseline_mips = mips;
+            result->baseline_ci = ci;
+            result->changed = (uint64_t)instructions != result->report.instructions;
+            result->regression = !result->changed && result->mips < mips * (1 - threshold / 100) &&
+                                 result->mips + result->mips_ci < mips - ci;
+        }
+    }
+    fclose(file);
+    return 1;
+}
+
+// Function to write the results, one per line so --baseline can read them back
+static int write_json(const char *filename, const result_t *results, size_t num_results) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        perror("Failed to open JSON file");
+        return 0;
+    }
+    fprintf(file, "{\n  \"runs\": %d,\n  \"warmups\": %d,\n  \"results\": [\n", runs, warmups);
+    for (size_t i = 0; i < num_results; i++) {
+        const result_t *result = &results[i];
+        fprintf(file, "    {\"benchmark\": \"%s\", \"core\": \"%s\", \"ok\": %s", base_name(result->path),
+                cores[result->core].name, result->report.ok ? "true" : "false");
+        if (result->report.ok) {
+            fprintf(file, ", \"instructions\": %llu, \"mips\": %.3f, \"mips_ci95\": %.3f, \"cycles_per_instruction\": %.3f, "
+                    "\"cycle_source\": \"%s\", \"peak_rss_kb\": %ld, \"cpu_seconds\": [", (unsigned long long)result->report.instructions,
+                    result->mips, result->mips_ci, result->cycles_per_insn, result->report.perf_cycles ? "perf" : "tsc",
+                    result->peak_rss_kb);
+            for (int r = 0; r < runs; r++) {
+                fprintf(file, "%s%.6f", r ? ", " : "", result->report.seconds[r]);
+            }
+            fprintf(file, "]");
+        }
+        fprintf(file, "}%s\n", i + 1 < num_results ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return 1;
+}
+
+//          Main function
+int main(int argc, char *argv[]) {
+    const char *json_file = NULL, *baseline_file = NULL;
+    int use_core[NUM_CORES] = { 1, 1, 1 };
+    double threshold = 5;
+    int usage_error = 0;
+    int num_dirs = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--core=", 7) == 0) {
+            int found = 0;
+            memset(use_core, 0, sizeof(use_core));
+            for (int c = 0; c < NUM_CORES; c++) {
+                if (strcmp(argv[i] + 7, cores[c].name) == 0 || strcmp(argv[i] + 7, "all") == 0) {
+                    use_core[c] = found = 1;
+                }
+            }
+            usage_error |= !found;
+        } else if (strncmp(argv[i], "--runs=", 7) == 0) {
+            runs = atoi(argv[i] + 7);
+            usage_error |= runs < 1 || runs > MAX_RUNS;
+        } else if (strncmp(argv[i], "--warmups=", 10) == 0) {
+            warmups = atoi(argv[i] + 10);
+            usage_error |= warmups < 0;
+        } else if (strncmp(argv[i], "--cpu=", 6) == 0) {
+            pin_cpu = atoi(argv[i] + 6);
+            usage_error |= pin_cpu < 0;
+        } else if (strcmp(argv[i], "--no-fusion") == 0) {
+            fusion = 0;
+        } else if (strncmp(argv[i], "--json=", 7) == 0) {
+            json_file = argv[i] + 7;
+        } else if (strncmp(argv[i], "--baseline=", 11) == 0) {
+            baseline_file = argv[i] + 11;
+        } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            threshold = atof(argv[i] + 12);
+            usage_error |= threshold < 0;
+        } else if (argv[i][0] != '-') {
+            num_dirs++;
+        } else {
+            usage_error = 1;
+        }
+    }
+    if (usage_error) {
+        printf("Usage: %s [--core=switch|threaded|jit|all] [--runs=<n>] [--warmups=<n>] [--cpu=<n>] [--no-fusion] [--json=<file>]\n"
+               "       [--baseline=<file> [--threshold=<percent>]] [<dir or .bin> ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (num_dirs == 0) {
+        find_benchmarks("benchmarks");
+    }
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            find_benchmarks(argv[i]);
+        }
+    }
+    if (num_paths == 0) {
+        printf("No .bin files found.\n");
+        return EXIT_FAILURE;
+    }
+    qsort(paths, num_paths, sizeof(char *), compare_paths);
+
+    result_t *results = calloc(num_paths * NUM_CORES, sizeof(result_t));
+    size_t num_results = 0;
+    if (!results) {
+        printf("Failed to allocate results\n");
+        return EXIT_FAILURE;
+    }
+    for (size_t p = 0; p < num_paths; p++) {
+        for (int c = 0; c < NUM_CORES; c++) {
+            if (use_core[c]) {
+                results[num_results].path = paths[p];
+                results[num_results++].core = c;
+            }
+        }
+    }
+
+    double start = now_seconds();
+    for (size_t i = 0; i < num_results; i++) {
+        run_benchmark(&results[i]);
+        if (results[i].report.ok) {
+            summarize(&results[i]);
+        }
+    }
+    double wall_seconds = now_seconds() - start;
+    if (baseline_file && !read_baseline(baseline_file, results, num_results, threshold)) {
+        return EXIT_FAILURE;
+    }
+
+    int failures = 0, regressions = 0;
+    printf("%-16s %-9s %12s %20s %12s %10s%s\n", "benchmark", "core", "instructions", "MIPS (95% CI)", "cycles/insn",
+           "peak RSS", baseline_file ? "   vs baseline" : "");
+    for (size_t i = 0; i < num_results; i++) {
+        const result_t *result = &results[i];
+        printf("%-16s %-9s ", base_name(result->path), cores[result->core].name);
+        if (!result->report.ok) {
+            printf("FAIL: %s\n", result->report.message);
+            failures++;
+            continue;
+        }
+        printf("%12llu %11.1f +- %-6.1f %12.2f %7.1f MiB", (unsigned long long)result->report.instructions, result->mips,
+               result->mips_ci, result->cycles_per_insn, result->peak_rss_kb / 1024.0);
+        if (result->changed) {
+            printf("   instruction count changed, baseline is stale");
+            failures++;
+        } else if (result->has_baseline) {
+            printf("   %+6.1f%%%s", (result->mips / result->baseline_mips - 1) * 100, result->regression ? "  REGRESSION" : "");
+            regressions += result->regression;
+        } else if (baseline_file) {
+            printf("   not in baseline");
+        }
+        printf("\n");
+    }
+    printf("%zu benchmarks x %d runs in %.1f s, %d failed", num_results, runs, wall_seconds, failures);
+    if (baseline_file) {
+        printf(", %d slower than the baseline by more than %.1f%%", regressions, threshold);
+    }
+    printf("\n");
+
+    if (json_file && !write_json(json_file, results, num_results)) {
+        return EXIT_FAILURE;
+    }
+    for (size_t p = 0; p < num_paths; p++) {
+        free(paths[p]);
+    }
+    free(results);
+    return failures || regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+	.text
+	# Byte loops: memcpy of a 65535-byte NUL-terminated string from 0x100000 to 0x200000, then strlen of the
+	# copy, 80 times
+	# a0 = sum of the lengths, a1 = last byte copied before the NUL
+	li s0, 0x100000
+	li s1, 0x200000
+	li s2, 65535
+	li t0, 0
+fill:
+	add t1, s0, t0
+	andi t2, t0, 0x7F
+	addi t2, t2, 1		# 1-128, never NUL
+	sb t2, 0(t1)
+	addi t0, t0, 1
+	bne t0, s2, fill
+	add t1, s0, s2
+	sb zero, 0(t1)
+	li s3, 80
+	li a0, 0
+repeat:
+	mv t0, s0
+	mv t1, s1
+memcpy:
+	lbu t2, 0(t0)
+	sb t2, 0(t1)
+	addi t0, t0, 1
+	addi t1, t1, 1
+	bnez t2, memcpy
+	mv t0, s1
+strlen:
+	lbu t2, 0(t0)
+	addi t0, t0, 1
+	bnez t2, strlen
+	sub t0, t0, s1
+	addi t0, t0, -1
+	add a0, a0, t0
+	addi s3, s3, -1
+	bnez s3, repeat
+	add t1, s1, s2
+	lbu a1, -1(t1)
+	ecall
@@ -0,0 +1,68 @@
+	.text
+	# Adler-style checksum over a table of 512 words, written the way a compiler emits it: the modulus is
+	# a global read through auipc+lw, the 16-bit halves are zero-extended with slli+srli, and the modulo
+	# reductions and the loop bound are compare-and-branch pairs. 4 000 passes over the table.
+	# a0, a1 = the two sums, a2 = last xorshift state
+	lui s4, 0x2
+	addi s4, s4, 0x40	# table at 0x2040
+	lui s5, 0x1
+	addi s5, s5, -2048	# 2048 bytes
+	lui a2, 0x92D6A
+	addi a2, a2, 0x5A2	# xorshift32 seed
+	li t0, 0
+fill:
+	slli t1, a2, 13
+	xor a2, a2, t1
+	srli t1, a2, 17
+	xor a2, a2, t1
+	slli t1, a2, 5
+	xor a2, a2, t1
+	add t1, s4, t0
+	sw a2, 0(t1)
+	addi t0, t0, 4
+	slt t6, t0, s5
+	bnez t6, fill
+	lui s0, 0x1
+	addi s0, s0, -96	# 4000 passes
+	li a0, 1
+	li a1, 0
+pass:
+	li t0, 0
+word:
+	add t1, s4, t0
+	lw t2, 0(t1)
+	slli t3, t2, 16
+	srli t3, t3, 16		# low half
+	srli t4, t2, 16		# high half
+P1:
+	auipc a5, hi(modulus-P1)
+	lw a5, lo(modulus-P1)(a5)
+	add a0, a0, t3
+	sltu t5, a0, a5
+	bnez t5, reduced0
+	sub a0, a0, a5
+reduced0:
+	add a1, a1, a0
+	sltu t5, a1, a5
+	bnez t5, reduced1
+	sub a1, a1, a5
+reduced1:
+	add a0, a0, t4
+	sltu t5, a0, a5
+	bnez t5, reduced2
+	sub a0, a0, a5
+reduced2:
+	add a1, a1, a0
+	sltu t5, a1, a5
+	bnez t5, reduced3
+	sub a1, a1, a5
+reduced3:
+	addi t0, t0, 4
+	slt t6, t0, s5
+	bnez t6, word
+	addi s0, s0, -1
+	bnez s0, pass
+	ecall
+	.align
+modulus:
+	.word 65521
@@ -0,0 +1,34 @@
+	.text
+	# Branch-heavy code: Collatz sequence lengths of 1-60000, with data-dependent branches on every step
+	# a0 = total steps, a1 = longest sequence, a2 = its start
+	li s0, 1
+	li s1, 60001
+	li a0, 0
+	li a1, 0
+	li a2, 0
+next:
+	mv t0, s0
+	li t1, 0
+	li t3, 1
+step:
+	beq t0, t3, finished
+	andi t2, t0, 1
+	bnez t2, odd
+	srli t0, t0, 1
+	addi t1, t1, 1
+	j step
+odd:
+	slli t2, t0, 1
+	add t0, t0, t2
+	addi t0, t0, 1		# 3n + 1
+	addi t1, t1, 1
+	j step
+finished:
+	add a0, a0, t1
+	bge a1, t1, shorter
+	mv a1, t1
+	mv a2, s0
+shorter:
+	addi s0, s0, 1
+	bne s0, s1, next
+	ecall
@@ -0,0 +1,30 @@
+	.text
+	# Integer-heavy loop: xorshift32, a multiplicative hash and a few accumulators, 3 000 000 iterations
+	# a0 = final xorshift state, a1-a4 = accumulators
+	li s1, 3000000
+	li s2, 0x9E3779B1
+	li s3, 0x0F0F0F0F
+	li a0, 2463534242
+	li a1, 0
+	li a2, 0
+	li a3, 0
+	li a4, 0
+loop:
+	slli t0, a0, 13
+	xor a0, a0, t0
+	srli t0, a0, 17
+	xor a0, a0, t0
+	slli t0, a0, 5
+	xor a0, a0, t0
+	mul t1, a0, s2
+	srli t2, t1, 16
+	xor t1, t1, t2
+	add a1, a1, t1
+	sub a2, a2, a0
+	and t3, a0, s3
+	or a3, a3, t3
+	sltu t4, a1, t1
+	add a4, a4, t4
+	addi s1, s1, -1
+	bnez s1, loop
+	ecall
@@ -0,0 +1,31 @@
+	.text
+	# Pointer chasing: a 65536-node linked list, one node per 64 bytes (4 MiB) from 0x100000, linked in
+	# the order of the full-period sequence i -> (1781 * i + 967) mod 65536, then followed for 8 000 000 steps
+	# a0 = sum of the node values visited, a1 = final node
+	li s0, 0x100000
+	li s1, 65536
+	li s2, 1781
+	li s3, 0xFFFF
+	li t0, 0		# i
+build:
+	slli t1, t0, 6
+	add t1, t1, s0		# node i
+	mul t2, t0, s2
+	addi t2, t2, 967
+	and t2, t2, s3
+	slli t2, t2, 6
+	add t2, t2, s0		# node (1781 * i + 967) mod 65536
+	sw t2, 0(t1)		# next
+	sw t0, 4(t1)		# value
+	addi t0, t0, 1
+	bne t0, s1, build
+	li s4, 8000000
+	mv a1, s0
+	li a0, 0
+chase:
+	lw t0, 4(a1)
+	add a0, a0, t0
+	lw a1, 0(a1)
+	addi s4, s4, -1
+	bnez s4, chase
+	ecall
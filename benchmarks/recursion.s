@@ -0,0 +1,41 @@
+	.text
+	# Deep recursion with full stack frames, as gcc -O0 compiles tests/task3/recursive.c: fib(29) the slow way
+	# a0 = fib(29) = 514229
+	li sp, 0x100000
+	jal main
+	ecall
+fib:
+	addi sp, sp, -32
+	sw ra, 28(sp)
+	sw s0, 24(sp)
+	sw s1, 20(sp)
+	addi s0, sp, 32
+	sw a0, -20(s0)
+	lw a5, -20(s0)
+	li a4, 1
+	bgt a5, a4, recurse
+	lw a0, -20(s0)
+	j done
+recurse:
+	lw a5, -20(s0)
+	addi a0, a5, -1
+	call fib
+	mv s1, a0
+	lw a5, -20(s0)
+	addi a0, a5, -2
+	call fib
+	add a0, s1, a0
+done:
+	lw ra, 28(sp)
+	lw s0, 24(sp)
+	lw s1, 20(sp)
+	addi sp, sp, 32
+	ret
+main:
+	addi sp, sp, -16
+	sw ra, 12(sp)
+	li a0, 29
+	call fib
+	lw ra, 12(sp)
+	addi sp, sp, 16
+	ret
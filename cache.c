@@ -0,0 +1,621 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+
+// L1 cache simulator.
+// While caches are on, the instrumented core variants hand every completed instruction to cache_retire:
+// its fetch goes to the instruction cache, and a load or store to the data cache with the address
+// cache_begin took before the instruction could overwrite its base register. Only the tags are modelled,
+// the data always comes from memory. An access that spans two lines accesses both.
+//
+// Misses are classified the usual way: compulsory if the line was never accessed before, capacity if a
+// fully associative LRU cache of the same size (the shadow below) would have missed too, conflict
+// otherwise. The shadow follows the same write-allocate policy as the cache.
+//
+// Most accesses hit one of the two lines the cache accessed last (fetches walk through a line or a loop
+// spanning two, loops walk through arrays). Those two stay cached until the next miss, and as long as only
+// they are accessed, the replacement state (LRU, PLRU and the shadow) only depends on which of them came
+// last. So such an access just swaps them, and the next access to another line first touches the older of
+// the two, then the newer one, which leaves the replacement state exactly as if every access had updated it.
+#define CACHE_MAX_WAYS 32
+#define CACHE_TOP_PCS 10
+#define SEEN_CHUNK_SHIFT 20           // the bitmap of lines seen is allocated per MiB of address space
+#define NO_LINE UINT32_MAX            // tag of an empty way; line numbers are below 2^30
+
+typedef struct {
+    uint32_t pc;
+    uint64_t count;                   // 0 marks an empty slot
+} pc_count_t;
+
+// Fully associative LRU cache of line numbers: a list in recency order, found through a hash table
+typedef struct {
+    uint32_t capacity;                // lines
+    uint32_t count;
+    uint32_t *lines;                  // per node
+    uint32_t *prev, *next;            // per node, NO_LINE ends the list
+    uint32_t head, tail;              // most and least recently used node
+    uint32_t *table;                  // open addressing on line, node index + 1, 0 when empty
+    uint32_t table_mask;
+} shadow_t;
+
+typedef struct {
+    rv_cache_config_t config;
+    const char *name;
+    uint32_t line_shift;
+    uint32_t set_mask;
+    uint32_t ways;
+    uint32_t *tags;                   // sets * ways line numbers, NO_LINE when empty
+    uint8_t *dirty;
+    uint64_t *stamps;                 // LRU: when the way was last used
+    uint32_t *plru;                   // PLRU: tree bits per set, node n has children 2n and 2n + 1
+    uint64_t clock;
+    uint64_t random_state;
+    uint32_t recent[2];               // lines accessed last, the newest first, NO_LINE if unknown
+    uint32_t recent_way[2];           // their index in tags
+    shadow_t shadow;
+    uint8_t *seen[1u << (32 - SEEN_CHUNK_SHIFT)];
+    pc_count_t *miss_pcs;             // open addressing on pc
+    size_t miss_pc_capacity;          // power of two
+    size_t num_miss_pcs;
+    int out_of_memory;
+    uint64_t reads, writes;
+    uint64_t read_misses, write_misses;
+    uint64_t compulsory, capacity, conflict;
+    uint64_t writebacks;              // dirty lines evicted
+    uint64_t memory_writes;           // stores passed on to memory by write-through or no-write-allocate
+    uint64_t miss_cycles;             // miss penalty of the instruction being retired, for the timing model
+} cache_t;
+
+struct cache_state {
+    cache_t *icache;                  // either may be NULL
+    cache_t *dcache;
+    uint32_t mem_address;             // address of the pending load or store
+};
+
+static const char *const replacement_names[] = { "LRU", "PLRU", "random" };
+
+static int is_power_of_two(uint32_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+static uint32_t log2_of(uint32_t value) {
+    uint32_t shift = 0;
+    while ((1u << shift) < value) {
+        shift++;
+    }
+    return shift;
+}
+
+static size_t hash_pc(uint32_t pc) {
+    return (size_t)((pc >> 1) * 2654435761u);
+}
+
+static uint32_t hash_line(const shadow_t *shadow, uint32_t line) {
+    return (line * 2654435761u) & shadow->table_mask;
+}
+
+static int shadow_init(shadow_t *shadow, uint32_t capacity) {
+    uint32_t table_size = 1;
+    while (table_size < capacity * 2) {
+        table_size <<= 1;
+    }
+    shadow->capacity = capacity;
+    shadow->lines = malloc(capacity * sizeof(uint32_t));
+    shadow->prev = malloc(capacity * sizeof(uint32_t));
+    shadow->next = malloc(capacity * sizeof(uint32_t));
+    shadow->table = calloc(table_size, sizeof(uint32_t));
+    shadow->table_mask = table_size - 1;
+    shadow->head = shadow->tail = NO_LINE;
+    return shadow->lines && shadow->prev && shadow->next && shadow->table;
+}
+
+static void shadow_free(shadow_t *shadow) {
+    free(shadow->lines);
+    free(shadow->prev);
+    free(shadow->next);
+    free(shadow->table);
+}
+
+static void shadow_unlink(shadow_t *shadow, uint32_t node) {
+    uint32_t prev = shadow->prev[node], next = shadow->next[node];
+    if (prev != NO_LINE) shadow->next[prev] = next; else shadow->head = next;
+    if (next != NO_LINE) shadow->prev[next] = prev; else shadow->tail = prev;
+}
+
+static void shadow_push_front(shadow_t *shadow, uint32_t node) {
+    shadow->prev[node] = NO_LINE;
+    shadow->next[node] = shadow->head;
+    if (shadow->head != NO_LINE) shadow->prev[shadow->head] = node; else shadow->tail = node;
+    shadow->head = node;
+}
+
+// Function to remove the line in slot s of the hash table, moving later entries of its probe run back
+static void shadow_remove_slot(shadow_t *shadow, uint32_t s) {
+    for (uint32_t next = (s + 1) & shadow->table_mask; shadow->table[next]; next = (next + 1) & shadow->table_mask) {
+        uint32_t home = hash_line(shadow, shadow->lines[shadow->table[next] - 1]);
+        // the entry may fill the hole unless its home slot lies cyclically in (s, next]
+        if (((next - home) & shadow->table_mask) >= ((next - s) & shadow->table_mask)) {
+            shadow->table[s] = shadow->table[next];
+            s = next;
+        }
+    }
+    shadow->table[s] = 0;
+}
+
+// Function to access line in the shadow cache. Returns 1 on a hit; a miss inserts the line if allocate.
+static int shadow_access(shadow_t *shadow, uint32_t line, int allocate) {
+    uint32_t s = hash_line(shadow, line);
+    for (; shadow->table[s]; s = (s + 1) & shadow->table_mask) {
+        uint32_t node = shadow->table[s] - 1;
+        if (shadow->lines[node] == line) {
+            if (shadow->head != node) {
+                shadow_unlink(shadow, node);
+                shadow_push_front(shadow, node);
+            }
+            return 1;
+        }
+    }
+    if (!allocate) {
+        return 0;
+    }
+    uint32_t node;
+    if (shadow->count < shadow->capacity) {
+        node = shadow->count++;
+    } else {
+        node = shadow->tail;
+        uint32_t victim = hash_line(shadow, shadow->lines[node]);
+        while (shadow->table[victim] != node + 1) {
+            victim = (victim + 1) & shadow->table_mask;
+        }
+        shadow_remove_slot(shadow, victim);
+        shadow_unlink(shadow, node);
+        s = hash_line(shadow, line); // the removal may have moved the end of the probe run
+        while (shadow->table[s]) {
+            s = (s + 1) & shadow->table_mask;
+        }
+    }
+    shadow->lines[node] = line;
+    shadow->table[s] = node + 1;
+    shadow_push_front(shadow, node);
+    return 0;
+}
+
+// Function to mark line as seen. Returns 1 if it was seen before.
+static int mark_seen(cache_t *cache, uint32_t line) {
+    uint32_t address = line << cache->line_shift;
+    uint32_t chunk = address >> SEEN_CHUNK_SHIFT;
+    uint32_t bit = (address & ((1u << SEEN_CHUNK_SHIFT) - 1)) >> cache->line_shift;
+
+    if (!cache->seen[chunk]) {
+        cache->seen[chunk] = calloc(((1u << SEEN_CHUNK_SHIFT) >> cache->line_shift) / 8 + 1, 1);
+        if (!cache->seen[chunk]) {
+            cache->out_of_memory = 1;
+            return 0;
+        }
+    }
+    int seen = (cache->seen[chunk][bit >> 3] >> (bit & 7)) & 1;
+    cache->seen[chunk][bit >> 3] |= (uint8_t)(1u << (bit & 7));
+    return seen;
+}
+
+static void free_cache(cache_t *cache) {
+    if (!cache) {
+        return;
+    }
+    free(cache->tags);
+    free(cache->dirty);
+    free(cache->stamps);
+    free(cache->plru);
+    shadow_free(&cache->shadow);
+    for (size_t i = 0; i < sizeof(cache->seen) / sizeof(cache->seen[0]); i++) {
+        free(cache->seen[i]);
+    }
+    free(cache->miss_pcs);
+    free(cache);
+}
+
+// Function to check a configuration, returning what is wrong with it or NULL
+static const char *check_config(const rv_cache_config_t *config) {
+    if (!is_power_of_two(config->size) || !is_power_of_two(config->line_size) || !is_power_of_two(config->ways)) {
+        return "size, line size and associativity must be powers of two";
+    }
+    if (config->line_size < 4 || config->line_size > 4096) {
+        return "lines must be 4 to 4096 bytes";
+    }
+    if (config->ways > CACHE_MAX_WAYS) {
+        return "at most 32 ways";
+    }
+    if ((uint64_t)config->line_size * config->ways > config->size) {
+        return "the size must hold at least one set";
+    }
+    if ((unsigned)config->replacement > RV_REPLACE_RANDOM) {
+        return "unknown replacement policy";
+    }
+    return NULL;
+}
+
+static cache_t *new_cache(const rv_cache_config_t *config, const char *name) {
+    cache_t *cache = calloc(1, sizeof(cache_t));
+    if (!cache) {
+        return NULL;
+    }
+    uint32_t lines = config->size / config->line_size;
+    cache->config = *config;
+    cache->name = name;
+    cache->line_shift = log2_of(config->line_size);
+    cache->ways = config->ways;
+    cache->set_mask = lines / config->ways - 1;
+    cache->random_state = 0x9E3779B97F4A7C15ull;
+    cache->recent[0] = cache->recent[1] = NO_LINE;
+    cache->tags = malloc(lines * sizeof(uint32_t));
+    cache->dirty = calloc(lines, 1);
+    cache->stamps = calloc(lines, sizeof(uint64_t));
+    cache->plru = calloc(cache->set_mask + 1, sizeof(uint32_t));
+    if (!shadow_init(&cache->shadow, lines) || !cache->tags || !cache->dirty || !cache->stamps || !cache->plru) {
+        free_cache(cache);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < lines; i++) {
+        cache->tags[i] = NO_LINE;
+    }
+    return cache;
+}
+
+rv_status_t rv_set_caches(rv_sim_t *sim, const rv_cache_config_t *icache, const rv_cache_config_t *dcache) {
+    const char *problem;
+
+    if (sim->cache) {
+        free_cache(sim->cache->icache);
+        free_cache(sim->cache->dcache);
+        free(sim->cache);
+        sim->cache = NULL;
+    }
+    if (!icache && !dcache) {
+        return RV_OK;
+    }
+    if (icache && (problem = check_config(icache)) != NULL) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Bad instruction cache configuration: %s", problem);
+    }
+    if (dcache && (problem = check_config(dcache)) != NULL) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Bad data cache configuration: %s", problem);
+    }
+    cache_state_t *state = calloc(1, sizeof(cache_state_t));
+    if (!state) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to allocate caches");
+    }
+    state->icache = icache ? new_cache(icache, "L1I") : NULL;
+    state->dcache = dcache ? new_cache(dcache, "L1D") : NULL;
+    if ((icache && !state->icache) || (dcache && !state->dcache)) {
+        free_cache(state->icache);
+        free_cache(state->dcache);
+        free(state);
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to allocate caches");
+    }
+    sim->cache = state;
+    return RV_OK;
+}
+
+static int grow_miss_pcs(cache_t *cache) {
+    size_t capacity = cache->miss_pc_capacity ? cache->miss_pc_capacity * 2 : 1024;
+    pc_count_t *pcs = calloc(capacity, sizeof(pc_count_t));
+    if (!pcs) {
+        return 0;
+    }
+    for (size_t i = 0; i < cache->miss_pc_capacity; i++) {
+        if (cache->miss_pcs[i].count) {
+            size_t s = hash_pc(cache->miss_pcs[i].pc) & (capacity - 1);
+            while (pcs[s].count) {
+                s = (s + 1) & (capacity - 1);
+            }
+            pcs[s] = cache->miss_pcs[i];
+        }
+    }
+    free(cache->miss_pcs);
+    cache->miss_pcs = pcs;
+    cache->miss_pc_capacity = capacity;
+    return 1;
+}
+
+static void count_miss_pc(cache_t *cache, uint32_t pc) {
+    if ((cache->num_miss_pcs + 1) * 2 > cache->miss_pc_capacity && !grow_miss_pcs(cache)) {
+        cache->out_of_memory = 1;
+        return;
+    }
+    size_t s = hash_pc(pc) & (cache->miss_pc_capacity - 1);
+    while (cache->miss_pcs[s].count && cache->miss_pcs[s].pc != pc) {
+        s = (s + 1) & (cache->miss_pc_capacity - 1);
+    }
+    if (cache->miss_pcs[s].count == 0) {
+        cache->miss_pcs[s].pc = pc;
+        cache->num_miss_pcs++;
+    }
+    cache->miss_pcs[s].count++;
+}
+
+// Function to mark way (0 to ways - 1) of the set at base as just used
+static void touch(cache_t *cache, uint32_t set, uint32_t base, uint32_t way) {
+    switch (cache->config.replacement) {
+        case RV_REPLACE_LRU:
+            cache->stamps[base + way] = ++cache->clock;
+            break;
+        case RV_REPLACE_PLRU: {
+            // every node on the path points to the other half
+            uint32_t bits = cache->plru[set];
+            for (uint32_t node = 1, half = cache->ways >> 1; half; half >>= 1) {
+                uint32_t right = (way & half) != 0;
+                bits = right ? bits & ~(1u << node) : bits | (1u << node);
+                node = 2 * node + right;
+            }
+            cache->plru[set] = bits;
+            break;
+        }
+        case RV_REPLACE_RANDOM:
+            break;
+    }
+}
+
+static uint32_t choose_victim(cache_t *cache, uint32_t set, uint32_t base) {
+    for (uint32_t way = 0; way < cache->ways; way++) {
+        if (cache->tags[base + way] == NO_LINE) {
+            return way;
+        }
+    }
+    switch (cache->config.replacement) {
+        case RV_REPLACE_LRU: {
+            uint32_t victim = 0;
+            for (uint32_t way = 1; way < cache->ways; way++) {
+                if (cache->stamps[base + way] < cache->stamps[base + victim]) {
+                    victim = way;
+                }
+            }
+            return victim;
+        }
+        case RV_REPLACE_PLRU: {
+            uint32_t way = 0;
+            for (uint32_t node = 1, half = cache->ways >> 1; half; half >>= 1) {
+                uint32_t right = (cache->plru[set] >> node) & 1;
+                way |= right ? half : 0;
+                node = 2 * node + right;
+            }
+            return way;
+        }
+        default: {
+            uint64_t x = cache->random_state; // xorshift64
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            cache->random_state = x;
+            return (uint32_t)(x % cache->ways);
+        }
+    }
+}
+
+// Function to apply the accesses to the two recent lines to the replacement state (see above)
+static void settle_recent(cache_t *cache) {
+    for (int i = 1; i >= 0; i--) {
+        uint32_t line = cache->recent[i];
+        if (line != NO_LINE) {
+            uint32_t set = line & cache->set_mask;
+            touch(cache, set, set * cache->ways, cache->recent_way[i] - set * cache->ways);
+            shadow_access(&cache->shadow, line, 1);
+        }
+    }
+}
+
+static void write_hit(cache_t *cache, uint32_t index) {
+    cache->dirty[index] |= (uint8_t)cache->config.write_back;
+    cache->memory_writes += !cache->config.write_back;
+}
+
+// Function to access a line other than the two recent ones. Returns 1 on a miss.
+static int access_other_line(cache_t *cache, uint32_t line, int write, uint32_t pc) {
+    const rv_cache_config_t *config = &cache->config;
+    int allocate = !write || config->write_allocate;
+
+    settle_recent(cache);
+
+    uint32_t set = line & cache->set_mask;
+    uint32_t base = set * cache->ways;
+    uint32_t index = NO_LINE;
+    for (uint32_t way = 0; way < cache->ways; way++) {
+        if (cache->tags[base + way] == line) {
+            index = base + way;
+            touch(cache, set, base, way);
+            if (write) write_hit(cache, index);
+            if (!shadow_access(&cache->shadow, line, allocate)) {
+                // a store that went around the shadow; the fast path needs the recent lines in it
+                cache->recent[0] = cache->recent[1] = NO_LINE;
+                return 0;
+            }
+            break;
+        }
+    }
+
+    int missed = index == NO_LINE;
+    if (missed) {
+        int seen = mark_seen(cache, line);
+        int shadow_hit = shadow_access(&cache->shadow, line, allocate);
+        if (!seen) {
+            cache->compulsory++;
+        } else if (shadow_hit) {
+            cache->conflict++;
+        } else {
+            cache->capacity++;
+        }
+        if (write) {
+            cache->write_misses++;
+        } else {
+            cache->read_misses++;
+        }
+        count_miss_pc(cache, pc);
+        if (!allocate) {
+            // the line went around the cache, but may have moved up in the shadow
+            cache->memory_writes++;
+            cache->recent[0] = cache->recent[1] = NO_LINE;
+            return 1;
+        }
+        uint32_t way = choose_victim(cache, set, base);
+        index = base + way;
+        if (cache->tags[index] != NO_LINE && cache->dirty[index]) {
+            cache->writebacks++;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (cache->recent[i] == cache->tags[index]) {
+                cache->recent[i] = NO_LINE; // evicted, so the next access to it has to miss
+            }
+        }
+        cache->tags[index] = line;
+        cache->dirty[index] = write && config->write_back;
+        cache->memory_writes += write && !config->write_back;
+        touch(cache, set, base, way);
+    }
+    cache->recent[1] = cache->recent[0];
+    cache->recent_way[1] = cache->recent_way[0];
+    cache->recent[0] = line;
+    cache->recent_way[0] = index;
+    return missed;
+}
+
+// Function to access one line for the instruction at pc. Returns 1 on a miss.
+static ALWAYS_INLINE int access_line(cache_t *cache, uint32_t line, int write, uint32_t pc) {
+    if (line == cache->recent[0]) {
+        if (write) write_hit(cache, cache->recent_way[0]);
+        return 0;
+    }
+    if (line == cache->recent[1]) {
+        cache->recent[1] = cache->recent[0];
+        cache->recent[0] = line;
+        uint32_t way = cache->recent_way[1];
+        cache->recent_way[1] = cache->recent_way[0];
+        cache->recent_way[0] = way;
+        if (write) write_hit(cache, way);
+        return 0;
+    }
+    return access_other_line(cache, line, write, pc);
+}
+
+// Function to access size bytes at address, one or two lines. Returns the cycles missing cost.
+static ALWAYS_INLINE uint64_t cache_access(cache_t *cache, uint32_t address, uint32_t size, int write, uint32_t pc) {
+    uint32_t first = address >> cache->line_shift;
+    uint32_t last = (address + size - 1) >> cache->line_shift;
+    int misses = access_line(cache, first, write, pc);
+
+    if (write) {
+        cache->writes++;
+    } else {
+        cache->reads++;
+    }
+    if (last != first) {
+        misses += access_line(cache, last, write, pc);
+    }
+    return misses ? cache->config.miss_cycles : 0;
+}
+
+void cache_begin(rv_sim_t *sim, const decoded_instr_t *d) {
+    if (d->opcode == OPCODE_LOAD || d->opcode == OPCODE_STORE || d->opcode == OPCODE_AMO) {
+        sim->cache->mem_address = (uint32_t)sim->registers_array[d->rs1] + d->imm; // before a load can overwrite rs1
+    }
+}
+
+void cache_retire(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d) {
+    cache_state_t *state = sim->cache;
+
+    if (state->icache) {
+        state->icache->miss_cycles = cache_access(state->icache, insn_pc, d->length, 0, insn_pc);
+    }
+    if (state->dcache) {
+        state->dcache->miss_cycles = 0;
+        if (d->opcode == OPCODE_LOAD || d->opcode == OPCODE_STORE || d->opcode == OPCODE_AMO) {
+            uint32_t size = 1u << (d->funct3 & 3); // byte, half or word
+            int write = d->opcode == OPCODE_STORE || (d->opcode == OPCODE_AMO && d->insn != INSN_LR);
+            state->dcache->miss_cycles = cache_access(state->dcache, state->mem_address, size, write, insn_pc);
+        }
+    }
+}
+
+void cache_miss_cycles(const rv_sim_t *sim, uint64_t *fetch, uint64_t *data) {
+    const cache_state_t *state = sim->cache;
+    *fetch = state && state->icache ? state->icache->miss_cycles : 0;
+    *data = state && state->dcache ? state->dcache->miss_cycles : 0;
+}
+
+static int compare_miss_pcs(const void *a, const void *b) {
+    const pc_count_t *x = a, *y = b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void print_cache(const rv_sim_t *sim, const cache_t *cache) {
+    const rv_cache_config_t *config = &cache->config;
+    uint64_t accesses = cache->reads + cache->writes;
+    uint64_t misses = cache->read_misses + cache->write_misses;
+
+    printf("\n%s: %u KiB, %u-byte lines, %u-way, %s", cache->name, config->size / 1024, config->line_size,
+           config->ways, replacement_names[config->replacement]);
+    if (cache->writes) {
+        printf(", %s, %s", config->write_back ? "write-back" : "write-through",
+               config->write_allocate ? "write-allocate" : "no-write-allocate");
+    }
+    printf("\n  Accesses: %llu, hits: %llu (%.2f%%), misses: %llu (%.2f%%)\n", (unsigned long long)accesses,
+           (unsigned long long)(accesses - misses), percent(accesses - misses, accesses),
+           (unsigned long long)misses, percent(misses, accesses));
+    if (cache->writes) {
+        printf("  Reads: %llu, misses: %llu; writes: %llu, misses: %llu\n", (unsigned long long)cache->reads,
+               (unsigned long long)cache->read_misses, (unsigned long long)cache->writes,
+               (unsigned long long)cache->write_misses);
+        printf("  Write-backs: %llu, writes to memory: %llu\n", (unsigned long long)cache->writebacks,
+               (unsigned long long)cache->memory_writes);
+    }
+    printf("  Misses: %llu compulsory, %llu capacity, %llu conflict\n", (unsigned long long)cache->compulsory,
+           (unsigned long long)cache->capacity, (unsigned long long)cache->conflict);
+
+    pc_count_t *pcs = cache->num_miss_pcs ? malloc(cache->num_miss_pcs * sizeof(pc_count_t)) : NULL;
+    if (pcs) {
+        size_t n = 0;
+        for (size_t i = 0; i < cache->miss_pc_capacity; i++) {
+            if (cache->miss_pcs[i].count) {
+                pcs[n++] = cache->miss_pcs[i];
+            }
+        }
+        qsort(pcs, n, sizeof(pc_count_t), compare_miss_pcs);
+        printf("  Top missing pcs:\n");
+        for (size_t i = 0; i < n && i < CACHE_TOP_PCS; i++) {
+            const rv_symbol_t *symbol = rv_find_symbol(sim, pcs[i].pc);
+            char location[64] = "";
+            if (symbol) {
+                snprintf(location, sizeof(location), "<%s+0x%X>", symbol->name, pcs[i].pc - symbol->address);
+            }
+            printf("    0x%08X %-28s %14llu %6.2f%%\n", pcs[i].pc, location, (unsigned long long)pcs[i].count,
+                   percent(pcs[i].count, misses));
+        }
+        free(pcs);
+    }
+    if (cache->out_of_memory) {
+        printf("  (out of memory, some misses are unclassified or missing from the pcs)\n");
+    }
+}
+
+void rv_print_caches(const rv_sim_t *sim) {
+    const cache_state_t *state = sim->cache;
+
+    if (!state) {
+        return;
+    }
+    printf("\n--- Caches ---\n");
+    if (state->icache) {
+        print_cache(sim, state->icache);
+    }
+    if (state->dcache) {
+        print_cache(sim, state->dcache);
+    }
+    printf("--------------------------\n");
+}
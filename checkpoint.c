@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+
+// Checkpoints.
+// A checkpoint holds the registers, pc, instret and every page that was written or had its permissions
+// changed; untouched memory reads as zeros and is not stored. All fields are little-endian:
+//
+//     "RVCKPT01"                         magic
+//     uint32 pc, uint32 page count, uint64 instret, int32 registers[32]
+//     per page: uint32 address, uint32 perms, uint32 compressed size, compressed data
+//
+// Page data is PackBits-compressed, and a compressed size of 0 means the page is all zeros. Decoded and
+// translated code, the core, tracing and symbols are not part of a checkpoint.
+#define CHECKPOINT_MAGIC "RVCKPT01"
+#define CHECKPOINT_HEADER_SIZE (8 + 4 + 4 + 8 + 4 * NUM_REGISTERS)
+#define PACKBITS_MAX_SIZE (PAGE_SIZE + PAGE_SIZE / 128 + 1)
+
+// Function to PackBits-compress n bytes: a header byte h of 0..127 is followed by h + 1 literal bytes,
+// a header of -1..-127 by one byte to repeat 1 - h times. Returns the compressed size.
+static size_t packbits(const uint8_t *in, size_t n, uint8_t *out) {
+    size_t i = 0, o = 0;
+
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < 128 && in[i + run] == in[i]) {
+            run++;
+        }
+        if (run >= 3) {
+            out[o++] = (uint8_t)(257 - run);
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+        // literals up to the next run of three
+        size_t start = i, length = 0;
+        while (i < n && length < 128 && !(i + 2 < n && in[i] == in[i + 1] && in[i] == in[i + 2])) {
+            i++;
+            length++;
+        }
+        out[o++] = (uint8_t)(length - 1);
+        memcpy(&out[o], &in[start], length);
+        o += length;
+    }
+    return o;
+}
+
+// Function to expand PackBits data into exactly n bytes. Returns 0 if the data is corrupt.
+static int unpackbits(const uint8_t *in, size_t in_size, uint8_t *out, size_t n) {
+    size_t i = 0, o = 0;
+
+    while (i < in_size) {
+        int8_t header = (int8_t)in[i++];
+        if (header >= 0) {
+            size_t length = (size_t)header + 1;
+            if (i + length > in_size || o + length > n) {
+                return 0;
+            }
+            memcpy(&out[o], &in[i], length);
+            i += length;
+            o += length;
+        } else if (header != -128) {
+            size_t length = (size_t)(1 - header);
+            if (i >= in_size || o + length > n) {
+                return 0;
+            }
+            memset(&out[o], in[i++], length);
+            o += length;
+        }
+    }
+    return o == n;
+}
+
+static int is_zero(const uint8_t *data, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (data[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to call visit for every page a checkpoint has to hold
+static int for_each_saved_page(const rv_sim_t *sim, int (*visit)(void *, uint32_t, const page_t *), void *context) {
+    for (uint32_t t = 0; t < PAGE_TABLE_ENTRIES; t++) {
+        const page_t *table = sim->page_tables[t];
+        if (!table) {
+            continue;
+        }
+        for (uint32_t i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+            if (table[i].data || table[i].perms != RV_PERM_ALL) {
+                uint32_t address = (t << (PAGE_SHIFT + PAGE_TABLE_SHIFT)) | (i << PAGE_SHIFT);
+                if (!visit(context, address, &table[i])) {
+                    return 0;
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+static int count_page(void *context, uint32_t address, const page_t *page) {
+    (void)address;
+    (void)page;
+    (*(uint32_t *)context)++;
+    return 1;
+}
+
+static int write_page(void *context, uint32_t address, const page_t *page) {
+    FILE *file = context;
+    uint8_t record[12 + PACKBITS_MAX_SIZE];
+    size_t size = 0;
+
+    if (page->data && !is_zero(page->data, PAGE_SIZE)) {
+        size = packbits(page->data, PAGE_SIZE, record + 12);
+    }
+    store_le(record, 4, address);
+    store_le(record + 4, 4, page->perms);
+    store_le(record + 8, 4, (uint32_t)size);
+    return fwrite(record, 1, 12 + size, file) == 12 + size;
+}
+
+rv_status_t rv_save_checkpoint(rv_sim_t *sim, const char *filename) {
+    uint8_t header[CHECKPOINT_HEADER_SIZE];
+    uint32_t num_pages = 0;
+
+    if (sim->smp) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Checkpoints need a single hart");
+    }
+    for_each_saved_page(sim, count_page, &num_pages);
+    memcpy(header, CHECKPOINT_MAGIC, 8);
+    store_le(header + 8, 4, sim->pc);
+    store_le(header + 12, 4, num_pages);
+    store_le(header + 16, 4, (uint32_t)sim->instret);
+    store_le(header + 20, 4, (uint32_t)(sim->instret >> 32));
+    for (int i = 0; i < NUM_REGISTERS; i++) {
+        store_le(header + 24 + 4 * i, 4, (uint32_t)sim->registers_array[i]);
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to open checkpoint file: %s", strerror(errno));
+    }
+    int ok = fwrite(header, 1, sizeof(header), file) == sizeof(header) && for_each_saved_page(sim, write_page, file);
+    if (fclose(file) != 0 || !ok) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to write checkpoint file: %s", filename);
+    }
+    return RV_OK;
+}
+
+// Function to read the pages of a checkpoint into the (freed) memory of sim
+static int read_pages(rv_sim_t *sim, FILE *file, uint32_t num_pages) {
+    uint8_t record[12], compressed[PACKBITS_MAX_SIZE], data[PAGE_SIZE];
+
+    for (uint32_t n = 0; n < num_pages; n++) {
+        if (fread(record, 1, 12, file) != 12) {
+            return 0;
+        }
+        uint32_t address = load_le(record, 4), perms = load_le(record + 4, 4), size = load_le(record + 8, 4);
+        if ((address & (PAGE_SIZE - 1)) || (perms & ~RV_PERM_ALL) || size > PACKBITS_MAX_SIZE) {
+            return 0;
+        }
+        if (size > 0) {
+            if (fread(compressed, 1, size, file) != size || !unpackbits(compressed, size, data, PAGE_SIZE) ||
+                rv_write_mem(sim, address, data, PAGE_SIZE) != RV_OK) {
+                return 0;
+            }
+        }
+        page_t *page = mem_page(sim, address, 1);
+        if (!page) {
+            return 0;
+        }
+        page->perms = (uint8_t)perms;
+    }
+    return 1;
+}
+
+rv_status_t rv_restore_checkpoint(rv_sim_t *sim, const char *filename) {
+    uint8_t header[CHECKPOINT_HEADER_SIZE];
+
+    if (sim->smp) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Checkpoints need a single hart");
+    }
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to open checkpoint file: %s", strerror(errno));
+    }
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, CHECKPOINT_MAGIC, 8) != 0) {
+        fclose(file);
+        return rv_raise(sim, RV_ERROR_IO, 0, "Not a checkpoint file: %s", filename);
+    }
+
+    jit_destroy(sim);
+    mem_free(sim);
+    int ok = read_pages(sim, file, load_le(header + 12, 4));
+    fclose(file);
+    mem_flush_tlb(sim); // permissions were changed behind the TLB's back
+    if (!ok) {
+        mem_free(sim);
+        return rv_raise(sim, RV_ERROR_IO, 0, "Corrupt checkpoint file: %s", filename);
+    }
+
+    sim->pc = load_le(header + 8, 4);
+    sim->instret = load_le(header + 16, 4) | (uint64_t)load_le(header + 20, 4) << 32;
+    for (int i = 0; i < NUM_REGISTERS; i++) {
+        sim->registers_array[i] = (int32_t)load_le(header + 24 + 4 * i, 4);
+    }
+    sim->registers_array[0] = 0;
+    sim->halted = RV_OK;
+    memset(&sim->trap, 0, sizeof(sim->trap));
+    return RV_OK;
+}
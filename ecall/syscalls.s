@@ -0,0 +1,91 @@
+	.text
+	# Linux system call emulation (syscall.c), run with --syscalls=ecall/sandbox. Every call leaves its
+	# result in a saved register, and the program ends with exit(42).
+	li a0, 1
+	li a2, 0
+	li a7, 64
+	ecall			# write(1, 0, 0) = 0
+	mv s1, a0
+	li a0, 9
+	li a2, 4
+	ecall			# write(9, ...) = -EBADF
+	mv s2, a0
+
+	li a0, 0
+	li a7, 214
+	ecall			# brk(0): the break starts after the last page of the program
+	mv s3, a0
+	lui t0, 0x2
+	add a0, s3, t0
+	ecall			# grow by 8 KiB
+	lui t0, 0x1
+	add t1, s3, t0
+	li t2, 0x55
+	sw t2, 0(t1)
+	mv a0, s3
+	ecall			# give it back
+	lui t0, 0x2
+	add a0, s3, t0
+	ecall			# and take it again: it reads as zeros
+	lw s4, 0(t1)
+	li a0, 16
+	ecall			# below the start: fails, returns the current break
+	sub s5, a0, s3
+
+	li a0, 1
+	mv a1, s3
+	li a7, 113
+	ecall			# clock_gettime(CLOCK_MONOTONIC, brk): one nanosecond per instruction
+	lw t0, 0(s3)		# seconds
+	lw s6, 8(s3)		# nanoseconds: the instructions before the ecall
+	add s6, s6, t0
+
+	li a0, -100
+P1:
+	auipc a1, hi(path-P1)
+	addi a1, a1, lo(path-P1)
+	li a2, 0
+	li a7, 56
+	ecall			# openat(AT_FDCWD, "input.txt", O_RDONLY) = 3
+	mv s7, a0
+	mv a1, s3
+	li a2, 64
+	li a7, 63
+	ecall			# read(3, brk, 64) = 6
+	mv s8, a0
+	lw s9, 0(s3)		# "hell"
+	mv a0, s7
+	li a7, 57
+	ecall			# close(3) = 0
+	mv s10, a0
+	mv a0, s7
+	ecall			# close(3) = -EBADF
+	mv s11, a0
+	li a0, -100
+P2:
+	auipc a1, hi(outside-P2)
+	addi a1, a1, lo(outside-P2)
+	li a2, 0
+	li a7, 56
+	ecall			# openat(AT_FDCWD, "../syscalls.s", O_RDONLY) = -EACCES
+	mv t3, a0
+	li a7, 1234
+	ecall			# unknown: -ENOSYS
+	mv t4, a0
+
+	li a0, 42
+	li a7, 93
+	ecall			# exit(42)
+	j fail
+fail:
+	j fail
+	.align
+path:
+	.word 0x75706e69	# "input.txt"
+	.word 0x78742e74
+	.word 0x00000074
+outside:
+	.word 0x732f2e2e	# "../syscalls.s"
+	.word 0x61637379
+	.word 0x2e736c6c
+	.word 0x00000073
@@ -0,0 +1,388 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+
+// ELF32 loader.
+// PT_LOAD segments are placed at their p_vaddr, .bss (p_memsz beyond p_filesz) reads as zeros because
+// fresh pages do, and pc starts at e_entry. Page permissions follow the segment flags; pages outside
+// every segment (stack, heap) stay readable, writable and executable.
+// Where the host can mmap, the file is mapped privately and every page of a read-only segment that is
+// entirely backed by file bytes points straight into the mapping instead of being copied. The mapping
+// is copy-on-write, so host writes through rv_write_mem still work. Partial pages are copied.
+
+#if defined(__unix__) || defined(__APPLE__)
+#define ELF_MMAP_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The parts of the ELF format the loader needs, so no <elf.h> is required
+#define ELFCLASS32  1
+#define ELFDATA2LSB 1
+#define ET_EXEC     2
+#define EM_RISCV    243
+#define PT_LOAD     1
+#define SHT_SYMTAB  2
+#define PF_X        1
+#define PF_W        2
+#define PF_R        4
+#define STT_OBJECT  1
+#define STT_FUNC    2
+
+typedef struct {
+    uint8_t e_ident[16];
+    uint16_t e_type, e_machine;
+    uint32_t e_version, e_entry, e_phoff, e_shoff, e_flags;
+    uint16_t e_ehsize, e_phentsize, e_phnum, e_shentsize, e_shnum, e_shstrndx;
+} elf32_ehdr_t;
+
+typedef struct {
+    uint32_t p_type, p_offset, p_vaddr, p_paddr, p_filesz, p_memsz, p_flags, p_align;
+} elf32_phdr_t;
+
+typedef struct {
+    uint32_t sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size, sh_link, sh_info, sh_addralign, sh_entsize;
+} elf32_shdr_t;
+
+typedef struct {
+    uint32_t st_name, st_value, st_size;
+    uint8_t st_info, st_other;
+    uint16_t st_shndx;
+} elf32_sym_t;
+
+// Functions to read little-endian ELF fields; the file offsets of headers need not be aligned
+static uint32_t field32(const uint8_t *p) { return load_le(p, 4); }
+static uint16_t field16(const uint8_t *p) { return (uint16_t)load_le(p, 2); }
+
+static void read_ehdr(const uint8_t *p, elf32_ehdr_t *e) {
+    memcpy(e->e_ident, p, 16);
+    e->e_type = field16(p + 16);
+    e->e_machine = field16(p + 18);
+    e->e_version = field32(p + 20);
+    e->e_entry = field32(p + 24);
+    e->e_phoff = field32(p + 28);
+    e->e_shoff = field32(p + 32);
+    e->e_flags = field32(p + 36);
+    e->e_ehsize = field16(p + 40);
+    e->e_phentsize = field16(p + 42);
+    e->e_phnum = field16(p + 44);
+    e->e_shentsize = field16(p + 46);
+    e->e_shnum = field16(p + 48);
+    e->e_shstrndx = field16(p + 50);
+}
+
+static void read_phdr(const uint8_t *p, elf32_phdr_t *ph) {
+    ph->p_type = field32(p);
+    ph->p_offset = field32(p + 4);
+    ph->p_vaddr = field32(p + 8);
+    ph->p_paddr = field32(p + 12);
+    ph->p_filesz = field32(p + 16);
+    ph->p_memsz = field32(p + 20);
+    ph->p_flags = field32(p + 24);
+    ph->p_align = field32(p + 28);
+}
+
+static void read_shdr(const uint8_t *p, elf32_shdr_t *sh) {
+    sh->sh_name = field32(p);
+    sh->sh_type = field32(p + 4);
+    sh->sh_flags = field32(p + 8);
+    sh->sh_addr = field32(p + 12);
+    sh->sh_offset = field32(p + 16);
+    sh->sh_size = field32(p + 20);
+    sh->sh_link = field32(p + 24);
+    sh->sh_info = field32(p + 28);
+    sh->sh_addralign = field32(p + 32);
+    sh->sh_entsize = field32(p + 36);
+}
+
+static void read_sym(const uint8_t *p, elf32_sym_t *sym) {
+    sym->st_name = field32(p);
+    sym->st_value = field32(p + 4);
+    sym->st_size = field32(p + 8);
+    sym->st_info = p[12];
+    sym->st_other = p[13];
+    sym->st_shndx = field16(p + 14);
+}
+
+int elf_is_elf(const uint8_t *header, size_t size) {
+    return size >= 4 && memcmp(header, "\x7F" "ELF", 4) == 0;
+}
+
+// Function to get the file into host memory: a private mapping where possible, a malloc'd copy otherwise
+static uint8_t *open_image(rv_sim_t *sim, const char *filename, size_t *size, int *mapped) {
+#ifdef ELF_MMAP_SUPPORTED
+    int fd = open(filename, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *image = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (image != MAP_FAILED) {
+                close(fd);
+                *size = (size_t)st.st_size;
+                *mapped = 1;
+                return image;
+            }
+        }
+        close(fd);
+    }
+#endif
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        rv_raise(sim, RV_ERROR_IO, 0, "Failed to open ELF file: %s", strerror(errno));
+        return NULL;
+    }
+    uint8_t *image = NULL;
+    long length = -1;
+    if (fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0) {
+        image = malloc((size_t)length);
+    }
+    if (!image || fread(image, 1, (size_t)length, file) != (size_t)length) {
+        free(image);
+        fclose(file);
+        rv_raise(sim, RV_ERROR_IO, 0, "Failed to read ELF file: %s", filename);
+        return NULL;
+    }
+    fclose(file);
+    *size = (size_t)length;
+    *mapped = 0;
+    return image;
+}
+
+static void close_image(uint8_t *image, size_t size, int mapped) {
+#ifdef ELF_MMAP_SUPPORTED
+    if (mapped) {
+        munmap(image, size);
+        return;
+    }
+#endif
+    (void)size;
+    (void)mapped;
+    free(image);
+}
+
+static unsigned segment_perms(uint32_t p_flags) {
+    return ((p_flags & PF_R) ? RV_PERM_READ : 0) | ((p_flags & PF_W) ? RV_PERM_WRITE : 0) |
+           ((p_flags & PF_X) ? RV_PERM_EXEC : 0);
+}
+
+// Function to place one PT_LOAD segment. Pages are fresh, so only file bytes have to be written.
+static rv_status_t load_segment(rv_sim_t *sim, const elf32_phdr_t *ph, uint8_t *image, int mapped) {
+    uint32_t end = ph->p_vaddr + ph->p_filesz;
+    int borrow = mapped && !(ph->p_flags & PF_W);
+
+    for (uint32_t address = ph->p_vaddr; address != end;) {
+        uint32_t page_end = (address & PAGE_MASK) + PAGE_SIZE;
+        uint32_t chunk = (end - address < page_end - address) ? end - address : page_end - address;
+        page_t *page = mem_page(sim, address, 1);
+        if (!page) {
+            return rv_raise(sim, RV_ERROR_IO, address, "Failed to allocate memory at address 0x%X", address);
+        }
+        if (borrow && chunk == PAGE_SIZE && !page->data) {
+            page->data = image + ph->p_offset + (address - ph->p_vaddr);
+            page->borrowed = 1;
+        } else {
+            // rv_write_mem ignores permissions, and those are only set once every segment is placed
+            rv_status_t status = rv_write_mem(sim, address, image + ph->p_offset + (address - ph->p_vaddr), chunk);
+            if (status != RV_OK) {
+                return status;
+            }
+        }
+        address += chunk;
+    }
+    return RV_OK;
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    const rv_symbol_t *x = a, *y = b;
+    if (x->address != y->address) {
+        return x->address < y->address ? -1 : 1;
+    }
+    return y->is_function - x->is_function; // functions first, so lookups prefer them
+}
+
+// Function to sort sim->symbols by address for rv_find_symbol
+void elf_sort_symbols(rv_sim_t *sim) {
+    if (sim->num_symbols > 1) {
+        qsort(sim->symbols, sim->num_symbols, sizeof(rv_symbol_t), compare_symbols);
+    }
+}
+
+// Function to copy the symbol table (if the file has one) into sim->symbols, sorted by address
+static void load_symbols(rv_sim_t *sim, const elf32_ehdr_t *e, const uint8_t *image, size_t size) {
+    for (uint32_t i = 0; i < e->e_shnum; i++) {
+        elf32_shdr_t symtab, strtab;
+        read_shdr(image + e->e_shoff + (size_t)i * e->e_shentsize, &symtab);
+        if (symtab.sh_type != SHT_SYMTAB || symtab.sh_link >= e->e_shnum || symtab.sh_entsize < 16 ||
+            (uint64_t)symtab.sh_offset + symtab.sh_size > size) {
+            continue;
+        }
+        read_shdr(image + e->e_shoff + (size_t)symtab.sh_link * e->e_shentsize, &strtab);
+        if ((uint64_t)strtab.sh_offset + strtab.sh_size > size || strtab.sh_size == 0) {
+            continue;
+        }
+
+        size_t count = symtab.sh_size / symtab.sh_entsize;
+        sim->symbols = malloc(count * sizeof(rv_symbol_t));
+        sim->symbol_names = malloc(strtab.sh_size + 1);
+        if (!sim->symbols || !sim->symbol_names) {
+            elf_free(sim); // symbols are optional, loading goes on without them
+            return;
+        }
+        memcpy(sim->symbol_names, image + strtab.sh_offset, strtab.sh_size);
+        sim->symbol_names[strtab.sh_size] = '\0';
+
+        for (size_t s = 0; s < count; s++) {
+            elf32_sym_t sym;
+            read_sym(image + symtab.sh_offset + s * symtab.sh_entsize, &sym);
+            unsigned type = sym.st_info & 0xF;
+            // undefined, section and file symbols don't name code or data
+            if (sym.st_shndx == 0 || sym.st_name == 0 || sym.st_name >= strtab.sh_size ||
+                (type != STT_FUNC && type != STT_OBJECT && type != 0)) {
+                continue;
+            }
+            rv_symbol_t *out = &sim->symbols[sim->num_symbols++];
+            out->name = sim->symbol_names + sym.st_name;
+            out->address = sym.st_value;
+            out->size = sym.st_size;
+            out->is_function = type == STT_FUNC;
+        }
+        elf_sort_symbols(sim);
+        return;
+    }
+}
+
+// Function to load an ELF32 RISC-V executable. It replaces the whole memory image and sets pc to e_entry.
+rv_status_t elf_load(rv_sim_t *sim, const char *filename) {
+    size_t size;
+    int mapped;
+    uint8_t *image = open_image(sim, filename, &size, &mapped);
+    if (!image) {
+        return sim->trap.status;
+    }
+
+    elf32_ehdr_t e;
+    if (size >= 52) {
+        read_ehdr(image, &e);
+    }
+    if (size < 52 || e.e_ident[4] != ELFCLASS32 || e.e_ident[5] != ELFDATA2LSB) {
+        close_image(image, size, mapped);
+        return rv_raise(sim, RV_ERROR_IO, 0, "Not a 32-bit little-endian ELF file: %s", filename);
+    }
+    if (e.e_machine != EM_RISCV || e.e_type != ET_EXEC) {
+        close_image(image, size, mapped);
+        return rv_raise(sim, RV_ERROR_IO, 0, "Not a RISC-V executable: %s", filename);
+    }
+    if (e.e_phentsize < 32 || (uint64_t)e.e_phoff + (uint64_t)e.e_phnum * e.e_phentsize > size ||
+        (e.e_shnum && (e.e_shentsize < 40 || (uint64_t)e.e_shoff + (uint64_t)e.e_shnum * e.e_shentsize > size))) {
+        close_image(image, size, mapped);
+        return rv_raise(sim, RV_ERROR_IO, 0, "Corrupt ELF headers: %s", filename);
+    }
+
+    jit_destroy(sim);
+    mem_free(sim);
+    elf_free(sim);
+
+    rv_status_t status = RV_OK;
+    for (uint32_t i = 0; i < e.e_phnum && status == RV_OK; i++) {
+        elf32_phdr_t ph;
+        read_phdr(image + e.e_phoff + (size_t)i * e.e_phentsize, &ph);
+        if (ph.p_type != PT_LOAD || ph.p_memsz == 0) {
+            continue;
+        }
+        if (ph.p_filesz > ph.p_memsz || (uint64_t)ph.p_offset + ph.p_filesz > size ||
+            (uint64_t)ph.p_vaddr + ph.p_memsz > (uint64_t)UINT32_MAX + 1) {
+            status = rv_raise(sim, RV_ERROR_IO, ph.p_vaddr, "Corrupt ELF segment at 0x%X: %s", ph.p_vaddr, filename);
+            break;
+        }
+        status = load_segment(sim, &ph, image, mapped);
+    }
+
+    // Permissions go on once everything is written; a page shared by two segments gets both sets
+    for (int pass = 0; pass < 2 && status == RV_OK; pass++) {
+        for (uint32_t i = 0; i < e.e_phnum; i++) {
+            elf32_phdr_t ph;
+            read_phdr(image + e.e_phoff + (size_t)i * e.e_phentsize, &ph);
+            if (ph.p_type != PT_LOAD || ph.p_memsz == 0) {
+                continue;
+            }
+            uint64_t last = ((uint64_t)ph.p_vaddr + ph.p_memsz - 1) >> PAGE_SHIFT;
+            for (uint64_t page_number = ph.p_vaddr >> PAGE_SHIFT; page_number <= last; page_number++) {
+                page_t *page = mem_page(sim, (uint32_t)(page_number << PAGE_SHIFT), 1);
+                if (!page) {
+                    status = rv_raise(sim, RV_ERROR_IO, (uint32_t)(page_number << PAGE_SHIFT), "Failed to allocate page table");
+                    break;
+                }
+                page->perms = pass == 0 ? 0 : page->perms | segment_perms(ph.p_flags);
+            }
+        }
+    }
+    mem_flush_tlb(sim);
+
+    if (status == RV_OK) {
+        load_symbols(sim, &e, image, size);
+        sim->pc = e.e_entry;
+    }
+    // Pages may point into the mapping, so it stays until the memory is freed
+    sim->elf_image = image;
+    sim->elf_image_size = size;
+    sim->elf_image_mapped = mapped;
+    if (!mapped) {
+        elf_release_image(sim);
+    }
+    return status;
+}
+
+// Function to unmap the file of the last ELF load. Only called once no page points into it.
+void elf_release_image(rv_sim_t *sim) {
+    if (sim->elf_image) {
+        close_image(sim->elf_image, sim->elf_image_size, sim->elf_image_mapped);
+        sim->elf_image = NULL;
+    }
+}
+
+// Function to drop the symbols of the last ELF load (or symbol file)
+void elf_free(rv_sim_t *sim) {
+    free(sim->symbols);
+    free(sim->symbol_names);
+    sim->symbols = NULL;
+    sim->symbol_names = NULL;
+    sim->num_symbols = 0;
+}
+
+size_t rv_get_symbols(const rv_sim_t *sim, const rv_symbol_t **symbols) {
+    if (symbols) {
+        *symbols = sim->symbols;
+    }
+    return sim->num_symbols;
+}
+
+const rv_symbol_t *rv_find_symbol(const rv_sim_t *sim, uint32_t address) {
+    size_t lo = 0, hi = sim->num_symbols;
+
+    // last symbol starting at or below address
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sim->symbols[mid].address <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return NULL;
+    }
+    const rv_symbol_t *symbol = &sim->symbols[lo - 1];
+    while (symbol > sim->symbols && symbol[-1].address == symbol->address) {
+        symbol--; // functions sort first among symbols at the same address
+    }
+    if (symbol->size != 0 && address - symbol->address >= symbol->size) {
+        return NULL;
+    }
+    return symbol;
+}
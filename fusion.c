@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+
+// Macro-op fusion.
+// When fetch_decoded_slow caches the record of an instruction, fuse_decoded looks at the instruction after
+// it. If the two form one of the idioms below, the first record gets an INSN_FUSED_* handler plus the rd,
+// immediate and length of the second instruction, and the threaded core runs both in one handler: one
+// dispatch instead of two, and the value passed between them stays in a host register.
+//
+// Only the handler changes. insn, rd, rs1, rs2 and imm still describe the first instruction, so the switch
+// core, the JIT and the instrumentation see it as before, and the record of the second instruction is
+// cached separately for jumps to it. The pair is only formed within a page, and the store check in
+// invalidate_decoded covers both instructions, so rewriting either one drops the fused record.
+//
+// Every fusion writes the register the first instruction writes too, so the state after a pair is exactly
+// the state after running both. The threaded core splits a pair up again (runs the first instruction
+// alone) when it would stop between the two.
+
+static const char *const fusion_names[RV_FUSION_COUNT] = {
+    [RV_FUSION_LUI_ADDI] = "lui+addi",
+    [RV_FUSION_AUIPC_JALR] = "auipc+jalr",
+    [RV_FUSION_AUIPC_LOAD] = "auipc+lw",
+    [RV_FUSION_SHIFT_EXTEND] = "slli+srli/srai",
+    [RV_FUSION_COMPARE_BRANCH] = "slt*+beqz/bnez",
+};
+
+// Function to decode the instruction after first into second, if it is on the same page
+static int decode_next(const page_t *page, uint32_t fetch_pc, const decoded_instr_t *first, decoded_instr_t *second) {
+    uint32_t offset = (fetch_pc & (PAGE_SIZE - 1)) + first->length;
+    uint16_t half;
+
+    if (!page->data || offset + 2 > PAGE_SIZE) {
+        return 0; // a page that was never written holds zeros, which don't fuse
+    }
+    memcpy(&half, page->data + offset, 2);
+    uint32_t instruction = LE16(half);
+    if (!IS_COMPRESSED(instruction)) {
+        if (offset + 4 > PAGE_SIZE) {
+            return 0;
+        }
+        memcpy(&half, page->data + offset + 2, 2);
+        instruction |= (uint32_t)LE16(half) << 16;
+    }
+    decode_instruction(instruction, second);
+    return 1;
+}
+
+// Function to tell whether a branch tests rd against zero (beqz/bnez rd and the compressed forms)
+static int tests_zero(const decoded_instr_t *branch, uint8_t rd) {
+    return (branch->rs1 == rd && branch->rs2 == 0) || (branch->rs1 == 0 && branch->rs2 == rd);
+}
+
+// Function to pick the handler of the pair first + second, or 0 if they don't fuse
+static uint8_t fused_handler(const decoded_instr_t *first, const decoded_instr_t *second) {
+    uint8_t rd = first->rd;
+
+    if (rd == 0) {
+        return 0; // hints, nothing to pass on
+    }
+    switch (first->insn) {
+        case INSN_LUI:
+            return second->insn == INSN_ADDI && second->rs1 == rd ? INSN_FUSED_LUI_ADDI : 0;
+        case INSN_AUIPC:
+            if (second->rs1 != rd) {
+                return 0;
+            }
+            return second->insn == INSN_JALR ? INSN_FUSED_AUIPC_JALR : second->insn == INSN_LW ? INSN_FUSED_AUIPC_LW : 0;
+        case INSN_SLLI:
+            if (second->rs1 != rd) {
+                return 0;
+            }
+            return second->insn == INSN_SRLI ? INSN_FUSED_SLLI_SRLI : second->insn == INSN_SRAI ? INSN_FUSED_SLLI_SRAI : 0;
+        case INSN_SLT:
+        case INSN_SLTU:
+        case INSN_SLTI:
+        case INSN_SLTIU:
+            // a branch to itself has to halt (see decode_instruction)
+            if ((second->insn != INSN_BEQ && second->insn != INSN_BNE) || !tests_zero(second, rd) || second->imm == 0) {
+                return 0;
+            }
+            {
+                int bnez = second->insn == INSN_BNE;
+                switch (first->insn) {
+                    case INSN_SLT:  return bnez ? INSN_FUSED_SLT_BNEZ : INSN_FUSED_SLT_BEQZ;
+                    case INSN_SLTU: return bnez ? INSN_FUSED_SLTU_BNEZ : INSN_FUSED_SLTU_BEQZ;
+                    case INSN_SLTI: return bnez ? INSN_FUSED_SLTI_BNEZ : INSN_FUSED_SLTI_BEQZ;
+                    default:        return bnez ? INSN_FUSED_SLTIU_BNEZ : INSN_FUSED_SLTIU_BEQZ;
+                }
+            }
+        default:
+            return 0;
+    }
+}
+
+void fuse_decoded(const page_t *page, uint32_t fetch_pc, decoded_instr_t *first) {
+    decoded_instr_t second;
+
+    if (!decode_next(page, fetch_pc, first, &second)) {
+        return;
+    }
+    uint8_t handler = fused_handler(first, &second);
+    if (!handler) {
+        return;
+    }
+    // imm2 is whatever the fused handler needs from the second instruction
+    switch (handler) {
+        case INSN_FUSED_LUI_ADDI:
+            first->imm2 = (int32_t)((uint32_t)first->imm + (uint32_t)second.imm); // the constant rd2 gets
+            break;
+        case INSN_FUSED_AUIPC_JALR:
+            first->imm2 = (int32_t)((uint32_t)first->imm + (uint32_t)second.imm); // target relative to pc
+            break;
+        case INSN_FUSED_AUIPC_LW:
+        case INSN_FUSED_SLLI_SRLI:
+        case INSN_FUSED_SLLI_SRAI:
+            first->imm2 = second.imm;
+            break;
+        default: // compare and branch: branch target relative to the pc of the compare
+            first->imm2 = first->length + second.imm;
+            break;
+    }
+    first->handler = first->length + second.length == 8 ? handler : handler + 1; // INSN_FUSED_C_* follows
+    first->rd2 = second.rd;
+    first->length2 = second.length;
+}
+
+void rv_set_fusion(rv_sim_t *sim, int enable) {
+    enable = enable != 0;
+    if (sim->fusion == enable) {
+        return;
+    }
+    sim->fusion = enable;
+    jit_destroy(sim);       // translated blocks point at the records dropped below
+    mem_drop_decoded(sim);  // records decoded with the old setting
+}
+
+uint64_t rv_get_fusions(const rv_sim_t *sim, rv_fusion_t kind) {
+    return (unsigned)kind < RV_FUSION_COUNT ? sim->fusions[kind] : 0;
+}
+
+const char *rv_fusion_name(rv_fusion_t kind) {
+    return (unsigned)kind < RV_FUSION_COUNT ? fusion_names[kind] : "?";
+}
+
+// Function to print how often each fusion ran, and the share of instructions that ran fused
+void rv_print_fusion(const rv_sim_t *sim) {
+    uint64_t total = 0;
+
+    printf("\n--- Fusion ---\n");
+    for (int kind = 0; kind < RV_FUSION_COUNT; kind++) {
+        printf("%-16s %12llu\n", fusion_names[kind], (unsigned long long)sim->fusions[kind]);
+        total += sim->fusions[kind];
+    }
+    printf("%-16s %12llu pairs, %.1f%% of %llu instructions\n", "total", (unsigned long long)total,
+           sim->instret ? 200.0 * (double)total / (double)sim->instret : 0.0, (unsigned long long)sim->instret);
+    printf("--------------------------\n");
+}
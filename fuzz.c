@@ -0,0 +1,1352 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "riscv_sim.h"
+
+// Differential fuzzer.
+// Every case is a small random program: a prologue that loads random values into x1-x30 (edge values,
+// shift amounts, pointers into a data block, ...), a body of random RV32IMAC instructions (and, now and then,
+// random words, reserved encodings and CSR writes) with branches and jumps inside the body, run as a loop
+// counted down in x31 so its blocks get hot enough for the JIT, then an ECALL, followed by random data.
+// Each worker thread runs every case through its own simulators, one per execution mode, in-process and
+// reset between cases, and through the reference model below, an independent interpreter written from the
+// spec, and compares status, pc, registers, instret and every page the reference wrote. Runs are cut at a
+// random instruction budget, sometimes over several rv_step calls. The batch modes run the case in every
+// lane of a batch (see batch.c), each lane but the first with its own values in the registers the prologue
+// leaves alone, so the lanes branch apart and meet again, and compare each lane with a reference run of its
+// own.
+//
+// A failing case is shrunk (instructions deleted or replaced by NOPs, registers left at zero, fewer loop
+// iterations, data dropped) while it keeps failing the same way, and written as <prefix>.<n>.bin with the
+// reference's registers in <prefix>.<n>.res, the format of the tests. The case number and seed reproduce it.
+//
+// The reference follows the simulator where the spec leaves a choice: misaligned loads and stores work but
+// misaligned atomics trap, FENCE and FENCE.I ignore their other fields, SC.W succeeds while the word still
+// holds what LR.W read, ECALL/EBREAK/WFI ignore their rd/rs1 fields, and the only CSRs are the read-only
+// counters and mhartid (0, there is one hart). A jump or taken branch to itself and WFI halt as idle, since
+// nothing could ever wake the hart.
+
+#define NUM_REGISTERS 32
+#define MAX_BODY 48
+#define PROLOGUE_MAX (31 * 8)
+#define DATA_BASE 0x800               // after the longest prologue and body
+#define DATA_SIZE 512
+#define IMAGE_SIZE (DATA_BASE + DATA_SIZE)    // within the first page
+#define LOOP_REG 31
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1u << PAGE_SHIFT)
+
+// ---- Reference model ----
+
+typedef struct {
+    int32_t regs[NUM_REGISTERS];
+    uint32_t pc;
+    uint64_t instret;
+    uint32_t reservation, reservation_value; // of the last LR.W; reservation 1 (misaligned) is none
+    uint8_t *pages[1u << (32 - PAGE_SHIFT)];
+    uint32_t *touched;                // pages written, compared with the simulator's and freed by ref_reset
+    size_t num_touched, touched_capacity;
+} ref_t;
+
+static void ref_reset(ref_t *ref) {
+    for (size_t i = 0; i < ref->num_touched; i++) {
+        free(ref->pages[ref->touched[i]]);
+        ref->pages[ref->touched[i]] = NULL;
+    }
+    ref->num_touched = 0;
+    memset(ref->regs, 0, sizeof(ref->regs));
+    ref->pc = 0;
+    ref->instret = 0;
+    ref->reservation = 1;
+}
+
+static uint8_t ref_read8(const ref_t *ref, uint32_t address) {
+    const uint8_t *page = ref->pages[address >> PAGE_SHIFT];
+    return page ? page[address & (PAGE_SIZE - 1)] : 0;
+}
+
+static uint32_t ref_read(const ref_t *ref, uint32_t address, int size) {
+    uint32_t value = 0;
+
+    if ((address & (PAGE_SIZE - 1)) <= PAGE_SIZE - 4) {
+        const uint8_t *page = ref->pages[address >> PAGE_SHIFT];
+        if (!page) {
+            return 0;
+        }
+        memcpy(&value, page + (address & (PAGE_SIZE - 1)), 4);
+        return size == 4 ? value : value & ((1u << (8 * size)) - 1);
+    }
+    for (int i = 0; i < size; i++) {
+        value |= (uint32_t)ref_read8(ref, address + (uint32_t)i) << (8 * i);
+    }
+    return value;
+}
+
+static int ref_write8(ref_t *ref, uint32_t address, uint8_t value) {
+    uint8_t **page = &ref->pages[address >> PAGE_SHIFT];
+    if (!*page) {
+        if (ref->num_touched == ref->touched_capacity) {
+            size_t capacity = ref->touched_capacity ? ref->touched_capacity * 2 : 64;
+            uint32_t *touched = realloc(ref->touched, capacity * sizeof(uint32_t));
+            if (!touched) {
+                return 0;
+            }
+            ref->touched = touched;
+            ref->touched_capacity = capacity;
+        }
+        *page = calloc(1, PAGE_SIZE);
+        if (!*page) {
+            return 0;
+        }
+        ref->touched[ref->num_touched++] = address >> PAGE_SHIFT;
+    }
+    (*page)[address & (PAGE_SIZE - 1)] = value;
+    return 1;
+}
+
+static void ref_write(ref_t *ref, uint32_t address, uint32_t value, int size) {
+    for (int i = 0; i < size; i++) {
+        ref_write8(ref, address + (uint32_t)i, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+// An instruction in the form the reference executes
+typedef enum {
+    OP_ILLEGAL, OP_LUI, OP_AUIPC, OP_JAL, OP_JALR, OP_BRANCH, OP_LOAD, OP_STORE, OP_ALU, OP_ALU_IMM,
+    OP_CSR, OP_ECALL, OP_EBREAK, OP_WFI, OP_FENCE, OP_AMO
+} ref_op_t;
+
+typedef struct {
+    ref_op_t op;
+    int funct3;                       // which branch, load, store, ALU operation or CSR instruction
+    int alt;                          // SUB/SRA/SRAI, an M instruction for OP_ALU, funct5 for OP_AMO
+    int rd, rs1, rs2;
+    int32_t imm;
+    int length;
+} ref_insn_t;
+
+static int32_t sext(uint32_t value, int bits) {
+    uint32_t sign = 1u << (bits - 1);
+    return (int32_t)((value ^ sign) - sign);
+}
+
+static uint32_t bits(uint32_t word, int high, int low) {
+    return (word >> low) & ((1u << (high - low + 1)) - 1);
+}
+
+// Function to decode a 32-bit instruction
+static ref_insn_t ref_decode32(uint32_t w) {
+    ref_insn_t in = { OP_ILLEGAL, 0, 0, 0, 0, 0, 0, 4 };
+    int funct3 = (int)bits(w, 14, 12);
+    uint32_t funct7 = bits(w, 31, 25);
+
+    in.rd = (int)bits(w, 11, 7);
+    in.rs1 = (int)bits(w, 19, 15);
+    in.rs2 = (int)bits(w, 24, 20);
+    in.funct3 = funct3;
+    switch (bits(w, 6, 0)) {
+        case 0x37: in.op = OP_LUI; in.imm = (int32_t)(w & 0xFFFFF000u); break;
+        case 0x17: in.op = OP_AUIPC; in.imm = (int32_t)(w & 0xFFFFF000u); break;
+        case 0x6F:
+            in.op = OP_JAL;
+            in.imm = sext(bits(w, 31, 31) << 20 | bits(w, 19, 12) << 12 | bits(w, 20, 20) << 11 | bits(w, 30, 21) << 1, 21);
+            break;
+        case 0x67:
+            if (funct3 == 0) {
+                in.op = OP_JALR;
+                in.imm = sext(bits(w, 31, 20), 12);
+            }
+            break;
+        case 0x63:
+            if (funct3 != 2 && funct3 != 3) {
+                in.op = OP_BRANCH;
+                in.imm = sext(bits(w, 31, 31) << 12 | bits(w, 7, 7) << 11 | bits(w, 30, 25) << 5 | bits(w, 11, 8) << 1, 13);
+            }
+            break;
+        case 0x03:
+            if (funct3 != 3 && funct3 < 6) {
+                in.op = OP_LOAD;
+                in.imm = sext(bits(w, 31, 20), 12);
+            }
+            break;
+        case 0x23:
+            if (funct3 < 3) {
+                in.op = OP_STORE;
+                in.imm = sext(bits(w, 31, 25) << 5 | bits(w, 11, 7), 12);
+            }
+            break;
+        case 0x13:
+            in.imm = sext(bits(w, 31, 20), 12);
+            if (funct3 == 1) {
+                if (funct7 == 0) in.op = OP_ALU_IMM;
+            } else if (funct3 == 5) {
+                if (funct7 == 0 || funct7 == 0x20) in.op = OP_ALU_IMM;
+                in.alt = funct7 == 0x20;
+            } else {
+                in.op = OP_ALU_IMM;
+            }
+            if (funct3 == 1 || funct3 == 5) {
+                in.imm &= 0x1F;
+            }
+            break;
+        case 0x33:
+            if (funct7 == 0x01) {
+                in.op = OP_ALU;
+                in.alt = 2; // M extension
+            } else if (funct7 == 0 || (funct7 == 0x20 && (funct3 == 0 || funct3 == 5))) {
+                in.op = OP_ALU;
+                in.alt = funct7 == 0x20;
+            }
+            break;
+        case 0x0F:
+            if (funct3 == 0 || funct3 == 1) {
+                in.op = OP_FENCE;
+            }
+            break;
+        case 0x2F:
+            in.alt = (int)bits(w, 31, 27); // the AMOs are the multiples of 4, then SWAP 1, LR 2 and SC 3
+            if (funct3 == 2 && ((in.alt & 3) == 0 || in.alt == 1 || in.alt == 3 || (in.alt == 2 && in.rs2 == 0))) {
+                in.op = OP_AMO;
+            }
+            break;
+        case 0x73:
+            if (funct3 == 0) {
+                uint32_t funct12 = bits(w, 31, 20);
+                in.op = funct12 == 0 ? OP_ECALL : funct12 == 1 ? OP_EBREAK : funct12 == 0x105 ? OP_WFI : OP_ILLEGAL;
+            } else if (funct3 != 4) {
+                in.op = OP_CSR;
+                in.imm = (int32_t)bits(w, 31, 20);
+            }
+            break;
+        default:
+            break;
+    }
+    return in;
+}
+
+// Function to decode a 16-bit RV32C instruction straight from its fields
+static ref_insn_t ref_decode16(uint32_t c) {
+    ref_insn_t in = { OP_ILLEGAL, 0, 0, 0, 0, 0, 0, 2 };
+    int rd = (int)bits(c, 11, 7), rs2 = (int)bits(c, 6, 2);
+    int rd_prime = 8 + (int)bits(c, 4, 2), rs1_prime = 8 + (int)bits(c, 9, 7);
+    int32_t imm6 = sext(bits(c, 12, 12) << 5 | bits(c, 6, 2), 6);
+    uint32_t quadrant_funct3 = bits(c, 1, 0) << 3 | bits(c, 15, 13);
+    uint32_t uimm;
+
+    switch (quadrant_funct3) {
+        case 000: // C.ADDI4SPN
+            uimm = bits(c, 12, 11) << 4 | bits(c, 10, 7) << 6 | bits(c, 6, 6) << 2 | bits(c, 5, 5) << 3;
+            if (uimm) {
+                in = (ref_insn_t){ OP_ALU_IMM, 0, 0, rd_prime, 2, 0, (int32_t)uimm, 2 };
+            }
+            break;
+        case 002: // C.LW
+        case 006: // C.SW
+            uimm = bits(c, 12, 10) << 3 | bits(c, 6, 6) << 2 | bits(c, 5, 5) << 6;
+            in = (ref_insn_t){ quadrant_funct3 == 002 ? OP_LOAD : OP_STORE, 2, 0, rd_prime, rs1_prime, rd_prime,
+                               (int32_t)uimm, 2 };
+            break;
+        case 010: // C.ADDI, C.NOP
+            in = (ref_insn_t){ OP_ALU_IMM, 0, 0, rd, rd, 0, imm6, 2 };
+            break;
+        case 011: // C.JAL
+        case 015: // C.J
+            in.op = OP_JAL;
+            in.rd = quadrant_funct3 == 011 ? 1 : 0;
+            in.imm = sext(bits(c, 12, 12) << 11 | bits(c, 11, 11) << 4 | bits(c, 10, 9) << 8 | bits(c, 8, 8) << 10 |
+                          bits(c, 7, 7) << 6 | bits(c, 6, 6) << 7 | bits(c, 5, 3) << 1 | bits(c, 2, 2) << 5, 12);
+            break;
+        case 012: // C.LI
+            in = (ref_insn_t){ OP_ALU_IMM, 0, 0, rd, 0, 0, imm6, 2 };
+            break;
+        case 013:
+            if (rd == 2) { // C.ADDI16SP
+                int32_t imm = sext(bits(c, 12, 12) << 9 | bits(c, 6, 6) << 4 | bits(c, 5, 5) << 6 | bits(c, 4, 3) << 7 |
+                                   bits(c, 2, 2) << 5, 10);
+                if (imm) {
+                    in = (ref_insn_t){ OP_ALU_IMM, 0, 0, 2, 2, 0, imm, 2 };
+                }
+            } else if (imm6) { // C.LUI
+                in = (ref_insn_t){ OP_LUI, 0, 0, rd, 0, 0, (int32_t)((uint32_t)imm6 << 12), 2 };
+            }
+            break;
+        case 014:
+            switch (bits(c, 11, 10)) {
+                case 0: // C.SRLI
+                case 1: // C.SRAI
+                    if (!bits(c, 12, 12)) {
+                        in = (ref_insn_t){ OP_ALU_IMM, 5, (int)bits(c, 10, 10), rs1_prime, rs1_prime, 0, rs2, 2 };
+                    }
+                    break;
+                case 2: // C.ANDI
+                    in = (ref_insn_t){ OP_ALU_IMM, 7, 0, rs1_prime, rs1_prime, 0, imm6, 2 };
+                    break;
+                default: // C.SUB, C.XOR, C.OR, C.AND
+                    if (!bits(c, 12, 12)) {
+                        static const int funct3s[4] = { 0, 4, 6, 7 };
+                        int op = (int)bits(c, 6, 5);
+                        in = (ref_insn_t){ OP_ALU, funct3s[op], op == 0, rs1_prime, rs1_prime, rd_prime, 0, 2 };
+                    }
+                    break;
+            }
+            break;
+        case 016: // C.BEQZ
+        case 017: // C.BNEZ
+            in = (ref_insn_t){ OP_BRANCH, quadrant_funct3 == 016 ? 0 : 1, 0, 0, rs1_prime, 0,
+                               sext(bits(c, 12, 12) << 8 | bits(c, 11, 10) << 3 | bits(c, 6, 5) << 6 | bits(c, 4, 3) << 1 |
+                                    bits(c, 2, 2) << 5, 9), 2 };
+            break;
+        case 020: // C.SLLI
+            if (!bits(c, 12, 12)) {
+                in = (ref_insn_t){ OP_ALU_IMM, 1, 0, rd, rd, 0, rs2, 2 };
+            }
+            break;
+        case 022: // C.LWSP
+            if (rd) {
+                uimm = bits(c, 12, 12) << 5 | bits(c, 6, 4) << 2 | bits(c, 3, 2) << 6;
+                in = (ref_insn_t){ OP_LOAD, 2, 0, rd, 2, 0, (int32_t)uimm, 2 };
+            }
+            break;
+        case 024:
+            if (!bits(c, 12, 12)) {
+                if (rs2 == 0) {
+                    if (rd) { // C.JR
+                        in = (ref_insn_t){ OP_JALR, 0, 0, 0, rd, 0, 0, 2 };
+                    }
+                } else { // C.MV
+                    in = (ref_insn_t){ OP_ALU, 0, 0, rd, 0, rs2, 0, 2 };
+                }
+            } else if (rs2 == 0) {
+                in = rd ? (ref_insn_t){ OP_JALR, 0, 0, 1, rd, 0, 0, 2 } // C.JALR
+                        : (ref_insn_t){ OP_EBREAK, 0, 0, 0, 0, 0, 0, 2 };
+            } else { // C.ADD
+                in = (ref_insn_t){ OP_ALU, 0, 0, rd, rd, rs2, 0, 2 };
+            }
+            break;
+        case 026: // C.SWSP
+            uimm = bits(c, 12, 9) << 2 | bits(c, 8, 7) << 6;
+            in = (ref_insn_t){ OP_STORE, 2, 0, 0, 2, rs2, (int32_t)uimm, 2 };
+            break;
+        default: // floating point, reserved
+            break;
+    }
+    return in;
+}
+
+static uint32_t alu(int funct3, int alt, uint32_t a, uint32_t b) {
+    int32_t sa = (int32_t)a, sb = (int32_t)b;
+
+    if (alt == 2) {
+        switch (funct3) {
+            case 0: return a * b;
+            case 1: return (uint32_t)(((int64_t)sa * sb) >> 32);
+            case 2: return (uint32_t)(((int64_t)sa * (int64_t)(uint64_t)b) >> 32);
+            case 3: return (uint32_t)(((uint64_t)a * b) >> 32);
+            case 4: return b == 0 ? UINT32_MAX : (sa == INT32_MIN && sb == -1) ? a : (uint32_t)(sa / sb);
+            case 5: return b == 0 ? UINT32_MAX : a / b;
+            case 6: return b == 0 ? a : (sa == INT32_MIN && sb == -1) ? 0 : (uint32_t)(sa % sb);
+            default: return b == 0 ? a : a % b;
+        }
+    }
+    switch (funct3) {
+        case 0: return alt ? a - b : a + b;
+        case 1: return a << (b & 31);
+        case 2: return sa < sb;
+        case 3: return a < b;
+        case 4: return a ^ b;
+        case 5: return alt ? (uint32_t)(sa >> (b & 31)) : a >> (b & 31);
+        case 6: return a | b;
+        default: return a & b;
+    }
+}
+
+// Function to run one instruction. Returns RV_OK, or the halt/trap status with pc left on the instruction.
+static rv_status_t ref_step(ref_t *ref) {
+    uint32_t pc = ref->pc;
+    uint32_t word = ref_read(ref, pc, 2);
+    ref_insn_t in = (word & 3) == 3 ? ref_decode32(ref_read(ref, pc, 4)) : ref_decode16(word);
+    uint32_t a = (uint32_t)ref->regs[in.rs1], b = (uint32_t)ref->regs[in.rs2];
+    uint32_t next_pc = pc + (uint32_t)in.length;
+    uint32_t result = 0;
+    int writes = 1;
+
+    switch (in.op) {
+        case OP_ILLEGAL:
+            return RV_TRAP_ILLEGAL_INSTRUCTION;
+        case OP_ECALL:
+            return RV_HALT_ECALL;
+        case OP_EBREAK:
+            return RV_HALT_EBREAK;
+        case OP_WFI:
+            return RV_HALT_IDLE;
+        case OP_LUI:
+            result = (uint32_t)in.imm;
+            break;
+        case OP_AUIPC:
+            result = pc + (uint32_t)in.imm;
+            break;
+        case OP_JAL:
+            if (in.imm == 0) {
+                return RV_HALT_IDLE;
+            }
+            result = next_pc;
+            next_pc = pc + (uint32_t)in.imm;
+            break;
+        case OP_JALR:
+            result = next_pc;
+            next_pc = (a + (uint32_t)in.imm) & ~1u;
+            break;
+        case OP_BRANCH: {
+            int taken;
+            switch (in.funct3) {
+                case 0: taken = a == b; break;
+                case 1: taken = a != b; break;
+                case 4: taken = (int32_t)a < (int32_t)b; break;
+                case 5: taken = (int32_t)a >= (int32_t)b; break;
+                case 6: taken = a < b; break;
+                default: taken = a >= b; break;
+            }
+            if (taken && in.imm == 0) {
+                return RV_HALT_IDLE;
+            }
+            if (taken) {
+                next_pc = pc + (uint32_t)in.imm;
+            }
+            writes = 0;
+            break;
+        }
+        case OP_LOAD: {
+            uint32_t address = a + (uint32_t)in.imm;
+            switch (in.funct3) {
+                case 0: result = (uint32_t)sext(ref_read(ref, address, 1), 8); break;
+                case 1: result = (uint32_t)sext(ref_read(ref, address, 2), 16); break;
+                case 2: result = ref_read(ref, address, 4); break;
+                case 4: result = ref_read(ref, address, 1); break;
+                default: result = ref_read(ref, address, 2); break;
+            }
+            break;
+        }
+        case OP_STORE:
+            ref_write(ref, a + (uint32_t)in.imm, b, 1 << in.funct3);
+            writes = 0;
+            break;
+        case OP_ALU:
+            result = alu(in.funct3, in.alt, a, b);
+            break;
+        case OP_ALU_IMM:
+            switch (in.funct3) {
+                case 2: result = (int32_t)a < in.imm; break;
+                case 3: result = a < (uint32_t)in.imm; break;
+                default: result = alu(in.funct3, in.alt, a, (uint32_t)in.imm); break;
+            }
+            break;
+        case OP_CSR: {
+            int csr = in.imm;
+            int writes_csr = (in.funct3 & 3) == 1 || in.rs1 != 0; // CSRRW(I), or CSRRS(I)/CSRRC(I) with bits to change
+            if ((csr & ~0x82) != 0xC00 && (csr & ~0x81) != 0xC00 && csr != 0xF14) {
+                return RV_TRAP_ILLEGAL_INSTRUCTION; // not cycle/time/instret, their high halves or mhartid
+            }
+            if (writes_csr) {
+                return RV_TRAP_ILLEGAL_INSTRUCTION; // read-only
+            }
+            result = csr == 0xF14 ? 0 : (uint32_t)(csr & 0x80 ? ref->instret >> 32 : ref->instret);
+            break;
+        }
+        case OP_FENCE:
+            writes = 0;
+            break;
+        case OP_AMO: {
+            if (a & 3) {
+                return RV_TRAP_MISALIGNED;
+            }
+            uint32_t old = ref_read(ref, a, 4);
+            int32_t so = (int32_t)old, sb = (int32_t)b;
+            result = old;
+            switch (in.alt) {
+                case 0x02: // LR.W
+                    ref->reservation = a;
+                    ref->reservation_value = old;
+                    break;
+                case 0x03: // SC.W
+                    result = ref->reservation != a || old != ref->reservation_value;
+                    if (!result) {
+                        ref_write(ref, a, b, 4);
+                    }
+                    ref->reservation = 1;
+                    break;
+                case 0x01: ref_write(ref, a, b, 4); break;
+                case 0x00: ref_write(ref, a, old + b, 4); break;
+                case 0x04: ref_write(ref, a, old ^ b, 4); break;
+                case 0x0C: ref_write(ref, a, old & b, 4); break;
+                case 0x08: ref_write(ref, a, old | b, 4); break;
+                case 0x10: ref_write(ref, a, (uint32_t)(so < sb ? so : sb), 4); break;
+                case 0x14: ref_write(ref, a, (uint32_t)(so > sb ? so : sb), 4); break;
+                case 0x18: ref_write(ref, a, old < b ? old : b, 4); break;
+                default: ref_write(ref, a, old > b ? old : b, 4); break;
+            }
+            break;
+        }
+    }
+    if (writes && in.rd != 0) {
+        ref->regs[in.rd] = (int32_t)result;
+    }
+    ref->pc = next_pc;
+    ref->instret++;
+    return RV_OK;
+}
+
+// ---- Cases ----
+
+// Random number generator (xorshift64*), one per case so a case number reproduces its case
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Dull;
+}
+
+static uint32_t random_below(uint64_t *state, uint32_t limit) {
+    return (uint32_t)((next_random(state) >> 32) % limit);
+}
+
+typedef enum {
+    ITEM_PLAIN,                       // word as is
+    ITEM_BRANCH,                      // word plus the offset to target
+    ITEM_JAL,
+    ITEM_AUIPC_JALR,                  // auipc rs1, 0 and jalr with the offset to target (+ word's low bit)
+    ITEM_C_BRANCH,                    // C.BEQZ/C.BNEZ, a C.NOP when target is out of reach
+    ITEM_C_JUMP                       // C.J/C.JAL
+} item_kind_t;
+
+typedef struct {
+    item_kind_t kind;
+    uint32_t word;
+    int target;                       // body index; MAX_BODY is the loop end, MAX_BODY + 1 the ECALL
+} item_t;
+
+typedef struct {
+    int32_t init[NUM_REGISTERS];      // x1-x30 are set by the prologue when set[r]
+    uint8_t set[NUM_REGISTERS];
+    uint32_t iterations;
+    item_t body[MAX_BODY];
+    int num_items;
+    int has_data;
+    uint8_t data[DATA_SIZE];
+    uint64_t budget;
+    uint64_t chunks[3];               // rv_step counts, adding up to at least budget
+    int num_chunks;
+} fuzz_case_t;
+
+#define NOP_WORD 0x00000013u          // addi x0, x0, 0
+#define C_NOP 0x0001u
+
+static int item_size(const item_t *item) {
+    if (item->kind == ITEM_AUIPC_JALR) {
+        return 8;
+    }
+    return item->kind == ITEM_C_BRANCH || item->kind == ITEM_C_JUMP || (item->kind == ITEM_PLAIN && (item->word & 3) != 3) ? 2 : 4;
+}
+
+static uint32_t encode_i(uint32_t opcode, int rd, int funct3, int rs1, int32_t imm) {
+    return ((uint32_t)imm & 0xFFF) << 20 | (uint32_t)rs1 << 15 | (uint32_t)funct3 << 12 | (uint32_t)rd << 7 | opcode;
+}
+
+static uint32_t encode_b(uint32_t word, int32_t offset) {
+    uint32_t o = (uint32_t)offset;
+    return (word & 0x01FFF07Fu) | ((o >> 12) & 1) << 31 | ((o >> 5) & 0x3F) << 25 | ((o >> 1) & 0xF) << 8 | ((o >> 11) & 1) << 7;
+}
+
+static uint32_t encode_j(uint32_t word, int32_t offset) {
+    uint32_t o = (uint32_t)offset;
+    return (word & 0xFFFu) | ((o >> 20) & 1) << 31 | ((o >> 1) & 0x3FF) << 21 | ((o >> 11) & 1) << 20 | ((o >> 12) & 0xFF) << 12;
+}
+
+static uint32_t encode_c_branch(uint32_t half, int32_t offset) {
+    uint32_t o = (uint32_t)offset;
+    return (half & 0xE383u) | ((o >> 8) & 1) << 12 | ((o >> 3) & 3) << 10 | ((o >> 6) & 3) << 5 | ((o >> 1) & 3) << 3 | ((o >> 5) & 1) << 2;
+}
+
+static uint32_t encode_c_jump(uint32_t half, int32_t offset) {
+    uint32_t o = (uint32_t)offset;
+    return (half & 0xE003u) | ((o >> 11) & 1) << 12 | ((o >> 4) & 1) << 11 | ((o >> 8) & 3) << 9 | ((o >> 10) & 1) << 8 |
+           ((o >> 6) & 1) << 7 | ((o >> 7) & 1) << 6 | ((o >> 1) & 7) << 3 | ((o >> 5) & 1) << 2;
+}
+
+static size_t put(uint8_t *image, size_t at, uint32_t word, int size) {
+    for (int i = 0; i < size; i++) {
+        image[at + (size_t)i] = (uint8_t)(word >> (8 * i));
+    }
+    return at + (size_t)size;
+}
+
+// Function to lay the case out as a program image. Returns its size.
+static size_t build_image(const fuzz_case_t *fc, uint8_t image[IMAGE_SIZE]) {
+    uint32_t offsets[MAX_BODY + 2];
+    size_t at = 0;
+
+    memset(image, 0, IMAGE_SIZE);
+    for (int r = 1; r < LOOP_REG; r++) {
+        if (!fc->set[r]) {
+            continue;
+        }
+        uint32_t value = (uint32_t)fc->init[r];
+        uint32_t upper = (value + 0x800) & 0xFFFFF000u;
+        if (upper) {
+            at = put(image, at, upper | (uint32_t)r << 7 | 0x37, 4);                         // lui
+            at = put(image, at, encode_i(0x13, r, 0, r, (int32_t)(value - upper)), 4);       // addi
+        } else {
+            at = put(image, at, encode_i(0x13, r, 0, 0, (int32_t)value), 4);                 // addi from x0
+        }
+    }
+    at = put(image, at, encode_i(0x13, LOOP_REG, 0, 0, (int32_t)fc->iterations), 4);
+
+    uint32_t body = (uint32_t)at;
+    for (int i = 0; i < fc->num_items; i++) {
+        offsets[i] = (uint32_t)at;
+        at += (size_t)item_size(&fc->body[i]);
+    }
+    offsets[fc->num_items] = (uint32_t)at;          // loop end
+    offsets[fc->num_items + 1] = (uint32_t)at + 8;  // ECALL
+    for (int i = 0; i < fc->num_items; i++) {
+        const item_t *item = &fc->body[i];
+        int target = item->target >= MAX_BODY ? fc->num_items + (item->target - MAX_BODY) : item->target;
+        int32_t offset = (int32_t)(offsets[target] - offsets[i]);
+        size_t where = offsets[i];
+        switch (item->kind) {
+            case ITEM_PLAIN:
+                put(image, where, item->word, item_size(item));
+                break;
+            case ITEM_BRANCH:
+                put(image, where, encode_b(item->word, offset), 4);
+                break;
+            case ITEM_JAL:
+                put(image, where, encode_j(item->word, offset), 4);
+                break;
+            case ITEM_AUIPC_JALR: {
+                int base = (int)((item->word >> 15) & 0x1F);
+                put(image, where, (uint32_t)base << 7 | 0x17, 4);
+                put(image, where + 4, encode_i(0x67, (int)((item->word >> 7) & 0x1F), 0, base, offset + (int32_t)(item->word & 1)), 4);
+                break;
+            }
+            case ITEM_C_BRANCH:
+                put(image, where, offset >= -256 && offset < 256 ? encode_c_branch(item->word, offset) : C_NOP, 2);
+                break;
+            case ITEM_C_JUMP:
+                put(image, where, encode_c_jump(item->word, offset), 2);
+                break;
+        }
+    }
+    at = put(image, at, encode_i(0x13, LOOP_REG, 0, LOOP_REG, -1), 4);                          // addi x31, x31, -1
+    at = put(image, at, encode_b(0x63 | 1 << 12 | LOOP_REG << 15, (int32_t)(body - at)), 4);    // bne x31, x0, body
+    at = put(image, at, 0x00000073, 4);                                                           // ecall
+    if (!fc->has_data) {
+        return at;
+    }
+    memcpy(image + DATA_BASE, fc->data, DATA_SIZE);
+    return IMAGE_SIZE;
+}
+
+static int32_t random_value(uint64_t *rng) {
+    static const int32_t edges[] = {
+        0, 1, -1, 2, INT32_MIN, INT32_MAX, 0x7FF, 0x800, -2048, -2049, 31, 32, 33, 0x80, 0xFF, 0xFFFF, 0x10000,
+        (int32_t)0x80000001, 0x7FFFFFFE
+    };
+    switch (random_below(rng, 8)) {
+        case 0: return (int32_t)random_below(rng, 33) - 16;
+        case 1: return edges[random_below(rng, sizeof(edges) / sizeof(edges[0]))];
+        case 2:
+        case 3: return DATA_BASE + (int32_t)random_below(rng, DATA_SIZE);
+        case 4: return (int32_t)random_below(rng, 64);
+        case 5: return (int32_t)((1u << random_below(rng, 32)) - random_below(rng, 2));
+        case 6: return sext(random_below(rng, 4096), 12);
+        default: return (int32_t)(uint32_t)next_random(rng);
+    }
+}
+
+static int32_t random_imm12(uint64_t *rng) {
+    static const int32_t edges[] = { 0, 1, -1, 2047, -2048, 31, 32, -32, 4, -4 };
+    switch (random_below(rng, 4)) {
+        case 0: return edges[random_below(rng, sizeof(edges) / sizeof(edges[0]))];
+        case 1: return sext(random_below(rng, 4096), 12);
+        default: return (int32_t)random_below(rng, 129) - 64;
+    }
+}
+
+// rd for generated instructions: anything but the loop counter
+static int random_rd(uint64_t *rng) {
+    return (int)random_below(rng, LOOP_REG);
+}
+
+static int random_rs(uint64_t *rng) {
+    return (int)random_below(rng, NUM_REGISTERS);
+}
+
+static int random_target(uint64_t *rng, int num_items) {
+    int target = (int)random_below(rng, (uint32_t)num_items + 2);
+    return target >= num_items ? MAX_BODY + (target - num_items) : target;
+}
+
+// Function to make a 16-bit instruction: a valid encoding of a random RV32C instruction with random fields
+// (HINTs and reserved values included), or now and then any halfword
+static item_t random_compressed(uint64_t *rng, int num_items) {
+    static const uint16_t formats[] = { // quadrant | funct3 << 13 of the encodings worth generating
+        0x0000, 0x4000, 0xC000, 0x0001, 0x2001, 0x4001, 0x6001, 0x8001, 0xA001, 0xC001, 0xE001,
+        0x0002, 0x4002, 0x8002, 0xC002
+    };
+    item_t item = { ITEM_PLAIN, 0, 0 };
+    uint32_t half = (uint32_t)next_random(rng) & 0xFFFF;
+
+    if (random_below(rng, 50) == 0) {
+        item.word = (half & 3) == 3 ? half & ~1u : half;
+        return item;
+    }
+    half = (half & 0x1FFC) | formats[random_below(rng, sizeof(formats) / sizeof(formats[0]))];
+    uint32_t quadrant_funct3 = (half & 3) << 3 | half >> 13;
+    int full_rd = quadrant_funct3 == 010 || quadrant_funct3 == 012 || quadrant_funct3 == 013 ||
+                  quadrant_funct3 == 020 || quadrant_funct3 == 022 || quadrant_funct3 == 024;
+    if (full_rd && ((half >> 7) & 0x1F) == LOOP_REG) {
+        half ^= 1u << 7; // x30
+    }
+    if (quadrant_funct3 == 024 && ((half >> 2) & 0x1F) == 0 && random_below(rng, 4) != 0) {
+        half |= (uint32_t)(1 + random_below(rng, 30)) << 2; // mostly C.MV/C.ADD rather than C.JR/C.JALR to anywhere
+    }
+    item.word = half;
+    if (quadrant_funct3 == 011 || quadrant_funct3 == 015) {
+        item.kind = ITEM_C_JUMP;
+        item.target = random_target(rng, num_items);
+    } else if (quadrant_funct3 == 016 || quadrant_funct3 == 017) {
+        item.kind = ITEM_C_BRANCH;
+        item.target = random_target(rng, num_items);
+    }
+    return item;
+}
+
+static item_t random_item(uint64_t *rng, int num_items, int rvc) {
+    static const int load_funct3s[] = { 0, 1, 2, 4, 5 };
+    static const int branch_funct3s[] = { 0, 1, 4, 5, 6, 7 };
+    static const int counters[] = { 0xC00, 0xC01, 0xC02, 0xC80, 0xC81, 0xC82, 0xF14 };
+    static const uint32_t amo_funct5s[] = { 0x02, 0x03, 0x01, 0x00, 0x04, 0x0C, 0x08, 0x10, 0x14, 0x18, 0x1C };
+    item_t item = { ITEM_PLAIN, 0, 0 };
+    int rd = random_rd(rng), rs1 = random_rs(rng), rs2 = random_rs(rng);
+    uint32_t pick = random_below(rng, 1000);
+
+    if (rvc && random_below(rng, 3) == 0) {
+        return random_compressed(rng, num_items);
+    }
+    if (pick < 250) { // OP and M
+        uint32_t funct3 = random_below(rng, 8);
+        uint32_t funct7 = random_below(rng, 3) == 0 ? 0x01 : ((funct3 == 0 || funct3 == 5) && random_below(rng, 2) ? 0x20 : 0);
+        if (random_below(rng, 50) == 0) {
+            funct7 = random_below(rng, 128);
+        }
+        item.word = funct7 << 25 | (uint32_t)rs2 << 20 | (uint32_t)rs1 << 15 | funct3 << 12 | (uint32_t)rd << 7 | 0x33;
+    } else if (pick < 450) { // OP-IMM
+        int funct3 = (int)random_below(rng, 8);
+        int32_t imm = random_imm12(rng);
+        if (funct3 == 1 || funct3 == 5) {
+            imm = (int32_t)random_below(rng, 32) | (funct3 == 5 && random_below(rng, 2) ? 0x400 : 0);
+            if (random_below(rng, 50) == 0) {
+                imm = (int32_t)random_below(rng, 4096);
+            }
+        }
+        item.word = encode_i(0x13, rd, funct3, rs1, imm);
+    } else if (pick < 500) { // LUI, AUIPC
+        item.word = (uint32_t)next_random(rng) & 0xFFFFF000u;
+        item.word |= (uint32_t)rd << 7 | (random_below(rng, 2) ? 0x37 : 0x17);
+    } else if (pick < 600) { // loads
+        int funct3 = random_below(rng, 40) ? load_funct3s[random_below(rng, 5)] : (int)random_below(rng, 8);
+        item.word = encode_i(0x03, rd, funct3, rs1, random_imm12(rng));
+    } else if (pick < 630) { // atomics, with any aq/rl bits, and fences
+        uint32_t funct5 = random_below(rng, 40) ? amo_funct5s[random_below(rng, 11)] : random_below(rng, 32);
+        uint32_t funct3 = random_below(rng, 40) ? 2 : random_below(rng, 8);
+        int source = funct5 == 0x02 && random_below(rng, 10) ? 0 : rs2;
+        item.word = funct5 << 27 | random_below(rng, 4) << 25 | (uint32_t)source << 20 | (uint32_t)rs1 << 15 |
+                    funct3 << 12 | (uint32_t)rd << 7 | 0x2F;
+        if (random_below(rng, 6) == 0) {
+            item.word = ((uint32_t)next_random(rng) & 0xFFF00000u) | (uint32_t)rs1 << 15 | random_below(rng, 3) << 12 |
+                        (uint32_t)rd << 7 | 0x0F;
+        }
+    } else if (pick < 720) { // stores
+        uint32_t funct3 = random_below(rng, 40) ? random_below(rng, 3) : random_below(rng, 8);
+        uint32_t imm = (uint32_t)random_imm12(rng);
+        item.word = (imm >> 5) << 25 | (uint32_t)rs2 << 20 | (uint32_t)rs1 << 15 | funct3 << 12 | (imm & 0x1F) << 7 | 0x23;
+    } else if (pick < 840) { // branches
+        int funct3 = random_below(rng, 40) ? branch_funct3s[random_below(rng, 6)] : (int)random_below(rng, 8);
+        item.kind = ITEM_BRANCH;
+        item.word = (uint32_t)rs2 << 20 | (uint32_t)rs1 << 15 | (uint32_t)funct3 << 12 | 0x63;
+        item.target = random_target(rng, num_items);
+    } else if (pick < 880) { // JAL
+        item.kind = ITEM_JAL;
+        item.word = (uint32_t)(random_below(rng, 2) ? 1 : rd) << 7 | 0x6F;
+        item.target = random_target(rng, num_items);
+    } else if (pick < 910) { // AUIPC + JALR to a body target, sometimes with bit 0 set
+        int base = 1 + (int)random_below(rng, LOOP_REG - 1);
+        item.kind = ITEM_AUIPC_JALR;
+        item.word = (uint32_t)base << 15 | (uint32_t)(random_below(rng, 2) ? 1 : rd) << 7 | random_below(rng, 2);
+        item.target = random_target(rng, num_items);
+    } else if (pick < 950) { // counters, mostly read
+        int funct3 = random_below(rng, 4) ? 2 + (int)random_below(rng, 2) * 4 : (int)random_below(rng, 8);
+        int csr = random_below(rng, 10) ? counters[random_below(rng, 7)] : (int)random_below(rng, 4096);
+        int source = random_below(rng, 10) ? 0 : rs1;
+        item.word = encode_i(0x73, rd, funct3, source, csr);
+    } else if (pick < 955) { // ECALL, EBREAK
+        item.word = random_below(rng, 2) ? 0x00000073 : 0x00100073;
+    } else if (pick < 970) { // any word
+        item.word = (uint32_t)next_random(rng) | 3;
+    } else { // a JALR through a random register, mostly to zeros and an illegal instruction
+        item.word = encode_i(0x67, rd, 0, rs1, random_imm12(rng));
+    }
+    return item;
+}
+
+// Function to make the second instruction of an idiom the threaded core fuses (see fusion.c) when first
+// can start one, so the fused handlers see all kinds of operands and branch targets, or the SC.W that
+// completes an LR.W. Returns 0 if it can't.
+static int fusion_partner(uint64_t *rng, item_t *first, int num_items, int rvc, item_t *second) {
+    uint32_t word = first->word;
+    uint32_t opcode = word & 0x7F, funct3 = (word >> 12) & 7;
+    int rd = (int)((word >> 7) & 0x1F);
+    int rd2 = random_below(rng, 2) ? rd : random_rd(rng);
+
+    if (first->kind != ITEM_PLAIN || (word & 3) != 3 || rd == 0) {
+        return 0;
+    }
+    *second = (item_t){ ITEM_PLAIN, 0, 0 };
+    if ((opcode == 0x33 && (word >> 25) == 0 && (funct3 == 2 || funct3 == 3)) ||
+        (opcode == 0x13 && (funct3 == 2 || funct3 == 3))) { // SLT(I)(U), then BEQZ/BNEZ on its result
+        second->target = random_target(rng, num_items);
+        if (rvc && rd >= 8 && rd < 16 && random_below(rng, 2)) {
+            second->kind = ITEM_C_BRANCH;
+            second->word = (random_below(rng, 2) ? 0xE001u : 0xC001u) | (uint32_t)(rd - 8) << 7;
+        } else {
+            second->kind = ITEM_BRANCH;
+            second->word = (random_below(rng, 2) ? (uint32_t)rd << 15 : (uint32_t)rd << 20) | random_below(rng, 2) << 12 | 0x63;
+        }
+    } else if (opcode == 0x13 && funct3 == 1 && (word >> 25) == 0) { // SLLI, then SRLI/SRAI
+        second->word = encode_i(0x13, rd2, 5, rd, (int32_t)random_below(rng, 32) | (random_below(rng, 2) ? 0x400 : 0));
+    } else if (opcode == 0x2F && (word >> 27) == 0x02) { // LR.W, then SC.W to the same address
+        second->word = 0x03u << 27 | random_below(rng, 4) << 25 | (uint32_t)random_rs(rng) << 20 | (word & 0x1F << 15) |
+                       2 << 12 | (uint32_t)rd2 << 7 | 0x2F;
+    } else if (opcode == 0x37) { // LUI, then ADDI
+        second->word = encode_i(0x13, rd2, 0, rd, random_imm12(rng));
+    } else if (opcode == 0x17) { // AUIPC, then LW, mostly from the program and its data
+        if (random_below(rng, 4)) {
+            first->word &= 0xFFF;
+        }
+        second->word = encode_i(0x03, rd2, 2, rd, random_imm12(rng) + (random_below(rng, 2) ? DATA_BASE / 2 : 0));
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static void generate_case(fuzz_case_t *fc, uint64_t seed, uint64_t budget) {
+    uint64_t rng = seed * 0x9E3779B97F4A7C15ull + 0x632BE59BD9B4E019ull;
+    int rvc = random_below(&rng, 2);
+
+    memset(fc, 0, sizeof(*fc));
+    for (int r = 1; r < LOOP_REG; r++) {
+        fc->set[r] = random_below(&rng, 4) != 0;
+        fc->init[r] = fc->set[r] ? random_value(&rng) : 0;
+    }
+    fc->iterations = 1 + random_below(&rng, 40);
+    fc->num_items = 1 + (int)random_below(&rng, MAX_BODY);
+    for (int i = 0; i < fc->num_items; i++) {
+        if (i > 0 && random_below(&rng, 2) && fusion_partner(&rng, &fc->body[i - 1], fc->num_items, rvc, &fc->body[i])) {
+            continue;
+        }
+        fc->body[i] = random_item(&rng, fc->num_items, rvc);
+    }
+    fc->has_data = 1;
+    for (int i = 0; i < DATA_SIZE; i++) {
+        fc->data[i] = (uint8_t)next_random(&rng);
+    }
+    fc->budget = 1 + random_below(&rng, (uint32_t)budget);
+    fc->num_chunks = 1 + (int)random_below(&rng, 3);
+    uint64_t left = fc->budget;
+    for (int i = 0; i < fc->num_chunks - 1; i++) {
+        fc->chunks[i] = random_below(&rng, (uint32_t)left + 1);
+        left -= fc->chunks[i];
+    }
+    fc->chunks[fc->num_chunks - 1] = left;
+}
+
+// ---- Running and comparing ----
+
+typedef struct {
+    const char *name;
+    rv_core_t core;
+    int instrumented;                 // run the instrumented variant (statistics on)
+    int batch;                        // run in a batch with isa instead
+    rv_batch_isa_t isa;
+} fuzz_mode_t;
+
+static const fuzz_mode_t all_modes[] = {
+    { "switch", RV_CORE_SWITCH, 0, 0, RV_BATCH_AUTO },
+    { "threaded", RV_CORE_THREADED, 0, 0, RV_BATCH_AUTO },
+    { "jit", RV_CORE_JIT, 0, 0, RV_BATCH_AUTO },
+    { "threaded+stats", RV_CORE_THREADED, 1, 0, RV_BATCH_AUTO },
+    { "batch", RV_CORE_SWITCH, 0, 1, RV_BATCH_AUTO },
+    { "batch-scalar", RV_CORE_SWITCH, 0, 1, RV_BATCH_SCALAR },
+};
+#define NUM_MODES (int)(sizeof(all_modes) / sizeof(all_modes[0]))
+
+typedef struct {
+    ref_t *ref;
+    rv_sim_t *sims[NUM_MODES];
+    rv_batch_t *batches[NUM_MODES];   // for the batch modes
+    rv_status_t ref_status;
+    uint8_t image[IMAGE_SIZE];
+    uint8_t page[PAGE_SIZE];
+    uint64_t instructions;            // reference instructions run
+} worker_t;
+
+static int modes_enabled[NUM_MODES] = { 1, 1, 1, 1, 0, 0 }; // the batch modes run 16 references a case, so only on request
+static uint64_t max_budget = 2000;
+
+// Function to make the value batch lane lane starts with in register r: 0 in lane 0, a small number or a
+// pointer into the data block in the others
+static int32_t lane_value(unsigned lane, unsigned r) {
+    uint32_t mix = lane * 0x9E3779B9u ^ r * 0x85EBCA6Bu;
+
+    if (lane == 0) {
+        return 0;
+    }
+    mix ^= mix >> 15;
+    mix *= 0x2C1B3C6Du;
+    mix ^= mix >> 12;
+    return mix & 1 ? (int32_t)(mix >> 28) - 8 : (int32_t)(DATA_BASE + ((mix >> 8) & (DATA_SIZE - 4)));
+}
+
+// Function to run the case on the reference, with the registers of batch lane lane
+static void run_reference(worker_t *w, const fuzz_case_t *fc, size_t size, unsigned lane) {
+    ref_t *ref = w->ref;
+    rv_status_t status = RV_OK;
+
+    ref_reset(ref);
+    ref_write8(ref, 0, 0); // the image fits in page 0
+    memcpy(ref->pages[0], w->image, size);
+    for (unsigned r = 1; r < NUM_REGISTERS; r++) {
+        ref->regs[r] = lane_value(lane, r);
+    }
+    for (uint64_t n = 0; n < fc->budget && status == RV_OK; n++) {
+        status = ref_step(ref);
+    }
+    w->ref_status = status;
+}
+
+// Function to compare a simulator that ended with status with the reference. Returns 1 if they agree;
+// otherwise describes the first difference in what.
+static int compare(worker_t *w, rv_sim_t *sim, rv_status_t status, char *what, size_t what_size) {
+    const ref_t *ref = w->ref;
+
+    if (status != w->ref_status) {
+        snprintf(what, what_size, "status %d, reference %d (%s)", (int)status, (int)w->ref_status, rv_get_trap(sim)->message);
+        return 0;
+    }
+    if (rv_get_pc(sim) != ref->pc) {
+        snprintf(what, what_size, "pc 0x%08X, reference 0x%08X", rv_get_pc(sim), ref->pc);
+        return 0;
+    }
+    if (rv_get_instret(sim) != ref->instret) {
+        snprintf(what, what_size, "instret %llu, reference %llu", (unsigned long long)rv_get_instret(sim),
+                 (unsigned long long)ref->instret);
+        return 0;
+    }
+    for (unsigned r = 0; r < NUM_REGISTERS; r++) {
+        if (rv_get_reg(sim, r) != ref->regs[r]) {
+            snprintf(what, what_size, "x%u = 0x%08X, reference 0x%08X", r, (uint32_t)rv_get_reg(sim, r), (uint32_t)ref->regs[r]);
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < ref->num_touched; i++) {
+        uint32_t address = ref->touched[i] << PAGE_SHIFT;
+        rv_read_mem(sim, address, w->page, PAGE_SIZE);
+        if (memcmp(w->page, ref->pages[ref->touched[i]], PAGE_SIZE) != 0) {
+            uint32_t at = 0;
+            while (w->page[at] == ref->pages[ref->touched[i]][at]) {
+                at++;
+            }
+            snprintf(what, what_size, "memory at 0x%08X = 0x%02X, reference 0x%02X", address + at, w->page[at],
+                     ref->pages[ref->touched[i]][at]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Function to run the case in every lane of a batch and compare each lane with its reference run, starting
+// with lane 0's (the case as it is) already in the reference and leaving it there
+static int run_batch(worker_t *w, int m, size_t size, const fuzz_case_t *fc, char *what, size_t what_size) {
+    rv_batch_t *batch = w->batches[m];
+    unsigned lanes = rv_batch_get_lanes(batch);
+    int agree = 1;
+
+    rv_batch_load_buffer(batch, w->image, size, 0);
+    for (unsigned l = 0; l < lanes; l++) {
+        for (unsigned r = 1; r < NUM_REGISTERS; r++) {
+            rv_set_reg(rv_batch_lane(batch, l), r, lane_value(l, r));
+        }
+    }
+    for (int i = 0; i < fc->num_chunks; i++) {
+        if (fc->chunks[i] && rv_batch_run(batch, fc->chunks[i]) == 0) {
+            break;
+        }
+    }
+
+    for (unsigned l = 0; l < lanes && agree; l++) {
+        rv_sim_t *lane = rv_batch_lane(batch, l);
+        if (l > 0) {
+            run_reference(w, fc, size, l);
+        }
+        if (!compare(w, lane, rv_get_trap(lane)->status, what, what_size)) {
+            size_t length = strlen(what);
+            snprintf(what + length, what_size - length, " in lane %u", l);
+            agree = 0;
+        }
+    }
+    if (lanes > 1) {
+        run_reference(w, fc, size, 0);
+    }
+    return agree;
+}
+
+// Function to run the case in a mode and compare it with the reference. Returns 1 if they agree; otherwise
+// describes the first difference in what.
+static int run_mode(worker_t *w, int m, size_t size, const fuzz_case_t *fc, char *what, size_t what_size) {
+    rv_sim_t *sim = w->sims[m];
+    rv_status_t status = RV_OK;
+
+    if (all_modes[m].batch) {
+        return run_batch(w, m, size, fc, what, what_size);
+    }
+    rv_reset(sim);
+    if (all_modes[m].instrumented) {
+        rv_set_stats(sim, 1);
+    }
+    rv_load_buffer(sim, w->image, size, 0);
+    for (int i = 0; i < fc->num_chunks && status == RV_OK; i++) {
+        if (fc->chunks[i]) {
+            status = rv_step(sim, fc->chunks[i]);
+        }
+    }
+    return compare(w, sim, status, what, what_size);
+}
+
+// Function to tell whether the case still fails in mode m (and still halts, if halted is set)
+static int still_fails(worker_t *w, const fuzz_case_t *fc, int m, int halted) {
+    char what[256];
+    size_t size = build_image(fc, w->image);
+
+    run_reference(w, fc, size, 0);
+    if (halted && w->ref_status == RV_OK) {
+        return 0;
+    }
+    return !run_mode(w, m, size, fc, what, sizeof(what));
+}
+
+// Function to shrink a case failing in mode m while it keeps failing
+static void shrink_case(worker_t *w, fuzz_case_t *fc, int m) {
+    fuzz_case_t trial;
+    int halted;
+    int progress = 1;
+
+    run_reference(w, fc, build_image(fc, w->image), 0);
+    halted = w->ref_status != RV_OK; // a case that halts can become a test, keep it halting
+
+    // one rv_step call with the budget, or no budget at all once it halts
+    trial = *fc;
+    trial.num_chunks = 1;
+    trial.chunks[0] = trial.budget;
+    if (still_fails(w, &trial, m, halted)) {
+        *fc = trial;
+    }
+    while (progress) {
+        progress = 0;
+        // delete instructions, keeping the targets of the others
+        for (int i = fc->num_items - 1; i >= 0; i--) {
+            trial = *fc;
+            for (int j = i; j < trial.num_items - 1; j++) {
+                trial.body[j] = trial.body[j + 1];
+            }
+            trial.num_items--;
+            for (int j = 0; j < trial.num_items; j++) {
+                if (trial.body[j].kind != ITEM_PLAIN && trial.body[j].target > i && trial.body[j].target < MAX_BODY) {
+                    trial.body[j].target--;
+                }
+                if (trial.body[j].kind != ITEM_PLAIN && trial.body[j].target == trial.num_items) {
+                    trial.body[j].target = MAX_BODY; // the deleted instruction was the last one
+                }
+            }
+            if (trial.num_items > 0 && still_fails(w, &trial, m, halted)) {
+                *fc = trial;
+                progress = 1;
+            }
+        }
+        // leave registers at zero
+        for (int r = 1; r < LOOP_REG; r++) {
+            if (!fc->set[r]) {
+                continue;
+            }
+            trial = *fc;
+            trial.set[r] = 0;
+            trial.init[r] = 0;
+            if (still_fails(w, &trial, m, halted)) {
+                *fc = trial;
+                progress = 1;
+            }
+        }
+        // fewer iterations
+        while (fc->iterations > 1) {
+            trial = *fc;
+            trial.iterations = fc->iterations / 2;
+            if (!still_fails(w, &trial, m, halted)) {
+                trial.iterations = fc->iterations - 1;
+                if (!still_fails(w, &trial, m, halted)) {
+                    break;
+                }
+            }
+            *fc = trial;
+            progress = 1;
+        }
+        // no data
+        if (fc->has_data) {
+            trial = *fc;
+            trial.has_data = 0;
+            if (still_fails(w, &trial, m, halted)) {
+                *fc = trial;
+                progress = 1;
+            }
+        }
+    }
+    // the smallest budget that still fails
+    if (!halted) {
+        uint64_t low = 1, high = fc->budget;
+        while (low < high) {
+            trial = *fc;
+            trial.budget = trial.chunks[0] = low + (high - low) / 2;
+            trial.num_chunks = 1;
+            if (still_fails(w, &trial, m, halted)) {
+                high = trial.budget;
+            } else {
+                low = trial.budget + 1;
+            }
+        }
+        fc->budget = fc->chunks[0] = high;
+        fc->num_chunks = 1;
+    }
+}
+
+// ---- Driver ----
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t next_case, num_cases = 1000000, base_seed = 1;
+static double deadline;
+static int max_failures = 1, failures;
+static volatile int stop;
+static const char *out_prefix = "fuzz-fail";
+static uint64_t total_instructions;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to write the shrunk case as a test and describe it
+static void report_failure(worker_t *w, const fuzz_case_t *original, uint64_t index, int m, const char *what) {
+    fuzz_case_t fc = *original;
+    char path[512], shrunk_what[256] = "";
+
+    shrink_case(w, &fc, m);
+    size_t size = build_image(&fc, w->image);
+    run_reference(w, &fc, size, 0);
+    run_mode(w, m, size, &fc, shrunk_what, sizeof(shrunk_what));
+
+    pthread_mutex_lock(&report_lock);
+    int n = ++failures;
+    printf("FAIL case %llu (seed %llu) in %s: %s\n", (unsigned long long)index, (unsigned long long)base_seed,
+           all_modes[m].name, what);
+    printf("     shrunk to %d instructions, %u iterations: %s\n", fc.num_items, fc.iterations, shrunk_what);
+    snprintf(path, sizeof(path), "%s.%d.bin", out_prefix, n);
+    FILE *file = fopen(path, "wb");
+    if (file) {
+        fwrite(w->image, 1, size, file);
+        fclose(file);
+        printf("     %s", path);
+    } else {
+        printf("     cannot write %s: %s", path, strerror(errno));
+    }
+    snprintf(path, sizeof(path), "%s.%d.res", out_prefix, n);
+    file = fopen(path, "wb");
+    if (file) {
+        fwrite(w->ref->regs, sizeof(int32_t), NUM_REGISTERS, file);
+        fclose(file);
+        printf(", %s", path);
+    }
+    if (w->ref_status == RV_OK) {
+        printf(" (stops after %llu instructions, run with --max-insns=%llu)", (unsigned long long)fc.budget,
+               (unsigned long long)fc.budget);
+    }
+    printf("\n");
+    if (failures >= max_failures) {
+        stop = 1;
+    }
+    pthread_mutex_unlock(&report_lock);
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    fuzz_case_t fc;
+    char what[256];
+
+    while (!stop) {
+        uint64_t index = __atomic_fetch_add(&next_case, 1, __ATOMIC_RELAXED);
+        if (index >= num_cases || (deadline && (index & 255) == 0 && now_seconds() > deadline)) {
+            break;
+        }
+        generate_case(&fc, base_seed ^ (index * 0xD6E8FEB86659FD93ull), max_budget);
+        size_t size = build_image(&fc, w->image);
+        run_reference(w, &fc, size, 0);
+        w->instructions += w->ref->instret;
+        for (int m = 0; m < NUM_MODES; m++) {
+            if (modes_enabled[m] && !run_mode(w, m, size, &fc, what, sizeof(what))) {
+                report_failure(w, &fc, index, m, what);
+                break;
+            }
+        }
+    }
+    __atomic_fetch_add(&total_instructions, w->instructions, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+//          Main function
+int main(int argc, char *argv[]) {
+    int num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int usage_error = 0;
+    int only_case = 0;
+    uint64_t case_index = 0;
+    double seconds = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--cases=", 8) == 0) {
+            num_cases = strtoull(argv[i] + 8, NULL, 0);
+        } else if (strncmp(argv[i], "--seconds=", 10) == 0) {
+            seconds = atof(argv[i] + 10);
+            usage_error |= seconds <= 0;
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            base_seed = strtoull(argv[i] + 7, NULL, 0);
+        } else if (strncmp(argv[i], "--case=", 7) == 0) {
+            only_case = 1;
+            case_index = strtoull(argv[i] + 7, NULL, 0);
+        } else if (strncmp(argv[i], "--budget=", 9) == 0) {
+            max_budget = strtoull(argv[i] + 9, NULL, 0);
+            usage_error |= max_budget == 0 || max_budget > UINT32_MAX;
+        } else if (strncmp(argv[i], "--failures=", 11) == 0) {
+            max_failures = atoi(argv[i] + 11);
+            usage_error |= max_failures < 1;
+        } else if (strncmp(argv[i], "--out=", 6) == 0) {
+            out_prefix = argv[i] + 6;
+        } else if (strncmp(argv[i], "--core=", 7) == 0) {
+            int found = 0;
+            for (int m = 0; m < NUM_MODES; m++) {
+                if (strcmp(argv[i] + 7, all_modes[m].name) == 0) {
+                    memset(modes_enabled, 0, sizeof(modes_enabled));
+                    modes_enabled[m] = found = 1;
+                }
+            }
+            usage_error |= !found;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            num_workers = atoi(argv[i] + 2);
+            usage_error |= num_workers < 1;
+        } else {
+            usage_error = 1;
+        }
+    }
+    if (usage_error) {
+        printf("Usage: %s [--cases=<n>] [--seconds=<s>] [--seed=<n>] [--case=<n>] [--budget=<instructions>]\n"
+               "       [--core=switch|threaded|jit|threaded+stats|batch|batch-scalar] [--failures=<n>] [--out=<prefix>] [-j<threads>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+    if (only_case) {
+        next_case = case_index;
+        num_cases = case_index + 1;
+        num_workers = 1;
+    }
+
+    worker_t *workers = calloc(num_workers, sizeof(worker_t));
+    pthread_t *threads = calloc(num_workers, sizeof(pthread_t));
+    if (!workers || !threads) {
+        printf("Failed to allocate worker threads\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < num_workers; i++) {
+        workers[i].ref = calloc(1, sizeof(ref_t));
+        for (int m = 0; m < NUM_MODES; m++) {
+            workers[i].sims[m] = rv_create();
+            if (!workers[i].sims[m] || rv_set_core(workers[i].sims[m], all_modes[m].core) != RV_OK) {
+                printf("Failed to allocate simulators\n");
+                return EXIT_FAILURE;
+            }
+            if (all_modes[m].batch) {
+                workers[i].batches[m] = rv_batch_create(RV_BATCH_MAX_LANES);
+                if (!workers[i].batches[m]) {
+                    printf("Failed to allocate simulators\n");
+                    return EXIT_FAILURE;
+                }
+                rv_batch_set_isa(workers[i].batches[m], all_modes[m].isa);
+            }
+        }
+        if (!workers[i].ref) {
+            printf("Failed to allocate the reference model\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    double start = now_seconds();
+    if (seconds > 0) {
+        deadline = start + seconds;
+    }
+    for (int i = 0; i < num_workers; i++) {
+        if (pthread_create(&threads[i], NULL, worker_main, &workers[i]) != 0) {
+            threads[i] = 0;
+            worker_main(&workers[i]); // run the share here instead
+        }
+    }
+    for (int i = 0; i < num_workers; i++) {
+        if (threads[i]) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    double wall_seconds = now_seconds() - start;
+
+    uint64_t run = next_case - (only_case ? case_index : 0);
+    if (run > num_cases - (only_case ? case_index : 0)) {
+        run = num_cases - (only_case ? case_index : 0);
+    }
+    printf("%llu cases, %d failed, %llu instructions per mode in %.1f s on %d threads (%.0f cases/s)\n",
+           (unsigned long long)run, failures, (unsigned long long)total_instructions, wall_seconds, num_workers,
+           wall_seconds > 0 ? run / wall_seconds : 0.0);
+
+    for (int i = 0; i < num_workers; i++) {
+        ref_reset(workers[i].ref);
+        free(workers[i].ref->touched);
+        free(workers[i].ref);
+        for (int m = 0; m < NUM_MODES; m++) {
+            rv_destroy(workers[i].sims[m]);
+            rv_batch_destroy(workers[i].batches[m]);
+        }
+    }
+    free(workers);
+    free(threads);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
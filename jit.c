@@ -0,0 +1,629 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+#include "trace.h"
+
+// Basic-block JIT from RV32I to x86-64.
+// run_jit() interprets code and counts how often each basic block starts. Once a block has run
+// JIT_HOT_THRESHOLD times it is translated into host code in an executable buffer. Translated blocks
+// keep the guest registers in sim->registers_array, reach guest memory through sim->tlb, and jump
+// straight into each other on branches and JAL once both ends are translated. A block never crosses a
+// page. Anything the translator does not handle (ECALL/EBREAK, CSRs, FENCE and the RV32A instructions,
+// illegal encodings, accesses that would trap or miss the TLB) goes back to the interpreter, so error messages and register dumps are the same
+// as with the interpreter cores.
+// Every simulator has its own jit_state_t, created on the first run_jit() and freed by jit_destroy().
+//
+// The instruction budget lives in r15 while translated code runs. A block is only entered with at least
+// JIT_MAX_BLOCK_INSNS instructions of budget left, and every exit subtracts the instructions the block
+// completed, so no block can run past the budget; the last few instructions are interpreted.
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#endif
+
+#define JIT_HOT_THRESHOLD 16
+#define JIT_MAX_BLOCK_INSNS 64
+#define JIT_CODE_SIZE (16 * 1024 * 1024)
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK_INSNS * 160 + 64) // worst case host code for one block
+
+typedef struct {
+    uint32_t start_pc;
+    uint32_t end_pc;        // first byte after the last guest instruction in the block
+    uint32_t exec_count;
+    int untranslatable;     // first instruction can't be translated, always interpret it
+    uint8_t *code;          // host code, NULL while the block is interpreted
+} jit_block_t;
+
+// A direct jump out of a translated block that can be patched to go straight to another block
+typedef struct {
+    uint8_t *rel32;         // the rel32 operand of the jmp
+    uint32_t target_pc;
+    jit_block_t *owner;
+} jit_exit_t;
+
+// Blocks are found through a two-level table like the page table: block_tables[pc >> 22] points to
+// PAGE_TABLE_ENTRIES pages, each with a jit_block_t pointer per halfword
+struct jit_state {
+    jit_block_t ***block_tables[PAGE_TABLE_ENTRIES];
+    jit_block_t **all_blocks;
+    size_t num_blocks, blocks_capacity;
+    jit_exit_t *exits;
+    size_t num_exits, exits_capacity;
+    int invalidations;
+    int supported;                   // 0 when the code buffer couldn't be mapped
+    rv_sim_t *sim;                   // the simulator whose code is being translated
+
+    uint8_t *code_buffer;
+    uint8_t *code_ptr;
+    uint8_t *code_start;             // first byte after the trampolines
+    uint8_t *exit_normal;            // return to run_jit() and continue at eax
+    uint8_t *exit_interpret;         // return to run_jit() and interpret the instruction at eax
+    uint64_t (*enter)(uint8_t *code, rv_sim_t *sim);
+};
+
+// Function to double a bookkeeping array. Returns NULL, leaving the array as it was, when out of memory.
+static void *grow(void *array, size_t *capacity, size_t element_size) {
+    size_t new_capacity = *capacity ? *capacity * 2 : 256;
+    void *grown = realloc(array, new_capacity * element_size);
+    if (grown) {
+        *capacity = new_capacity;
+    }
+    return grown;
+}
+// Function to find the table slot of the block starting at block_pc, allocating the tables if create is set
+static jit_block_t **jit_slot(jit_state_t *jit, uint32_t block_pc, int create) {
+    jit_block_t ***table = jit->block_tables[block_pc >> (PAGE_SHIFT + PAGE_TABLE_SHIFT)];
+    if (!table) {
+        if (!create || !(table = calloc(PAGE_TABLE_ENTRIES, sizeof(jit_block_t **)))) {
+            return NULL;
+        }
+        jit->block_tables[block_pc >> (PAGE_SHIFT + PAGE_TABLE_SHIFT)] = table;
+    }
+    jit_block_t **page = table[(block_pc >> PAGE_SHIFT) & (PAGE_TABLE_ENTRIES - 1)];
+    if (!page) {
+        if (!create || !(page = calloc(DECODE_PAGE_ENTRIES, sizeof(jit_block_t *)))) {
+            return NULL;
+        }
+        table[(block_pc >> PAGE_SHIFT) & (PAGE_TABLE_ENTRIES - 1)] = page;
+    }
+    return &page[(block_pc >> 1) & (DECODE_PAGE_ENTRIES - 1)];
+}
+
+// Function to find the block starting at block_pc, creating an empty one on the first visit
+// Returns NULL when out of memory, in which case the code at block_pc is simply interpreted
+static jit_block_t *jit_lookup(jit_state_t *jit, uint32_t block_pc) {
+    jit_block_t **slot = jit_slot(jit, block_pc, 1);
+    if (!slot) {
+        return NULL;
+    }
+    if (!*slot) {
+        if (jit->num_blocks == jit->blocks_capacity) {
+            jit_block_t **grown = grow(jit->all_blocks, &jit->blocks_capacity, sizeof(jit_block_t *));
+            if (!grown) {
+                return NULL;
+            }
+            jit->all_blocks = grown;
+        }
+        jit_block_t *block = calloc(1, sizeof(jit_block_t));
+        if (!block) {
+            return NULL;
+        }
+        block->start_pc = block_pc;
+        jit->all_blocks[jit->num_blocks++] = block;
+        *slot = block;
+    }
+    return *slot;
+}
+
+#ifdef JIT_SUPPORTED
+
+// x86-64 emitter. Host register use inside translated code:
+//   rbx = sim->registers_array, r12 = sim->tlb, r14 = sim, r15 = instruction budget left,
+//   eax/ecx/edx/edi/esi = scratch (r13 is saved but unused)
+#define REG_DISP(r) ((uint8_t)((r) * 4))
+
+static void emit8(jit_state_t *jit, uint8_t byte) { *jit->code_ptr++ = byte; }
+static void emit32(jit_state_t *jit, uint32_t value) { memcpy(jit->code_ptr, &value, 4); jit->code_ptr += 4; }
+static void emit64(jit_state_t *jit, uint64_t value) { memcpy(jit->code_ptr, &value, 8); jit->code_ptr += 8; }
+static void emit_bytes(jit_state_t *jit, const char *bytes, int count) { memcpy(jit->code_ptr, bytes, count); jit->code_ptr += count; }
+
+static void emit_load_eax(jit_state_t *jit, uint32_t r) { emit8(jit, 0x8B); emit8(jit, 0x43); emit8(jit, REG_DISP(r)); }  // mov eax, [rbx+4r]
+static void emit_load_ecx(jit_state_t *jit, uint32_t r) { emit8(jit, 0x8B); emit8(jit, 0x4B); emit8(jit, REG_DISP(r)); }  // mov ecx, [rbx+4r]
+static void emit_store_eax(jit_state_t *jit, uint32_t r) { emit8(jit, 0x89); emit8(jit, 0x43); emit8(jit, REG_DISP(r)); } // mov [rbx+4r], eax
+static void emit_store_imm(jit_state_t *jit, uint32_t r, uint32_t value) {                                 // mov dword [rbx+4r], imm
+    emit8(jit, 0xC7); emit8(jit, 0x43); emit8(jit, REG_DISP(r)); emit32(jit, value);
+}
+static void emit_op_eax_reg(jit_state_t *jit, uint8_t opcode, uint32_t r) { emit8(jit, opcode); emit8(jit, 0x43); emit8(jit, REG_DISP(r)); } // op eax, [rbx+4r]
+static void emit_op_eax_imm(jit_state_t *jit, uint8_t opcode, uint32_t value) { emit8(jit, opcode); emit32(jit, value); }            // op eax, imm32
+static void emit_mov_eax_imm(jit_state_t *jit, uint32_t value) { emit8(jit, 0xB8); emit32(jit, value); }
+static void emit_jmp(jit_state_t *jit, uint8_t *target) { emit8(jit, 0xE9); emit32(jit, (uint32_t)(target - (jit->code_ptr + 4))); }
+static uint8_t *emit_short_jcc(jit_state_t *jit, uint8_t short_jcc) { emit8(jit, short_jcc); emit8(jit, 0); return jit->code_ptr - 1; }
+static void patch_short_jcc(jit_state_t *jit, uint8_t *rel8) { *rel8 = (uint8_t)(jit->code_ptr - (rel8 + 1)); }
+static void emit_setcc_eax(jit_state_t *jit, uint8_t cc) { emit8(jit, 0x0F); emit8(jit, cc); emit8(jit, 0xC0); emit8(jit, 0x0F); emit8(jit, 0xB6); emit8(jit, 0xC0); } // setcc al; movzx eax, al
+// Charge the instructions the block completed before leaving it (always 4 bytes)
+static void emit_charge(jit_state_t *jit, uint32_t completed) { emit8(jit, 0x49); emit8(jit, 0x83); emit8(jit, 0xEF); emit8(jit, (uint8_t)completed); } // sub r15, completed
+
+// Leave the block and continue at next_pc through a jmp that can later be chained to the target block
+static void emit_chained_exit(jit_state_t *jit, jit_block_t *owner, uint32_t next_pc, uint32_t completed) {
+    emit_charge(jit, completed);
+    emit_mov_eax_imm(jit, next_pc);
+    emit8(jit, 0xE9);
+    if (jit->num_exits == jit->exits_capacity) {
+        jit_exit_t *grown = grow(jit->exits, &jit->exits_capacity, sizeof(jit_exit_t));
+        if (!grown) {
+            emit32(jit, (uint32_t)(jit->exit_normal - (jit->code_ptr + 4))); // can't be chained, always go back to run_jit()
+            return;
+        }
+        jit->exits = grown;
+    }
+    jit->exits[jit->num_exits].rel32 = jit->code_ptr;
+    jit->exits[jit->num_exits].target_pc = next_pc;
+    jit->exits[jit->num_exits].owner = owner;
+    jit->num_exits++;
+    uint8_t *destination = jit->exit_normal;
+    jit_block_t **target = (next_pc & 1) == 0 ? jit_slot(jit, next_pc, 0) : NULL;
+    if (target && *target && (*target)->code) {
+        destination = (*target)->code;
+    }
+    emit32(jit, (uint32_t)(destination - (jit->code_ptr + 4)));
+}
+// Skip the next 14 bytes when the condition holds, otherwise hand the instruction at insn_pc to the interpreter
+static void emit_guard(jit_state_t *jit, uint8_t short_jcc, uint32_t insn_pc, uint32_t completed) {
+    emit8(jit, short_jcc); emit8(jit, 14);
+    emit_charge(jit, completed);
+    emit_mov_eax_imm(jit, insn_pc);
+    emit_jmp(jit, jit->exit_interpret);
+}
+
+_Static_assert(sizeof(tlb_entry_t) == 16 && TLB_ENTRIES == 256, "emit_tlb_lookup indexes the TLB with movzx/shl 4");
+
+// Checks the alignment of the address in eax (if required) and looks it up in the TLB. Afterwards edx holds
+// the offset of the TLB entry from r12, and the flags are "equal" when tag_offset's tag matched.
+static void emit_tlb_lookup(jit_state_t *jit, uint32_t insn_pc, uint32_t completed, int size, int tag_offset) {
+    if (!jit->sim->allow_misaligned && size > 1) {
+        emit_op_eax_imm(jit, 0xA9, size - 1);           // test eax, size - 1
+        emit_guard(jit, 0x74, insn_pc, completed);      // jz ok
+    }
+    emit_bytes(jit, "\x89\xC2\xC1\xEA\x0C", 5);         // mov edx, eax; shr edx, 12
+    emit_bytes(jit, "\x0F\xB6\xD2\xC1\xE2\x04", 6);     // movzx edx, dl; shl edx, 4 (TLB_ENTRIES entries of 16 bytes)
+    emit8(jit, 0x8D); emit8(jit, 0x48); emit8(jit, (uint8_t)(size - 1)); // lea ecx, [rax+size-1]
+    emit_bytes(jit, "\x81\xE1", 2); emit32(jit, PAGE_MASK); // and ecx, PAGE_MASK
+    emit_bytes(jit, "\x41\x3B\x4C\x14", 4); emit8(jit, (uint8_t)tag_offset); // cmp ecx, [r12+rdx+tag_offset]
+}
+
+// Loads that miss the TLB go back to the interpreter, which fills the TLB or reports the fault
+static void emit_load(jit_state_t *jit, const decoded_instr_t *d, uint32_t insn_pc, uint32_t completed, int size,
+                      const char *load_op, int load_op_length) {
+    emit_load_eax(jit, d->rs1);
+    emit_op_eax_imm(jit, 0x05, d->imm);                 // add eax, imm
+    emit_tlb_lookup(jit, insn_pc, completed, size, offsetof(tlb_entry_t, read_tag));
+    emit_guard(jit, 0x74, insn_pc, completed);          // je hit
+    emit_bytes(jit, "\x49\x03\x44\x14", 4); emit8(jit, offsetof(tlb_entry_t, addend)); // add rax, [r12+rdx+addend]
+    emit_bytes(jit, load_op, load_op_length);
+    if (d->rd != 0) {
+        emit_store_eax(jit, d->rd);
+    }
+}
+
+// Called from translated code for stores that miss the TLB: the first write to a page, a store that
+// crosses a page, or a store into a page that holds decoded code. Returns 0 when the block can go on,
+// 1 when translated code was thrown away and 2 when the store faults.
+static int jit_store_slow(rv_sim_t *sim, uint32_t address, uint32_t value, uint32_t size) {
+    int before = sim->jit->invalidations;
+    if (mem_store_slow(sim, address, (int)size, value) != RV_OK) {
+        return 2;
+    }
+    return sim->jit->invalidations != before;
+}
+
+static void emit_store(jit_state_t *jit, const decoded_instr_t *d, uint32_t insn_pc, uint32_t completed, int size) {
+    emit_load_eax(jit, d->rs1);
+    emit_op_eax_imm(jit, 0x05, d->imm);
+    emit_tlb_lookup(jit, insn_pc, completed, size, offsetof(tlb_entry_t, write_tag));
+    uint8_t *miss = emit_short_jcc(jit, 0x75);          // jne slow
+    emit_bytes(jit, "\x49\x03\x44\x14", 4); emit8(jit, offsetof(tlb_entry_t, addend)); // add rax, [r12+rdx+addend]
+    emit_load_ecx(jit, d->rs2);
+    if (size == 1) {
+        emit_bytes(jit, "\x88\x08", 2);                 // mov [rax], cl
+    } else if (size == 2) {
+        emit_bytes(jit, "\x66\x89\x08", 3);             // mov [rax], cx
+    } else {
+        emit_bytes(jit, "\x89\x08", 2);                 // mov [rax], ecx
+    }
+    uint8_t *stored = emit_short_jcc(jit, 0xEB);        // jmp done
+
+    patch_short_jcc(jit, miss);                         // slow: jit_store_slow(sim, address, value, size)
+    emit_bytes(jit, "\x89\xC6", 2);                     // mov esi, eax
+    emit8(jit, 0x8B); emit8(jit, 0x53); emit8(jit, REG_DISP(d->rs2)); // mov edx, [rbx+4rs2]
+    emit8(jit, 0xB9); emit32(jit, size);                // mov ecx, size
+    emit_bytes(jit, "\x4C\x89\xF7", 3);                 // mov rdi, r14
+    emit8(jit, 0x48); emit8(jit, 0xB8); emit64(jit, (uint64_t)(uintptr_t)jit_store_slow); // mov rax, jit_store_slow
+    emit_bytes(jit, "\xFF\xD0", 2);                     // call rax
+    emit_bytes(jit, "\x85\xC0", 2);                     // test eax, eax
+    uint8_t *still_valid = emit_short_jcc(jit, 0x74);   // jz done
+    emit_bytes(jit, "\x83\xF8\x01", 3);                 // cmp eax, 1
+    uint8_t *fault = emit_short_jcc(jit, 0x75);         // jne fault
+    emit_charge(jit, completed + 1);                    // the block was invalidated, leave it
+    emit_mov_eax_imm(jit, insn_pc + d->length);
+    emit_jmp(jit, jit->exit_normal);
+    patch_short_jcc(jit, fault);                        // fault: the interpreter runs the store again and reports it
+    emit_charge(jit, completed);
+    emit_mov_eax_imm(jit, insn_pc);
+    emit_jmp(jit, jit->exit_interpret);
+    patch_short_jcc(jit, stored);
+    patch_short_jcc(jit, still_valid);
+}
+
+// Divisor in ecx, dividend in eax; the RV32M results for a zero divisor and INT32_MIN / -1 are handled
+// before the host divide, which would fault on either
+static void emit_divide(jit_state_t *jit, uint32_t rs2, int is_signed, int remainder) {
+    emit_load_ecx(jit, rs2);
+    emit_bytes(jit, "\x85\xC9", 2);                     // test ecx, ecx
+    uint8_t *by_zero = emit_short_jcc(jit, 0x74);       // jz by_zero
+    uint8_t *by_minus_one = NULL;
+    if (is_signed) {
+        emit_bytes(jit, "\x83\xF9\xFF", 3);             // cmp ecx, -1
+        uint8_t *normal = emit_short_jcc(jit, 0x75);    // jne normal
+        if (remainder) {
+            emit_bytes(jit, "\x31\xC0", 2);             // xor eax, eax (x % -1 == 0)
+        } else {
+            emit_bytes(jit, "\xF7\xD8", 2);             // neg eax (INT32_MIN wraps to itself)
+        }
+        by_minus_one = emit_short_jcc(jit, 0xEB);       // jmp done
+        patch_short_jcc(jit, normal);
+        emit_bytes(jit, "\x99\xF7\xF9", 3);             // cdq; idiv ecx
+    } else {
+        emit_bytes(jit, "\x31\xD2\xF7\xF1", 4);         // xor edx, edx; div ecx
+    }
+    if (remainder) {
+        emit_bytes(jit, "\x89\xD0", 2);                 // mov eax, edx
+    }
+    uint8_t *divided = emit_short_jcc(jit, 0xEB);       // jmp done
+    patch_short_jcc(jit, by_zero);
+    if (!remainder) {
+        emit_mov_eax_imm(jit, 0xFFFFFFFFu);             // x / 0 == -1, x % 0 == x (already in eax)
+    }
+    patch_short_jcc(jit, divided);
+    if (by_minus_one) {
+        patch_short_jcc(jit, by_minus_one);
+    }
+}
+
+static void emit_branch(jit_state_t *jit, jit_block_t *block, const decoded_instr_t *d, uint32_t insn_pc, uint32_t completed,
+                        uint8_t inverse_short_jcc) {
+    emit_load_eax(jit, d->rs1);
+    emit_op_eax_reg(jit, 0x3B, d->rs2);                 // cmp eax, [rbx+4rs2]
+    emit8(jit, inverse_short_jcc); emit8(jit, 14);      // not taken: skip the taken exit
+    emit_chained_exit(jit, block, insn_pc + d->imm, completed + 1);
+    emit_chained_exit(jit, block, insn_pc + d->length, completed + 1);
+}
+
+// Translate one instruction, the block's completed-th. Returns 0 if the instruction can't be translated.
+static int translate_instruction(jit_state_t *jit, jit_block_t *block, const decoded_instr_t *d, uint32_t insn_pc, uint32_t completed) {
+    uint32_t rd = d->rd;
+
+    if (d->handler == INSN_SYSTEM) {
+        return 0; // ECALL/EBREAK, or a jump or branch to itself (see decode_instruction)
+    }
+    switch (d->insn) {
+        case INSN_LUI:
+            if (rd != 0) emit_store_imm(jit, rd, d->imm);
+            return 1;
+        case INSN_AUIPC:
+            if (rd != 0) emit_store_imm(jit, rd, insn_pc + d->imm);
+            return 1;
+        case INSN_JAL:
+            if (rd != 0) emit_store_imm(jit, rd, insn_pc + d->length);
+            emit_chained_exit(jit, block, insn_pc + d->imm, completed + 1);
+            return 1;
+        case INSN_JALR:
+            emit_load_eax(jit, d->rs1);                 // read rs1 before rd is written (rd may equal rs1)
+            emit_op_eax_imm(jit, 0x05, d->imm);
+            emit_op_eax_imm(jit, 0x25, ~1u);            // and eax, ~1
+            if (rd != 0) emit_store_imm(jit, rd, insn_pc + d->length);
+            emit_charge(jit, completed + 1);
+            emit_jmp(jit, jit->exit_normal);
+            return 1;
+        case INSN_BEQ:  emit_branch(jit, block, d, insn_pc, completed, 0x75); return 1; // jne skip
+        case INSN_BNE:  emit_branch(jit, block, d, insn_pc, completed, 0x74); return 1; // je skip
+        case INSN_BLT:  emit_branch(jit, block, d, insn_pc, completed, 0x7D); return 1; // jge skip
+        case INSN_BGE:  emit_branch(jit, block, d, insn_pc, completed, 0x7C); return 1; // jl skip
+        case INSN_BLTU: emit_branch(jit, block, d, insn_pc, completed, 0x73); return 1; // jae skip
+        case INSN_BGEU: emit_branch(jit, block, d, insn_pc, completed, 0x72); return 1; // jb skip
+        case INSN_LB:  emit_load(jit, d, insn_pc, completed, 1, "\x0F\xBE\x00", 3); return 1; // movsx eax, byte [rax]
+        case INSN_LH:  emit_load(jit, d, insn_pc, completed, 2, "\x0F\xBF\x00", 3); return 1; // movsx eax, word [rax]
+        case INSN_LW:  emit_load(jit, d, insn_pc, completed, 4, "\x8B\x00", 2); return 1;     // mov eax, [rax]
+        case INSN_LBU: emit_load(jit, d, insn_pc, completed, 1, "\x0F\xB6\x00", 3); return 1; // movzx eax, byte [rax]
+        case INSN_LHU: emit_load(jit, d, insn_pc, completed, 2, "\x0F\xB7\x00", 3); return 1; // movzx eax, word [rax]
+        case INSN_SB: emit_store(jit, d, insn_pc, completed, 1); return 1;
+        case INSN_SH: emit_store(jit, d, insn_pc, completed, 2); return 1;
+        case INSN_SW: emit_store(jit, d, insn_pc, completed, 4); return 1;
+        case INSN_CSR:
+        case INSN_ILLEGAL:
+        case INSN_FENCE: case INSN_FENCE_I:
+        case INSN_LR: case INSN_SC: case INSN_AMOSWAP: case INSN_AMOADD: case INSN_AMOXOR: case INSN_AMOAND:
+        case INSN_AMOOR: case INSN_AMOMIN: case INSN_AMOMAX: case INSN_AMOMINU: case INSN_AMOMAXU:
+            return 0;
+        default:
+            break;
+    }
+
+    // Register/immediate ALU operations have no side effects, so a write to x0 is dropped entirely
+    if (rd == 0) {
+        return 1;
+    }
+    emit_load_eax(jit, d->rs1);
+    switch (d->insn) {
+        case INSN_ADDI:  emit_op_eax_imm(jit, 0x05, d->imm); break;
+        case INSN_XORI:  emit_op_eax_imm(jit, 0x35, d->imm); break;
+        case INSN_ORI:   emit_op_eax_imm(jit, 0x0D, d->imm); break;
+        case INSN_ANDI:  emit_op_eax_imm(jit, 0x25, d->imm); break;
+        case INSN_SLTI:  emit_op_eax_imm(jit, 0x3D, d->imm); emit_setcc_eax(jit, 0x9C); break; // setl
+        case INSN_SLTIU: emit_op_eax_imm(jit, 0x3D, d->imm); emit_setcc_eax(jit, 0x92); break; // setb
+        case INSN_SLLI:  emit8(jit, 0xC1); emit8(jit, 0xE0); emit8(jit, (uint8_t)d->imm); break;
+        case INSN_SRLI:  emit8(jit, 0xC1); emit8(jit, 0xE8); emit8(jit, (uint8_t)d->imm); break;
+        case INSN_SRAI:  emit8(jit, 0xC1); emit8(jit, 0xF8); emit8(jit, (uint8_t)d->imm); break;
+        case INSN_ADD:   emit_op_eax_reg(jit, 0x03, d->rs2); break;
+        case INSN_SUB:   emit_op_eax_reg(jit, 0x2B, d->rs2); break;
+        case INSN_XOR:   emit_op_eax_reg(jit, 0x33, d->rs2); break;
+        case INSN_OR:    emit_op_eax_reg(jit, 0x0B, d->rs2); break;
+        case INSN_AND:   emit_op_eax_reg(jit, 0x23, d->rs2); break;
+        case INSN_SLT:   emit_op_eax_reg(jit, 0x3B, d->rs2); emit_setcc_eax(jit, 0x9C); break;
+        case INSN_SLTU:  emit_op_eax_reg(jit, 0x3B, d->rs2); emit_setcc_eax(jit, 0x92); break;
+        case INSN_SLL:   emit_load_ecx(jit, d->rs2); emit8(jit, 0xD3); emit8(jit, 0xE0); break; // shl eax, cl (x86 masks cl to 5 bits)
+        case INSN_SRL:   emit_load_ecx(jit, d->rs2); emit8(jit, 0xD3); emit8(jit, 0xE8); break;
+        case INSN_SRA:   emit_load_ecx(jit, d->rs2); emit8(jit, 0xD3); emit8(jit, 0xF8); break;
+        case INSN_MUL:   emit8(jit, 0x0F); emit_op_eax_reg(jit, 0xAF, d->rs2); break; // imul eax, [rbx+4rs2]
+        case INSN_MULH:  emit8(jit, 0xF7); emit8(jit, 0x6B); emit8(jit, REG_DISP(d->rs2)); // imul dword [rbx+4rs2]
+                         emit_bytes(jit, "\x89\xD0", 2); break;                          // mov eax, edx
+        case INSN_MULHU: emit8(jit, 0xF7); emit8(jit, 0x63); emit8(jit, REG_DISP(d->rs2)); // mul dword [rbx+4rs2]
+                         emit_bytes(jit, "\x89\xD0", 2); break;
+        case INSN_MULHSU: emit_load_ecx(jit, d->rs2);                  // rcx = zero-extended rs2
+                         emit_bytes(jit, "\x48\x63\xC0", 3);           // movsxd rax, eax
+                         emit_bytes(jit, "\x48\x0F\xAF\xC1", 4);       // imul rax, rcx
+                         emit_bytes(jit, "\x48\xC1\xE8\x20", 4); break; // shr rax, 32
+        case INSN_DIV:   emit_divide(jit, d->rs2, 1, 0); break;
+        case INSN_DIVU:  emit_divide(jit, d->rs2, 0, 0); break;
+        case INSN_REM:   emit_divide(jit, d->rs2, 1, 1); break;
+        case INSN_REMU:  emit_divide(jit, d->rs2, 0, 1); break;
+        default:
+            return 0;
+    }
+    emit_store_eax(jit, rd);
+    return 1;
+}
+
+// Drop every translated block and start over with an empty code buffer
+static void jit_flush(jit_state_t *jit) {
+    for (size_t i = 0; i < jit->num_blocks; i++) {
+        jit->all_blocks[i]->code = NULL;
+        jit->all_blocks[i]->exec_count = 0;
+    }
+    jit->num_exits = 0;
+    jit->code_ptr = jit->code_start;
+}
+
+// Function to translate a hot block. Returns 0 if not even its first instruction could be translated.
+static int jit_translate(jit_state_t *jit, jit_block_t *block) {
+    if ((size_t)(jit->code_buffer + JIT_CODE_SIZE - jit->code_ptr) < JIT_MAX_BLOCK_BYTES) {
+        jit_flush(jit);
+    }
+
+    uint8_t *code = jit->code_ptr;
+    uint32_t insn_pc = block->start_pc;
+    uint32_t count = 0;
+
+    // Blocks are only entered with budget for the longest possible block, otherwise run_jit() interprets
+    emit_bytes(jit, "\x49\x83\xFF", 3); emit8(jit, JIT_MAX_BLOCK_INSNS); // cmp r15, JIT_MAX_BLOCK_INSNS
+    emit8(jit, 0x73); emit8(jit, 10);                   // jae body
+    emit_mov_eax_imm(jit, block->start_pc);
+    emit_jmp(jit, jit->exit_normal);
+
+    while (count < JIT_MAX_BLOCK_INSNS) {
+        const decoded_instr_t *d = fetch_decoded(jit->sim, insn_pc);
+        // An instruction crossing into the next page has no decoded record there, so a store to its second
+        // half couldn't drop the translation; leave it to the interpreter
+        if (!d || (((insn_pc + d->length - 1) ^ insn_pc) & PAGE_MASK) || !translate_instruction(jit, block, d, insn_pc, count)) {
+            if (count == 0) {
+                block->untranslatable = 1;
+                jit->code_ptr = code;
+                return 0;
+            }
+            emit_charge(jit, count);                    // let the interpreter run it
+            emit_mov_eax_imm(jit, insn_pc);
+            emit_jmp(jit, jit->exit_normal);
+            break;
+        }
+        count++;
+        insn_pc += d->length;
+        if (insn_ends_block(d)) {
+            break;
+        }
+        if (count == JIT_MAX_BLOCK_INSNS || (insn_pc & (PAGE_SIZE - 1)) == 0) {
+            emit_chained_exit(jit, block, insn_pc, count);
+        }
+    }
+
+    block->code = code;
+    block->end_pc = insn_pc;
+
+    // Chain every existing exit that was waiting for this block
+    for (size_t i = 0; i < jit->num_exits; i++) {
+        if (jit->exits[i].target_pc == block->start_pc) {
+            uint32_t rel = (uint32_t)(code - (jit->exits[i].rel32 + 4));
+            memcpy(jit->exits[i].rel32, &rel, 4);
+        }
+    }
+    return 1;
+}
+
+// Function to drop translated blocks overlapping [address, address + size)
+void jit_invalidate(rv_sim_t *sim, uint32_t address, int size) {
+    jit_state_t *jit = sim->jit;
+
+    for (size_t i = 0; i < jit->num_blocks; i++) {
+        jit_block_t *block = jit->all_blocks[i];
+        if (!block->code || address >= block->end_pc || address + size <= block->start_pc) {
+            continue;
+        }
+        // Unchain jumps into the block and forget the jumps out of it
+        size_t kept = 0;
+        for (size_t e = 0; e < jit->num_exits; e++) {
+            if (jit->exits[e].owner == block) {
+                continue;
+            }
+            if (jit->exits[e].target_pc == block->start_pc) {
+                uint32_t rel = (uint32_t)(jit->exit_normal - (jit->exits[e].rel32 + 4));
+                memcpy(jit->exits[e].rel32, &rel, 4);
+            }
+            jit->exits[kept++] = jit->exits[e];
+        }
+        jit->num_exits = kept;
+        block->code = NULL;
+        block->exec_count = 0;
+        jit->invalidations++;
+    }
+}
+
+// Function to map the code buffer and emit the entry trampoline and the two exits
+static int jit_init(jit_state_t *jit) {
+    jit->code_buffer = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code_buffer == MAP_FAILED) {
+        jit->code_buffer = NULL;
+        return 0;
+    }
+    jit->code_ptr = jit->code_buffer;
+
+    // uint64_t enter(uint8_t *code, rv_sim_t *sim): save callee-saved registers (five pushes keep the
+    // stack 16-byte aligned for jit_store_slow), load the base pointers and the budget, jump to the block
+    jit->enter = (uint64_t (*)(uint8_t *, rv_sim_t *))(void *)jit->code_ptr;
+    emit_bytes(jit, "\x53\x41\x54\x41\x55\x41\x56\x41\x57", 9); // push rbx; push r12; push r13; push r14; push r15
+    emit_bytes(jit, "\x49\x89\xF6", 3);                          // mov r14, rsi
+    emit_bytes(jit, "\x48\x8D\x9E", 3); emit32(jit, offsetof(rv_sim_t, registers_array)); // lea rbx, [rsi+registers_array]
+    emit_bytes(jit, "\x4C\x8D\xA6", 3); emit32(jit, offsetof(rv_sim_t, tlb));             // lea r12, [rsi+tlb]
+    emit_bytes(jit, "\x4C\x8B\xBE", 3); emit32(jit, offsetof(rv_sim_t, jit_budget));      // mov r15, [rsi+jit_budget]
+    emit_bytes(jit, "\xFF\xE7", 2);                              // jmp rdi
+
+    // Exits return the next pc in eax; bit 32 asks run_jit() to interpret that instruction
+    jit->exit_interpret = jit->code_ptr;
+    emit_bytes(jit, "\x48\x0F\xBA\xE8\x20", 5);                  // bts rax, 32
+    jit->exit_normal = jit->code_ptr;
+    emit_bytes(jit, "\x4D\x89\xBE", 3); emit32(jit, offsetof(rv_sim_t, jit_budget));      // mov [r14+jit_budget], r15
+    emit_bytes(jit, "\x41\x5F\x41\x5E\x41\x5D\x41\x5C\x5B\xC3", 10); // pop r15; pop r14; pop r13; pop r12; pop rbx; ret
+    jit->code_start = jit->code_ptr;
+    return 1;
+}
+
+static void jit_unmap(jit_state_t *jit) {
+    if (jit->code_buffer) {
+        munmap(jit->code_buffer, JIT_CODE_SIZE);
+    }
+}
+
+#else
+
+static int jit_init(jit_state_t *jit) { (void)jit; return 0; }
+static int jit_translate(jit_state_t *jit, jit_block_t *block) { (void)jit; block->untranslatable = 1; return 0; }
+void jit_invalidate(rv_sim_t *sim, uint32_t address, int size) { (void)sim; (void)address; (void)size; }
+static void jit_unmap(jit_state_t *jit) { (void)jit; }
+
+#endif
+
+// Function to free the translations and bookkeeping of a simulator
+void jit_destroy(rv_sim_t *sim) {
+    jit_state_t *jit = sim->jit;
+
+    if (!jit) {
+        return;
+    }
+    jit_unmap(jit);
+    for (size_t i = 0; i < jit->num_blocks; i++) {
+        free(jit->all_blocks[i]);
+    }
+    for (int t = 0; t < PAGE_TABLE_ENTRIES; t++) {
+        if (jit->block_tables[t]) {
+            for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+                free(jit->block_tables[t][i]);
+            }
+            free(jit->block_tables[t]);
+        }
+    }
+    free(jit->all_blocks);
+    free(jit->exits);
+    free(jit);
+    sim->jit = NULL;
+}
+
+// Function to interpret instructions up to the end of a basic block, or just one when single is set
+static rv_status_t interpret_block(rv_sim_t *sim, int single) {
+    const decoded_instr_t *d;
+    rv_status_t status;
+
+    do {
+        d = fetch_decoded(sim, sim->pc);
+        if (!d) {
+            return fetch_fault(sim);
+        }
+        status = execute_decoded(sim, d);
+        if (status != RV_OK) {
+            return status;
+        }
+        sim->jit_budget--;
+        sim->instret++;
+    } while (!single && !insn_ends_block(d) && sim->jit_budget > 0);
+    return RV_OK;
+}
+
+// JIT execution mode: translated blocks run natively, everything else is interpreted a block at a time
+rv_status_t run_jit(rv_sim_t *sim, uint64_t budget) {
+    rv_status_t status = RV_OK;
+
+    if (sim_instrumented(sim)) {
+        return run_threaded(sim, budget, NO_STOP_PC);
+    }
+    if (!sim->jit) {
+        sim->jit = calloc(1, sizeof(jit_state_t));
+        if (!sim->jit) {
+            return run_threaded(sim, budget, NO_STOP_PC);
+        }
+        sim->jit->sim = sim;
+        sim->jit->supported = jit_init(sim->jit);
+    }
+    jit_state_t *jit = sim->jit;
+    if (!jit->supported) {
+        return run_threaded(sim, budget, NO_STOP_PC);
+    }
+
+    sim->jit_budget = budget; // instret is kept current after every block for the CSR instructions
+    while (sim->jit_budget > 0) {
+        if ((sim->pc & 1) == 0 && sim->jit_budget >= JIT_MAX_BLOCK_INSNS) {
+            jit_block_t *block = jit_lookup(jit, sim->pc);
+            if (block && block->code) {
+                uint64_t remaining = sim->jit_budget;
+                uint64_t result = jit->enter(block->code, sim);
+                sim->instret += remaining - sim->jit_budget;
+                sim->pc = (uint32_t)result;
+                if (result >> 32) {
+                    // the access would trap, let the interpreter report it
+                    if (sim->jit_budget > 0 && (status = interpret_block(sim, 1)) != RV_OK) {
+                        break;
+                    }
+                }
+                continue;
+            }
+            if (block && !block->untranslatable && ++block->exec_count >= JIT_HOT_THRESHOLD && jit_translate(jit, block)) {
+                continue;
+            }
+        }
+        if ((status = interpret_block(sim, 0)) != RV_OK) {
+            break;
+        }
+    }
+
+    return status;
+}
@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "riscv_sim.h"
+
+#define RES_REGISTERS 32 // words per register set in a .res file
+#define EXIT_IDLE 3       // the program ended in a jump to itself or WFI
+#define EXIT_WATCHDOG 124 // --watchdog or --timeout stopped it, the code timeout(1) uses
+
+// Command line simulator built on the library in riscv_sim.h.
+// Runs one binary (or a checkpoint) and leaves its final registers in register_dump.res, whatever way the
+// program ends. With --batch it runs the binary once per register set in a .res file instead, leaving each
+// run's registers in register_dump.<n>.res.
+
+// Function to parse "A:B" option values (decimal or 0x hex)
+int parse_range(const char *text, uint64_t *low, uint64_t *high) {
+    char *end;
+
+    *low = strtoull(text, &end, 0);
+    if (*end != ':') {
+        return 0;
+    }
+    *high = strtoull(end + 1, &end, 0);
+    return *end == '\0' && *low <= *high;
+}
+
+// Function to parse a positive count option value (decimal or 0x hex)
+int parse_count(const char *text, uint64_t *value) {
+    char *end;
+
+    *value = strtoull(text, &end, 0);
+    return *text != '\0' && *end == '\0' && *value > 0;
+}
+
+// Function to parse a positive number of seconds
+int parse_seconds(const char *text, double *value) {
+    char *end;
+
+    *value = strtod(text, &end);
+    return *text != '\0' && *end == '\0' && *value > 0;
+}
+
+// Function to parse a cache option value "<size>:<line size>:<ways>[:<policy>]...", the size in bytes or
+// with a k suffix, the policies lru, plru or random and wb/wt (write-back/write-through) and wa/nwa
+// ((no-)write-allocate), by default lru, wb and wa
+int parse_cache(const char *text, rv_cache_config_t *config) {
+    char *end;
+
+    config->size = (uint32_t)strtoul(text, &end, 0);
+    if (*end == 'k' || *end == 'K') {
+        config->size *= 1024;
+        end++;
+    }
+    if (*end != ':') {
+        return 0;
+    }
+    config->line_size = (uint32_t)strtoul(end + 1, &end, 0);
+    if (*end != ':') {
+        return 0;
+    }
+    config->ways = (uint32_t)strtoul(end + 1, &end, 0);
+    config->replacement = RV_REPLACE_LRU;
+    config->write_back = 1;
+    config->write_allocate = 1;
+    while (*end == ':') {
+        const char *policy = end + 1;
+        size_t length = strcspn(policy, ":");
+        if (length == 3 && strncmp(policy, "lru", 3) == 0) {
+            config->replacement = RV_REPLACE_LRU;
+        } else if (length == 4 && strncmp(policy, "plru", 4) == 0) {
+            config->replacement = RV_REPLACE_PLRU;
+        } else if (length == 6 && strncmp(policy, "random", 6) == 0) {
+            config->replacement = RV_REPLACE_RANDOM;
+        } else if (length == 2 && strncmp(policy, "wb", 2) == 0) {
+            config->write_back = 1;
+        } else if (length == 2 && strncmp(policy, "wt", 2) == 0) {
+            config->write_back = 0;
+        } else if (length == 2 && strncmp(policy, "wa", 2) == 0) {
+            config->write_allocate = 1;
+        } else if (length == 3 && strncmp(policy, "nwa", 3) == 0) {
+            config->write_allocate = 0;
+        } else {
+            return 0;
+        }
+        end = (char *)policy + length;
+    }
+    return *end == '\0';
+}
+
+// Function to dump the registers into register_dump.res, exiting if the file can't be written
+void dump_registers_res(const rv_sim_t *sim) {
+    if (rv_dump_registers(sim, "register_dump.res") != RV_OK) {
+        perror("Failed to open register dump file");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Function to run binary_file once for every register set in inputs_filename (the register_dump.res layout,
+// x0 ignored), lanes runs at a time, writing run n's registers to register_dump.<n>.res. Returns the exit
+// code: failure if any run trapped or a file couldn't be used, otherwise EXIT_WATCHDOG if the watchdog
+// stopped any run.
+int run_batch(const char *binary_file, const char *inputs_filename, unsigned lanes, rv_batch_isa_t isa,
+              int syscalls, const char *sandbox_dir, uint64_t max_insns, uint64_t watchdog_insns, double timeout) {
+    int32_t (*inputs)[RES_REGISTERS] = NULL;
+    size_t count = 0;
+    int exit_code = EXIT_SUCCESS;
+    int stuck = 0;                 // a run the watchdog stopped
+    FILE *file = fopen(inputs_filename, "rb");
+
+    if (!file) {
+        perror("Failed to open batch input file");
+        return EXIT_FAILURE;
+    }
+    for (;;) {
+        int32_t (*grown)[RES_REGISTERS] = realloc(inputs, (count + 1) * sizeof(*inputs));
+        if (!grown) {
+            printf("Failed to allocate simulator memory\n");
+            free(inputs);
+            fclose(file);
+            return EXIT_FAILURE;
+        }
+        inputs = grown;
+        if (fread(inputs[count], sizeof(int32_t), RES_REGISTERS, file) != RES_REGISTERS) {
+            break;
+        }
+        count++;
+    }
+    fclose(file);
+    if (count == 0) {
+        fprintf(stderr, "%s holds no register set\n", inputs_filename);
+        free(inputs);
+        return EXIT_FAILURE;
+    }
+
+    rv_batch_t *batch = rv_batch_create(lanes);
+    if (!batch) {
+        printf("Failed to allocate simulator memory\n");
+        free(inputs);
+        return EXIT_FAILURE;
+    }
+    if (rv_batch_set_isa(batch, isa) != RV_OK) {
+        fprintf(stderr, "%s\n", rv_get_trap(rv_batch_lane(batch, 0))->message);
+        exit_code = EXIT_FAILURE;
+    }
+    for (unsigned l = 0; l < lanes && exit_code == EXIT_SUCCESS; l++) {
+        if ((syscalls && rv_set_syscalls(rv_batch_lane(batch, l), 1, sandbox_dir) != RV_OK) ||
+            rv_set_watchdog(rv_batch_lane(batch, l), watchdog_insns, timeout) != RV_OK) {
+            fprintf(stderr, "%s\n", rv_get_trap(rv_batch_lane(batch, l))->message);
+            exit_code = EXIT_FAILURE;
+        }
+    }
+    fflush(stdout); // the program's own output goes straight to the file descriptors
+
+    for (size_t first = 0; first < count && exit_code == EXIT_SUCCESS; first += lanes) {
+        unsigned used = count - first < lanes ? (unsigned)(count - first) : lanes;
+        size_t loaded_bytes;
+        if (rv_batch_load(batch, binary_file, &loaded_bytes) != RV_OK) {
+            fprintf(stderr, "%s\n", rv_get_trap(rv_batch_lane(batch, 0))->message);
+            exit_code = EXIT_FAILURE;
+            break;
+        }
+        if (first == 0 && loaded_bytes % 2 != 0) {
+            printf("Warning: File size is not a multiple of 2 bytes.\n");
+        }
+        for (unsigned l = 0; l < lanes; l++) {
+            rv_sim_t *lane = rv_batch_lane(batch, l);
+            for (unsigned r = 1; r < RES_REGISTERS; r++) {
+                rv_set_reg(lane, r, inputs[first + (l < used ? l : 0)][r]); // spare lanes repeat the first run
+            }
+        }
+        rv_batch_run(batch, max_insns);
+
+        for (unsigned l = 0; l < used; l++) {
+            rv_sim_t *lane = rv_batch_lane(batch, l);
+            const rv_trap_t *trap = rv_get_trap(lane);
+            char filename[64];
+            if (trap->status == RV_OK) {
+                printf("Run %zu: stopped after %llu instructions at PC: 0x%08X\n", first + l,
+                       (unsigned long long)rv_get_instret(lane), rv_get_pc(lane));
+            } else {
+                printf("Run %zu: %s\n", first + l, trap->message);
+                if (trap->status == RV_HALT_WATCHDOG) {
+                    stuck = 1; // the other runs go on, as the watchdog is there to end stuck ones
+                } else if (trap->status > RV_HALT_EXIT) {
+                    exit_code = EXIT_FAILURE;
+                }
+            }
+            snprintf(filename, sizeof(filename), "register_dump.%zu.res", first + l);
+            if (rv_dump_registers(lane, filename) != RV_OK) {
+                perror("Failed to open register dump file");
+                exit_code = EXIT_FAILURE;
+            }
+        }
+    }
+    rv_print_batch(batch);
+    rv_batch_destroy(batch);
+    free(inputs);
+    return exit_code == EXIT_SUCCESS && stuck ? EXIT_WATCHDOG : exit_code;
+}
+
+//          Main function
+int main(int argc, char *argv[]) {
+    const char *binary_file = NULL;
+    const char *trace_filename = NULL;
+    const char *restore_filename = NULL;
+    const char *save_filename = NULL;
+    const char *bbv_filename = NULL;
+    const char *bbv_checkpoint_prefix = NULL;
+    const char *profile_filename = NULL;
+    const char *profile_pcs_filename = NULL;
+    const char *symbols_filename = NULL;
+    const char *sandbox_dir = NULL;
+    const char *batch_filename = NULL;
+    uint64_t max_insns = RV_UNLIMITED;
+    uint64_t watchdog_insns = 0;
+    double timeout = 0;
+    uint64_t bbv_interval = 100000000;
+    uint64_t trace_lo_pc = 0, trace_hi_pc = UINT32_MAX;
+    uint64_t trace_first = 0, trace_last = UINT64_MAX;
+    rv_core_t core = RV_CORE_SWITCH;
+    int usage_error = 0;
+    int stats = 0;
+    int fusion = 1, print_fusion = 0;
+    int allow_misaligned = 1;
+    int syscalls = 0;
+    int timing = 0;
+    int forwarding = 1;
+    rv_predictor_t predictor = RV_PREDICTOR_BIMODAL;
+    rv_cache_config_t icache, dcache;
+    int use_icache = 0, use_dcache = 0;
+    uint64_t miss_cycles = 20;
+    uint64_t harts = 1, quantum = 10000;
+    rv_memory_order_t order = RV_ORDER_SC;
+    uint64_t lanes = RV_BATCH_MAX_LANES;
+    rv_batch_isa_t batch_isa = RV_BATCH_AUTO;
+    int other_options = 0;         // options batch mode has no use for
+    int exit_code = EXIT_SUCCESS;
+    size_t loaded_bytes;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--core=switch") == 0) {
+            core = RV_CORE_SWITCH;
+        } else if (strcmp(argv[i], "--core=threaded") == 0) {
+            core = RV_CORE_THREADED;
+        } else if (strcmp(argv[i], "--core=jit") == 0) {
+            core = RV_CORE_JIT;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[i], "--fusion") == 0) {
+            print_fusion = 1;
+        } else if (strcmp(argv[i], "--no-fusion") == 0) {
+            fusion = 0;
+        } else if (strcmp(argv[i], "--misaligned=allow") == 0) {
+            allow_misaligned = 1;
+        } else if (strcmp(argv[i], "--misaligned=trap") == 0) {
+            allow_misaligned = 0;
+        } else if (strcmp(argv[i], "--syscalls") == 0) {
+            syscalls = 1;
+        } else if (strncmp(argv[i], "--syscalls=", 11) == 0) {
+            syscalls = 1;
+            sandbox_dir = argv[i] + 11;
+        } else if (strncmp(argv[i], "--harts=", 8) == 0) {
+            usage_error |= !parse_count(argv[i] + 8, &harts) || harts > RV_MAX_HARTS;
+        } else if (strcmp(argv[i], "--memory-order=sc") == 0) {
+            order = RV_ORDER_SC;
+        } else if (strcmp(argv[i], "--memory-order=relaxed") == 0) {
+            order = RV_ORDER_RELAXED;
+        } else if (strncmp(argv[i], "--quantum=", 10) == 0) {
+            usage_error |= !parse_count(argv[i] + 10, &quantum);
+        } else if (strcmp(argv[i], "--timing") == 0) {
+            timing = 1;
+        } else if (strcmp(argv[i], "--timing=not-taken") == 0) {
+            timing = 1;
+            predictor = RV_PREDICTOR_NOT_TAKEN;
+        } else if (strcmp(argv[i], "--timing=bimodal") == 0) {
+            timing = 1;
+            predictor = RV_PREDICTOR_BIMODAL;
+        } else if (strcmp(argv[i], "--timing=gshare") == 0) {
+            timing = 1;
+            predictor = RV_PREDICTOR_GSHARE;
+        } else if (strcmp(argv[i], "--no-forwarding") == 0) {
+            forwarding = 0;
+        } else if (strncmp(argv[i], "--icache=", 9) == 0) {
+            use_icache = 1;
+            usage_error |= !parse_cache(argv[i] + 9, &icache);
+        } else if (strncmp(argv[i], "--dcache=", 9) == 0) {
+            use_dcache = 1;
+            usage_error |= !parse_cache(argv[i] + 9, &dcache);
+        } else if (strncmp(argv[i], "--miss-cycles=", 14) == 0) {
+            usage_error |= !parse_count(argv[i] + 14, &miss_cycles);
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profile_filename = argv[i] + 10;
+        } else if (strncmp(argv[i], "--profile-pcs=", 14) == 0) {
+            profile_pcs_filename = argv[i] + 14;
+        } else if (strncmp(argv[i], "--symbols=", 10) == 0) {
+            symbols_filename = argv[i] + 10;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_filename = argv[i] + 8;
+        } else if (strncmp(argv[i], "--trace-pc=", 11) == 0) {
+            usage_error |= !parse_range(argv[i] + 11, &trace_lo_pc, &trace_hi_pc);
+        } else if (strncmp(argv[i], "--trace-window=", 15) == 0) {
+            usage_error |= !parse_range(argv[i] + 15, &trace_first, &trace_last);
+        } else if (strncmp(argv[i], "--max-insns=", 12) == 0) {
+            usage_error |= !parse_count(argv[i] + 12, &max_insns);
+        } else if (strncmp(argv[i], "--watchdog=", 11) == 0) {
+            usage_error |= !parse_count(argv[i] + 11, &watchdog_insns);
+        } else if (strncmp(argv[i], "--timeout=", 10) == 0) {
+            usage_error |= !parse_seconds(argv[i] + 10, &timeout);
+        } else if (strncmp(argv[i], "--restore=", 10) == 0) {
+            restore_filename = argv[i] + 10;
+        } else if (strncmp(argv[i], "--save-checkpoint=", 18) == 0) {
+            save_filename = argv[i] + 18;
+        } else if (strncmp(argv[i], "--bbv=", 6) == 0) {
+            bbv_filename = argv[i] + 6;
+        } else if (strncmp(argv[i], "--bbv-interval=", 15) == 0) {
+            usage_error |= !parse_count(argv[i] + 15, &bbv_interval);
+        } else if (strncmp(argv[i], "--bbv-checkpoints=", 18) == 0) {
+            bbv_checkpoint_prefix = argv[i] + 18;
+        } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+            batch_filename = argv[i] + 8;
+        } else if (strncmp(argv[i], "--lanes=", 8) == 0) {
+            usage_error |= !parse_count(argv[i] + 8, &lanes) || lanes > RV_BATCH_MAX_LANES;
+        } else if (strcmp(argv[i], "--batch-isa=auto") == 0) {
+            batch_isa = RV_BATCH_AUTO;
+        } else if (strcmp(argv[i], "--batch-isa=scalar") == 0) {
+            batch_isa = RV_BATCH_SCALAR;
+        } else if (strcmp(argv[i], "--batch-isa=sse2") == 0) {
+            batch_isa = RV_BATCH_SSE2;
+        } else if (strcmp(argv[i], "--batch-isa=avx2") == 0) {
+            batch_isa = RV_BATCH_AVX2;
+        } else if (argv[i][0] != '-' && !binary_file) {
+            binary_file = argv[i];
+        } else {
+            usage_error = 1;
+        }
+    }
+    other_options = core != RV_CORE_SWITCH || stats || print_fusion || !fusion || !allow_misaligned || harts > 1 ||
+                    timing || use_icache || use_dcache || profile_filename || profile_pcs_filename || symbols_filename ||
+                    trace_filename || restore_filename || save_filename || bbv_filename;
+    if ((!binary_file && !restore_filename) || (bbv_checkpoint_prefix && !bbv_filename) ||
+        (batch_filename && (!binary_file || other_options)) || usage_error) {
+        printf("Usage: %s [--core=switch|threaded|jit] [--syscalls[=<sandbox dir>]] [--stats] [--fusion|--no-fusion] [--misaligned=allow|trap] [--trace=<file> [--trace-pc=<lo>:<hi>] [--trace-window=<first>:<last>]]\n"
+               "       [--harts=<n> [--memory-order=sc|relaxed] [--quantum=<n>]]\n"
+               "       [--timing[=not-taken|bimodal|gshare] [--no-forwarding]] [--icache=<cache>] [--dcache=<cache>] [--miss-cycles=<n>]\n"
+               "       [--profile=<file>] [--profile-pcs=<file>] [--symbols=<file.s or nm listing>]\n"
+               "       [--max-insns=<n>] [--watchdog=<n>] [--timeout=<seconds>] [--save-checkpoint=<file>] [--bbv=<file> [--bbv-interval=<n>] [--bbv-checkpoints=<prefix>]]\n"
+               "       <binary_file> | --restore=<checkpoint>\n"
+               "       %s --batch=<registers.res> [--lanes=<n>] [--batch-isa=auto|scalar|sse2|avx2] [--syscalls[=<sandbox dir>]] [--max-insns=<n>] [--watchdog=<n>] [--timeout=<seconds>] <binary_file>\n"
+               "<cache> is <size>:<line size>:<ways>[:lru|plru|random][:wb|wt][:wa|nwa], e.g. 32k:64:8:plru\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (batch_filename) {
+        return run_batch(binary_file, batch_filename, (unsigned)lanes, batch_isa, syscalls, sandbox_dir, max_insns,
+                         watchdog_insns, timeout);
+    }
+
+    rv_sim_t *sim = rv_create();
+    if (!sim) {
+        printf("Failed to allocate simulator memory\n");
+        return EXIT_FAILURE;
+    }
+    rv_set_core(sim, core);
+    rv_set_fusion(sim, fusion);
+    rv_set_allow_misaligned(sim, allow_misaligned);
+    rv_set_watchdog(sim, watchdog_insns, timeout);
+    if ((harts > 1 && (rv_set_harts(sim, (unsigned)harts) != RV_OK || rv_set_memory_order(sim, order, quantum) != RV_OK)) ||
+        (syscalls && rv_set_syscalls(sim, 1, sandbox_dir) != RV_OK) ||
+        (stats && rv_set_stats(sim, 1) != RV_OK) ||
+        ((profile_filename || profile_pcs_filename) && rv_set_profile(sim, 1) != RV_OK) ||
+        (timing && rv_set_timing(sim, 1, predictor, forwarding) != RV_OK)) {
+        fprintf(stderr, "%s\n", rv_get_trap(sim)->message);
+        rv_destroy(sim);
+        return EXIT_FAILURE;
+    }
+    icache.miss_cycles = dcache.miss_cycles = (uint32_t)miss_cycles;
+    if ((use_icache || use_dcache) &&
+        rv_set_caches(sim, use_icache ? &icache : NULL, use_dcache ? &dcache : NULL) != RV_OK) {
+        fprintf(stderr, "%s\n", rv_get_trap(sim)->message);
+        rv_destroy(sim);
+        return EXIT_FAILURE;
+    }
+    if (trace_filename) {
+        if (rv_trace_open(sim, trace_filename, (uint32_t)trace_lo_pc, (uint32_t)trace_hi_pc, trace_first, trace_last) != RV_OK) {
+            fprintf(stderr, "%s\n", rv_get_trap(sim)->message);
+            rv_destroy(sim);
+            return EXIT_FAILURE;
+        }
+    }
+    if ((trace_filename || stats || timing || use_icache || use_dcache || profile_filename || profile_pcs_filename) && core == RV_CORE_JIT) {
+        fprintf(stderr, "Translated code is not instrumented, using the threaded core.\n");
+    }
+
+    if (binary_file && rv_load_file(sim, binary_file, &loaded_bytes) != RV_OK) {
+        fprintf(stderr, "%s\n", rv_get_trap(sim)->message);
+        dump_registers_res(sim);
+        rv_destroy(sim);
+        return EXIT_FAILURE;
+    }
+    if (binary_file && loaded_bytes % 2 != 0) {
+        printf("Warning: File size is not a multiple of 2 bytes.\n");
+    }
+    if (restore_filename && rv_restore_checkpoint(sim, restore_filename) != RV_OK) {
+        fprintf(stderr, "%s\n", rv_get_trap(sim)->message);
+        dump_registers_res(sim);
+        rv_destroy(sim);
+        return EXIT_FAILURE;
+    }
+    if (symbols_filename && rv_load_symbols(sim, symbols_filename) != RV_OK) {
+        fprintf(stderr, "%s\n", rv_get_trap(sim)->message); // the run goes on unsymbolized
+    }
+
+    uint64_t start_instret = rv_get_instret(sim);
+    rv_status_t status;
+    fflush(stdout); // the program's own output goes straight to the file descriptors
+
+    if (bbv_filename) {
+        status = rv_collect_bbv(sim, bbv_interval, max_insns, bbv_filename, bbv_checkpoint_prefix);
+    } else {
+        status = rv_step(sim, max_insns);
+    }
+    switch (status) {
+        case RV_OK:
+            printf("Stopped after %llu instructions at PC: 0x%08X\n",
+                   (unsigned long long)(rv_get_instret(sim) - start_instret), rv_get_pc(sim));
+            rv_print_registers(sim);
+            break;
+        case RV_HALT_ECALL:
+        case RV_HALT_EBREAK:
+            printf("%s\n", rv_get_trap(sim)->message);
+            rv_print_registers(sim);
+            break;
+        case RV_HALT_EXIT:
+            printf("%s\n", rv_get_trap(sim)->message);
+            rv_print_registers(sim);
+            exit_code = rv_get_reg(sim, 10) & 0xFF; // the program's exit status becomes the simulator's
+            break;
+        case RV_HALT_IDLE:
+        case RV_HALT_WATCHDOG:
+            printf("%s\n", rv_get_trap(sim)->message);
+            rv_print_registers(sim);
+            exit_code = status == RV_HALT_IDLE ? EXIT_IDLE : EXIT_WATCHDOG;
+            break;
+        default:
+            printf("%s\n", rv_get_trap(sim)->message);
+            exit_code = EXIT_FAILURE;
+            break;
+    }
+    rv_print_stats(sim);
+    rv_print_caches(sim);
+    rv_print_timing(sim);
+    if (print_fusion) {
+        rv_print_fusion(sim);
+    }
+    if ((profile_filename || profile_pcs_filename) &&
+        rv_write_profile(sim, profile_filename, profile_pcs_filename) != RV_OK) {
+        fprintf(stderr, "%s\n", rv_get_trap(sim)->message);
+        exit_code = EXIT_FAILURE;
+    }
+    if (save_filename && rv_save_checkpoint(sim, save_filename) != RV_OK) {
+        fprintf(stderr, "%s\n", rv_get_trap(sim)->message);
+        exit_code = EXIT_FAILURE;
+    }
+    dump_registers_res(sim);
+    rv_destroy(sim);
+    return exit_code;
+}
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+
+// Paged guest memory.
+// sim->page_tables[address >> 22] points to a second-level table of PAGE_TABLE_ENTRIES page_t entries,
+// allocated the first time anything in its 4 MiB is touched. A page's data is allocated on its first
+// write; until then loads see zero_page. Loads and stores go through sim->tlb (mem_load/mem_store in
+// RISC-V.h) and only come here on a TLB miss, for an access that crosses into the next page, or for a
+// misaligned access while those trap.
+//
+// All harts of a simulator share the page tables (see smp.c), so tables, page data and decode caches are
+// allocated with a compare-and-swap and never freed while harts run: the loser of a race frees its copy
+// and takes the winner's. With several harts, reads allocate the data of the page too, since a TLB entry
+// pointing at zero_page would never see the writes of the other harts.
+
+static const uint8_t zero_page[PAGE_SIZE];
+
+// Function to find the page_t of address, allocating its second-level table if create is set
+// Returns NULL if the table doesn't exist (and wasn't created), which means the page is untouched
+page_t *mem_page(rv_sim_t *sim, uint32_t address, int create) {
+    page_t **slot = &sim->page_tables[address >> (PAGE_SHIFT + PAGE_TABLE_SHIFT)];
+    page_t *table = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+    if (!table) {
+        if (!create) {
+            return NULL;
+        }
+        page_t *fresh = calloc(PAGE_TABLE_ENTRIES, sizeof(page_t));
+        if (!fresh) {
+            return NULL;
+        }
+        for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+            fresh[i].perms = RV_PERM_ALL;
+        }
+        if (__atomic_compare_exchange_n(slot, &table, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            table = fresh;
+        } else {
+            free(fresh); // another hart created it first
+        }
+    }
+    return &table[(address >> PAGE_SHIFT) & (PAGE_TABLE_ENTRIES - 1)];
+}
+
+static const page_t *find_page(const rv_sim_t *sim, uint32_t address) {
+    const page_t *table = sim->page_tables[address >> (PAGE_SHIFT + PAGE_TABLE_SHIFT)];
+    return table ? &table[(address >> PAGE_SHIFT) & (PAGE_TABLE_ENTRIES - 1)] : NULL;
+}
+
+// Function to allocate the data of a page on its first write. Returns NULL when out of memory.
+static uint8_t *page_data(rv_sim_t *sim, page_t *page, uint32_t address) {
+    uint8_t *data = __atomic_load_n(&page->data, __ATOMIC_ACQUIRE);
+
+    if (!data) {
+        uint8_t *fresh = calloc(1, PAGE_SIZE);
+        if (!fresh) {
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(&page->data, &data, fresh, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            data = fresh;
+        } else {
+            free(fresh);
+        }
+        // the TLB may still map the page to zero_page
+        tlb_entry_t *entry = &sim->tlb[(address >> PAGE_SHIFT) & (TLB_ENTRIES - 1)];
+        entry->read_tag = TLB_INVALID;
+        entry->write_tag = TLB_INVALID;
+    }
+    return data;
+}
+
+// Function to point the TLB entry of the page at address to that page
+static void tlb_fill(rv_sim_t *sim, uint32_t address, const page_t *page) {
+    uint32_t page_address = address & PAGE_MASK;
+    tlb_entry_t *entry = &sim->tlb[(address >> PAGE_SHIFT) & (TLB_ENTRIES - 1)];
+    const uint8_t *data = page && page->data ? page->data : zero_page;
+    unsigned perms = page ? page->perms : RV_PERM_ALL;
+
+    entry->read_tag = (perms & RV_PERM_READ) ? page_address : TLB_INVALID;
+    entry->write_tag = (perms & RV_PERM_WRITE) && page && page->data && !page->decoded ? page_address : TLB_INVALID;
+    entry->addend = (uintptr_t)data - page_address;
+}
+
+void mem_flush_tlb(rv_sim_t *sim) {
+    for (int i = 0; i < TLB_ENTRIES; i++) {
+        sim->tlb[i].read_tag = TLB_INVALID;
+        sim->tlb[i].write_tag = TLB_INVALID;
+    }
+    sim->itlb_tag = TLB_INVALID;
+    sim->itlb_decoded = NULL;
+}
+
+// Function to load an access that missed the TLB. Only accesses that cross a page go byte by byte.
+rv_status_t mem_load_slow(rv_sim_t *sim, uint32_t address, int size, uint32_t *value) {
+    if (address & (size - 1) & sim->misaligned_mask) {
+        return RV_TRAP_MISALIGNED;
+    }
+    if (((address ^ (address + size - 1)) & PAGE_MASK) == 0) {
+        const page_t *page = find_page(sim, address);
+        if (page && !(page->perms & RV_PERM_READ)) {
+            return RV_TRAP_ACCESS_FAULT;
+        }
+        if (sim->smp && !(page && page->data)) {
+            page_t *shared = mem_page(sim, address, 1);
+            if (!shared || !page_data(sim, shared, address)) {
+                return RV_TRAP_ACCESS_FAULT; // out of host memory
+            }
+            page = shared;
+        }
+        tlb_fill(sim, address, page);
+        const uint8_t *data = page && page->data ? page->data : zero_page;
+        *value = load_le(&data[address & (PAGE_SIZE - 1)], size);
+        return RV_OK;
+    }
+
+    uint32_t result = 0;
+    for (int i = 0; i < size; i++) {
+        uint32_t byte_address = address + i;
+        const page_t *page = find_page(sim, byte_address);
+        if (page && !(page->perms & RV_PERM_READ)) {
+            return RV_TRAP_ACCESS_FAULT;
+        }
+        if (page && page->data) {
+            result |= (uint32_t)page->data[byte_address & (PAGE_SIZE - 1)] << (8 * i);
+        }
+    }
+    *value = result;
+    return RV_OK;
+}
+
+// Function to store an access that missed the TLB. Allocates the pages it writes and drops decoded
+// copies of the bytes it overwrites. Only accesses that cross a page go byte by byte.
+rv_status_t mem_store_slow(rv_sim_t *sim, uint32_t address, int size, uint32_t value) {
+    if (address & (size - 1) & sim->misaligned_mask) {
+        return RV_TRAP_MISALIGNED;
+    }
+    // Check every page first, so a faulting store that crosses a page changes nothing
+    for (int i = 0; i < size; i++) {
+        const page_t *page = find_page(sim, address + i);
+        if (page && !(page->perms & RV_PERM_WRITE)) {
+            return RV_TRAP_ACCESS_FAULT;
+        }
+    }
+    if (((address ^ (address + size - 1)) & PAGE_MASK) == 0) {
+        page_t *page = mem_page(sim, address, 1);
+        uint8_t *data = page ? page_data(sim, page, address) : NULL;
+        if (!data) {
+            return RV_TRAP_ACCESS_FAULT; // out of host memory
+        }
+        store_le(&data[address & (PAGE_SIZE - 1)], size, value);
+        tlb_fill(sim, address, page);
+        if (page->decoded) {
+            invalidate_decoded(sim, address, size); // drop any decoded copy of the bytes we just overwrote
+        }
+        return RV_OK;
+    }
+
+    for (int i = 0; i < size; i++) {
+        uint32_t byte_address = address + i;
+        page_t *page = mem_page(sim, byte_address, 1);
+        uint8_t *data = page ? page_data(sim, page, byte_address) : NULL;
+        if (!data) {
+            return RV_TRAP_ACCESS_FAULT;
+        }
+        data[byte_address & (PAGE_SIZE - 1)] = (value >> (8 * i)) & 0xFF;
+    }
+    invalidate_decoded(sim, address, size);
+    return RV_OK;
+}
+
+// Function to find the host address of the word at address for LR.W, SC.W and the AMOs, which access it
+// with host atomics. The word has to be aligned even while misaligned accesses are allowed, so it never
+// crosses a page; write is 0 for LR.W, which only needs read permission. The page data is allocated, so
+// every hart gets the same host word, and decoded copies of the word are dropped before it is written.
+rv_status_t mem_atomic_word(rv_sim_t *sim, uint32_t address, int write, uint32_t **host) {
+    if (address & 3) {
+        return RV_TRAP_MISALIGNED;
+    }
+    page_t *page = mem_page(sim, address, 1);
+    if (!page) {
+        return RV_TRAP_ACCESS_FAULT;
+    }
+    if (!(page->perms & RV_PERM_READ) || (write && !(page->perms & RV_PERM_WRITE))) {
+        return RV_TRAP_ACCESS_FAULT;
+    }
+    uint8_t *data = page_data(sim, page, address);
+    if (!data) {
+        return RV_TRAP_ACCESS_FAULT;
+    }
+    if (write && page->decoded) {
+        invalidate_decoded(sim, address, 4);
+    }
+    *host = (uint32_t *)(void *)&data[address & (PAGE_SIZE - 1)];
+    return RV_OK;
+}
+
+// Function to free every page and second-level table
+void mem_free(rv_sim_t *sim) {
+    for (int t = 0; t < PAGE_TABLE_ENTRIES; t++) {
+        page_t *table = sim->page_tables[t];
+        if (!table) {
+            continue;
+        }
+        for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+            if (!table[i].data && !table[i].decoded) {
+                continue; // untouched, the common case for a small program
+            }
+            if (!table[i].borrowed) {
+                free(table[i].data);
+            }
+            free(table[i].decoded);
+        }
+        free(table);
+        sim->page_tables[t] = NULL;
+    }
+    elf_release_image(sim); // no page points into it any more
+    sim->code_writes++;
+    mem_flush_tlb(sim);
+    if (sim->smp) {
+        smp_memory_changed(sim);
+    }
+}
+
+// Function to free the decode cache of every page, so each instruction is decoded again on its next fetch
+void mem_drop_decoded(rv_sim_t *sim) {
+    for (int t = 0; t < PAGE_TABLE_ENTRIES; t++) {
+        page_t *table = sim->page_tables[t];
+        if (!table) {
+            continue;
+        }
+        for (int i = 0; i < PAGE_TABLE_ENTRIES; i++) {
+            free(table[i].decoded);
+            table[i].decoded = NULL;
+        }
+    }
+    sim->code_writes++;
+    mem_flush_tlb(sim); // stores to those pages may take the fast path again
+    if (sim->smp) {
+        smp_memory_changed(sim);
+    }
+}
+
+rv_status_t rv_write_mem(rv_sim_t *sim, uint32_t address, const void *buffer, size_t size) {
+    const uint8_t *bytes = buffer;
+
+    if (size > (uint64_t)UINT32_MAX + 1) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, address, "Memory range too large: %zu bytes", size);
+    }
+    while (size > 0) {
+        uint32_t offset = address & (PAGE_SIZE - 1);
+        size_t chunk = PAGE_SIZE - offset < size ? PAGE_SIZE - offset : size;
+        page_t *page = mem_page(sim, address, 1);
+        uint8_t *data = page ? page_data(sim, page, address) : NULL;
+        if (!data) {
+            return rv_raise(sim, RV_ERROR_IO, address, "Failed to allocate memory at address 0x%X", address);
+        }
+        memcpy(&data[offset], bytes, chunk);
+        if (page->decoded) {
+            invalidate_decoded(sim, address, (int)chunk);
+            if (sim->smp) {
+                smp_memory_changed(sim); // the other harts' translations of the code are stale too
+            }
+        }
+        address += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+    return RV_OK;
+}
+
+rv_status_t rv_read_mem(const rv_sim_t *sim, uint32_t address, void *buffer, size_t size) {
+    uint8_t *bytes = buffer;
+
+    if (size > (uint64_t)UINT32_MAX + 1) {
+        return RV_ERROR_ARGUMENT;
+    }
+    while (size > 0) {
+        uint32_t offset = address & (PAGE_SIZE - 1);
+        size_t chunk = PAGE_SIZE - offset < size ? PAGE_SIZE - offset : size;
+        const page_t *page = find_page(sim, address);
+        memcpy(bytes, page && page->data ? &page->data[offset] : &zero_page[offset], chunk);
+        address += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+    return RV_OK;
+}
+
+rv_status_t rv_set_permissions(rv_sim_t *sim, uint32_t address, uint64_t size, unsigned perms) {
+    if (size == 0) {
+        return RV_OK;
+    }
+    if (size > (uint64_t)UINT32_MAX + 1 || (perms & ~RV_PERM_ALL)) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, address, "Bad permission range or bits");
+    }
+    uint64_t first = address >> PAGE_SHIFT;
+    uint64_t last = ((uint64_t)address + size - 1) >> PAGE_SHIFT;
+    for (uint64_t page_number = first; page_number <= last; page_number++) {
+        page_t *page = mem_page(sim, (uint32_t)(page_number << PAGE_SHIFT), 1);
+        if (!page) {
+            return rv_raise(sim, RV_ERROR_IO, (uint32_t)(page_number << PAGE_SHIFT), "Failed to allocate page table");
+        }
+        page->perms = (uint8_t)perms;
+    }
+    mem_flush_tlb(sim);
+    jit_destroy(sim); // translated code may sit on pages that are no longer executable
+    if (sim->smp) {
+        smp_memory_changed(sim);
+    }
+    return RV_OK;
+}
@@ -0,0 +1,313 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+
+// Guest profiler.
+// While profiling is on, the instrumented core variants hand every completed instruction to
+// profile_retire, which counts it twice: per pc, and in the call tree node of the function that is
+// running. Calls and returns follow the calling convention: JAL/JALR with rd = ra is a call, and
+// JALR x0, 0(ra) returns. A tail call (J/JR) stays in the caller's node. The tree is rooted at the
+// first instruction profiled.
+//
+// rv_write_profile writes the tree in the collapsed-stack format of flamegraph.pl and speedscope,
+// one "root;caller;callee <instructions>" line per node, and the histogram as one
+// "<pc> <symbol+offset> <instructions> <percent>" line per pc, most executed first.
+#define PROFILE_MAX_DEPTH 1024 // deeper calls (runaway recursion) are counted in the deepest node
+
+typedef struct {
+    uint32_t pc;
+    uint64_t count;               // 0 marks an empty slot
+} pc_count_t;
+
+typedef struct {
+    uint32_t address;             // entry point of the function
+    uint32_t parent;              // index of the caller's node, the root is its own parent
+    uint32_t depth;
+    uint64_t self;                // instructions executed in this node
+} profile_node_t;
+
+struct profile_state {
+    pc_count_t *pcs;              // open addressing on pc
+    size_t pc_capacity;           // power of two
+    size_t num_pcs;
+    profile_node_t *nodes;        // nodes[0] is the root
+    size_t num_nodes, node_capacity;
+    uint32_t *children;           // open addressing on (parent, address), node index + 1, 0 when empty
+    size_t child_capacity;        // power of two
+    uint32_t current;             // node of the running function
+    uint32_t excess_depth;        // calls below a node at PROFILE_MAX_DEPTH that are still running
+    int out_of_memory;            // counts that didn't fit are missing
+};
+
+static size_t hash_pc(uint32_t pc) {
+    return (size_t)((pc >> 1) * 2654435761u);
+}
+
+static size_t hash_child(uint32_t parent, uint32_t address) {
+    return (size_t)(((address >> 1) ^ (parent * 0x9E3779B9u)) * 2654435761u);
+}
+
+rv_status_t rv_set_profile(rv_sim_t *sim, int enable) {
+    profile_state_t *profile = sim->profile;
+
+    if (profile) {
+        free(profile->pcs);
+        free(profile->nodes);
+        free(profile->children);
+        free(profile);
+        sim->profile = NULL;
+    }
+    if (!enable) {
+        return RV_OK;
+    }
+    sim->profile = calloc(1, sizeof(profile_state_t));
+    if (!sim->profile) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to allocate profile");
+    }
+    return RV_OK;
+}
+
+static int grow_pcs(profile_state_t *profile) {
+    size_t capacity = profile->pc_capacity ? profile->pc_capacity * 2 : 4096;
+    pc_count_t *pcs = calloc(capacity, sizeof(pc_count_t));
+    if (!pcs) {
+        return 0;
+    }
+    for (size_t i = 0; i < profile->pc_capacity; i++) {
+        if (profile->pcs[i].count) {
+            size_t s = hash_pc(profile->pcs[i].pc) & (capacity - 1);
+            while (pcs[s].count) {
+                s = (s + 1) & (capacity - 1);
+            }
+            pcs[s] = profile->pcs[i];
+        }
+    }
+    free(profile->pcs);
+    profile->pcs = pcs;
+    profile->pc_capacity = capacity;
+    return 1;
+}
+
+static void count_pc(profile_state_t *profile, uint32_t pc) {
+    if ((profile->num_pcs + 1) * 2 > profile->pc_capacity && !grow_pcs(profile)) {
+        profile->out_of_memory = 1;
+        return;
+    }
+    size_t s = hash_pc(pc) & (profile->pc_capacity - 1);
+    while (profile->pcs[s].count && profile->pcs[s].pc != pc) {
+        s = (s + 1) & (profile->pc_capacity - 1);
+    }
+    if (profile->pcs[s].count == 0) {
+        profile->pcs[s].pc = pc;
+        profile->num_pcs++;
+    }
+    profile->pcs[s].count++;
+}
+
+static int grow_children(profile_state_t *profile) {
+    size_t capacity = profile->child_capacity ? profile->child_capacity * 2 : 1024;
+    uint32_t *children = calloc(capacity, sizeof(uint32_t));
+    if (!children) {
+        return 0;
+    }
+    for (size_t i = 0; i < profile->child_capacity; i++) {
+        uint32_t child = profile->children[i];
+        if (child) {
+            const profile_node_t *node = &profile->nodes[child - 1];
+            size_t s = hash_child(node->parent, node->address) & (capacity - 1);
+            while (children[s]) {
+                s = (s + 1) & (capacity - 1);
+            }
+            children[s] = child;
+        }
+    }
+    free(profile->children);
+    profile->children = children;
+    profile->child_capacity = capacity;
+    return 1;
+}
+
+// Function to add a node to the tree. Returns its index, or UINT32_MAX when out of memory.
+static uint32_t add_node(profile_state_t *profile, uint32_t parent, uint32_t address, uint32_t depth) {
+    if (profile->num_nodes == profile->node_capacity) {
+        size_t capacity = profile->node_capacity ? profile->node_capacity * 2 : 256;
+        profile_node_t *nodes = realloc(profile->nodes, capacity * sizeof(profile_node_t));
+        if (!nodes) {
+            return UINT32_MAX;
+        }
+        profile->nodes = nodes;
+        profile->node_capacity = capacity;
+    }
+    profile_node_t *node = &profile->nodes[profile->num_nodes];
+    node->address = address;
+    node->parent = parent;
+    node->depth = depth;
+    node->self = 0;
+    return (uint32_t)profile->num_nodes++;
+}
+
+// Function to enter the function at address from the running one
+static void profile_call(profile_state_t *profile, uint32_t address) {
+    uint32_t parent = profile->current;
+
+    if (profile->excess_depth || profile->nodes[parent].depth >= PROFILE_MAX_DEPTH) {
+        profile->excess_depth++;
+        return;
+    }
+    if ((profile->num_nodes + 1) * 2 > profile->child_capacity && !grow_children(profile)) {
+        profile->out_of_memory = 1;
+        profile->excess_depth++;
+        return;
+    }
+    size_t s = hash_child(parent, address) & (profile->child_capacity - 1);
+    for (uint32_t child; (child = profile->children[s]) != 0; s = (s + 1) & (profile->child_capacity - 1)) {
+        if (profile->nodes[child - 1].parent == parent && profile->nodes[child - 1].address == address) {
+            profile->current = child - 1;
+            return;
+        }
+    }
+    uint32_t node = add_node(profile, parent, address, profile->nodes[parent].depth + 1);
+    if (node == UINT32_MAX) {
+        profile->out_of_memory = 1;
+        profile->excess_depth++;
+        return;
+    }
+    profile->children[s] = node + 1;
+    profile->current = node;
+}
+
+static void profile_return(profile_state_t *profile) {
+    if (profile->excess_depth) {
+        profile->excess_depth--;
+    } else {
+        profile->current = profile->nodes[profile->current].parent; // returning from the root stays there
+    }
+}
+
+void profile_retire(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d, uint32_t next_pc) {
+    profile_state_t *profile = sim->profile;
+
+    if (profile->num_nodes == 0 && add_node(profile, 0, insn_pc, 0) == UINT32_MAX) {
+        profile->out_of_memory = 1;
+        return;
+    }
+    count_pc(profile, insn_pc);
+    profile->nodes[profile->current].self++;
+    if (d->insn == INSN_JAL || d->insn == INSN_JALR) {
+        if (d->rd == 1) {
+            profile_call(profile, next_pc);
+        } else if (d->insn == INSN_JALR && d->rd == 0 && d->rs1 == 1 && d->imm == 0) {
+            profile_return(profile);
+        }
+    }
+}
+
+// Function to print the name of the function at address: its symbol, the symbol it is in plus an offset,
+// or the address itself
+static void write_function_name(FILE *out, const rv_sim_t *sim, uint32_t address) {
+    const rv_symbol_t *symbol = rv_find_symbol(sim, address);
+
+    if (!symbol) {
+        fprintf(out, "0x%08X", address);
+    } else if (symbol->address == address) {
+        fputs(symbol->name, out);
+    } else {
+        fprintf(out, "%s+0x%X", symbol->name, address - symbol->address);
+    }
+}
+
+static int write_stacks(const rv_sim_t *sim, FILE *out) {
+    const profile_state_t *profile = sim->profile;
+    uint32_t path[PROFILE_MAX_DEPTH + 1];
+
+    for (size_t i = 0; i < profile->num_nodes; i++) {
+        const profile_node_t *node = &profile->nodes[i];
+        if (node->self == 0) {
+            continue;
+        }
+        uint32_t depth = 0;
+        for (uint32_t n = (uint32_t)i; ; n = profile->nodes[n].parent) {
+            path[depth++] = n;
+            if (n == 0) {
+                break;
+            }
+        }
+        while (depth-- > 0) {
+            write_function_name(out, sim, profile->nodes[path[depth]].address);
+            fputc(depth ? ';' : ' ', out);
+        }
+        fprintf(out, "%llu\n", (unsigned long long)node->self);
+    }
+    return !ferror(out);
+}
+
+static int compare_pc_counts(const void *a, const void *b) {
+    const pc_count_t *x = a, *y = b;
+    if (x->count != y->count) {
+        return x->count < y->count ? 1 : -1;
+    }
+    return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+static int write_histogram(const rv_sim_t *sim, FILE *out) {
+    const profile_state_t *profile = sim->profile;
+    pc_count_t *pcs = malloc((profile->num_pcs + 1) * sizeof(pc_count_t));
+    uint64_t total = 0;
+    size_t n = 0;
+
+    if (!pcs) {
+        return 0;
+    }
+    for (size_t i = 0; i < profile->pc_capacity; i++) {
+        if (profile->pcs[i].count) {
+            pcs[n++] = profile->pcs[i];
+            total += profile->pcs[i].count;
+        }
+    }
+    qsort(pcs, n, sizeof(pc_count_t), compare_pc_counts);
+    for (size_t i = 0; i < n; i++) {
+        const rv_symbol_t *symbol = rv_find_symbol(sim, pcs[i].pc);
+        char location[128] = "-";
+        if (symbol) {
+            snprintf(location, sizeof(location), "%s+0x%X", symbol->name, pcs[i].pc - symbol->address);
+        }
+        fprintf(out, "0x%08X %-32s %14llu %6.2f%%\n", pcs[i].pc, location, (unsigned long long)pcs[i].count,
+                100.0 * pcs[i].count / total);
+    }
+    free(pcs);
+    return !ferror(out);
+}
+
+// Function to write one of the profile files with writer
+static rv_status_t write_profile_file(rv_sim_t *sim, const char *filename, int (*writer)(const rv_sim_t *, FILE *)) {
+    FILE *out = fopen(filename, "w");
+    if (!out) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to open profile file: %s", strerror(errno));
+    }
+    int ok = writer(sim, out);
+    if (fclose(out) != 0 || !ok) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to write profile file: %s", filename);
+    }
+    return RV_OK;
+}
+
+rv_status_t rv_write_profile(rv_sim_t *sim, const char *stacks_filename, const char *pcs_filename) {
+    if (!sim->profile) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Profiling is off");
+    }
+    rv_status_t status = RV_OK;
+    if (stacks_filename) {
+        status = write_profile_file(sim, stacks_filename, write_stacks);
+    }
+    if (status == RV_OK && pcs_filename) {
+        status = write_profile_file(sim, pcs_filename, write_histogram);
+    }
+    if (status == RV_OK && sim->profile->out_of_memory) {
+        status = rv_raise(sim, RV_ERROR_IO, 0, "The profiler ran out of memory, the profile is incomplete");
+    }
+    return status;
+}
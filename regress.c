@@ -0,0 +1,518 @@
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "riscv_sim.h"
+
+// Batch regression runner.
+// Finds every .bin under the given directories, runs them in-process on a pool of worker threads (one
+// simulator per worker, reset between tests) and compares the final registers with the .res file next
+// to each binary. Work is split evenly up front; a worker that runs out steals from the back of the
+// busiest other worker's queue, so a few long tests don't leave the other cores idle.
+// A .res file with the registers of several harts one after the other runs its test on that many harts.
+
+#define NUM_REGISTERS 32
+
+typedef enum {
+    RESULT_PASS,
+    RESULT_FAIL,      // registers differ from the .res file
+    RESULT_TIMEOUT,   // instruction limit reached
+    RESULT_NO_REF,    // no .res file next to the binary
+    RESULT_ERROR      // binary or .res file unreadable
+} test_result_t;
+
+static const char *result_names[] = { "PASS", "FAIL", "TIMEOUT", "NOREF", "ERROR" };
+
+typedef struct {
+    char *path;
+    test_result_t result;
+    rv_status_t status;
+    uint64_t instructions;
+    double seconds;
+    unsigned harts;                                        // from the size of the .res file
+    int32_t registers[RV_MAX_HARTS * NUM_REGISTERS];       // hart h's registers start at h * NUM_REGISTERS
+    int32_t expected[RV_MAX_HARTS * NUM_REGISTERS];
+    uint64_t fusions[RV_FUSION_COUNT];
+    char message[128];
+} test_t;
+
+// Indices [head, tail) into the test list that a worker has still to run
+typedef struct {
+    pthread_mutex_t lock;
+    size_t head, tail;
+} work_queue_t;
+
+static test_t *tests;
+static size_t num_tests, tests_capacity;
+static work_queue_t *queues;
+static int num_workers;
+static rv_core_t core = RV_CORE_SWITCH;
+static uint64_t max_instructions = RV_UNLIMITED;
+static int fusion = 1;
+static const char *out_dir;
+static int syscalls;
+static const char *sandbox_dir;
+static rv_memory_order_t memory_order = RV_ORDER_SC;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int has_suffix(const char *name, const char *suffix) {
+    size_t name_length = strlen(name), suffix_length = strlen(suffix);
+    return name_length > suffix_length && strcmp(name + name_length - suffix_length, suffix) == 0;
+}
+
+static void add_test(const char *path) {
+    if (num_tests == tests_capacity) {
+        tests_capacity = tests_capacity ? tests_capacity * 2 : 256;
+        tests = realloc(tests, tests_capacity * sizeof(test_t));
+        if (!tests) {
+            printf("Failed to allocate the test list\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memset(&tests[num_tests], 0, sizeof(test_t));
+    tests[num_tests].path = strdup(path);
+    num_tests++;
+}
+
+// Function to collect the .bin files under path (or path itself if it is a file)
+static void find_tests(const char *path) {
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        printf("Error: '%s': %s\n", path, strerror(errno));
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        add_test(path);
+        return;
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        printf("Error: '%s': %s\n", path, strerror(errno));
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        size_t length = strlen(path) + strlen(entry->d_name) + 2;
+        char *child = malloc(length);
+        snprintf(child, length, "%s/%s", path, entry->d_name);
+        if (stat(child, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                find_tests(child);
+            } else if (has_suffix(entry->d_name, ".bin")) {
+                add_test(child);
+            }
+        }
+        free(child);
+    }
+    closedir(dir);
+}
+
+static int compare_tests(const void *a, const void *b) {
+    return strcmp(((const test_t *)a)->path, ((const test_t *)b)->path);
+}
+
+// Function to read the expected registers from the .res file next to the binary, and the number of harts
+// Returns 1 on success, 0 if there is no .res file, -1 if it doesn't hold the registers of 1 to RV_MAX_HARTS harts
+static int read_expected(test_t *test) {
+    size_t length = strlen(test->path);
+    char *res_path = malloc(length + 5);
+
+    memcpy(res_path, test->path, length + 1);
+    if (has_suffix(res_path, ".bin")) {
+        res_path[length - 4] = '\0';
+    }
+    strcat(res_path, ".res");
+    FILE *file = fopen(res_path, "rb");
+    free(res_path);
+    if (!file) {
+        return 0;
+    }
+    size_t count = fread(test->expected, sizeof(int32_t), RV_MAX_HARTS * NUM_REGISTERS, file);
+    int longer = fgetc(file) != EOF;
+    fclose(file);
+    if (count == 0 || count % NUM_REGISTERS != 0 || longer) {
+        return -1;
+    }
+    test->harts = (unsigned)(count / NUM_REGISTERS);
+    return 1;
+}
+
+// Function to write the register dump of a test to out_dir/<name>.res, as run_simulations.sh did
+static void write_dump(const rv_sim_t *sim, const test_t *test) {
+    const char *name = strrchr(test->path, '/');
+    name = name ? name + 1 : test->path;
+    size_t length = strlen(out_dir) + strlen(name) + 6;
+    char *res_path = malloc(length);
+
+    snprintf(res_path, length, "%s/%s", out_dir, name);
+    if (has_suffix(res_path, ".bin")) {
+        res_path[strlen(res_path) - 4] = '\0';
+    }
+    strcat(res_path, ".res");
+    if (rv_dump_registers(sim, res_path) != RV_OK) {
+        printf("Error: Failed to write '%s'.\n", res_path);
+    }
+    free(res_path);
+}
+
+static void run_test(rv_sim_t *sim, test_t *test) {
+    double start = now_seconds();
+    int found = read_expected(test);
+
+    if (found < 0) {
+        test->result = RESULT_ERROR;
+        snprintf(test->message, sizeof(test->message), "Reference .res file doesn't hold 1 to %d times %d registers",
+                 RV_MAX_HARTS, NUM_REGISTERS);
+        return;
+    }
+    if (found == 0) {
+        test->harts = 1;
+    }
+    if (rv_set_harts(sim, test->harts) != RV_OK || rv_set_memory_order(sim, memory_order, 10000) != RV_OK) {
+        test->result = RESULT_ERROR;
+        snprintf(test->message, sizeof(test->message), "%s", rv_get_trap(sim)->message);
+        return;
+    }
+    rv_reset(sim);
+    if (rv_load_file(sim, test->path, NULL) != RV_OK) {
+        test->result = RESULT_ERROR;
+        snprintf(test->message, sizeof(test->message), "%s", rv_get_trap(sim)->message);
+        test->seconds = now_seconds() - start;
+        return;
+    }
+    test->status = rv_step(sim, max_instructions);
+    for (unsigned h = 0; h < test->harts; h++) {
+        const rv_sim_t *hart = rv_get_hart(sim, h);
+        test->instructions += rv_get_instret(hart);
+        for (int kind = 0; kind < RV_FUSION_COUNT; kind++) {
+            test->fusions[kind] += rv_get_fusions(hart, kind);
+        }
+        for (int i = 0; i < NUM_REGISTERS; i++) {
+            test->registers[h * NUM_REGISTERS + i] = rv_get_reg(hart, i);
+        }
+    }
+    if (test->status != RV_OK) {
+        snprintf(test->message, sizeof(test->message), "%s", rv_get_trap(sim)->message);
+    }
+    if (out_dir) {
+        write_dump(sim, test);
+    }
+
+    if (test->status == RV_OK) {
+        test->result = RESULT_TIMEOUT;
+        snprintf(test->message, sizeof(test->message), "Stopped after %llu instructions", (unsigned long long)max_instructions);
+    } else if (found == 0) {
+        test->result = RESULT_NO_REF;
+    } else {
+        size_t size = test->harts * NUM_REGISTERS * sizeof(int32_t);
+        test->result = memcmp(test->registers, test->expected, size) == 0 ? RESULT_PASS : RESULT_FAIL;
+    }
+    test->seconds = now_seconds() - start;
+}
+
+// Function to take the next test for a worker: its own queue first, then the back of the fullest other queue
+static int next_test(int worker, size_t *index) {
+    work_queue_t *own = &queues[worker];
+
+    pthread_mutex_lock(&own->lock);
+    if (own->head < own->tail) {
+        *index = own->head++;
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (;;) {
+        int victim = -1;
+        size_t most = 0;
+        for (int w = 0; w < num_workers; w++) {
+            if (w == worker) {
+                continue;
+            }
+            pthread_mutex_lock(&queues[w].lock);
+            size_t left = queues[w].tail - queues[w].head;
+            pthread_mutex_unlock(&queues[w].lock);
+            if (left > most) {
+                most = left;
+                victim = w;
+            }
+        }
+        if (victim < 0) {
+            return 0;
+        }
+        pthread_mutex_lock(&queues[victim].lock);
+        if (queues[victim].head < queues[victim].tail) {
+            *index = --queues[victim].tail;
+            pthread_mutex_unlock(&queues[victim].lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&queues[victim].lock);
+    }
+}
+
+static void *worker_main(void *arg) {
+    int worker = (int)(intptr_t)arg;
+    size_t index;
+    rv_sim_t *sim = rv_create();
+
+    if (!sim) {
+        printf("Failed to allocate simulator memory\n");
+        return NULL; // the other workers steal this worker's tests
+    }
+    rv_set_core(sim, core);
+    rv_set_fusion(sim, fusion);
+    if (syscalls) {
+        rv_set_syscalls(sim, 1, sandbox_dir); // main checked that the sandbox opens
+    }
+    while (next_test(worker, &index)) {
+        run_test(sim, &tests[index]);
+    }
+    rv_destroy(sim);
+    return NULL;
+}
+
+static const char *status_name(rv_status_t status) {
+    switch (status) {
+        case RV_OK: return "running";
+        case RV_HALT_ECALL: return "ecall";
+        case RV_HALT_EBREAK: return "ebreak";
+        case RV_HALT_IDLE: return "idle";
+        case RV_HALT_EXIT: return "exit";
+        case RV_HALT_WATCHDOG: return "watchdog";
+        case RV_TRAP_ACCESS_FAULT: return "access_fault";
+        case RV_TRAP_MISALIGNED: return "misaligned";
+        case RV_TRAP_ILLEGAL_INSTRUCTION: return "illegal_instruction";
+        default: return "error";
+    }
+}
+
+static void write_json_string(FILE *file, const char *text) {
+    fputc('"', file);
+    for (; *text; text++) {
+        if (*text == '"' || *text == '\\') {
+            fprintf(file, "\\%c", *text);
+        } else if ((unsigned char)*text < 0x20) {
+            fprintf(file, "\\u%04x", *text);
+        } else {
+            fputc(*text, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// Function to write the machine-readable summary
+static int write_summary(const char *filename, const size_t counts[], double wall_seconds) {
+    FILE *file = fopen(filename, "w");
+    if (!file) {
+        perror("Failed to open summary file");
+        return 0;
+    }
+    fprintf(file, "{\n  \"threads\": %d,\n  \"wall_seconds\": %.6f,\n", num_workers, wall_seconds);
+    fprintf(file, "  \"passed\": %zu,\n  \"failed\": %zu,\n  \"timeouts\": %zu,\n  \"no_reference\": %zu,\n  \"errors\": %zu,\n",
+            counts[RESULT_PASS], counts[RESULT_FAIL], counts[RESULT_TIMEOUT], counts[RESULT_NO_REF], counts[RESULT_ERROR]);
+    fprintf(file, "  \"tests\": [\n");
+    for (size_t i = 0; i < num_tests; i++) {
+        const test_t *test = &tests[i];
+        fprintf(file, "    {\"binary\": ");
+        write_json_string(file, test->path);
+        fprintf(file, ", \"result\": \"%s\", \"status\": \"%s\", \"instructions\": %llu, \"seconds\": %.6f",
+                result_names[test->result], status_name(test->status), (unsigned long long)test->instructions, test->seconds);
+        if (test->result == RESULT_FAIL) {
+            fprintf(file, ", \"mismatched_registers\": ["); // hart h's register r is h * 32 + r
+            for (unsigned r = 0, first = 1; r < test->harts * NUM_REGISTERS; r++) {
+                if (test->registers[r] != test->expected[r]) {
+                    fprintf(file, "%s%u", first ? "" : ", ", r);
+                    first = 0;
+                }
+            }
+            fprintf(file, "]");
+        }
+        fprintf(file, "}%s\n", i + 1 < num_tests ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    fclose(file);
+    return 1;
+}
+
+//          Main function
+int main(int argc, char *argv[]) {
+    const char *summary_file = NULL;
+    int quiet = 0;
+    int print_fusion = 0;
+    int usage_error = 0;
+    int num_paths = 0;
+
+    num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--core=switch") == 0) {
+            core = RV_CORE_SWITCH;
+        } else if (strcmp(argv[i], "--core=threaded") == 0) {
+            core = RV_CORE_THREADED;
+        } else if (strcmp(argv[i], "--core=jit") == 0) {
+            core = RV_CORE_JIT;
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            num_workers = atoi(argv[i] + 2);
+            usage_error |= num_workers < 1;
+        } else if (strncmp(argv[i], "--max-insns=", 12) == 0) {
+            max_instructions = strtoull(argv[i] + 12, NULL, 0);
+            usage_error |= max_instructions == 0;
+        } else if (strncmp(argv[i], "--summary=", 10) == 0) {
+            summary_file = argv[i] + 10;
+        } else if (strncmp(argv[i], "--out=", 6) == 0) {
+            out_dir = argv[i] + 6;
+        } else if (strcmp(argv[i], "--fusion") == 0) {
+            print_fusion = 1;
+        } else if (strcmp(argv[i], "--no-fusion") == 0) {
+            fusion = 0;
+        } else if (strcmp(argv[i], "--syscalls") == 0) {
+            syscalls = 1;
+        } else if (strncmp(argv[i], "--syscalls=", 11) == 0) {
+            syscalls = 1;
+            sandbox_dir = argv[i] + 11;
+        } else if (strcmp(argv[i], "--memory-order=sc") == 0) {
+            memory_order = RV_ORDER_SC;
+        } else if (strcmp(argv[i], "--memory-order=relaxed") == 0) {
+            memory_order = RV_ORDER_RELAXED;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            quiet = 1;
+        } else if (argv[i][0] != '-') {
+            num_paths++;
+        } else {
+            usage_error = 1;
+        }
+    }
+    if (usage_error) {
+        printf("Usage: %s [--core=switch|threaded|jit] [-j<threads>] [--max-insns=<n>] [--summary=<file.json>] [--out=<dir>] [--fusion|--no-fusion] [--syscalls[=<sandbox dir>]] [--memory-order=sc|relaxed] [-q] [<dir or .bin> ...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+    if (out_dir && mkdir(out_dir, 0777) != 0 && errno != EEXIST) {
+        printf("Error: Cannot create output directory '%s': %s\n", out_dir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (syscalls && sandbox_dir) {
+        rv_sim_t *sim = rv_create();
+        if (sim && rv_set_syscalls(sim, 1, sandbox_dir) != RV_OK) {
+            printf("Error: %s\n", rv_get_trap(sim)->message);
+            rv_destroy(sim);
+            return EXIT_FAILURE;
+        }
+        rv_destroy(sim);
+    }
+
+    if (num_paths == 0) {
+        find_tests("tests");
+    }
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            find_tests(argv[i]);
+        }
+    }
+    if (num_tests == 0) {
+        printf("No .bin files found.\n");
+        return EXIT_FAILURE;
+    }
+    qsort(tests, num_tests, sizeof(test_t), compare_tests);
+    if ((size_t)num_workers > num_tests) {
+        num_workers = (int)num_tests;
+    }
+
+    double start = now_seconds();
+    queues = calloc(num_workers, sizeof(work_queue_t));
+    pthread_t *threads = calloc(num_workers, sizeof(pthread_t));
+    if (!queues || !threads) {
+        printf("Failed to allocate worker threads\n");
+        return EXIT_FAILURE;
+    }
+    for (int w = 0; w < num_workers; w++) {
+        pthread_mutex_init(&queues[w].lock, NULL);
+        queues[w].head = num_tests * w / num_workers;
+        queues[w].tail = num_tests * (w + 1) / num_workers;
+    }
+    for (int w = 0; w < num_workers; w++) {
+        if (pthread_create(&threads[w], NULL, worker_main, (void *)(intptr_t)w) != 0) {
+            threads[w] = 0;
+            worker_main((void *)(intptr_t)w); // run the share here instead
+        }
+    }
+    for (int w = 0; w < num_workers; w++) {
+        if (threads[w]) {
+            pthread_join(threads[w], NULL);
+        }
+    }
+    double wall_seconds = now_seconds() - start;
+
+    size_t counts[5] = { 0 };
+    uint64_t total_instructions = 0;
+    for (size_t i = 0; i < num_tests; i++) {
+        const test_t *test = &tests[i];
+        counts[test->result]++;
+        total_instructions += test->instructions;
+        if (quiet && test->result == RESULT_PASS) {
+            continue;
+        }
+        printf("%-7s %s  %llu instructions  %.3f ms\n", result_names[test->result], test->path,
+               (unsigned long long)test->instructions, test->seconds * 1e3);
+        if (test->message[0] && test->result != RESULT_PASS) {
+            printf("        %s\n", test->message);
+        }
+        if (test->result == RESULT_FAIL) {
+            for (unsigned r = 0; r < test->harts * NUM_REGISTERS; r++) {
+                if (test->registers[r] == test->expected[r]) {
+                    continue;
+                }
+                if (test->harts > 1) {
+                    printf("        Hart %u register x%02u: ", r / NUM_REGISTERS, r % NUM_REGISTERS);
+                } else {
+                    printf("        Register x%02u: ", r);
+                }
+                printf("Incorrect value. Expected 0x%08X (%d), got 0x%08X (%d)\n",
+                       (uint32_t)test->expected[r], test->expected[r], (uint32_t)test->registers[r], test->registers[r]);
+            }
+        }
+    }
+    printf("%zu tests: %zu passed, %zu failed, %zu timed out, %zu without reference, %zu errors\n",
+           num_tests, counts[RESULT_PASS], counts[RESULT_FAIL], counts[RESULT_TIMEOUT], counts[RESULT_NO_REF], counts[RESULT_ERROR]);
+    printf("%llu instructions in %.3f s on %d threads\n", (unsigned long long)total_instructions, wall_seconds, num_workers);
+    if (print_fusion) {
+        // how often each fusion fired over all tests; only the threaded core fuses
+        uint64_t fused = 0;
+        for (int kind = 0; kind < RV_FUSION_COUNT; kind++) {
+            uint64_t count = 0;
+            size_t tests_using = 0;
+            for (size_t i = 0; i < num_tests; i++) {
+                count += tests[i].fusions[kind];
+                tests_using += tests[i].fusions[kind] != 0;
+            }
+            printf("%-16s %12llu pairs in %zu tests\n", rv_fusion_name(kind), (unsigned long long)count, tests_using);
+            fused += count;
+        }
+        printf("%-16s %12llu pairs, %.1f%% of the instructions\n", "total", (unsigned long long)fused,
+               total_instructions ? 200.0 * (double)fused / (double)total_instructions : 0.0);
+    }
+
+    if (summary_file && !write_summary(summary_file, counts, wall_seconds)) {
+        return EXIT_FAILURE;
+    }
+    return counts[RESULT_FAIL] || counts[RESULT_TIMEOUT] || counts[RESULT_ERROR] ? EXIT_FAILURE : EXIT_SUCCESS;
+}
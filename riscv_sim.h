@@ -0,0 +1,269 @@
+#ifndef RISCV_SIM_H
+#define RISCV_SIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Embeddable RV32IMAC simulator.
+// All hart state lives in an rv_sim_t, so any number of simulators can exist in one process (one thread
+// per simulator). Nothing in the library calls exit(): errors and program halts are returned as an
+// rv_status_t, and rv_get_trap() describes the last one.
+//
+//     rv_sim_t *sim = rv_create();
+//     if (rv_load_file(sim, "prog.bin", NULL) == RV_OK && rv_run(sim) == RV_HALT_ECALL) {
+//         int32_t a0 = rv_get_reg(sim, 10);
+//     }
+//     rv_destroy(sim);
+
+typedef struct rv_sim rv_sim_t;
+
+typedef enum {
+    RV_OK = 0,                     // instruction budget used up or stop pc reached, execution can continue
+    RV_HALT_ECALL,                 // ECALL executed, pc points at it
+    RV_HALT_EBREAK,                // EBREAK executed, pc points at it
+    RV_HALT_IDLE,                  // jump or taken branch to itself, or WFI: nothing could ever wake the hart;
+                                   // pc points at it
+    RV_HALT_EXIT,                  // exit system call (emulation only), pc points at the ECALL, a0 is the code
+    RV_HALT_WATCHDOG,              // a limit of rv_set_watchdog ran out, pc is where the program got to
+    RV_TRAP_ACCESS_FAULT,          // load, store or fetch on a page without the permission for it
+    RV_TRAP_MISALIGNED,            // misaligned access while misaligned accesses are disabled
+    RV_TRAP_ILLEGAL_INSTRUCTION,   // unsupported opcode/funct3/funct7
+    RV_ERROR_IO,                   // loading a program failed
+    RV_ERROR_ARGUMENT              // bad register number, address range or option
+} rv_status_t;
+
+// Description of the last halt, trap or error
+typedef struct {
+    rv_status_t status;
+    uint32_t pc;                   // pc of the instruction that halted or trapped
+    uint32_t address;              // faulting address for memory traps, 0 otherwise
+    char message[128];             // the message the command line simulator prints
+} rv_trap_t;
+
+// Interpreter cores
+typedef enum {
+    RV_CORE_SWITCH = 0,            // switch on opcode, then on funct3/funct7
+    RV_CORE_THREADED = 1,          // one handler per instruction, computed-goto dispatch
+    RV_CORE_JIT = 2                // x86-64 translation of hot basic blocks
+} rv_core_t;
+
+#define RV_UNLIMITED UINT64_MAX
+
+// Permissions of a page of memory. Pages are readable, writable and executable until changed.
+#define RV_PERM_READ  1
+#define RV_PERM_WRITE 2
+#define RV_PERM_EXEC  4
+#define RV_PERM_ALL   (RV_PERM_READ | RV_PERM_WRITE | RV_PERM_EXEC)
+
+// Lifetime. rv_create returns NULL when out of memory; rv_reset clears registers, pc and memory.
+// Memory covers the whole 32-bit address space, and only the 4 KiB pages a program writes are allocated.
+rv_sim_t *rv_create(void);
+void rv_destroy(rv_sim_t *sim);
+void rv_reset(rv_sim_t *sim);
+
+// Options
+rv_status_t rv_set_core(rv_sim_t *sim, rv_core_t core);
+void rv_set_allow_misaligned(rv_sim_t *sim, int allow);
+// Statistics: instruction counts per mnemonic, taken/not-taken counts per branch site, load/store bytes and
+// simulated MIPS, printed by rv_print_stats. Enabling them clears them. While they are on, the cores run
+// their instrumented variants and the JIT falls back to the threaded core; rv_collect_bbv isn't counted.
+rv_status_t rv_set_stats(rv_sim_t *sim, int enable);
+
+// Loading. A raw binary file or a buffer is copied to memory starting at address 0 / address, and
+// loaded_bytes is its size. An ELF32 RISC-V executable replaces the whole memory image: its PT_LOAD
+// segments are placed at their addresses with the segments' permissions, pc is set to the entry point,
+// its symbols become available below, and loaded_bytes is 0.
+rv_status_t rv_load_file(rv_sim_t *sim, const char *filename, size_t *loaded_bytes);
+rv_status_t rv_load_buffer(rv_sim_t *sim, const void *data, size_t size, uint32_t address);
+
+// Execution. rv_step runs at most count instructions; rv_run_until also stops as soon as pc reaches
+// stop_pc after at least one instruction; rv_run runs until the program halts or traps. After a halt or
+// trap every call returns the same status until rv_set_pc or rv_reset.
+rv_status_t rv_step(rv_sim_t *sim, uint64_t count);
+rv_status_t rv_run_until(rv_sim_t *sim, uint32_t stop_pc, uint64_t max_count);
+rv_status_t rv_run(rv_sim_t *sim);
+const rv_trap_t *rv_get_trap(const rv_sim_t *sim);
+uint64_t rv_get_instret(const rv_sim_t *sim);   // instructions completed since the last reset
+
+// Watchdog for programs that never halt: once the program has run max_insns instructions (counted from
+// this call or the last rv_reset, on the hart that ran the most), or for longer than seconds of wall-clock
+// time since the first run after this call, the next rv_step, rv_run_until, rv_run or rv_collect_bbv halts
+// it with RV_HALT_WATCHDOG. The limits hold across calls, so a host stepping the program a little at a
+// time is stopped too. 0 turns a limit off; both are off by default. With a time limit the program runs
+// RV_WATCHDOG_SLICE instructions at a time and the clock is read in between, so the limit is overshot by
+// at most one slice.
+#define RV_WATCHDOG_SLICE 1000000
+rv_status_t rv_set_watchdog(rv_sim_t *sim, uint64_t max_insns, double seconds);
+
+// State access. Writes to x0 are ignored; memory writes drop stale decoded/translated code. Memory access
+// from the host ignores page permissions, and ranges may wrap around the top of the address space.
+int32_t rv_get_reg(const rv_sim_t *sim, unsigned reg);
+void rv_set_reg(rv_sim_t *sim, unsigned reg, int32_t value);
+uint32_t rv_get_pc(const rv_sim_t *sim);
+void rv_set_pc(rv_sim_t *sim, uint32_t new_pc);
+rv_status_t rv_read_mem(const rv_sim_t *sim, uint32_t address, void *buffer, size_t size);
+rv_status_t rv_write_mem(rv_sim_t *sim, uint32_t address, const void *buffer, size_t size);
+// Sets the RV_PERM_* bits of every page overlapping [address, address + size)
+rv_status_t rv_set_permissions(rv_sim_t *sim, uint32_t address, uint64_t size, unsigned perms);
+
+// Symbols of the loaded ELF file (none for raw binaries), sorted by address
+typedef struct {
+    const char *name;
+    uint32_t address;
+    uint32_t size;                 // 0 for assembler labels
+    int is_function;
+} rv_symbol_t;
+size_t rv_get_symbols(const rv_sim_t *sim, const rv_symbol_t **symbols);
+// The symbol containing address, or the closest label below it; NULL if there is none
+const rv_symbol_t *rv_find_symbol(const rv_sim_t *sim, uint32_t address);
+
+// Loads symbols for a raw binary from an `nm` listing or, for a .s/.S file, from the labels of the assembly
+// source it was built from (see symbols.c for how their addresses are found). Replaces the current symbols.
+rv_status_t rv_load_symbols(rv_sim_t *sim, const char *filename);
+
+// Profiling: a per-pc histogram of executed instructions and a call-stack profile built from the calling
+// convention (JAL/JALR with rd = ra calls, JALR x0, 0(ra) returns). Enabling it clears the profile; it runs
+// like statistics. rv_write_profile writes the stacks in collapsed format (flamegraph.pl) and/or the
+// histogram, symbolized with the symbols above; either filename may be NULL.
+rv_status_t rv_set_profile(rv_sim_t *sim, int enable);
+rv_status_t rv_write_profile(rv_sim_t *sim, const char *stacks_filename, const char *pcs_filename);
+
+// Timing model: places every instruction in a classic 5-stage pipeline (see timing.c) and counts cycles,
+// stalls per cause and branch predictions, printed by rv_print_timing. Enabling it clears it; it runs like
+// statistics and never changes the results of the program, the counter CSRs included.
+typedef enum {
+    RV_PREDICTOR_NOT_TAKEN,        // static, every branch falls through
+    RV_PREDICTOR_BIMODAL,          // a two-bit counter per branch
+    RV_PREDICTOR_GSHARE            // two-bit counters indexed by pc xor the global branch history
+} rv_predictor_t;
+rv_status_t rv_set_timing(rv_sim_t *sim, int enable, rv_predictor_t predictor, int forwarding);
+
+// L1 caches: set-associative tag models of an instruction cache, fed by every fetch, and a data cache, fed
+// by every load and store (see cache.c). They count hits and misses per cache, classify the misses as
+// compulsory, capacity or conflict and keep the pcs that miss most, printed by rv_print_caches. Either
+// configuration may be NULL for no such cache, both NULL turn the caches off; enabling them clears them.
+// They run like statistics. With the timing model on, a miss costs miss_cycles.
+typedef enum {
+    RV_REPLACE_LRU,
+    RV_REPLACE_PLRU,               // tree pseudo-LRU
+    RV_REPLACE_RANDOM
+} rv_replacement_t;
+typedef struct {
+    uint32_t size;                 // bytes; size, line_size and ways are powers of two
+    uint32_t line_size;            // 4 to 4096 bytes
+    uint32_t ways;                 // at most 32, size / line_size for a fully associative cache of up to 32 lines
+    rv_replacement_t replacement;
+    int write_back;                // 1: stores dirty the line, written back on eviction; 0: write-through
+    int write_allocate;            // 1: a store miss fills the line; 0: it goes around the cache
+    uint32_t miss_cycles;          // cycles the timing model adds for a miss
+} rv_cache_config_t;
+rv_status_t rv_set_caches(rv_sim_t *sim, const rv_cache_config_t *icache, const rv_cache_config_t *dcache);
+
+// Macro-op fusion: the threaded core runs common instruction pairs as one operation, with exactly the
+// architectural state of running them one by one (see fusion.c). The other cores and the instrumented runs
+// don't fuse. On by default; rv_get_fusions counts the pairs of one kind that ran since the last reset.
+typedef enum {
+    RV_FUSION_LUI_ADDI,            // lui rd, hi; addi rd2, rd, lo
+    RV_FUSION_AUIPC_JALR,          // auipc rd, hi; jalr rd2, lo(rd)
+    RV_FUSION_AUIPC_LOAD,          // auipc rd, hi; lw rd2, lo(rd)
+    RV_FUSION_SHIFT_EXTEND,        // slli rd, rs, n; srli/srai rd2, rd, m
+    RV_FUSION_COMPARE_BRANCH,      // slt/sltu/slti/sltiu rd, ...; beqz/bnez rd, target
+    RV_FUSION_COUNT
+} rv_fusion_t;
+void rv_set_fusion(rv_sim_t *sim, int enable);
+uint64_t rv_get_fusions(const rv_sim_t *sim, rv_fusion_t kind);
+const char *rv_fusion_name(rv_fusion_t kind);
+
+// System calls. By default ECALL halts the program with RV_HALT_ECALL and leaves the call to the host.
+// With emulation on, ECALL runs the Linux system call numbered a7 and the program goes on (see syscall.c):
+// write, read, openat, close, brk, clock_gettime/gettimeofday on a clock that counts one nanosecond per
+// instruction, and exit/exit_group, which halt with RV_HALT_EXIT. Other numbers return -ENOSYS.
+// Descriptors 0-2 are the host's stdin/stdout/stderr, and guest writes are buffered on the host side, all
+// of them written out by the time a run returns. openat only reaches files below sandbox_dir (none without
+// one), never following symbolic links or "..". rv_reset closes the files the program opened.
+rv_status_t rv_set_syscalls(rv_sim_t *sim, int enable, const char *sandbox_dir);
+
+// Multiple harts (see smp.c). rv_set_harts gives a simulator count harts (1 to RV_MAX_HARTS) that share its
+// memory, each with its own registers, pc and mhartid. The simulator itself is hart 0; rv_get_hart returns
+// the others for the state access functions, and they go away with it. Programs are loaded and harts are
+// run through hart 0, and every hart starts at hart 0's pc the first time it runs after a reset.
+// rv_step/rv_run then run every hart for at most count instructions, until every hart has halted. A hart
+// that traps or exits stops the others, and hart 0 reports its trap, the message naming the hart. rv_step
+// returns RV_OK while any hart can continue.
+// In RV_ORDER_SC the harts take turns on the calling thread a quantum of instructions at a time, so runs
+// are repeatable and every execution is sequentially consistent. In RV_ORDER_RELAXED each hart runs on its
+// own host thread, in parallel, and they meet at a barrier every quantum, which bounds how far one hart
+// gets ahead of another. Only hart 0 is traced, profiled or counted in statistics, and only hart 0 runs
+// system calls; ECALL halts the others. rv_run_until, checkpoints and rv_collect_bbv need a single hart.
+#define RV_MAX_HARTS 16
+typedef enum {
+    RV_ORDER_SC,                   // one hart at a time, round robin (default)
+    RV_ORDER_RELAXED               // all harts at once
+} rv_memory_order_t;
+rv_status_t rv_set_harts(rv_sim_t *sim, unsigned count);
+unsigned rv_get_num_harts(const rv_sim_t *sim);
+rv_sim_t *rv_get_hart(const rv_sim_t *sim, unsigned hart);   // NULL if there is no such hart
+rv_status_t rv_set_memory_order(rv_sim_t *sim, rv_memory_order_t order, uint64_t quantum);
+
+// Batch mode (see batch.c): runs one program for many inputs, 1 to RV_BATCH_MAX_LANES instances (lanes) at
+// a time in lockstep. Every lane is a simulator of its own, returned by rv_batch_lane for the state access
+// functions: rv_batch_load loads the program into every lane, the host then sets each lane's registers and
+// memory, and rv_batch_run runs every lane for at most max_count instructions like rv_step, returning how
+// many lanes can still continue. Each lane's halt or trap is in its rv_get_trap, load errors in lane 0's.
+// Lanes at the same pc run each instruction once for all of them: their registers are kept as structure of
+// arrays and ALU operations, branch conditions and addresses are computed with SIMD instructions. Lanes
+// that branch apart are grouped again by pc. Loads and stores go to each lane's memory; CSR, system and
+// atomic instructions and traps run through the switch core one lane at a time, so every lane ends exactly
+// as rv_step would leave it. The lanes share the decoded program: a lane whose own code differs (it stored
+// into it, or the host changed it) goes on alone. Lanes have one hart, never fuse, and aren't traced,
+// profiled, timed or counted in statistics. rv_set_watchdog on a lane stops that lane alone, the way it
+// stops rv_step.
+#define RV_BATCH_MAX_LANES 16
+typedef enum {
+    RV_BATCH_AUTO,                 // the best the host supports (rv_batch_create's choice)
+    RV_BATCH_SCALAR,               // one lane after the other, plain C; the only choice on hosts other than x86
+    RV_BATCH_SSE2,                 // 4 lanes per instruction
+    RV_BATCH_AVX2                  // 8 lanes per instruction
+} rv_batch_isa_t;
+typedef struct rv_batch rv_batch_t;
+rv_batch_t *rv_batch_create(unsigned lanes);       // NULL when out of memory or lanes is out of range
+void rv_batch_destroy(rv_batch_t *batch);
+// RV_ERROR_ARGUMENT, reported in lane 0's trap, if the host can't run isa
+rv_status_t rv_batch_set_isa(rv_batch_t *batch, rv_batch_isa_t isa);
+rv_batch_isa_t rv_batch_get_isa(const rv_batch_t *batch);
+unsigned rv_batch_get_lanes(const rv_batch_t *batch);
+rv_sim_t *rv_batch_lane(const rv_batch_t *batch, unsigned lane);   // NULL if there is no such lane
+// Both reset every lane before loading
+rv_status_t rv_batch_load(rv_batch_t *batch, const char *filename, size_t *loaded_bytes);
+rv_status_t rv_batch_load_buffer(rv_batch_t *batch, const void *data, size_t size, uint32_t address);
+unsigned rv_batch_run(rv_batch_t *batch, uint64_t max_count);
+// Prints the instruction set, how many instructions the lanes ran since rv_batch_create and how many SIMD
+// steps that took
+void rv_print_batch(const rv_batch_t *batch);
+
+// Checkpoints hold the registers, pc, instret and every written page (compressed) with its permissions.
+// Restoring replaces all of that and clears a halt; the core, options, tracing and symbols are kept.
+rv_status_t rv_save_checkpoint(rv_sim_t *sim, const char *filename);
+rv_status_t rv_restore_checkpoint(rv_sim_t *sim, const char *filename);
+
+// Runs at most max_count instructions like rv_step, and writes a SimPoint basic-block vector file with
+// one line per interval of about `interval` instructions. With a checkpoint_prefix, the state at the
+// start of interval k is saved to <checkpoint_prefix>.<k>.ckpt. Not traced.
+rv_status_t rv_collect_bbv(rv_sim_t *sim, uint64_t interval, uint64_t max_count, const char *bbv_filename,
+                           const char *checkpoint_prefix);
+
+// Output in the formats of the command line simulator. With several harts, the registers of every hart
+// follow each other, hart 0 first.
+void rv_print_registers(const rv_sim_t *sim);
+void rv_print_stats(const rv_sim_t *sim);          // nothing while statistics are off
+void rv_print_timing(const rv_sim_t *sim);         // nothing while the timing model is off
+void rv_print_caches(const rv_sim_t *sim);         // nothing while the caches are off
+void rv_print_fusion(const rv_sim_t *sim);
+rv_status_t rv_dump_registers(const rv_sim_t *sim, const char *filename);
+
+// Binary execution trace (see trace.h for the format)
+rv_status_t rv_trace_open(rv_sim_t *sim, const char *filename, uint32_t lo_pc, uint32_t hi_pc,
+                          uint64_t first, uint64_t last);
+void rv_trace_close(rv_sim_t *sim);
+
+#endif
@@ -0,0 +1,188 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+
+// SimPoint basic-block vectors.
+// rv_collect_bbv() runs the program a basic block at a time on the predecoded instructions and counts,
+// per interval of (about) `interval` instructions, how many instructions each block executed. Every
+// interval becomes one line of a SimPoint .bb file:
+//
+//     T:<block id>:<instructions> :<block id>:<instructions> ...
+//
+// Block ids start at 1 in order of first execution. An interval ends at the first block boundary at or
+// after `interval` instructions, so the last block of an interval is never split. With a checkpoint
+// prefix, the state at the start of interval k is saved to <prefix>.<k>.ckpt, so the intervals SimPoint
+// picks can be restored and simulated in detail on their own.
+
+typedef struct {
+    uint32_t pc;              // start of the block
+    uint32_t id;              // 0 marks an empty slot
+} bbv_slot_t;
+
+typedef struct {
+    bbv_slot_t *slots;        // open addressing, pc -> id
+    size_t capacity;          // power of two
+    uint32_t num_blocks;
+    uint64_t *counts;         // instructions per block id in the current interval
+    uint32_t *touched;        // ids with a nonzero count in the current interval
+    uint32_t num_touched;
+} bbv_table_t;
+
+static size_t hash_pc(uint32_t pc) {
+    return (size_t)((pc >> 2) * 2654435761u);
+}
+
+static int grow_table(bbv_table_t *table) {
+    size_t capacity = table->capacity ? table->capacity * 2 : 4096;
+    bbv_slot_t *slots = calloc(capacity, sizeof(bbv_slot_t));
+    uint64_t *counts = calloc(capacity / 2 + 1, sizeof(uint64_t));
+    uint32_t *touched = malloc((capacity / 2 + 1) * sizeof(uint32_t));
+    if (!slots || !counts || !touched) {
+        free(slots);
+        free(counts);
+        free(touched);
+        return 0;
+    }
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].id) {
+            size_t s = hash_pc(table->slots[i].pc) & (capacity - 1);
+            while (slots[s].id) {
+                s = (s + 1) & (capacity - 1);
+            }
+            slots[s] = table->slots[i];
+        }
+    }
+    if (table->counts) {
+        memcpy(counts, table->counts, (table->num_blocks + 1) * sizeof(uint64_t));
+        memcpy(touched, table->touched, table->num_touched * sizeof(uint32_t));
+    }
+    free(table->slots);
+    free(table->counts);
+    free(table->touched);
+    table->slots = slots;
+    table->counts = counts;
+    table->touched = touched;
+    table->capacity = capacity;
+    return 1;
+}
+
+// Function to add length instructions to the block starting at pc. Returns 0 when out of memory.
+static int count_block(bbv_table_t *table, uint32_t pc, uint32_t length) {
+    if ((table->num_blocks + 1) * 2 > table->capacity && !grow_table(table)) {
+        return 0;
+    }
+    size_t s = hash_pc(pc) & (table->capacity - 1);
+    while (table->slots[s].id && table->slots[s].pc != pc) {
+        s = (s + 1) & (table->capacity - 1);
+    }
+    if (!table->slots[s].id) {
+        table->slots[s].pc = pc;
+        table->slots[s].id = ++table->num_blocks;
+    }
+    uint32_t id = table->slots[s].id;
+    if (table->counts[id] == 0) {
+        table->touched[table->num_touched++] = id;
+    }
+    table->counts[id] += length;
+    return 1;
+}
+
+// Function to write the current interval as one .bb line and start the next one
+static void write_interval(bbv_table_t *table, FILE *out) {
+    fputc('T', out);
+    for (uint32_t i = 0; i < table->num_touched; i++) {
+        uint32_t id = table->touched[i];
+        fprintf(out, ":%u:%llu ", id, (unsigned long long)table->counts[id]);
+        table->counts[id] = 0;
+    }
+    fputc('\n', out);
+    table->num_touched = 0;
+}
+
+static rv_status_t save_interval_checkpoint(rv_sim_t *sim, const char *prefix, unsigned interval_index) {
+    char filename[4096];
+    snprintf(filename, sizeof(filename), "%s.%u.ckpt", prefix, interval_index);
+    return rv_save_checkpoint(sim, filename);
+}
+
+rv_status_t rv_collect_bbv(rv_sim_t *sim, uint64_t interval, uint64_t max_count, const char *bbv_filename,
+                           const char *checkpoint_prefix) {
+    if (sim->halted) {
+        return sim->halted;
+    }
+    if (interval == 0) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "The BBV interval must be at least one instruction");
+    }
+    if (sim->smp) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Basic-block vectors need a single hart");
+    }
+    FILE *out = fopen(bbv_filename, "w");
+    if (!out) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to open BBV file: %s", strerror(errno));
+    }
+
+    bbv_table_t table = {0};
+    uint64_t executed = 0, in_interval = 0;
+    uint64_t watch_next = 0, bound = max_count; // blocks end where the watchdog checks next
+    unsigned interval_index = 0;
+    rv_status_t status = checkpoint_prefix ? save_interval_checkpoint(sim, checkpoint_prefix, 0) : RV_OK;
+
+    while (status == RV_OK && executed < max_count) {
+        uint32_t block_pc = sim->pc;
+        uint32_t length = 0;
+        const decoded_instr_t *d;
+
+        if (watchdog_armed(sim) && executed >= watch_next) {
+            status = watchdog_check(sim);
+            if (status != RV_OK) {
+                break;
+            }
+            uint64_t left = watchdog_left(sim);
+            watch_next = left < max_count - executed ? executed + left : max_count;
+            bound = watch_next;
+        }
+        do {
+            d = fetch_decoded(sim, sim->pc);
+            if (!d) {
+                status = fetch_fault(sim);
+                break;
+            }
+            status = execute_decoded(sim, d);
+            if (status != RV_OK) {
+                break;
+            }
+            length++;
+            sim->instret++; // current for the CSR instructions
+        } while (!insn_ends_block(d) && executed + length < bound);
+
+        executed += length;
+        in_interval += length;
+        if (length && !count_block(&table, block_pc, length)) {
+            status = rv_raise(sim, RV_ERROR_IO, 0, "Out of memory for basic-block vectors");
+            break;
+        }
+        if (in_interval >= interval) {
+            write_interval(&table, out);
+            in_interval = 0;
+            interval_index++;
+            if (status == RV_OK && checkpoint_prefix) {
+                status = save_interval_checkpoint(sim, checkpoint_prefix, interval_index);
+            }
+        }
+    }
+    if (in_interval > 0) {
+        write_interval(&table, out); // the last, shorter interval
+    }
+
+    free(table.slots);
+    free(table.counts);
+    free(table.touched);
+    if (fclose(out) != 0 && status < RV_ERROR_IO) {
+        status = rv_raise(sim, RV_ERROR_IO, 0, "Failed to write BBV file: %s", bbv_filename);
+    }
+    return status;
+}
@@ -0,0 +1,380 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+
+// Multiple harts.
+// rv_set_harts gives hart 0 (the simulator the host created) count - 1 more rv_sim_t, each with its own
+// registers, pc, TLB, decode scratch and JIT, and all pointing at hart 0's page tables. A run gives every
+// hart the same budget and runs it a quantum at a time through run_hart:
+//
+//   RV_ORDER_SC       the harts take turns on the caller's thread, so they interleave quantum by quantum,
+//                     always the same way, and a turn costs no more than a call
+//   RV_ORDER_RELAXED  every hart but 0 has a host thread that sleeps until hart 0 starts a run; then all
+//                     of them run at once and wait for each other at a barrier after every quantum
+//
+// A hart leaves the run when it halts or its budget is used up, and everybody leaves once a hart traps or
+// exits. The guest memory is shared without locks: pages and decode caches are allocated with a
+// compare-and-swap (memory.c) and never freed during a run, plain loads and stores become plain host
+// accesses, and the RV32A instructions and FENCE use host atomics. The guest therefore sees the host's
+// memory model, which on x86-64 and AArch64 is at least as strong as RVWMO.
+//
+// Code one hart writes while another runs it is not supported: the writer drops the shared decoded
+// records but not the other harts' translations or TLB entries. Host changes to memory between runs are
+// fine, smp_run brings the other harts up to date first.
+
+#define DEFAULT_QUANTUM 10000
+
+struct smp_state {
+    rv_sim_t *harts[RV_MAX_HARTS];         // harts[0] is the simulator the host created
+    pthread_t threads[RV_MAX_HARTS];       // threads[0] is unused, hart 0 always runs on the caller's thread
+    unsigned count;
+    rv_memory_order_t order;
+    uint64_t quantum;
+    unsigned memory_epoch;                 // bumped by smp_memory_changed
+    unsigned translated_epoch[RV_MAX_HARTS]; // memory_epoch when hart h's translations were last valid
+    int started;                           // 0 until the first run after a reset, which starts every hart at hart 0's pc
+    pthread_mutex_t lock;                  // guards everything below
+    pthread_cond_t wake[RV_MAX_HARTS];     // hart h waits on wake[h]
+    uint64_t run_generation;               // bumped to start a run on the threads
+    int quit;                              // tells the threads to exit
+    uint64_t budget;                       // of each hart in the current run
+    unsigned running;                      // harts still in the run
+    unsigned arrived;                      // harts waiting at the barrier
+    uint64_t barrier_generation;
+    int stopped;                           // a hart trapped or exited, everybody stops
+    unsigned stopper;                      // which one
+};
+
+static void wake_all(smp_state_t *smp) {
+    for (unsigned h = 0; h < smp->count; h++) {
+        pthread_cond_signal(&smp->wake[h]);
+    }
+}
+
+// Function to run hart h for a quantum, at most *left instructions. Returns 1 if it trapped or exited.
+static int run_quantum(smp_state_t *smp, unsigned h, uint64_t *left) {
+    rv_sim_t *hart = smp->harts[h];
+    uint64_t instret = hart->instret;
+    rv_status_t status = run_hart(hart, *left < smp->quantum ? *left : smp->quantum, NO_STOP_PC);
+    uint64_t retired = hart->instret - instret;
+
+    *left -= retired < *left ? retired : *left;
+    return status >= RV_HALT_EXIT;
+}
+
+static void stop_run(smp_state_t *smp, unsigned h) {
+    if (!smp->stopped) {
+        smp->stopped = 1;
+        smp->stopper = h;
+    }
+}
+
+// Function to run the harts in turn on the caller's thread until none of them can go on (RV_ORDER_SC)
+static void run_in_turn(smp_state_t *smp) {
+    uint64_t left[RV_MAX_HARTS];
+    int ran = 1;
+
+    for (unsigned h = 0; h < smp->count; h++) {
+        left[h] = smp->budget;
+    }
+    while (ran && !smp->stopped) {
+        ran = 0;
+        for (unsigned h = 0; h < smp->count && !smp->stopped; h++) {
+            if (smp->harts[h]->halted == RV_OK && left[h] > 0) {
+                if (run_quantum(smp, h, &left[h])) {
+                    stop_run(smp, h);
+                }
+                ran = 1;
+            }
+        }
+    }
+}
+
+static void release_barrier(smp_state_t *smp) {
+    smp->arrived = 0;
+    smp->barrier_generation++;
+    wake_all(smp);
+}
+
+// Function to wait until every hart still in the run has finished its quantum
+static void barrier_wait(smp_state_t *smp, unsigned h) {
+    uint64_t generation = smp->barrier_generation;
+
+    if (++smp->arrived == smp->running) {
+        release_barrier(smp);
+        return;
+    }
+    while (smp->barrier_generation == generation) {
+        pthread_cond_wait(&smp->wake[h], &smp->lock);
+    }
+}
+
+// Function to run hart h's part of the current run on its thread (RV_ORDER_RELAXED), called with smp->lock held
+static void run_quanta(smp_state_t *smp, unsigned h) {
+    uint64_t left = smp->budget;
+
+    while (!smp->stopped && smp->harts[h]->halted == RV_OK && left > 0) {
+        pthread_mutex_unlock(&smp->lock);
+        int stopped = run_quantum(smp, h, &left);
+        pthread_mutex_lock(&smp->lock);
+        if (stopped) {
+            stop_run(smp, h);
+        }
+        barrier_wait(smp, h);
+    }
+
+    smp->running--;
+    if (smp->arrived > 0 && smp->arrived == smp->running) {
+        release_barrier(smp); // the others were only waiting for this hart
+    }
+    if (smp->running == 0) {
+        pthread_cond_signal(&smp->wake[0]); // smp_run waits for the last hart
+    }
+}
+
+static void *hart_thread(void *arg) {
+    rv_sim_t *hart = arg;
+    smp_state_t *smp = hart->smp;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&smp->lock);
+    for (;;) {
+        while (smp->run_generation == seen && !smp->quit) {
+            pthread_cond_wait(&smp->wake[hart->hart_id], &smp->lock);
+        }
+        if (smp->quit) {
+            break;
+        }
+        seen = smp->run_generation;
+        run_quanta(smp, hart->hart_id);
+    }
+    pthread_mutex_unlock(&smp->lock);
+    return NULL;
+}
+
+// Function to stop the threads and free the other harts and the shared state
+static void smp_free(rv_sim_t *sim) {
+    smp_state_t *smp = sim->smp;
+
+    pthread_mutex_lock(&smp->lock);
+    smp->quit = 1;
+    wake_all(smp);
+    pthread_mutex_unlock(&smp->lock);
+    for (unsigned h = 1; h < smp->count; h++) {
+        rv_sim_t *hart = smp->harts[h];
+        if (!hart) {
+            continue;
+        }
+        if (smp->threads[h]) {
+            pthread_join(smp->threads[h], NULL);
+        }
+        jit_destroy(hart);
+        free(hart);
+    }
+    for (unsigned h = 0; h < RV_MAX_HARTS; h++) {
+        pthread_cond_destroy(&smp->wake[h]);
+    }
+    pthread_mutex_destroy(&smp->lock);
+    free(smp);
+    sim->smp = NULL;
+}
+
+// Function to create hart h, sharing hart 0's memory
+static rv_sim_t *create_hart(rv_sim_t *sim, unsigned h) {
+    rv_sim_t *hart = calloc(1, sizeof(rv_sim_t));
+    if (!hart) {
+        return NULL;
+    }
+    mem_flush_tlb(hart);
+    hart->page_tables = sim->page_tables;
+    hart->hart_id = h;
+    hart->smp = sim->smp;
+    hart->reservation = NO_RESERVATION;
+    hart->allow_misaligned = sim->allow_misaligned;
+    hart->misaligned_mask = sim->misaligned_mask;
+    hart->core = sim->core;
+    hart->fusion = sim->fusion;
+    return hart;
+}
+
+rv_status_t rv_set_harts(rv_sim_t *sim, unsigned count) {
+    rv_memory_order_t order = RV_ORDER_SC;
+    uint64_t quantum = DEFAULT_QUANTUM;
+
+    if (sim->hart_id != 0 || count < 1 || count > RV_MAX_HARTS) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Number of harts must be 1 to %d, set through hart 0", RV_MAX_HARTS);
+    }
+    if (count == rv_get_num_harts(sim)) {
+        return RV_OK;
+    }
+    if (sim->smp) {
+        order = sim->smp->order;
+        quantum = sim->smp->quantum;
+        smp_free(sim);
+    }
+    if (count == 1) {
+        return RV_OK;
+    }
+
+    smp_state_t *smp = calloc(1, sizeof(smp_state_t));
+    if (!smp) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to allocate %u harts", count);
+    }
+    pthread_mutex_init(&smp->lock, NULL);
+    for (unsigned h = 0; h < RV_MAX_HARTS; h++) {
+        pthread_cond_init(&smp->wake[h], NULL);
+    }
+    smp->count = count;
+    smp->order = order;
+    smp->quantum = quantum;
+    smp->harts[0] = sim;
+    sim->smp = smp;
+    mem_flush_tlb(sim); // loads may have mapped untouched pages to zero_page, where the other harts' stores never show
+    for (unsigned h = 1; h < count; h++) {
+        smp->harts[h] = create_hart(sim, h);
+        if (!smp->harts[h] || pthread_create(&smp->threads[h], NULL, hart_thread, smp->harts[h]) != 0) {
+            smp->threads[h] = 0;
+            smp_free(sim);
+            return rv_raise(sim, RV_ERROR_IO, 0, "Failed to start %u harts", count);
+        }
+    }
+    return RV_OK;
+}
+
+unsigned rv_get_num_harts(const rv_sim_t *sim) {
+    return sim->smp ? sim->smp->count : 1;
+}
+
+rv_sim_t *rv_get_hart(const rv_sim_t *sim, unsigned hart) {
+    if (!sim->smp) {
+        return hart == 0 ? (rv_sim_t *)sim : NULL;
+    }
+    return hart < sim->smp->count ? sim->smp->harts[hart] : NULL;
+}
+
+rv_status_t rv_set_memory_order(rv_sim_t *sim, rv_memory_order_t order, uint64_t quantum) {
+    if ((order != RV_ORDER_SC && order != RV_ORDER_RELAXED) || quantum == 0) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Unknown memory order %d or zero quantum", (int)order);
+    }
+    if (!sim->smp) {
+        return RV_OK; // one hart is sequentially consistent whatever the setting
+    }
+    sim->smp->order = order;
+    sim->smp->quantum = quantum;
+    return RV_OK;
+}
+
+// Function to reset the other harts along with hart 0. They start at hart 0's pc on the next run.
+void smp_reset(rv_sim_t *sim) {
+    smp_state_t *smp = sim->smp;
+
+    for (unsigned h = 1; h < smp->count; h++) {
+        rv_reset(smp->harts[h]);
+    }
+    smp->started = 0;
+}
+
+void smp_memory_changed(rv_sim_t *sim) {
+    sim->smp->memory_epoch++;
+}
+
+// Function to bring the other harts up to date with hart 0 before a run: the options they copy, TLBs that
+// may point at freed or remapped pages, and translations of code that changed since their last run
+static void prepare_harts(smp_state_t *smp) {
+    rv_sim_t *sim = smp->harts[0];
+
+    for (unsigned h = 1; h < smp->count; h++) {
+        rv_sim_t *hart = smp->harts[h];
+        if (!smp->started) {
+            hart->pc = sim->pc;
+        }
+        if (smp->translated_epoch[h] != smp->memory_epoch) {
+            jit_destroy(hart);
+            smp->translated_epoch[h] = smp->memory_epoch;
+        }
+        if (hart->allow_misaligned != sim->allow_misaligned) {
+            rv_set_allow_misaligned(hart, sim->allow_misaligned);
+        }
+        hart->core = sim->core;
+        hart->fusion = sim->fusion;
+        mem_flush_tlb(hart);
+    }
+    smp->started = 1;
+}
+
+// Function to tell whether the program is over: a hart trapped or exited, the watchdog stopped the run, or
+// every hart has halted
+static int program_over(const smp_state_t *smp) {
+    rv_status_t status = smp->harts[0]->halted;
+
+    if (status >= RV_HALT_EXIT) {
+        return 1;
+    }
+    for (unsigned h = 0; h < smp->count; h++) {
+        if (smp->harts[h]->halted == RV_OK) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int smp_program_over(const rv_sim_t *sim) {
+    return program_over(sim->smp);
+}
+
+uint64_t smp_instret(const rv_sim_t *sim) {
+    const smp_state_t *smp = sim->smp;
+    uint64_t most = 0;
+
+    for (unsigned h = 0; h < smp->count; h++) {
+        if (smp->harts[h]->instret > most) {
+            most = smp->harts[h]->instret;
+        }
+    }
+    return most;
+}
+
+rv_status_t smp_run(rv_sim_t *sim, uint64_t budget, uint32_t stop_pc) {
+    smp_state_t *smp = sim->smp;
+
+    if (sim->hart_id != 0) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, sim->pc, "Harts are run through hart 0");
+    }
+    if (stop_pc != NO_STOP_PC) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, sim->pc, "Running to a stop pc needs a single hart");
+    }
+    if (program_over(smp)) {
+        return sim->halted;
+    }
+    prepare_harts(smp);
+
+    smp->budget = budget;
+    smp->stopped = 0;
+    if (smp->order == RV_ORDER_SC) {
+        run_in_turn(smp);
+    } else {
+        pthread_mutex_lock(&smp->lock);
+        smp->running = smp->count;
+        smp->arrived = 0;
+        smp->run_generation++;
+        wake_all(smp);
+        run_quanta(smp, 0);
+        while (smp->running > 0) {
+            pthread_cond_wait(&smp->wake[0], &smp->lock);
+        }
+        pthread_mutex_unlock(&smp->lock);
+    }
+
+    if (smp->stopped && smp->stopper != 0) {
+        // hart 0 reports the trap of the hart that stopped the others
+        const rv_sim_t *hart = smp->harts[smp->stopper];
+        sim->trap = hart->trap;
+        snprintf(sim->trap.message, sizeof(sim->trap.message), "Hart %u: %.100s", smp->stopper, hart->trap.message);
+        sim->halted = hart->halted;
+    }
+    return program_over(smp) ? sim->halted : RV_OK;
+}
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "RISC-V.h"
+
+// Execution statistics.
+// While statistics are on, the instrumented core variants count every completed instruction per concrete
+// instruction (INSN_*) and every conditional branch per branch site. Load and store byte counts follow
+// from the per-instruction counts, so they cost nothing extra. run_core measures the host time of every
+// run for the simulated MIPS.
+
+static const char *const insn_names[INSN_COUNT] = {
+#define INSN_NAME(name) #name,
+    INSN_LIST(INSN_NAME)
+#undef INSN_NAME
+};
+
+typedef struct {
+    uint32_t pc;
+    uint64_t taken;
+    uint64_t not_taken;           // taken + not_taken == 0 marks an empty slot
+} branch_site_t;
+
+struct stats_state {
+    uint64_t insn_counts[INSN_COUNT];
+    branch_site_t *sites;         // open addressing on pc
+    size_t capacity;              // power of two
+    size_t num_sites;
+    int out_of_memory;            // sites that didn't fit are missing from the branch table
+    struct timespec run_start;
+    double host_seconds;
+};
+
+static size_t hash_pc(uint32_t pc) {
+    return (size_t)((pc >> 1) * 2654435761u);
+}
+
+static int is_branch(uint8_t insn) {
+    return insn >= INSN_BEQ && insn <= INSN_BGEU;
+}
+
+rv_status_t rv_set_stats(rv_sim_t *sim, int enable) {
+    if (sim->stats) {
+        free(sim->stats->sites);
+        free(sim->stats);
+        sim->stats = NULL;
+    }
+    if (!enable) {
+        return RV_OK;
+    }
+    sim->stats = calloc(1, sizeof(stats_state_t));
+    if (!sim->stats) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to allocate statistics");
+    }
+    return RV_OK;
+}
+
+static int grow_sites(stats_state_t *stats) {
+    size_t capacity = stats->capacity ? stats->capacity * 2 : 1024;
+    branch_site_t *sites = calloc(capacity, sizeof(branch_site_t));
+    if (!sites) {
+        return 0;
+    }
+    for (size_t i = 0; i < stats->capacity; i++) {
+        const branch_site_t *site = &stats->sites[i];
+        if (site->taken + site->not_taken) {
+            size_t s = hash_pc(site->pc) & (capacity - 1);
+            while (sites[s].taken + sites[s].not_taken) {
+                s = (s + 1) & (capacity - 1);
+            }
+            sites[s] = *site;
+        }
+    }
+    free(stats->sites);
+    stats->sites = sites;
+    stats->capacity = capacity;
+    return 1;
+}
+
+// Function to count one execution of the branch at pc
+static void count_branch(stats_state_t *stats, uint32_t pc, int taken) {
+    if ((stats->num_sites + 1) * 2 > stats->capacity && !grow_sites(stats)) {
+        stats->out_of_memory = 1;
+        return;
+    }
+    size_t s = hash_pc(pc) & (stats->capacity - 1);
+    while (stats->sites[s].taken + stats->sites[s].not_taken && stats->sites[s].pc != pc) {
+        s = (s + 1) & (stats->capacity - 1);
+    }
+    branch_site_t *site = &stats->sites[s];
+    if (site->taken + site->not_taken == 0) {
+        site->pc = pc;
+        stats->num_sites++;
+    }
+    if (taken) {
+        site->taken++;
+    } else {
+        site->not_taken++;
+    }
+}
+
+void stats_retire(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d, uint32_t next_pc) {
+    stats_state_t *stats = sim->stats;
+
+    stats->insn_counts[d->insn]++;
+    if (is_branch(d->insn)) {
+        count_branch(stats, insn_pc, next_pc != insn_pc + d->length);
+    }
+}
+
+void stats_run_begin(rv_sim_t *sim) {
+    clock_gettime(CLOCK_MONOTONIC, &sim->stats->run_start);
+}
+
+void stats_run_end(rv_sim_t *sim) {
+    stats_state_t *stats = sim->stats;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stats->host_seconds += (double)(now.tv_sec - stats->run_start.tv_sec) +
+                           (double)(now.tv_nsec - stats->run_start.tv_nsec) / 1e9;
+}
+
+typedef struct {
+    uint64_t count;
+    uint8_t insn;
+} insn_count_t;
+
+// Function to order instructions by descending count, then in INSN_LIST order
+static int compare_insn_counts(const void *a, const void *b) {
+    const insn_count_t *count_a = a, *count_b = b;
+    if (count_a->count != count_b->count) {
+        return count_a->count < count_b->count ? 1 : -1;
+    }
+    return count_a->insn - count_b->insn;
+}
+
+static int compare_sites(const void *a, const void *b) {
+    uint32_t pc_a = ((const branch_site_t *)a)->pc, pc_b = ((const branch_site_t *)b)->pc;
+    return (pc_a > pc_b) - (pc_a < pc_b);
+}
+
+// Function to print the address of a branch site, with the symbol it is in when there is one
+static void print_site_address(const rv_sim_t *sim, uint32_t pc) {
+    const rv_symbol_t *symbol = rv_find_symbol(sim, pc);
+    char location[64] = "";
+
+    if (symbol) {
+        snprintf(location, sizeof(location), "<%s+0x%X>", symbol->name, pc - symbol->address);
+    }
+    printf("0x%08X %-28s", pc, location);
+}
+
+void rv_print_stats(const rv_sim_t *sim) {
+    const stats_state_t *stats = sim->stats;
+    insn_count_t mix[INSN_COUNT];
+    uint64_t total = 0;
+
+    if (!stats) {
+        return;
+    }
+    for (int i = 0; i < INSN_COUNT; i++) {
+        total += stats->insn_counts[i];
+        mix[i].count = stats->insn_counts[i];
+        mix[i].insn = (uint8_t)i;
+    }
+    const uint64_t *counts = stats->insn_counts;
+    uint64_t loads = counts[INSN_LB] + counts[INSN_LH] + counts[INSN_LW] + counts[INSN_LBU] + counts[INSN_LHU];
+    uint64_t load_bytes = counts[INSN_LB] + counts[INSN_LBU] + 2 * (counts[INSN_LH] + counts[INSN_LHU]) + 4 * counts[INSN_LW];
+    uint64_t stores = counts[INSN_SB] + counts[INSN_SH] + counts[INSN_SW];
+    uint64_t store_bytes = counts[INSN_SB] + 2 * counts[INSN_SH] + 4 * counts[INSN_SW];
+
+    printf("\n--- Statistics ---\n");
+    printf("Instructions: %llu in %.3f s (%.2f MIPS)\n", (unsigned long long)total, stats->host_seconds,
+           stats->host_seconds > 0 ? total / stats->host_seconds / 1e6 : 0.0);
+    printf("Loads: %llu (%llu bytes), stores: %llu (%llu bytes)\n", (unsigned long long)loads,
+           (unsigned long long)load_bytes, (unsigned long long)stores, (unsigned long long)store_bytes);
+
+    printf("\nInstruction mix:\n");
+    qsort(mix, INSN_COUNT, sizeof(insn_count_t), compare_insn_counts);
+    for (int i = 0; i < INSN_COUNT && mix[i].count > 0; i++) {
+        printf("  %-8s %14llu %6.2f%%\n", insn_names[mix[i].insn], (unsigned long long)mix[i].count,
+               100.0 * mix[i].count / total);
+    }
+
+    if (stats->num_sites > 0) {
+        branch_site_t *sites = malloc(stats->num_sites * sizeof(branch_site_t));
+        size_t n = 0;
+        if (sites) {
+            for (size_t i = 0; i < stats->capacity; i++) {
+                if (stats->sites[i].taken + stats->sites[i].not_taken) {
+                    sites[n++] = stats->sites[i];
+                }
+            }
+            qsort(sites, n, sizeof(branch_site_t), compare_sites);
+            printf("\nBranch sites:%*s %14s %14s\n", 28, "", "taken", "not taken");
+            for (size_t i = 0; i < n; i++) {
+                printf("  ");
+                print_site_address(sim, sites[i].pc);
+                printf(" %14llu %14llu\n", (unsigned long long)sites[i].taken, (unsigned long long)sites[i].not_taken);
+            }
+            free(sites);
+        }
+    }
+    if (stats->out_of_memory) {
+        printf("(out of memory, some branch sites are missing)\n");
+    }
+    printf("--------------------------\n");
+}
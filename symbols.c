@@ -0,0 +1,305 @@
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+
+// Symbols for raw binaries.
+// rv_load_symbols reads either an `nm` listing ("<hex address> <type> <name>" per line) or, for files
+// ending in .s/.S, the assembly source the binary was built from. For a source, label addresses are
+// found by adding up the size of everything in .text from address 0, the way the tests are linked:
+// instructions are 4 bytes (2 for explicit c.* ones), li and la expand to one or two, call and tail
+// are relaxed to a single jal, and .align/.word/.string/... take what they take. Labels in other
+// sections, numeric labels and compiler-local .L labels are skipped. Code the assembler compresses on
+// its own (an rv32*c arch or .option rvc) can't be placed this way and is rejected.
+#define SYMBOL_LINE_SIZE 1024
+
+typedef struct {
+    rv_symbol_t *symbols;
+    size_t count, capacity;
+    char *names;
+    size_t names_size, names_capacity;
+} symbol_list_t;
+
+// Function to append a symbol, keeping its name in the shared name buffer. Returns 0 when out of memory.
+static int add_symbol(symbol_list_t *list, const char *name, size_t length, uint32_t address, int is_function) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        rv_symbol_t *symbols = realloc(list->symbols, capacity * sizeof(rv_symbol_t));
+        if (!symbols) {
+            return 0;
+        }
+        list->symbols = symbols;
+        list->capacity = capacity;
+    }
+    if (list->names_size + length + 1 > list->names_capacity) {
+        size_t capacity = (list->names_capacity + length + 1) * 2;
+        char *names = realloc(list->names, capacity);
+        if (!names) {
+            return 0;
+        }
+        list->names = names;
+        list->names_capacity = capacity;
+    }
+    rv_symbol_t *symbol = &list->symbols[list->count++];
+    symbol->name = (const char *)(uintptr_t)list->names_size; // an offset until the buffer stops moving
+    symbol->address = address;
+    symbol->size = 0;
+    symbol->is_function = is_function;
+    memcpy(list->names + list->names_size, name, length);
+    list->names[list->names_size + length] = '\0';
+    list->names_size += length + 1;
+    return 1;
+}
+
+static int is_symbol_char(char c) {
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+static char *skip_spaces(char *text) {
+    while (*text == ' ' || *text == '\t') {
+        text++;
+    }
+    return text;
+}
+
+// Function to count the bytes of a .string/.asciz/.ascii operand, escapes included
+static uint32_t string_size(const char *text) {
+    uint32_t size = 0;
+
+    text = strchr(text, '"');
+    if (!text) {
+        return 0;
+    }
+    for (text++; *text && *text != '"'; text++, size++) {
+        if (*text != '\\' || !text[1]) {
+            continue;
+        }
+        text++;
+        if (*text >= '0' && *text <= '7') {
+            for (int digits = 1; digits < 3 && text[1] >= '0' && text[1] <= '7'; digits++) {
+                text++;
+            }
+        } else if (*text == 'x') {
+            while (isxdigit((unsigned char)text[1])) {
+                text++;
+            }
+        }
+    }
+    return size;
+}
+
+// Function to cut a line at its comment or line end, leaving '#' inside strings alone
+static void strip_comment(char *line) {
+    int quoted = 0;
+
+    for (; *line && *line != '\n' && *line != '\r'; line++) {
+        if (*line == '"') {
+            quoted = !quoted;
+        } else if (*line == '\\' && quoted && line[1]) {
+            line++;
+        } else if (*line == '#' && !quoted) {
+            break;
+        }
+    }
+    *line = '\0';
+}
+
+static uint32_t count_operands(const char *operands) {
+    uint32_t count = *operands ? 1 : 0;
+    for (; *operands; operands++) {
+        count += *operands == ',';
+    }
+    return count;
+}
+
+// Function to find the size of the instruction "mnemonic operands" once assembled and linked
+static uint32_t instruction_size(const char *mnemonic, const char *operands) {
+    if (strncmp(mnemonic, "c.", 2) == 0) {
+        return 2;
+    }
+    if (strcmp(mnemonic, "la") == 0 || strcmp(mnemonic, "lla") == 0) {
+        return 8;
+    }
+    if (strcmp(mnemonic, "li") == 0) {
+        const char *value = strchr(operands, ',');
+        char *end;
+        long long imm = value ? strtoll(value + 1, &end, 0) : 0;
+        if (!value || *skip_spaces(end) != '\0') {
+            return 8; // a symbolic value, assume the long form
+        }
+        int32_t word = (int32_t)imm;
+        return (word >= -2048 && word < 2048) || (word & 0xFFF) == 0 ? 4 : 8;
+    }
+    return 4; // everything else, including call/tail relaxed to jal
+}
+
+// Function to tell whether an .attribute arch string or .option enables automatic compression
+static int enables_rvc(const char *directive, const char *operands) {
+    if (strcmp(directive, ".option") == 0) {
+        return strcmp(operands, "rvc") == 0;
+    }
+    if (strcmp(directive, ".attribute") != 0 || strncmp(operands, "arch", 4) != 0) {
+        return 0;
+    }
+    const char *arch = strstr(operands, "rv32");
+    if (!arch) {
+        return 0;
+    }
+    for (arch += 4; isalpha((unsigned char)*arch); arch++) {
+        if (*arch == 'c') {
+            return 1; // rv32imc
+        }
+    }
+    return strstr(arch, "_c") != NULL; // rv32i2p0_m2p0_c2p0
+}
+
+// Function to collect the .text labels of an assembly source. Returns 0 on a read or memory error, -1 for
+// compressed code.
+static int read_assembly_labels(FILE *file, symbol_list_t *list) {
+    char line[SYMBOL_LINE_SIZE];
+    char function[SYMBOL_LINE_SIZE] = "";
+    uint32_t address = 0;
+    int in_text = 1;
+
+    while (fgets(line, sizeof(line), file)) {
+        strip_comment(line);
+        char *text = skip_spaces(line);
+
+        // labels, possibly several, before the statement
+        for (;;) {
+            char *end = text;
+            while (is_symbol_char(*end)) {
+                end++;
+            }
+            if (end == text || *end != ':') {
+                break;
+            }
+            size_t length = (size_t)(end - text);
+            int local = strncmp(text, ".L", 2) == 0 || strspn(text, "0123456789") == length;
+            if (in_text && !local) {
+                int is_function = strlen(function) == length && strncmp(function, text, length) == 0;
+                if (!add_symbol(list, text, length, address, is_function)) {
+                    return 0;
+                }
+            }
+            text = skip_spaces(end + 1);
+        }
+        if (!*text) {
+            continue;
+        }
+
+        char *mnemonic = text;
+        while (*text && *text != ' ' && *text != '\t') {
+            text++;
+        }
+        if (*text) {
+            *text++ = '\0';
+        }
+        char *operands = skip_spaces(text);
+        for (char *end = operands + strlen(operands); end > operands && (end[-1] == ' ' || end[-1] == '\t'); end--) {
+            end[-1] = '\0';
+        }
+
+        if (mnemonic[0] != '.') {
+            if (in_text) {
+                address += instruction_size(mnemonic, operands);
+            }
+            continue;
+        }
+        if (enables_rvc(mnemonic, operands)) {
+            return -1;
+        }
+        if (strcmp(mnemonic, ".text") == 0) {
+            in_text = 1;
+        } else if (strcmp(mnemonic, ".data") == 0 || strcmp(mnemonic, ".bss") == 0 ||
+                   strcmp(mnemonic, ".rodata") == 0) {
+            in_text = 0;
+        } else if (strcmp(mnemonic, ".section") == 0) {
+            in_text = strncmp(operands, ".text", 5) == 0;
+        } else if (strcmp(mnemonic, ".type") == 0 && strstr(operands, "function")) {
+            size_t length = strcspn(operands, ", \t");
+            memcpy(function, operands, length);
+            function[length] = '\0';
+        } else if (!in_text) {
+            continue;
+        } else if (strcmp(mnemonic, ".align") == 0 || strcmp(mnemonic, ".p2align") == 0 ||
+                   strcmp(mnemonic, ".balign") == 0) {
+            uint32_t alignment = (uint32_t)strtoul(operands, NULL, 0);
+            if (mnemonic[1] != 'b') {
+                alignment = alignment < 32 ? 1u << alignment : 0;
+            }
+            if (alignment > 1) {
+                address = (address + alignment - 1) & ~(alignment - 1);
+            }
+        } else if (strcmp(mnemonic, ".word") == 0 || strcmp(mnemonic, ".4byte") == 0 ||
+                   strcmp(mnemonic, ".long") == 0) {
+            address += 4 * count_operands(operands);
+        } else if (strcmp(mnemonic, ".half") == 0 || strcmp(mnemonic, ".2byte") == 0 ||
+                   strcmp(mnemonic, ".short") == 0) {
+            address += 2 * count_operands(operands);
+        } else if (strcmp(mnemonic, ".byte") == 0) {
+            address += count_operands(operands);
+        } else if (strcmp(mnemonic, ".string") == 0 || strcmp(mnemonic, ".asciz") == 0) {
+            address += string_size(operands) + 1;
+        } else if (strcmp(mnemonic, ".ascii") == 0) {
+            address += string_size(operands);
+        } else if (strcmp(mnemonic, ".zero") == 0 || strcmp(mnemonic, ".space") == 0) {
+            address += (uint32_t)strtoul(operands, NULL, 0);
+        } else if (strcmp(mnemonic, ".org") == 0) {
+            address = (uint32_t)strtoul(operands, NULL, 0);
+        }
+    }
+    return !ferror(file);
+}
+
+// Function to collect the symbols of an nm listing. Lines that don't parse are skipped.
+static int read_nm_symbols(FILE *file, symbol_list_t *list) {
+    char line[SYMBOL_LINE_SIZE];
+
+    while (fgets(line, sizeof(line), file)) {
+        char type, name[SYMBOL_LINE_SIZE];
+        unsigned long address;
+        if (sscanf(line, "%lx %c %1023s", &address, &type, name) != 3) {
+            continue;
+        }
+        if (!add_symbol(list, name, strlen(name), (uint32_t)address, type == 'T' || type == 't')) {
+            return 0;
+        }
+    }
+    return !ferror(file);
+}
+
+rv_status_t rv_load_symbols(rv_sim_t *sim, const char *filename) {
+    symbol_list_t list = {0};
+    size_t length = strlen(filename);
+    int assembly = length > 2 && filename[length - 2] == '.' && (filename[length - 1] == 's' || filename[length - 1] == 'S');
+
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to open symbol file: %s", strerror(errno));
+    }
+    int result = assembly ? read_assembly_labels(file, &list) : read_nm_symbols(file, &list);
+    fclose(file);
+    if (result != 1) {
+        free(list.symbols);
+        free(list.names);
+        if (result < 0) {
+            return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Label addresses of compressed code are unknown: %s", filename);
+        }
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to read symbol file: %s", filename);
+    }
+
+    elf_free(sim);
+    for (size_t i = 0; i < list.count; i++) {
+        list.symbols[i].name = list.names + (uintptr_t)list.symbols[i].name;
+    }
+    sim->symbols = list.symbols;
+    sim->symbol_names = list.names;
+    sim->num_symbols = list.count;
+    elf_sort_symbols(sim);
+    return RV_OK;
+}
@@ -0,0 +1,544 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "RISC-V.h"
+
+// Linux system call emulation.
+// With emulation on, ECALL runs the system call numbered a7 with the arguments in a0-a5 and returns the
+// result (or -errno) in a0, the RISC-V Linux ABI that newlib's libgloss uses as well. Numbers and flag
+// values are those of the generic Linux ABI, whatever the host is.
+//
+// Guest file descriptors index sim->syscalls->files. 0, 1 and 2 are the host's stdin, stdout and stderr;
+// openat opens files below the sandbox directory only. Writes collect in a SYSCALL_BUFFER_SIZE buffer per
+// descriptor and reach the host when it is full, before a read or close of the same descriptor, when the
+// program exits and at the end of every rv_step/rv_run call, so the host sees everything a call produced
+// once it returns. stderr is flushed after every write (stdout first, to keep the two in order), and
+// stdout before every read of stdin, so prompts show up.
+
+#define SYSCALL_MAX_FILES   64
+#define SYSCALL_BUFFER_SIZE (64 * 1024)
+#define SYSCALL_MAX_PATH    4096
+#define STACK_RESERVE       (8u << 20)   // the break stays this far below the stack pointer
+
+// System call numbers (asm-generic/unistd.h)
+#define SYS_OPENAT          56
+#define SYS_CLOSE           57
+#define SYS_READ            63
+#define SYS_WRITE           64
+#define SYS_EXIT            93
+#define SYS_EXIT_GROUP      94
+#define SYS_CLOCK_GETTIME   113
+#define SYS_GETTIMEOFDAY    169
+#define SYS_BRK             214
+#define SYS_CLOCK_GETTIME64 403
+
+// Guest errno values (asm-generic/errno-base.h), which need not match the host's
+#define GUEST_EPERM         1
+#define GUEST_ENOENT        2
+#define GUEST_EINTR         4
+#define GUEST_EIO           5
+#define GUEST_EBADF         9
+#define GUEST_EAGAIN        11
+#define GUEST_ENOMEM        12
+#define GUEST_EACCES        13
+#define GUEST_EFAULT        14
+#define GUEST_EEXIST        17
+#define GUEST_ENOTDIR       20
+#define GUEST_EISDIR        21
+#define GUEST_EINVAL        22
+#define GUEST_EMFILE        24
+#define GUEST_EFBIG         27
+#define GUEST_ENOSPC        28
+#define GUEST_EROFS         30
+#define GUEST_EPIPE         32
+#define GUEST_ENAMETOOLONG  36
+#define GUEST_ENOSYS        38
+#define GUEST_ELOOP         40
+
+// Guest open flags (asm-generic/fcntl.h)
+#define GUEST_O_ACCMODE     03
+#define GUEST_O_CREAT       0100
+#define GUEST_O_EXCL        0200
+#define GUEST_O_TRUNC       01000
+#define GUEST_O_APPEND      02000
+#define GUEST_O_DIRECTORY   0200000
+
+#define AT_FDCWD_GUEST      (-100)
+
+// The clocks run on the time CSR, which counts instructions; one tick is taken to be a nanosecond
+#define NS_PER_TICK         1
+
+typedef struct {
+    int host_fd;                           // -1 while the guest descriptor is free
+    int owned;                             // 1 if closing the guest descriptor closes host_fd
+    uint8_t *buffer;                       // writes not passed to the host yet, allocated on the first write
+    size_t buffered;
+} guest_file_t;
+
+struct syscall_state {
+    guest_file_t files[SYSCALL_MAX_FILES];
+    int sandbox_fd;                        // directory openat resolves paths in, -1 without a sandbox
+    uint32_t brk;                          // current program break, 0 until the first brk call
+    uint32_t brk_start, brk_limit;
+};
+
+// Function to translate a host errno into the negative guest errno a system call returns
+static int32_t guest_error(int host_errno) {
+    switch (host_errno) {
+        case EPERM:        return -GUEST_EPERM;
+        case ENOENT:       return -GUEST_ENOENT;
+        case EINTR:        return -GUEST_EINTR;
+        case EBADF:        return -GUEST_EBADF;
+        case EAGAIN:       return -GUEST_EAGAIN;
+        case ENOMEM:       return -GUEST_ENOMEM;
+        case EACCES:       return -GUEST_EACCES;
+        case EFAULT:       return -GUEST_EFAULT;
+        case EEXIST:       return -GUEST_EEXIST;
+        case ENOTDIR:      return -GUEST_ENOTDIR;
+        case EISDIR:       return -GUEST_EISDIR;
+        case EINVAL:       return -GUEST_EINVAL;
+        case EMFILE:       return -GUEST_EMFILE;
+        case EFBIG:        return -GUEST_EFBIG;
+        case ENOSPC:       return -GUEST_ENOSPC;
+        case EROFS:        return -GUEST_EROFS;
+        case EPIPE:        return -GUEST_EPIPE;
+        case ENAMETOOLONG: return -GUEST_ENAMETOOLONG;
+        case ELOOP:        return -GUEST_ELOOP;
+        default:           return -GUEST_EIO;
+    }
+}
+
+// Function to check that the guest may access [address, address + size) with perm, as the kernel would
+// before copying from or to user memory
+static int guest_range_ok(rv_sim_t *sim, uint32_t address, uint32_t size, unsigned perm) {
+    if (size == 0) {
+        return 1;
+    }
+    if ((uint64_t)address + size > (uint64_t)UINT32_MAX + 1) {
+        return 0;
+    }
+    uint32_t last = address + size - 1;
+    for (uint32_t page = address & PAGE_MASK;; page += PAGE_SIZE) {
+        const page_t *entry = mem_page(sim, page, 0);
+        if (entry && !(entry->perms & perm)) {
+            return 0;
+        }
+        if (page == (last & PAGE_MASK)) {
+            return 1;
+        }
+    }
+}
+
+static guest_file_t *guest_file(syscall_state_t *state, int32_t fd) {
+    if (fd < 0 || fd >= SYSCALL_MAX_FILES || state->files[fd].host_fd < 0) {
+        return NULL;
+    }
+    return &state->files[fd];
+}
+
+// Function to pass the buffered writes of a descriptor to the host. Returns 0 or a host errno.
+static int flush_file(guest_file_t *file) {
+    size_t done = 0;
+
+    while (done < file->buffered) {
+        ssize_t written = write(file->host_fd, file->buffer + done, file->buffered - done);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            int error = written < 0 ? errno : EIO;
+            file->buffered = 0; // like stdio, the data is lost rather than retried forever
+            return error;
+        }
+        done += (size_t)written;
+    }
+    file->buffered = 0;
+    return 0;
+}
+
+void syscall_flush(rv_sim_t *sim) {
+    for (int fd = 0; fd < SYSCALL_MAX_FILES; fd++) {
+        guest_file_t *file = &sim->syscalls->files[fd];
+        if (file->host_fd >= 0 && file->buffered) {
+            flush_file(file);
+        }
+    }
+}
+
+static void close_file(guest_file_t *file) {
+    if (file->buffered) {
+        flush_file(file);
+    }
+    if (file->owned) {
+        close(file->host_fd);
+    }
+    free(file->buffer);
+    memset(file, 0, sizeof(*file));
+    file->host_fd = -1;
+}
+
+// Function to close every descriptor, and reopen 0, 1 and 2 on the host's
+static void reset_files(syscall_state_t *state) {
+    for (int fd = 0; fd < SYSCALL_MAX_FILES; fd++) {
+        if (state->files[fd].host_fd >= 0) {
+            close_file(&state->files[fd]);
+        }
+        state->files[fd].host_fd = -1;
+    }
+    for (int fd = 0; fd < 3; fd++) {
+        state->files[fd].host_fd = fd;
+    }
+}
+
+void syscall_reset(rv_sim_t *sim) {
+    reset_files(sim->syscalls);
+    sim->syscalls->brk = 0;
+}
+
+rv_status_t rv_set_syscalls(rv_sim_t *sim, int enable, const char *sandbox_dir) {
+    if (sim->syscalls) {
+        reset_files(sim->syscalls);
+        if (sim->syscalls->sandbox_fd >= 0) {
+            close(sim->syscalls->sandbox_fd);
+        }
+        free(sim->syscalls);
+        sim->syscalls = NULL;
+    }
+    if (!enable) {
+        return RV_OK;
+    }
+    int sandbox_fd = -1;
+    if (sandbox_dir) {
+        sandbox_fd = open(sandbox_dir, O_RDONLY | O_DIRECTORY);
+        if (sandbox_fd < 0) {
+            return rv_raise(sim, RV_ERROR_IO, 0, "Failed to open sandbox directory %s: %s", sandbox_dir, strerror(errno));
+        }
+    }
+    sim->syscalls = calloc(1, sizeof(syscall_state_t));
+    if (!sim->syscalls) {
+        if (sandbox_fd >= 0) {
+            close(sandbox_fd);
+        }
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to allocate the system call state");
+    }
+    sim->syscalls->sandbox_fd = sandbox_fd;
+    for (int fd = 0; fd < SYSCALL_MAX_FILES; fd++) {
+        sim->syscalls->files[fd].host_fd = -1;
+    }
+    reset_files(sim->syscalls);
+    return RV_OK;
+}
+
+static int32_t sys_write(rv_sim_t *sim, int32_t fd, uint32_t address, uint32_t count) {
+    guest_file_t *file = guest_file(sim->syscalls, fd);
+    uint32_t done = 0;
+
+    if (!file) {
+        return -GUEST_EBADF;
+    }
+    if (!guest_range_ok(sim, address, count, RV_PERM_READ)) {
+        return -GUEST_EFAULT;
+    }
+    if (count && !file->buffer) {
+        file->buffer = malloc(SYSCALL_BUFFER_SIZE);
+        if (!file->buffer) {
+            return -GUEST_ENOMEM;
+        }
+    }
+    if (fd == 2 && sim->syscalls->files[1].buffered) {
+        flush_file(&sim->syscalls->files[1]);
+    }
+    while (done < count) {
+        if (file->buffered == SYSCALL_BUFFER_SIZE) {
+            int error = flush_file(file);
+            if (error) {
+                return done ? (int32_t)done : guest_error(error);
+            }
+        }
+        uint32_t chunk = count - done;
+        if (chunk > SYSCALL_BUFFER_SIZE - file->buffered) {
+            chunk = (uint32_t)(SYSCALL_BUFFER_SIZE - file->buffered);
+        }
+        rv_read_mem(sim, address + done, file->buffer + file->buffered, chunk);
+        file->buffered += chunk;
+        done += chunk;
+    }
+    if (fd == 2 && file->buffered) {
+        int error = flush_file(file);
+        if (error && !done) {
+            return guest_error(error);
+        }
+    }
+    return (int32_t)done;
+}
+
+static int32_t sys_read(rv_sim_t *sim, int32_t fd, uint32_t address, uint32_t count) {
+    guest_file_t *file = guest_file(sim->syscalls, fd);
+    uint8_t chunk[16 * 1024];
+
+    if (!file) {
+        return -GUEST_EBADF;
+    }
+    if (!guest_range_ok(sim, address, count, RV_PERM_WRITE)) {
+        return -GUEST_EFAULT;
+    }
+    if (file->buffered) {
+        flush_file(file);
+    }
+    if (file->host_fd == 0 && sim->syscalls->files[1].buffered) {
+        flush_file(&sim->syscalls->files[1]);
+    }
+    // one host read, which may return less than asked for, like the read it stands for
+    ssize_t got;
+    do {
+        got = read(file->host_fd, chunk, count < sizeof(chunk) ? count : sizeof(chunk));
+    } while (got < 0 && errno == EINTR);
+    if (got < 0) {
+        return guest_error(errno);
+    }
+    if (got > 0 && rv_write_mem(sim, address, chunk, (size_t)got) != RV_OK) {
+        return -GUEST_EFAULT;
+    }
+    return (int32_t)got;
+}
+
+// Function to copy a NUL-terminated path from the guest. Returns 0 or a negative guest errno.
+static int32_t read_guest_path(rv_sim_t *sim, uint32_t address, char path[SYSCALL_MAX_PATH]) {
+    for (uint32_t i = 0; i < SYSCALL_MAX_PATH; i++) {
+        if (!guest_range_ok(sim, address + i, 1, RV_PERM_READ)) {
+            return -GUEST_EFAULT;
+        }
+        rv_read_mem(sim, address + i, &path[i], 1);
+        if (path[i] == '\0') {
+            return 0;
+        }
+    }
+    return -GUEST_ENAMETOOLONG;
+}
+
+// Function to translate guest open flags into host ones
+static int host_open_flags(int32_t flags) {
+    static const int access_modes[4] = { O_RDONLY, O_WRONLY, O_RDWR, O_RDWR };
+    int host = access_modes[flags & GUEST_O_ACCMODE];
+
+    if (flags & GUEST_O_CREAT)     host |= O_CREAT;
+    if (flags & GUEST_O_EXCL)      host |= O_EXCL;
+    if (flags & GUEST_O_TRUNC)     host |= O_TRUNC;
+    if (flags & GUEST_O_APPEND)    host |= O_APPEND;
+    if (flags & GUEST_O_DIRECTORY) host |= O_DIRECTORY;
+    return host;
+}
+
+// Function to open path below the sandbox. Absolute paths start at the sandbox directory as well, ".."
+// is refused and no symbolic link is followed, so nothing outside the sandbox can be reached.
+// Returns a host descriptor or a negative guest errno.
+static int open_in_sandbox(int sandbox_fd, char *path, int flags, int mode) {
+    int dir_fd = sandbox_fd;
+    char *component = path;
+
+    for (;;) {
+        while (*component == '/') {
+            component++;
+        }
+        char *end = strchr(component, '/');
+        while (end && end[1] == '/') {
+            end++; // "a//b"
+        }
+        int last = !end || end[1] == '\0';
+        if (end) {
+            *end = '\0';
+        }
+        if (strcmp(component, "..") == 0) {
+            if (dir_fd != sandbox_fd) {
+                close(dir_fd);
+            }
+            return -GUEST_EACCES;
+        }
+        const char *name = component[0] ? component : ".";
+        int fd = last ? openat(dir_fd, name, flags | O_NOFOLLOW, mode)
+                      : openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        int error = errno;
+        if (dir_fd != sandbox_fd) {
+            close(dir_fd);
+        }
+        if (fd < 0) {
+            return guest_error(error);
+        }
+        if (last) {
+            return fd;
+        }
+        dir_fd = fd;
+        component = end + 1;
+    }
+}
+
+static int32_t sys_openat(rv_sim_t *sim, int32_t dir_fd, uint32_t path_address, int32_t flags, int32_t mode) {
+    syscall_state_t *state = sim->syscalls;
+    char path[SYSCALL_MAX_PATH];
+    int fd;
+
+    int32_t error = read_guest_path(sim, path_address, path);
+    if (error) {
+        return error;
+    }
+    if (state->sandbox_fd < 0) {
+        return -GUEST_EACCES;
+    }
+    if (dir_fd != AT_FDCWD_GUEST && path[0] != '/') {
+        return -GUEST_EBADF; // only the sandbox directory is a current directory
+    }
+    fd = 3;
+    while (fd < SYSCALL_MAX_FILES && state->files[fd].host_fd >= 0) {
+        fd++;
+    }
+    if (fd == SYSCALL_MAX_FILES) {
+        return -GUEST_EMFILE;
+    }
+    int host_fd = open_in_sandbox(state->sandbox_fd, path, host_open_flags(flags), mode & 0777);
+    if (host_fd < 0) {
+        return host_fd;
+    }
+    state->files[fd].host_fd = host_fd;
+    state->files[fd].owned = 1;
+    return fd;
+}
+
+static int32_t sys_close(rv_sim_t *sim, int32_t fd) {
+    guest_file_t *file = guest_file(sim->syscalls, fd);
+
+    if (!file) {
+        return -GUEST_EBADF;
+    }
+    int error = file->buffered ? flush_file(file) : 0;
+    close_file(file);
+    return error ? guest_error(error) : 0;
+}
+
+// Function to find where the heap starts: above every page the program was loaded into or has touched
+// below the stack, which covers .bss (its pages have permissions) and state restored from a checkpoint
+static void init_brk(rv_sim_t *sim) {
+    syscall_state_t *state = sim->syscalls;
+    uint64_t top = sim->registers_array[2] ? (uint64_t)(uint32_t)sim->registers_array[2] : (uint64_t)UINT32_MAX + 1;
+    uint64_t end = 0;
+
+    for (uint64_t page = 0; page < (top & ~(uint64_t)(PAGE_SIZE - 1)); page += PAGE_SIZE) {
+        const page_t *table = sim->page_tables[page >> (PAGE_SHIFT + PAGE_TABLE_SHIFT)];
+        if (!table) {
+            page |= ((uint64_t)PAGE_SIZE << PAGE_TABLE_SHIFT) - PAGE_SIZE; // skip the untouched 4 MiB
+            continue;
+        }
+        const page_t *entry = &table[(page >> PAGE_SHIFT) & (PAGE_TABLE_ENTRIES - 1)];
+        if (entry->data || entry->perms != RV_PERM_ALL) {
+            end = page + PAGE_SIZE;
+        }
+    }
+    state->brk_start = (uint32_t)end;
+    state->brk_limit = top > end + STACK_RESERVE ? (uint32_t)(top - STACK_RESERVE) : (uint32_t)end;
+    state->brk = state->brk_start;
+}
+
+// brk returns the new break, or the old one if it can't move there; brk(0) asks for the current one
+static uint32_t sys_brk(rv_sim_t *sim, uint32_t address) {
+    syscall_state_t *state = sim->syscalls;
+
+    if (state->brk == 0) {
+        init_brk(sim);
+    }
+    if (address < state->brk_start || address > state->brk_limit) {
+        return state->brk;
+    }
+    if (address > state->brk) {
+        // memory given back and taken again reads as zeros, as it would on a fresh mapping
+        static const uint8_t zeros[PAGE_SIZE];
+        for (uint32_t at = state->brk; at < address;) {
+            uint32_t chunk = (at & PAGE_MASK) + PAGE_SIZE - at;
+            if (chunk > address - at) {
+                chunk = address - at;
+            }
+            const page_t *entry = mem_page(sim, at, 0);
+            if (entry && entry->data) {
+                rv_write_mem(sim, at, zeros, chunk);
+            }
+            at += chunk;
+        }
+    }
+    state->brk = address;
+    return address;
+}
+
+// Function to write a struct timespec or timeval with a 64-bit tv_sec, as rv32 newlib and time64 Linux
+// define them: tv_sec, then the 32-bit fraction and 4 bytes of padding
+static int32_t write_time(rv_sim_t *sim, uint32_t address, uint64_t seconds, uint32_t fraction) {
+    uint8_t value[16] = { 0 };
+
+    if (!guest_range_ok(sim, address, sizeof(value), RV_PERM_WRITE)) {
+        return -GUEST_EFAULT;
+    }
+    for (int i = 0; i < 8; i++) {
+        value[i] = (uint8_t)(seconds >> (8 * i));
+    }
+    for (int i = 0; i < 4; i++) {
+        value[8 + i] = (uint8_t)(fraction >> (8 * i));
+    }
+    rv_write_mem(sim, address, value, sizeof(value));
+    return 0;
+}
+
+static int32_t sys_clock_gettime(rv_sim_t *sim, int32_t clock, uint32_t address) {
+    uint64_t ns = sim->instret * NS_PER_TICK;
+
+    if (clock < 0 || clock > 7) {
+        return -GUEST_EINVAL; // realtime, monotonic, cputime, raw, coarse and boottime all read the same
+    }
+    return write_time(sim, address, ns / 1000000000, (uint32_t)(ns % 1000000000));
+}
+
+static int32_t sys_gettimeofday(rv_sim_t *sim, uint32_t address) {
+    uint64_t ns = sim->instret * NS_PER_TICK;
+
+    return address ? write_time(sim, address, ns / 1000000000, (uint32_t)(ns % 1000000000 / 1000)) : 0;
+}
+
+rv_status_t syscall_handle(rv_sim_t *sim) {
+    const int32_t *x = sim->registers_array;
+    int32_t result;
+
+    switch (x[17]) {
+        case SYS_WRITE:
+            result = sys_write(sim, x[10], (uint32_t)x[11], (uint32_t)x[12]);
+            break;
+        case SYS_READ:
+            result = sys_read(sim, x[10], (uint32_t)x[11], (uint32_t)x[12]);
+            break;
+        case SYS_OPENAT:
+            result = sys_openat(sim, x[10], (uint32_t)x[11], x[12], x[13]);
+            break;
+        case SYS_CLOSE:
+            result = sys_close(sim, x[10]);
+            break;
+        case SYS_BRK:
+            result = (int32_t)sys_brk(sim, (uint32_t)x[10]);
+            break;
+        case SYS_CLOCK_GETTIME:
+        case SYS_CLOCK_GETTIME64:
+            result = sys_clock_gettime(sim, x[10], (uint32_t)x[11]);
+            break;
+        case SYS_GETTIMEOFDAY:
+            result = sys_gettimeofday(sim, (uint32_t)x[10]);
+            break;
+        case SYS_EXIT:
+        case SYS_EXIT_GROUP:
+            syscall_flush(sim);
+            return rv_raise(sim, RV_HALT_EXIT, 0, "Program exited with code %d at PC: 0x%08X", x[10], sim->pc);
+        default:
+            result = -GUEST_ENOSYS;
+            break;
+    }
+    sim->registers_array[10] = result;
+    return RV_OK;
+}
@@ -0,0 +1,24 @@
+	.text
+	# Loads that conflict in the data cache: 0x1000, 0x2000 and 0x3000 all map to set 0 of a 1k cache with
+	# 64-byte lines. The first loop alternates between two of the lines, the second cycles through all three.
+	# Direct-mapped (1k:64:1) all 50 loads miss, 47 of them conflict misses; 2-way with random replacement
+	# (1k:64:2:random) the first loop misses only twice and a load in the second hits only if its line is
+	# still in the set.
+	lui s0, 1		# 0x1000
+	lui s1, 2		# 0x2000
+	lui s2, 3		# 0x3000
+	li t0, 10
+pair:
+	lw a0, 0(s0)
+	lw a1, 0(s1)
+	addi t0, t0, -1
+	bnez t0, pair
+	li t0, 10
+triple:
+	lw a0, 0(s0)
+	lw a1, 0(s1)
+	lw a2, 0(s2)
+	addi t0, t0, -1
+	bnez t0, triple
+	li a3, 1
+	ecall
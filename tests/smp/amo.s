@@ -0,0 +1,35 @@
+	.text
+	# RV32A on one hart: every AMO returns the old value and stores op(old, rs2), and sc.w only succeeds
+	# on the word its lr.w reserved, once
+	csrr a0, mhartid	# 0
+	lui s0, 2		# 0x2000
+	li t0, -5
+	sw t0, 0(s0)
+	li t1, 3
+	amoswap.w a1, t1, (s0)	# -5, memory 3
+	amoadd.w a2, t1, (s0)	# 3, memory 6
+	li t2, 5
+	amoxor.w a3, t2, (s0)	# 6, memory 3
+	li t2, 6
+	amoor.w a4, t2, (s0)	# 3, memory 7
+	li t2, 12
+	amoand.w a5, t2, (s0)	# 7, memory 4
+	li t2, -1
+	amomin.w a6, t2, (s0)	# 4, memory -1
+	li t2, 2
+	amominu.w a7, t2, (s0)	# -1, memory 2
+	li t2, -7
+	amomax.w s2, t2, (s0)	# 2, memory 2
+	amomaxu.w s3, t2, (s0)	# 2, memory -7
+	lw s4, 0(s0)		# -7
+	sc.w s5, t1, (s0)	# 1, no reservation
+	lr.w s6, (s0)		# -7
+	sc.w s7, t1, (s0)	# 0, memory 3
+	sc.w s8, t2, (s0)	# 1, the reservation is gone
+	lw s9, 0(s0)		# 3
+	fence
+	fence.i
+	li t0, 0
+	li t1, 0
+	li t2, 0
+	ecall
@@ -0,0 +1,32 @@
+	.text
+	# Four harts sum 1..4000 between them: hart h adds up h+1, h+5, h+9, ... and amoadd.w's its share
+	# into the total. Hart 0 waits for every hart to check in, then loads the total.
+	csrr a0, mhartid	# 0, 1, 2, 3
+	lui s0, 2		# shared data at 0x2000: total, then the number of harts done
+	addi t0, a0, 1		# next number
+	lui t1, 1
+	addi t1, t1, -96	# 4000
+	li a1, 0		# this hart's share
+sum:
+	add a1, a1, t0
+	addi t0, t0, 4
+	bge t1, t0, sum
+	amoadd.w x0, a1, (s0)	# 1999000, 2000000, 2001000, 2002000
+	li t2, 1
+	addi t3, s0, 4
+	amoadd.w.rl x0, t2, (t3)
+	bnez a0, done
+	li t4, 4
+wait:
+	lw t5, 0(t3)
+	bne t5, t4, wait
+	fence
+	lw a2, 0(s0)		# 8002000
+done:
+	li t0, 0
+	li t1, 0
+	li t2, 0
+	li t3, 0
+	li t4, 0
+	li t5, 0
+	ecall
@@ -0,0 +1,45 @@
+	.text
+	# Four harts each add 1 to two shared counters 1000 times: one a plain lw/addi/sw under an amoswap.w
+	# spinlock, the other through an lr.w/sc.w retry loop. Hart 0 waits for every hart, then loads both.
+	csrr a0, mhartid	# 0, 1, 2, 3
+	lui s0, 2		# 0x2000: lock, locked counter, lr/sc counter, number of harts done
+	li s1, 1000
+	li t6, 1
+locked:
+	amoswap.w.aq t0, t6, (s0)
+	bnez t0, locked		# spin while another hart holds the lock
+	lw t1, 4(s0)
+	addi t1, t1, 1
+	sw t1, 4(s0)
+	amoswap.w.rl x0, x0, (s0)
+	addi s1, s1, -1
+	bnez s1, locked
+	li s1, 1000
+	addi s2, s0, 8
+reserved:
+	lr.w t1, (s2)
+	addi t1, t1, 1
+	sc.w t2, t1, (s2)
+	bnez t2, reserved	# lost the reservation, try again
+	addi s1, s1, -1
+	bnez s1, reserved
+	addi t3, s0, 12
+	amoadd.w.aqrl x0, t6, (t3)
+	bnez a0, done
+	li t4, 4
+wait:
+	lw t5, 12(s0)
+	bne t5, t4, wait
+	fence
+	lw a1, 4(s0)		# 4000
+	lw a2, 8(s0)		# 4000
+	lw a3, 0(s0)		# 0, released
+done:
+	li s2, 0
+	li t0, 0
+	li t1, 0
+	li t2, 0
+	li t3, 0
+	li t4, 0
+	li t5, 0
+	ecall
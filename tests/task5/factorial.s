@@ -0,0 +1,21 @@
+	.text
+	# 12! with MUL, then the sum of its decimal digits with DIVU/REMU
+	li s0, 1		# product
+	li s1, 1		# i
+	li s2, 12
+fact:
+	mul s0, s0, s1
+	addi s1, s1, 1
+	bge s2, s1, fact
+	mv a0, s0		# a0 = 479001600
+	li s3, 0		# digit sum
+	li s4, 10
+	mv s5, s0
+digits:
+	remu t0, s5, s4
+	add s3, s3, t0
+	divu s5, s5, s4
+	bnez s5, digits
+	mv a1, s3		# a1 = 27
+	li a7, 10
+	ecall
@@ -0,0 +1,60 @@
+	.text
+	# factorial.s as gcc -march=rv32i builds it: the multiplies and divides become calls
+	# to shift-and-add / shift-and-subtract helpers like libgcc's __mulsi3 and __udivsi3
+	li s0, 1		# product
+	li s1, 1		# i
+	li s2, 12
+fact:
+	mv a0, s0
+	mv a1, s1
+	jal __mulsi3
+	mv s0, a0
+	addi s1, s1, 1
+	bge s2, s1, fact
+	li s3, 0		# digit sum
+	li s4, 10
+	mv s5, s0
+digits:
+	mv a0, s5
+	mv a1, s4
+	jal __udivmodsi4
+	add s3, s3, a1
+	mv s5, a0
+	bnez s5, digits
+	mv a0, s0		# a0 = 479001600
+	mv a1, s3		# a1 = 27
+	li a7, 10
+	ecall
+
+__mulsi3:			# a0 = a0 * a1
+	mv a2, a0
+	li a0, 0
+mul_loop:
+	andi a3, a1, 1
+	beqz a3, mul_skip
+	add a0, a0, a2
+mul_skip:
+	srli a1, a1, 1
+	slli a2, a2, 1
+	bnez a1, mul_loop
+	ret
+
+__udivmodsi4:			# a0 = a0 / a1, a1 = a0 % a1 (unsigned, a1 != 0)
+	li t0, 0		# remainder
+	li t1, 32		# bits left
+	li t2, 0		# quotient
+div_loop:
+	srli t3, a0, 31
+	slli t0, t0, 1
+	or t0, t0, t3
+	slli a0, a0, 1
+	slli t2, t2, 1
+	bltu t0, a1, div_skip
+	sub t0, t0, a1
+	ori t2, t2, 1
+div_skip:
+	addi t1, t1, -1
+	bnez t1, div_loop
+	mv a0, t2
+	mv a1, t0
+	ret
@@ -0,0 +1,28 @@
+	.text
+	# RV32M, including the results the spec defines for division by zero and overflow
+	lui t0, 0x80000		# t0 = INT32_MIN
+	li t1, -1
+	li t2, 7
+	li t3, -3
+	mul a0, t2, t3		# -21
+	mulh a1, t0, t0		# 0x40000000
+	mulhsu a2, t1, t1	# -1
+	mulhu a3, t1, t1	# 0xFFFFFFFE
+	div a4, t0, t1		# overflow: INT32_MIN
+	rem a5, t0, t1		# overflow: 0
+	div a6, t2, zero	# by zero: -1
+	divu s2, t2, zero	# by zero: 0xFFFFFFFF
+	rem s3, t2, zero	# by zero: 7
+	remu s4, t3, zero	# by zero: -3
+	div s5, t3, t2		# 0 (rounds towards zero)
+	rem s6, t3, t2		# -3 (sign of the dividend)
+	div s7, t2, t3		# -2
+	rem s8, t2, t3		# 1
+	divu s9, t3, t2		# 0x24924924
+	remu s10, t3, t2	# 1
+	mul s11, t0, t1		# INT32_MIN
+	mulh t4, t3, t2		# -1
+	mulhsu t5, t0, t1	# INT32_MIN * 0xFFFFFFFF >> 32 = INT32_MIN
+	mulhu t6, t0, t2	# 3
+	li a7, 10
+	ecall
@@ -0,0 +1,80 @@
+	.text
+	# Every RV32C instruction, with the results left in registers
+	lui sp, 0x10		# sp = 0x10000
+	c.li a0, -5		# a0 = -5
+	c.addi a0, 12		# a0 = 7
+	c.lui a1, -1		# a1 = 0xFFFFF000
+	c.addi16sp sp, -64	# sp = 0xFFC0
+	c.addi4spn a2, sp, 8	# a2 = 0xFFC8
+	c.mv a3, a0
+	c.add a3, a1		# a3 = 0xFFFFF007
+	c.li a4, 12
+	c.sub a4, a0		# a4 = 5
+	c.li a5, 12
+	c.xor a5, a0		# a5 = 11
+	c.li s0, 12
+	c.or s0, a0		# s0 = 15
+	c.li s1, 12
+	c.and s1, a0		# s1 = 4
+	c.mv a4, a1
+	c.srli a4, 20
+	c.mv s2, a4		# s2 = 0xFFF
+	c.mv a4, a1
+	c.srai a4, 20
+	c.mv s3, a4		# s3 = -1
+	c.mv a4, a3
+	c.andi a4, -6
+	c.mv s4, a4		# s4 = 0xFFFFF002
+	c.li a4, 3
+	c.slli a4, 30
+	c.mv s5, a4		# s5 = 0xC0000000
+	c.swsp a3, 60(sp)
+	c.lw a4, 52(a2)
+	c.mv s6, a4		# s6 = 0xFFFFF007 (sp + 60 == a2 + 52)
+	c.sw a0, 4(a2)
+	c.lwsp s7, 12(sp)	# s7 = 7
+	addi s11, zero, 100	# s11 = 100, a 32-bit instruction at pc % 4 == 2
+	c.nop
+
+	# Branches and jumps
+	c.li s8, 0
+	c.li a4, 0
+	c.beqz a4, L1		# taken
+	c.addi s8, 1
+L1:
+	c.bnez a0, L2		# taken
+	c.addi s8, 2
+L2:
+	c.beqz a0, L3		# not taken
+	c.addi s8, 4
+L3:
+	c.bnez a4, L4		# not taken
+	c.addi s8, 8
+L4:
+	c.j L5
+	c.addi s8, 16
+L5:				# s8 = 12
+
+	# Calls: the return address is the compressed call + 2
+	c.jal sub1		# s9 = ra = R1
+R1:
+	auipc t4, 0
+	sub t4, t4, s9		# t4 = 0
+P1:
+	auipc t0, hi(sub2-P1)
+	addi t0, t0, lo(sub2-P1)
+	c.jalr t0		# s10 = ra = R2
+R2:
+	auipc t5, 0
+	sub t5, t5, s10		# t5 = 0
+	c.li t0, 0
+	c.li ra, 0
+	c.li a7, 10
+	ecall
+
+sub1:
+	c.mv s9, ra
+	c.jr ra
+sub2:
+	c.mv s10, ra
+	c.jr ra
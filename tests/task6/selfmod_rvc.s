@@ -0,0 +1,41 @@
+	.text
+	# Stores into compressed code, into the second half of a 32-bit instruction that starts at pc % 4 == 2,
+	# and into the half of a 32-bit instruction that lies on the next page. Every pass after the first must
+	# see the patched instructions, on every core (40 passes make the loop hot enough for the JIT).
+	li s1, 40		# passes
+	c.li s0, 0		# sum of a0
+	c.li a2, 0		# sum of a1
+	c.li a4, 0		# sum of a3
+P1:
+	auipc t0, hi(T1-P1)
+	addi t0, t0, lo(T1-P1)
+P2:
+	auipc t1, hi(T2-P2)
+	addi t1, t1, lo(T2-P2)
+P3:
+	auipc t2, hi(T3-P3)
+	addi t2, t2, lo(T3-P3)
+	lui t3, 0x4
+	addi t3, t3, 0x515	# t3 = c.li a0, 5
+	li t4, 0x20		# upper half of addi a1/a3, zero, 2
+loop:
+T1:
+	c.li a0, 1		# becomes c.li a0, 5
+	c.nop
+T2:
+	addi a1, zero, 1	# at pc % 4 == 2, becomes addi a1, zero, 2
+	c.add s0, a0
+	c.add a2, a1
+	sh t3, 0(t0)
+	sh t4, 2(t1)
+	j T3
+	.org 0xFFE
+T3:
+	addi a3, zero, 1	# crosses into the next page, becomes addi a3, zero, 2
+	c.add a4, a3
+	sh t4, 2(t2)		# the second half is on the next page
+	c.addi s1, -1
+	bnez s1, loop
+	c.li t3, 0
+	c.li a7, 10
+	ecall			# s0 = 1 + 39 * 5 = 196, a2 = a4 = 1 + 39 * 2 = 79
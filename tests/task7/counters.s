@@ -0,0 +1,21 @@
+	.text
+	# Zicntr counters: cycle, time and instret all count the instructions completed before the read
+	rdinstret a0		# 0
+	li t0, 100
+loop:
+	rdcycle t1		# 2, 5, ..., 299
+	addi t0, t0, -1
+	bnez t0, loop
+	rdinstret a1		# 302
+	sub a2, a1, a0		# 302
+	rdcycle a3		# 304
+	rdtime a4		# 305
+	rdinstreth a5		# 0
+	csrr a6, instret	# 307
+	csrrc a7, cycle, zero	# 308, no write with rs1 = x0
+	csrrsi s2, time, 0	# 309, no write with a zero immediate
+	sub s3, a6, a1		# 5
+	mv s4, t1		# 299
+	rdcycleh s5		# 0
+	rdtimeh s6		# 0
+	ecall
@@ -0,0 +1,65 @@
+	.text
+	# Every instruction pair the threaded core fuses (see fusion.c). The registers must come out as if the
+	# two instructions ran one by one: both register writes, jumps to the second instruction of a pair,
+	# and compressed pairs.
+	li s0, 3		# passes
+	li s1, 0		# checksum
+	j second		# the first pass enters the lui+addi below at the addi
+loop:
+	lui a0, 0x12345
+	addi a1, a0, 0x678	# a0 = 0x12345000, a1 = 0x12345678
+	add s1, s1, a0
+	add s1, s1, a1
+pair:
+	lui a6, 0x1
+second:
+	addi a6, a6, 1		# 1 on the first pass, 0x1001 after
+	add s1, s1, a6
+P1:
+	auipc t0, hi(data-P1)
+	lw a2, lo(data-P1)(t0)	# a2 = 0x8765FEDC, t0 keeps the auipc result
+	add s1, s1, a2
+	slli a3, a2, 16
+	srli a4, a3, 16		# zero-extend the low halfword: 0xFEDC
+	slli a5, a2, 24
+	srai a5, a5, 24		# sign-extend the low byte: -36
+	add s1, s1, a4
+	add s1, s1, a5
+	c.mv a3, a2
+	c.slli a3, 20
+	c.srli a3, 28		# 0xE
+	add s1, s1, a3
+	slt t1, a5, a4
+	beqz t1, skip1		# not taken, t1 = 1
+	addi s1, s1, 7
+skip1:
+	sltu t2, a5, a4
+	bnez t2, skip2		# not taken, t2 = 0
+	addi s1, s1, 11
+skip2:
+	slti t3, s0, 2
+	bnez t3, skip3		# taken on the last pass
+	addi s1, s1, 13
+skip3:
+	sltiu a4, s0, 3
+	c.beqz a4, skip4	# taken on the first pass
+	addi s1, s1, 17
+skip4:
+P2:
+	auipc t4, hi(function-P2)
+	jalr ra, lo(function-P2)(t4)	# t4 keeps the auipc result, ra the return address
+	addi s0, s0, -1
+	bnez s0, loop
+	ecall
+function:
+	mv t5, ra
+	addi s1, s1, 19
+P3:
+	auipc ra, hi(back-P3)
+	jalr x0, lo(back-P3)(ra)	# ra keeps the auipc result
+back:
+	add s1, s1, ra
+	jalr x0, t5, 0
+	.align
+data:
+	.word 0x8765FEDC
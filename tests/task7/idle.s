@@ -0,0 +1,16 @@
+	.text
+	# A program may end in a jump to itself rather than ECALL; the simulator halts there as idle.
+	# Branches to themselves that aren't taken fall through like any other.
+	li a0, 3
+loop:
+	addi a0, a0, -1
+	bnez a0, loop		# back twice, a0 = 0
+	bnez a0, .		# not taken
+	li a2, 7
+	sltu t1, a0, a2		# 1
+	beqz t1, .		# not taken, and not fused with the sltu
+	sltu t2, a2, a0		# 0
+	bnez t2, .		# not taken
+	li a1, 42
+	j .			# halts here, pc 0x28
+	li a1, 0		# never reached
@@ -0,0 +1,7 @@
+	.text
+	# AND with funct7 0x20 is a reserved encoding: it traps as an illegal instruction
+	li a0, 6
+	li a1, 3
+	.word 0x40b57633	# and a2, a0, a1 with funct7 0x20, stops here
+	li a3, 1		# not reached
+	ecall
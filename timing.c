@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+
+// Pipeline timing model.
+// While timing is on, the instrumented core variants hand every completed instruction to timing_retire,
+// which places it in a classic in-order 5-stage pipeline (IF ID EX MEM WB) by the cycle it enters EX.
+// The model only watches: registers, memory and the counter CSRs are the same with or without it.
+//
+// An instruction enters EX one cycle after the one before it, later if
+//   - a source register isn't ready. With forwarding, ALU results reach the next instruction's EX and
+//     loaded values the one after (one load-use stall); without, every value goes through the register
+//     file, written in WB and read in ID in the same cycle (two stalls for the next instruction, one for
+//     the one after).
+//   - the divider is busy: DIV/DIVU/REM/REMU stay in EX for TIMING_DIV_CYCLES cycles, MUL is pipelined.
+//   - fetch was redirected. Branches are predicted in ID, where their target is computed, so a branch
+//     predicted taken and JAL cost one bubble, and branches resolve in EX, so a mispredicted branch and
+//     JALR (target from a register) cost two.
+//   - the caches (cache.c), when they are on: an instruction cache miss holds the instruction in IF, and a
+//     data cache miss holds it in MEM, and everything behind it, for the miss cycles of the cache.
+// Without caches memory is ideal. Cycles are counted from the first instruction's fetch to the last one's
+// WB.
+#define TIMING_DIV_CYCLES 32
+#define PREDICTOR_TABLE_BITS 12       // 4096 two-bit counters
+#define PREDICTOR_TABLE_SIZE (1u << PREDICTOR_TABLE_BITS)
+
+// Where cycles beyond one per instruction went
+enum {
+    STALL_LOAD_USE,                   // waiting for a loaded value
+    STALL_DATA,                       // waiting for any other result (only without forwarding)
+    STALL_DIVIDER,
+    STALL_MISPREDICT,
+    STALL_TAKEN,                      // correctly predicted taken branches and JAL
+    STALL_INDIRECT,                   // JALR
+    STALL_ICACHE,
+    STALL_DCACHE,
+    STALL_KINDS
+};
+
+static const char *const stall_names[STALL_KINDS] = {
+    "load-use", "data hazards", "divider", "mispredicted branches", "taken branches and jumps",
+    "indirect jumps", "instruction cache misses", "data cache misses"
+};
+
+// Branch predictor. predict tells whether the branch at pc will be taken, update learns its outcome.
+typedef struct {
+    const char *name;
+    int (*predict)(const timing_state_t *timing, uint32_t pc);
+    void (*update)(timing_state_t *timing, uint32_t pc, int taken);
+} predictor_t;
+
+struct timing_state {
+    const predictor_t *predictor;
+    int forwarding;
+    uint64_t instructions;
+    uint64_t last_ex;                 // cycle the last instruction entered EX
+    uint64_t next_ex;                 // earliest EX of the next instruction once fetch was redirected
+    int pending_stall;                // STALL_* kind of the redirect, or -1
+    uint64_t divider_free;            // first cycle the divider takes a new instruction
+    uint64_t memory_free;             // first EX cycle after a data cache miss let the pipeline go on
+    uint64_t last_data_miss;          // data cache miss cycles of the last instruction
+    uint64_t ready[NUM_REGISTERS];    // first EX cycle that can use the register's value
+    uint8_t loaded[NUM_REGISTERS];    // the value comes from a load
+    uint64_t stalls[STALL_KINDS];
+    uint64_t branches;
+    uint64_t mispredicted;
+    uint8_t counters[PREDICTOR_TABLE_SIZE]; // 0-1 predict not taken, 2-3 taken
+    uint32_t history;                 // outcomes of the last PREDICTOR_TABLE_BITS branches, newest in bit 0
+};
+
+static int predict_not_taken(const timing_state_t *timing, uint32_t pc) {
+    (void)timing;
+    (void)pc;
+    return 0;
+}
+
+static void update_nothing(timing_state_t *timing, uint32_t pc, int taken) {
+    (void)timing;
+    (void)pc;
+    (void)taken;
+}
+
+static void train_counter(uint8_t *counter, int taken) {
+    if (taken && *counter < 3) {
+        (*counter)++;
+    } else if (!taken && *counter > 0) {
+        (*counter)--;
+    }
+}
+
+// pc >> 1 since compressed branches sit on any even address
+static uint32_t bimodal_index(uint32_t pc) {
+    return (pc >> 1) & (PREDICTOR_TABLE_SIZE - 1);
+}
+
+static int predict_bimodal(const timing_state_t *timing, uint32_t pc) {
+    return timing->counters[bimodal_index(pc)] >= 2;
+}
+
+static void update_bimodal(timing_state_t *timing, uint32_t pc, int taken) {
+    train_counter(&timing->counters[bimodal_index(pc)], taken);
+}
+
+static uint32_t gshare_index(const timing_state_t *timing, uint32_t pc) {
+    return ((pc >> 1) ^ timing->history) & (PREDICTOR_TABLE_SIZE - 1);
+}
+
+static int predict_gshare(const timing_state_t *timing, uint32_t pc) {
+    return timing->counters[gshare_index(timing, pc)] >= 2;
+}
+
+static void update_gshare(timing_state_t *timing, uint32_t pc, int taken) {
+    train_counter(&timing->counters[gshare_index(timing, pc)], taken);
+    timing->history = ((timing->history << 1) | (uint32_t)taken) & (PREDICTOR_TABLE_SIZE - 1);
+}
+
+// Indexed by rv_predictor_t
+static const predictor_t predictors[] = {
+    { "static not-taken", predict_not_taken, update_nothing },
+    { "bimodal", predict_bimodal, update_bimodal },
+    { "gshare", predict_gshare, update_gshare },
+};
+
+rv_status_t rv_set_timing(rv_sim_t *sim, int enable, rv_predictor_t predictor, int forwarding) {
+    free(sim->timing);
+    sim->timing = NULL;
+    if (!enable) {
+        return RV_OK;
+    }
+    if ((unsigned)predictor >= sizeof(predictors) / sizeof(predictors[0])) {
+        return rv_raise(sim, RV_ERROR_ARGUMENT, 0, "Unknown branch predictor: %d", (int)predictor);
+    }
+    timing_state_t *timing = calloc(1, sizeof(timing_state_t));
+    if (!timing) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to allocate the timing model");
+    }
+    timing->predictor = &predictors[predictor];
+    timing->forwarding = forwarding;
+    timing->last_ex = 1;              // the first instruction is fetched in cycle 0 and enters EX in cycle 2
+    timing->next_ex = 2;
+    timing->pending_stall = -1;
+    for (uint32_t i = 0; i < PREDICTOR_TABLE_SIZE; i++) {
+        timing->counters[i] = 1;      // weakly not taken
+    }
+    sim->timing = timing;
+    return RV_OK;
+}
+
+// Function to wait in EX until reg can be read, counting the stall against the kind of its producer
+static uint64_t wait_for_register(timing_state_t *timing, uint8_t reg, uint64_t ex) {
+    if (reg == 0 || timing->ready[reg] <= ex) {
+        return ex;
+    }
+    timing->stalls[timing->loaded[reg] ? STALL_LOAD_USE : STALL_DATA] += timing->ready[reg] - ex;
+    return timing->ready[reg];
+}
+
+void timing_retire(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d, uint32_t next_pc) {
+    timing_state_t *timing = sim->timing;
+    uint8_t insn = d->insn;
+    int reads_rs1, reads_rs2, writes_rd;
+
+    switch (insn) {
+        case INSN_LUI: case INSN_AUIPC: case INSN_JAL:
+            reads_rs1 = 0, reads_rs2 = 0, writes_rd = 1;
+            break;
+        case INSN_BEQ: case INSN_BNE: case INSN_BLT: case INSN_BGE: case INSN_BLTU: case INSN_BGEU:
+        case INSN_SB: case INSN_SH: case INSN_SW:
+            reads_rs1 = 1, reads_rs2 = 1, writes_rd = 0;
+            break;
+        case INSN_JALR:
+        case INSN_LB: case INSN_LH: case INSN_LW: case INSN_LBU: case INSN_LHU: case INSN_LR:
+        case INSN_ADDI: case INSN_SLTI: case INSN_SLTIU: case INSN_XORI: case INSN_ORI: case INSN_ANDI:
+        case INSN_SLLI: case INSN_SRLI: case INSN_SRAI:
+            reads_rs1 = 1, reads_rs2 = 0, writes_rd = 1;
+            break;
+        case INSN_CSR:
+            reads_rs1 = (d->funct3 & 4) == 0, reads_rs2 = 0, writes_rd = 1; // CSRR*I take an immediate
+            break;
+        case INSN_SYSTEM: case INSN_ILLEGAL: case INSN_FENCE: case INSN_FENCE_I:
+            reads_rs1 = 0, reads_rs2 = 0, writes_rd = 0;
+            break;
+        default: // OP, the M extension, SC.W and the AMOs
+            reads_rs1 = 1, reads_rs2 = 1, writes_rd = 1;
+            break;
+    }
+
+    uint64_t fetch_miss, data_miss;
+    cache_miss_cycles(sim, &fetch_miss, &data_miss);
+
+    uint64_t ex = timing->next_ex;
+    if (timing->pending_stall >= 0) {
+        timing->stalls[timing->pending_stall] += ex - (timing->last_ex + 1);
+        timing->pending_stall = -1;
+    }
+    if (timing->memory_free > ex) {
+        timing->stalls[STALL_DCACHE] += timing->memory_free - ex;
+        ex = timing->memory_free;
+    }
+    ex += fetch_miss;
+    timing->stalls[STALL_ICACHE] += fetch_miss;
+    if (timing->divider_free > ex) {
+        timing->stalls[STALL_DIVIDER] += timing->divider_free - ex;
+        ex = timing->divider_free;
+    }
+    if (reads_rs1) {
+        ex = wait_for_register(timing, d->rs1, ex);
+    }
+    if (reads_rs2) {
+        ex = wait_for_register(timing, d->rs2, ex);
+    }
+
+    // the last cycle in EX
+    uint64_t ex_done = ex;
+    if (insn >= INSN_DIV && insn <= INSN_REMU) {
+        ex_done += TIMING_DIV_CYCLES - 1;
+        timing->divider_free = ex_done + 1;
+    }
+    if (data_miss) {
+        timing->memory_free = ex_done + 1 + data_miss;
+    }
+    if (writes_rd && d->rd != 0) {
+        int is_load = (insn >= INSN_LB && insn <= INSN_LHU) || (insn >= INSN_LR && insn <= INSN_AMOMAXU);
+        timing->ready[d->rd] = ex_done + data_miss + (timing->forwarding ? (is_load ? 2 : 1) : 3);
+        timing->loaded[d->rd] = (uint8_t)is_load;
+    }
+
+    // where the next instruction can be fetched from
+    uint64_t penalty = 0;
+    if (insn >= INSN_BEQ && insn <= INSN_BGEU) {
+        int taken = next_pc != insn_pc + d->length;
+        int predicted = timing->predictor->predict(timing, insn_pc);
+        timing->predictor->update(timing, insn_pc, taken);
+        timing->branches++;
+        if (predicted != taken) {
+            timing->mispredicted++;
+            penalty = 2;
+            timing->pending_stall = STALL_MISPREDICT;
+        } else if (taken) {
+            penalty = 1;
+            timing->pending_stall = STALL_TAKEN;
+        }
+    } else if (insn == INSN_JAL) {
+        penalty = 1;
+        timing->pending_stall = STALL_TAKEN;
+    } else if (insn == INSN_JALR) {
+        penalty = 2;
+        timing->pending_stall = STALL_INDIRECT;
+    }
+    timing->last_ex = ex;
+    timing->last_data_miss = data_miss;
+    timing->next_ex = ex + 1 + penalty;
+    timing->instructions++;
+}
+
+void rv_print_timing(const rv_sim_t *sim) {
+    const timing_state_t *timing = sim->timing;
+
+    if (!timing) {
+        return;
+    }
+    uint64_t stalls[STALL_KINDS];
+    memcpy(stalls, timing->stalls, sizeof(stalls));
+    stalls[STALL_DCACHE] += timing->last_data_miss; // nothing came after the last instruction to wait for it
+    // the last instruction leaves WB two cycles after EX
+    uint64_t cycles = timing->instructions ? timing->last_ex + 3 + timing->last_data_miss : 0;
+    printf("\n--- Timing (5-stage pipeline, %s predictor, %s) ---\n", timing->predictor->name,
+           timing->forwarding ? "forwarding" : "no forwarding");
+    printf("Cycles: %llu, instructions: %llu, CPI: %.3f\n", (unsigned long long)cycles,
+           (unsigned long long)timing->instructions,
+           timing->instructions ? (double)cycles / timing->instructions : 0.0);
+    printf("\nStall cycles:\n");
+    printf("  %-26s %14llu\n", "pipeline fill and drain", (unsigned long long)(timing->instructions ? 4 : 0));
+    for (int i = 0; i < STALL_KINDS; i++) {
+        printf("  %-26s %14llu\n", stall_names[i], (unsigned long long)stalls[i]);
+    }
+    printf("\nBranches: %llu, predicted correctly: %llu (%.2f%%)\n", (unsigned long long)timing->branches,
+           (unsigned long long)(timing->branches - timing->mispredicted),
+           timing->branches ? 100.0 * (timing->branches - timing->mispredicted) / timing->branches : 100.0);
+    printf("--------------------------\n");
+}
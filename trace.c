@@ -0,0 +1,123 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "RISC-V.h"
+#include "trace.h"
+
+// Records are collected in a large buffer and written with one fwrite per TRACE_BUFFER_RECORDS
+#define TRACE_BUFFER_RECORDS (64 * 1024)
+
+struct trace_state {
+    FILE *file;
+    trace_record_t *buffer;
+    size_t buffered;
+    uint32_t lo_pc, hi_pc;
+    uint64_t first, last;
+    uint64_t index;                      // dynamic instruction index, counted while tracing
+    trace_record_t pending;              // record of the instruction that is executing now
+    const decoded_instr_t *pending_d;    // NULL when that instruction is filtered out
+};
+
+static void trace_flush(trace_state_t *trace) {
+    if (trace->buffered && fwrite(trace->buffer, sizeof(trace_record_t), trace->buffered, trace->file) != trace->buffered) {
+        perror("Failed to write trace file");
+    }
+    trace->buffered = 0;
+}
+
+rv_status_t rv_trace_open(rv_sim_t *sim, const char *filename, uint32_t lo_pc, uint32_t hi_pc,
+                          uint64_t first, uint64_t last) {
+    trace_header_t header;
+    trace_state_t *trace;
+
+    rv_trace_close(sim);
+    trace = calloc(1, sizeof(trace_state_t));
+    if (!trace) {
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to allocate trace buffer");
+    }
+    trace->file = fopen(filename, "wb");
+    if (!trace->file) {
+        free(trace);
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to open trace file: %s", strerror(errno));
+    }
+    trace->buffer = malloc(TRACE_BUFFER_RECORDS * sizeof(trace_record_t));
+    if (!trace->buffer) {
+        fclose(trace->file);
+        free(trace);
+        return rv_raise(sim, RV_ERROR_IO, 0, "Failed to allocate trace buffer");
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(trace_record_t);
+    fwrite(&header, sizeof(header), 1, trace->file);
+
+    trace->lo_pc = lo_pc;
+    trace->hi_pc = hi_pc;
+    trace->first = first;
+    trace->last = last;
+    sim->trace = trace;
+    return RV_OK;
+}
+
+void rv_trace_close(rv_sim_t *sim) {
+    trace_state_t *trace = sim->trace;
+
+    if (!trace) {
+        return;
+    }
+    trace_end(sim); // an instruction that stopped in the middle
+    trace_flush(trace);
+    fclose(trace->file);
+    free(trace->buffer);
+    free(trace);
+    sim->trace = NULL;
+}
+
+void trace_begin(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d) {
+    trace_state_t *trace = sim->trace;
+    uint64_t index = trace->index++;
+
+    if (insn_pc < trace->lo_pc || insn_pc >= trace->hi_pc || index < trace->first || index >= trace->last) {
+        trace->pending_d = NULL;
+        return;
+    }
+    trace->pending.pc = insn_pc;
+    trace->pending.instruction = d->raw;
+    trace->pending.mem_address = 0;
+    if (d->opcode == OPCODE_LOAD || d->opcode == OPCODE_STORE || d->opcode == OPCODE_AMO) {
+        trace->pending.mem_address = (uint32_t)sim->registers_array[d->rs1] + d->imm; // before a load can overwrite rs1
+    }
+    trace->pending_d = d;
+}
+
+void trace_end(rv_sim_t *sim) {
+    trace_state_t *trace = sim->trace;
+    const decoded_instr_t *d = trace->pending_d;
+
+    if (!d) {
+        return;
+    }
+    trace->pending.rd_value = 0;
+    switch (d->opcode) {
+        case OPCODE_BRANCH:
+        case OPCODE_STORE:
+        case OPCODE_MISC_MEM:
+            break; // no register result
+        case OPCODE_SYSTEM:
+            if (d->insn == INSN_CSR) {
+                trace->pending.rd_value = (uint32_t)sim->registers_array[d->rd];
+            }
+            break;
+        default:
+            trace->pending.rd_value = (uint32_t)sim->registers_array[d->rd];
+            break;
+    }
+    trace->buffer[trace->buffered++] = trace->pending;
+    if (trace->buffered == TRACE_BUFFER_RECORDS) {
+        trace_flush(trace);
+    }
+    trace->pending_d = NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Binary execution trace.
+// A trace file is a trace_header_t followed by one trace_record_t per traced instruction, all fields
+// in host byte order. trace_decode turns a trace file back into the "PC = ... | Instruction = ..." text.
+#define TRACE_MAGIC "RVTRACE1"
+
+typedef struct {
+    char magic[8];            // TRACE_MAGIC
+    uint32_t record_size;     // sizeof(trace_record_t)
+    uint32_t reserved;
+} trace_header_t;
+
+typedef struct {
+    uint32_t pc;
+    uint32_t instruction;     // raw instruction word
+    uint32_t rd_value;        // value written to rd, 0 for instructions without a register result
+    uint32_t mem_address;     // effective address of loads, stores and atomics, 0 otherwise
+} trace_record_t;
+
+#ifndef TRACE_FORMAT_ONLY
+#include "RISC-V.h"
+
+// Tracing is opened and closed per simulator with rv_trace_open/rv_trace_close (riscv_sim.h).
+// Only instructions with lo_pc <= pc < hi_pc and dynamic instruction index first <= index < last are
+// recorded.
+
+// Called around every executed instruction by the tracing variants of the interpreter cores
+void trace_begin(rv_sim_t *sim, uint32_t insn_pc, const decoded_instr_t *d);
+void trace_end(rv_sim_t *sim);
+#endif
+
+#endif
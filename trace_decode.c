@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_FORMAT_ONLY
+#include "trace.h"
+
+// Companion decoder for binary traces written with --trace.
+// Prints one "PC = ... | Instruction = ..." line per record, the same text the simulator used to print.
+// With -v the rd value and memory address of each record are appended.
+int main(int argc, char *argv[]) {
+    const char *filename = NULL;
+    int verbose = 0;
+    trace_header_t header;
+    trace_record_t records[4096];
+    size_t count;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else if (!filename) {
+            filename = argv[i];
+        } else {
+            filename = NULL;
+            break;
+        }
+    }
+    if (!filename) {
+        printf("Usage: %s [-v] <trace_file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *file = fopen(filename, "rb");
+    if (!file) {
+        perror("Failed to open trace file");
+        return EXIT_FAILURE;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.record_size != sizeof(trace_record_t)) {
+        printf("%s is not a trace file.\n", filename);
+        fclose(file);
+        return EXIT_FAILURE;
+    }
+
+    while ((count = fread(records, sizeof(trace_record_t), sizeof(records) / sizeof(records[0]), file)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            if (verbose) {
+                printf("PC = 0x%08X | Instruction = 0x%08X | rd = 0x%08X | addr = 0x%08X\n",
+                       records[i].pc, records[i].instruction, records[i].rd_value, records[i].mem_address);
+            } else {
+                printf("PC = 0x%08X | Instruction = 0x%08X\n", records[i].pc, records[i].instruction);
+            }
+        }
+    }
+    fclose(file);
+    return EXIT_SUCCESS;
+}